@@ -0,0 +1,118 @@
+/**
+ * @file arena.c
+ * @brief Bump allocator for parse-lifetime objects
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "arena.h"
+
+// Every allocation is aligned to this many bytes
+#define ARENA_ALIGNMENT 16
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size; // bytes of data
+    size_t used;
+    _Alignas(ARENA_ALIGNMENT) uint8_t data[];
+} arena_block;
+
+struct arena {
+    pthread_mutex_t lock;
+    size_t block_size;
+    struct arena_block *blocks; // newest first, allocations come from the head
+    struct arena_stats stats;
+};
+
+/**
+ * @brief Creates an empty arena.  No memory is allocated until the first arena_alloc.
+ *
+ * @param block_size size of the blocks memory is carved out of
+ * @return struct arena* : NULL if out of memory
+ */
+struct arena *arena_create(size_t block_size){
+    struct arena *arena = calloc(1, sizeof(struct arena));
+    if (arena == NULL)
+        return NULL;
+    pthread_mutex_init(&arena->lock, NULL);
+    arena->block_size = block_size;
+    return arena;
+}
+
+/**
+ * @brief Frees every block, and with them every object allocated from the arena
+ *
+ * @param arena
+ */
+void arena_destroy(struct arena *arena){
+    if (arena == NULL)
+        return;
+    while (arena->blocks != NULL){
+        struct arena_block *next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+    pthread_mutex_destroy(&arena->lock);
+    free(arena);
+}
+
+/**
+ * @brief Allocates zeroed memory that stays valid until the arena is destroyed.  Requests larger
+ * than a quarter of a block get a block of their own, so they don't waste the rest of the current
+ * one.  Safe to call from several threads at once.
+ *
+ * @param arena
+ * @param size
+ * @return void* : aligned to ARENA_ALIGNMENT, NULL if out of memory
+ */
+void *arena_alloc(struct arena *arena, size_t size){
+    size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (size == 0)
+        size = ARENA_ALIGNMENT;
+
+    pthread_mutex_lock(&arena->lock);
+    struct arena_block *block = arena->blocks;
+    if (block == NULL || block->size - block->used < size){
+        size_t block_size = (size > arena->block_size / 4) ? size : arena->block_size;
+        struct arena_block *fresh = malloc(sizeof(struct arena_block) + block_size);
+        if (fresh == NULL){
+            pthread_mutex_unlock(&arena->lock);
+            return NULL;
+        }
+        fresh->size = block_size;
+        fresh->used = 0;
+        arena->stats.blocks++;
+        if (block != NULL && block_size != arena->block_size){
+            // A private block, keep allocating from the current one
+            fresh->next = block->next;
+            block->next = fresh;
+        }
+        else{
+            fresh->next = block;
+            arena->blocks = fresh;
+        }
+        block = fresh;
+    }
+    void *memory = block->data + block->used;
+    block->used += size;
+    arena->stats.allocations++;
+    arena->stats.bytes += size;
+    pthread_mutex_unlock(&arena->lock);
+
+    memset(memory, 0, size);
+    return memory;
+}
+
+/**
+ * @brief Returns what the arena has handed out so far
+ *
+ * @param arena
+ * @param stats
+ */
+void arena_get_stats(struct arena *arena, struct arena_stats *stats){
+    pthread_mutex_lock(&arena->lock);
+    *stats = arena->stats;
+    pthread_mutex_unlock(&arena->lock);
+}
@@ -0,0 +1,26 @@
+/**
+ * @file arena.h
+ * @brief Bump allocator for objects that live as long as the volume being parsed.  Memory is
+ * carved out of large blocks and only ever released all at once by arena_destroy.
+ */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct arena arena;
+
+// What an arena has handed out, for checking that the hot paths stay off malloc
+typedef struct arena_stats {
+    uint64_t allocations; // arena_alloc calls
+    uint64_t bytes; // bytes handed out
+    uint64_t blocks; // blocks allocated from the system
+} arena_stats;
+
+struct arena *arena_create(size_t block_size);
+void arena_destroy(struct arena *arena);
+void *arena_alloc(struct arena *arena, size_t size);
+void arena_get_stats(struct arena *arena, struct arena_stats *stats);
+
+#endif
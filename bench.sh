@@ -0,0 +1,107 @@
+#!/bin/sh
+# End to end benchmark: generates a matrix of synthetic images with fg_mkimage.out and times each
+# phase of feeler gauge over them with a cold and a warm page cache.  Run through `make bench`.
+#
+#   BENCH_DIR      where the images are written (default /tmp/feeler_gauge_bench), reused if present
+#   BENCH_THREADS  -j used for the walk (default 4)
+#
+# GB/s is the size of the image over the run time for every phase, so phases and images compare
+# on the same scale even though only the slack and unallocated phases read much of the image.
+#
+# Runs that check slack (-h) must report at least as many findings as the generator wrote slack
+# payloads, otherwise the benchmark fails rather than time a build that finds nothing.
+#
+# The cold runs drop the page cache through /proc/sys/vm/drop_caches when running as root, and
+# otherwise evict just the image with dd iflag=nocache.
+
+BENCH_DIR=${BENCH_DIR:-/tmp/feeler_gauge_bench}
+BENCH_THREADS=${BENCH_THREADS:-4}
+FG=./feeler_gauge.out
+MKIMAGE=./fg_mkimage.out
+
+mkdir -p "$BENCH_DIR" || exit 1
+
+# name | fs type for -f | fg_mkimage.out options
+MATRIX="
+fat12_small|fat12|-t fat12 -s 4 -c 2048 -n 400 -d 2 -w 3 -l 50 -p 2
+fat16_medium|fat16|-t fat16 -s 128 -c 4096 -n 5000 -d 3 -w 4 -l 50 -p 1
+fat32_contiguous|fat32|-t fat32 -s 512 -c 4096 -n 20000 -d 3 -w 8 -F 0 -l 50 -p 1
+fat32_fragmented|fat32|-t fat32 -s 512 -c 4096 -n 20000 -d 3 -w 8 -F 50 -l 50 -p 1
+fat32_long_names|fat32|-t fat32 -s 512 -c 4096 -n 20000 -d 4 -w 4 -F 10 -l 100 -p 1
+fat32_small_clusters|fat32|-t fat32 -s 256 -c 512 -n 20000 -d 3 -w 8 -F 10 -l 25 -p 1
+mbr_fat32|raw|-t fat32 -s 256 -c 2048 -n 5000 -m -p 1
+"
+
+# name | feeler gauge options, entries are only counted for phases that walk a directory tree
+PHASES="
+fat|
+walk_slack|-h -j $BENCH_THREADS
+sequential_slack|-h -s
+unallocated|-u -j $BENCH_THREADS
+"
+
+now(){
+    date +%s%N
+}
+
+drop_cache(){
+    if [ -w /proc/sys/vm/drop_caches ]; then
+        sync
+        echo 3 > /proc/sys/vm/drop_caches
+    else
+        dd if="$1" iflag=nocache count=0 status=none 2>/dev/null
+    fi
+}
+
+# Times one run of feeler gauge, prints the seconds taken.  The report is kept in $BENCH_DIR/run.txt
+time_run(){
+    start=$(now)
+    $FG "$@" > "$BENCH_DIR/run.txt" 2>&1
+    status=$?
+    end=$(now)
+    if [ $status -ne 0 ]; then
+        echo "feeler gauge failed: $FG $*" >&2
+        exit 1
+    fi
+    awk -v s="$start" -v e="$end" 'BEGIN { printf "%.4f", (e - s) / 1e9 }'
+}
+
+printf "%-22s %-17s %-5s %9s %14s %9s\n" image phase cache seconds entries/s GB/s
+echo "$MATRIX" | while IFS='|' read -r name fs options; do
+    [ -z "$name" ] && continue
+    image="$BENCH_DIR/$name.img"
+    info="$BENCH_DIR/$name.txt"
+    if [ ! -f "$image" ] || [ ! -f "$info" ]; then
+        $MKIMAGE -o "$image" $options > "$info" || exit 1
+    fi
+    # Directory entries in the image, from the generator's summary line
+    entries=$(awk '{ for (i = 1; i < NF; i++) if ($(i + 1) ~ /^(directories|files)/) n += $i } END { print n }' "$info")
+    payloads=$(awk '{ for (i = 1; i < NF; i++) if ($(i + 1) == "with" && $(i + 2) == "slack") n += $i } END { print n + 0 }' "$info")
+    bytes=$(wc -c < "$image")
+
+    echo "$PHASES" | while IFS='|' read -r phase flags; do
+        [ -z "$phase" ] && continue
+        for cache in cold warm; do
+            if [ $cache = cold ]; then
+                drop_cache "$image"
+            else
+                $FG -i "$image" -f "$fs" $flags > /dev/null 2>&1
+            fi
+            seconds=$(time_run -i "$image" -f "$fs" $flags) || exit 1
+            case "$flags" in
+            *-h*)
+                found=$(grep -c "in the slack space of" "$BENCH_DIR/run.txt")
+                if [ "$found" -lt "$payloads" ]; then
+                    echo "feeler gauge found $found of the $payloads slack payloads in $image: $FG -i $image -f $fs $flags" >&2
+                    exit 1
+                fi
+                ;;
+            esac
+            awk -v name="$name" -v phase="$phase" -v cache="$cache" -v s="$seconds" -v n="$entries" -v b="$bytes" -v walk="$flags" 'BEGIN {
+                if (s <= 0) s = 0.0001
+                rate = (walk ~ /-h/) ? sprintf("%14.0f", n / s) : sprintf("%14s", "-")
+                printf "%-22s %-17s %-5s %9.4f %s %9.3f\n", name, phase, cache, s, rate, b / s / 1e9
+            }'
+        done
+    done || exit 1
+done || exit 1
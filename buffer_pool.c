@@ -0,0 +1,129 @@
+/**
+ * @file buffer_pool.c
+ * @brief Pool of reusable aligned I/O buffers
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "buffer_pool.h"
+
+// Smallest buffer handed out is 1 << MIN_CLASS_SHIFT bytes
+#define MIN_CLASS_SHIFT 12
+#define CLASS_COUNT (64 - MIN_CLASS_SHIFT)
+
+// A free buffer, the link lives in the buffer itself
+typedef struct free_buffer {
+    struct free_buffer *next;
+} free_buffer;
+
+struct buffer_pool {
+    pthread_mutex_t lock;
+    struct free_buffer *free[CLASS_COUNT]; // free buffers of 1 << (class + MIN_CLASS_SHIFT) bytes
+    struct buffer_pool_stats stats;
+};
+
+/**
+ * @brief Returns the size class holding buffers of at least size bytes
+ */
+static int size_class(size_t size){
+    int class = 0;
+    while (((size_t)1 << (class + MIN_CLASS_SHIFT)) < size)
+        class++;
+    return class;
+}
+
+/**
+ * @brief Creates an empty pool
+ *
+ * @return struct buffer_pool* : NULL if out of memory
+ */
+struct buffer_pool *buffer_pool_create(void){
+    struct buffer_pool *pool = calloc(1, sizeof(struct buffer_pool));
+    if (pool == NULL)
+        return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    return pool;
+}
+
+/**
+ * @brief Frees the pool and every buffer on its free lists.  Buffers still acquired must have been
+ * released first.
+ *
+ * @param pool
+ */
+void buffer_pool_destroy(struct buffer_pool *pool){
+    if (pool == NULL)
+        return;
+    for (int i = 0; i < CLASS_COUNT; i++){
+        while (pool->free[i] != NULL){
+            struct free_buffer *next = pool->free[i]->next;
+            free(pool->free[i]);
+            pool->free[i] = next;
+        }
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+/**
+ * @brief Hands out a buffer of at least size bytes, reusing a released one when there is one.
+ * Safe to call from several threads at once.
+ *
+ * @param pool
+ * @param size
+ * @param capacity receives the real size of the buffer, which must be passed back on release
+ * @return void* : aligned to BUFFER_POOL_ALIGNMENT, NULL if out of memory
+ */
+void *buffer_pool_acquire(struct buffer_pool *pool, size_t size, size_t *capacity){
+    int class = size_class(size);
+    *capacity = (size_t)1 << (class + MIN_CLASS_SHIFT);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stats.acquired++;
+    struct free_buffer *buffer = pool->free[class];
+    if (buffer != NULL){
+        pool->free[class] = buffer->next;
+        pthread_mutex_unlock(&pool->lock);
+        return buffer;
+    }
+    pool->stats.allocated++;
+    pool->stats.bytes += *capacity;
+    pthread_mutex_unlock(&pool->lock);
+
+    void *fresh = NULL;
+    if (posix_memalign(&fresh, BUFFER_POOL_ALIGNMENT, *capacity) != 0)
+        return NULL;
+    return fresh;
+}
+
+/**
+ * @brief Puts a buffer back on the free list of its size class
+ *
+ * @param pool
+ * @param buffer may be NULL
+ * @param capacity as returned by buffer_pool_acquire
+ */
+void buffer_pool_release(struct buffer_pool *pool, void *buffer, size_t capacity){
+    if (buffer == NULL)
+        return;
+    int class = size_class(capacity);
+    struct free_buffer *released = buffer;
+
+    pthread_mutex_lock(&pool->lock);
+    released->next = pool->free[class];
+    pool->free[class] = released;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * @brief Returns what the pool has handed out so far
+ *
+ * @param pool
+ * @param stats
+ */
+void buffer_pool_get_stats(struct buffer_pool *pool, struct buffer_pool_stats *stats){
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+}
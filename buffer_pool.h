@@ -0,0 +1,31 @@
+/**
+ * @file buffer_pool.h
+ * @brief Pool of reusable, page aligned I/O buffers.  Buffers are handed out in power of two size
+ * classes and go back on a free list when released, so reading directories and clusters over and
+ * over again does not go back to malloc.
+ */
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Alignment of every buffer, suits O_DIRECT style reads and SIMD scans alike
+#define BUFFER_POOL_ALIGNMENT 4096
+
+typedef struct buffer_pool buffer_pool;
+
+// What a pool has handed out, for checking that the hot paths stay off malloc
+typedef struct buffer_pool_stats {
+    uint64_t acquired; // buffer_pool_acquire calls
+    uint64_t allocated; // buffers allocated from the system, the rest were reused
+    uint64_t bytes; // bytes allocated from the system
+} buffer_pool_stats;
+
+struct buffer_pool *buffer_pool_create(void);
+void buffer_pool_destroy(struct buffer_pool *pool);
+void *buffer_pool_acquire(struct buffer_pool *pool, size_t size, size_t *capacity);
+void buffer_pool_release(struct buffer_pool *pool, void *buffer, size_t capacity);
+void buffer_pool_get_stats(struct buffer_pool *pool, struct buffer_pool_stats *stats);
+
+#endif
@@ -0,0 +1,193 @@
+/**
+ * @file compressed_image.c
+ * @brief Reader for seekable compressed disk images
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "compressed_image.h"
+#include "page_cache.h"
+#include "perf_stats.h"
+
+struct compressed_image {
+    int fd;
+    uint32_t chunk_size;
+    uint64_t size; // size of the uncompressed image
+    uint64_t chunk_count;
+    uint64_t *offsets; // chunk_count + 1 file offsets
+    struct page_cache *cache; // inflated chunks, shared by every thread reading the image
+};
+
+static uint32_t get_le32(const uint8_t *p){
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get_le64(const uint8_t *p){
+    return get_le32(p) | ((uint64_t)get_le32(p + 4) << 32);
+}
+
+/**
+ * @brief Reads exactly length bytes at offset
+ *
+ * @return int : 0 if successful, -1 on a read error or if the file ends early
+ */
+static int read_fully(int fd, void *buffer, size_t length, off_t offset){
+    size_t done = 0;
+    while (done < length){
+        uint64_t start = perf_read_begin();
+        ssize_t n = pread(fd, (uint8_t *)buffer + done, length - done, offset + done);
+        perf_read_end(start);
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks if the file starts with the compressed image magic
+ *
+ * @param fd
+ * @return bool
+ */
+bool compressed_image_detect(int fd){
+    uint8_t magic[8];
+    return pread(fd, magic, sizeof(magic), 0) == sizeof(magic) && !memcmp(magic, COMPRESSED_IMAGE_MAGIC, sizeof(magic));
+}
+
+/**
+ * @brief Reads and inflates one chunk, the load function of the chunk cache
+ *
+ * @param context the compressed image
+ * @param chunk
+ * @param data receives the chunk_size bytes of the chunk, the last chunk is zero padded
+ * @return int : 0 if successful, -1 if the chunk could not be read or is corrupt
+ */
+static int load_chunk(void *context, uint64_t chunk, uint8_t *data){
+    struct compressed_image *image = context;
+    uint64_t stored = image->offsets[chunk + 1] - image->offsets[chunk];
+    uint64_t expected = image->size - chunk * image->chunk_size;
+    if (expected > image->chunk_size)
+        expected = image->chunk_size;
+    if (expected < image->chunk_size)
+        memset(data + expected, 0, image->chunk_size - expected);
+
+    // Chunks that did not compress are stored as is
+    if (stored == expected)
+        return read_fully(image->fd, data, expected, image->offsets[chunk]);
+    if (stored > compressBound(image->chunk_size))
+        return -1;
+
+    uint8_t *compressed = malloc(stored);
+    uLongf length = expected;
+    int result = -1;
+    if (compressed != NULL && read_fully(image->fd, compressed, stored, image->offsets[chunk]) == 0
+        && uncompress(data, &length, compressed, stored) == Z_OK && length == expected)
+        result = 0;
+    free(compressed);
+    return result;
+}
+
+/**
+ * @brief Reads the header and chunk offset table of a compressed image.  The cache starts out
+ * with COMPRESSED_IMAGE_DEFAULT_CACHE_BYTES of chunks.
+ *
+ * @param fd open file holding the compressed image, still owned by the caller
+ * @return struct compressed_image* : NULL if the header or offset table is invalid or if out of memory
+ */
+struct compressed_image *compressed_image_open(int fd){
+    uint8_t header[COMPRESSED_IMAGE_HEADER_SIZE];
+
+    if (read_fully(fd, header, sizeof(header), 0) < 0 || memcmp(header, COMPRESSED_IMAGE_MAGIC, 8))
+        return NULL;
+
+    struct compressed_image *image = calloc(1, sizeof(struct compressed_image));
+    if (image == NULL)
+        return NULL;
+    image->fd = fd;
+    image->chunk_size = get_le32(header + 8);
+    image->size = get_le64(header + 16);
+    image->chunk_count = get_le64(header + 24);
+
+    // The table must describe exactly the chunks needed to hold the image
+    if (image->chunk_size == 0 || image->chunk_count != (image->size + image->chunk_size - 1) / image->chunk_size
+        || image->chunk_count > (SIZE_MAX / 8) - 1){
+        compressed_image_close(image);
+        return NULL;
+    }
+
+    size_t table_size = (image->chunk_count + 1) * 8;
+    uint8_t *table = malloc(table_size);
+    image->offsets = malloc(table_size);
+    if (table == NULL || image->offsets == NULL || read_fully(fd, table, table_size, sizeof(header)) < 0){
+        free(table);
+        compressed_image_close(image);
+        return NULL;
+    }
+    for (uint64_t i = 0; i <= image->chunk_count; i++){
+        image->offsets[i] = get_le64(table + i * 8);
+        if (i > 0 && image->offsets[i] < image->offsets[i - 1]){
+            free(table);
+            compressed_image_close(image);
+            return NULL;
+        }
+    }
+    free(table);
+
+    image->cache = page_cache_create(image->chunk_size, COMPRESSED_IMAGE_DEFAULT_CACHE_BYTES, load_chunk, image);
+    if (image->cache == NULL){
+        compressed_image_close(image);
+        return NULL;
+    }
+    return image;
+}
+
+/**
+ * @brief Frees the cache and offset table.  The file descriptor is left open.
+ *
+ * @param image
+ */
+void compressed_image_close(struct compressed_image *image){
+    if (image == NULL)
+        return;
+    page_cache_destroy(image->cache);
+    free(image->offsets);
+    free(image);
+}
+
+/**
+ * @brief Returns the size of the uncompressed image
+ */
+uint64_t compressed_image_size(struct compressed_image *image){
+    return image->size;
+}
+
+/**
+ * @brief Sizes the chunk cache to hold as many chunks as fit in bytes.  Drops every cached chunk,
+ * so it must not be called while other threads are reading the image.
+ *
+ * @param image
+ * @param bytes memory budget for inflated chunks
+ * @return int : 0 if successful, -1 if out of memory, the cache then keeps its old size
+ */
+int compressed_image_set_cache_budget(struct compressed_image *image, size_t bytes){
+    return page_cache_set_budget(image->cache, bytes);
+}
+
+/**
+ * @brief Copies length bytes of the uncompressed image starting at offset into buffer.  The
+ * caller has already clamped the range to the size of the image.  Safe to call from several
+ * threads at once.
+ *
+ * @param image
+ * @param buffer
+ * @param length
+ * @param offset offset in bytes from the start of the uncompressed image
+ * @return int : 0 if successful, -1 if a chunk could not be read or is corrupt
+ */
+int compressed_image_read(struct compressed_image *image, void *buffer, size_t length, uint64_t offset){
+    return page_cache_read(image->cache, buffer, length, offset);
+}
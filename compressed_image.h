@@ -0,0 +1,33 @@
+/**
+ * @file compressed_image.h
+ * @brief Seekable compressed disk images.  The image is cut into fixed size chunks that are zlib
+ * compressed independently and located through a chunk offset table, so any byte can be read by
+ * inflating a single chunk.  Inflated chunks are kept in an LRU cache bounded by a memory budget.
+ *
+ * Layout, all fields little endian:
+ *   header        "FGZIMG01", uint32 chunk size, uint32 reserved (0), uint64 image size, uint64 chunk count
+ *   offset table  chunk count + 1 uint64 file offsets, chunk i is stored in [offset[i], offset[i+1])
+ *   chunks        zlib streams, or the plain bytes when compressing would not make the chunk smaller
+ */
+#ifndef COMPRESSED_IMAGE_H
+#define COMPRESSED_IMAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define COMPRESSED_IMAGE_MAGIC "FGZIMG01"
+#define COMPRESSED_IMAGE_HEADER_SIZE 32
+#define COMPRESSED_IMAGE_DEFAULT_CHUNK_SIZE (64 * 1024)
+#define COMPRESSED_IMAGE_DEFAULT_CACHE_BYTES (64 * 1024 * 1024)
+
+typedef struct compressed_image compressed_image;
+
+bool compressed_image_detect(int fd);
+struct compressed_image *compressed_image_open(int fd);
+void compressed_image_close(struct compressed_image *image);
+uint64_t compressed_image_size(struct compressed_image *image);
+int compressed_image_set_cache_budget(struct compressed_image *image, size_t bytes);
+int compressed_image_read(struct compressed_image *image, void *buffer, size_t length, uint64_t offset);
+
+#endif
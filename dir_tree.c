@@ -0,0 +1,493 @@
+/**
+ * @file dir_tree.c
+ * @brief Compact directory tree with interned names
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "dir_tree.h"
+
+// Nodes are allocated NODE_BLOCK_SIZE at a time, the block table covers every 32 bit index
+#define NODE_BLOCK_SHIFT 16
+#define NODE_BLOCK_SIZE (1u << NODE_BLOCK_SHIFT)
+#define NODE_BLOCK_COUNT (1u << (32 - NODE_BLOCK_SHIFT))
+
+// Names are packed into blocks of STRING_BLOCK_SIZE bytes, a reference is block << shift | offset
+#define STRING_BLOCK_SHIFT 20
+#define STRING_BLOCK_SIZE (1u << STRING_BLOCK_SHIFT)
+#define STRING_BLOCK_COUNT ((1u << (32 - STRING_BLOCK_SHIFT)) - 1)
+
+// Open addressing hash table slot that holds no name
+#define EMPTY_SLOT UINT32_MAX
+
+// Sections of a saved tree start on multiples of this many bytes
+#define SAVED_ALIGNMENT 64
+
+// Layout of a saved tree, followed by the nodes, infos and string blocks
+typedef struct saved_tree_header {
+    uint32_t node_size; // sizeof(struct dir_node), a tree saved by a different build is rejected
+    uint32_t info_size;
+    uint32_t node_count;
+    uint32_t string_block_count;
+    uint32_t string_block_used;
+    uint32_t reserved;
+} saved_tree_header;
+
+struct dir_tree {
+    pthread_mutex_t lock; // held while adding nodes, names or findings
+    uint32_t node_count;
+    struct dir_node **nodes; // NODE_BLOCK_COUNT blocks
+    struct dir_node_info **infos; // NODE_BLOCK_COUNT blocks
+
+    char **strings; // STRING_BLOCK_COUNT blocks
+    uint32_t string_block_count;
+    uint32_t string_block_used; // bytes used in the last block
+    uint32_t *name_slots; // interned names, EMPTY_SLOT if free
+    uint32_t *name_hashes;
+    uint32_t name_mask;
+    uint32_t name_count;
+
+    struct slack_finding **findings;
+    uint32_t finding_count;
+    uint32_t finding_capacity;
+
+    bool borrowed; // nodes and names point into a saved tree owned by the caller
+};
+
+/**
+ * @brief Reserves count consecutive nodes, zeroed.  Called with the lock held.
+ *
+ * @return uint32_t : index of the first node, DIR_TREE_NONE if out of memory
+ */
+static uint32_t reserve_nodes(struct dir_tree *tree, uint32_t count){
+    uint32_t first = tree->node_count;
+    // Blocks are allocated up front so a failure leaves the tree as it was
+    for (uint32_t block = first >> NODE_BLOCK_SHIFT; count && block <= (first + count - 1) >> NODE_BLOCK_SHIFT; block++){
+        if (tree->nodes[block] != NULL)
+            continue;
+        struct dir_node *nodes = malloc(NODE_BLOCK_SIZE * sizeof(struct dir_node));
+        struct dir_node_info *infos = malloc(NODE_BLOCK_SIZE * sizeof(struct dir_node_info));
+        if (nodes == NULL || infos == NULL){
+            free(nodes);
+            free(infos);
+            return DIR_TREE_NONE;
+        }
+        tree->nodes[block] = nodes;
+        tree->infos[block] = infos;
+    }
+    for (uint32_t i = 0; i < count; i++){
+        uint32_t index = first + i;
+        memset(dir_tree_node(tree, index), 0, sizeof(struct dir_node));
+        memset(dir_tree_info(tree, index), 0, sizeof(struct dir_node_info));
+    }
+    tree->node_count += count;
+    return first;
+}
+
+/**
+ * @brief Creates a tree holding only the root directory, node 0
+ *
+ * @param root_cluster first cluster of the root directory, 0 for the fixed FAT12/16 root directory
+ * @return struct dir_tree* : NULL if out of memory
+ */
+struct dir_tree *dir_tree_create(uint32_t root_cluster){
+    struct dir_tree *tree = calloc(1, sizeof(struct dir_tree));
+    if (tree == NULL)
+        return NULL;
+    pthread_mutex_init(&tree->lock, NULL);
+    tree->nodes = calloc(NODE_BLOCK_COUNT, sizeof(struct dir_node *));
+    tree->infos = calloc(NODE_BLOCK_COUNT, sizeof(struct dir_node_info *));
+    tree->strings = calloc(STRING_BLOCK_COUNT, sizeof(char *));
+
+    tree->name_mask = 1023;
+    tree->name_slots = malloc((tree->name_mask + 1) * sizeof(uint32_t));
+    tree->name_hashes = malloc((tree->name_mask + 1) * sizeof(uint32_t));
+    if (tree->nodes == NULL || tree->infos == NULL || tree->strings == NULL || tree->name_slots == NULL
+        || tree->name_hashes == NULL || reserve_nodes(tree, 1) == DIR_TREE_NONE){
+        dir_tree_destroy(tree);
+        return NULL;
+    }
+    memset(tree->name_slots, 0xff, (tree->name_mask + 1) * sizeof(uint32_t));
+
+    struct dir_node *root = dir_tree_node(tree, 0);
+    root->cluster_addr = root_cluster;
+    root->parent = DIR_TREE_NONE;
+    root->file_attributes = 0x10;
+    dir_tree_info(tree, 0)->short_name = DIR_TREE_NO_NAME;
+    dir_tree_info(tree, 0)->long_name = DIR_TREE_NO_NAME;
+    return tree;
+}
+
+/**
+ * @brief Frees the tree.  Every node and name goes with the blocks holding them.
+ *
+ * @param tree
+ */
+void dir_tree_destroy(struct dir_tree *tree){
+    if (tree == NULL)
+        return;
+    for (uint32_t i = 0; !tree->borrowed && tree->nodes != NULL && i < NODE_BLOCK_COUNT && tree->nodes[i] != NULL; i++){
+        free(tree->nodes[i]);
+        free(tree->infos[i]);
+    }
+    for (uint32_t i = 0; !tree->borrowed && tree->strings != NULL && i < tree->string_block_count; i++)
+        free(tree->strings[i]);
+    free(tree->nodes);
+    free(tree->infos);
+    free(tree->strings);
+    free(tree->name_slots);
+    free(tree->name_hashes);
+    free(tree->findings);
+    pthread_mutex_destroy(&tree->lock);
+    free(tree);
+}
+
+/**
+ * @brief Returns the # of nodes in the tree, including the root
+ */
+uint32_t dir_tree_node_count(struct dir_tree *tree){
+    return tree->node_count;
+}
+
+/**
+ * @brief Returns the walk fields of a node.  The pointer stays valid until the tree is destroyed.
+ */
+struct dir_node *dir_tree_node(struct dir_tree *tree, uint32_t index){
+    return &tree->nodes[index >> NODE_BLOCK_SHIFT][index & (NODE_BLOCK_SIZE - 1)];
+}
+
+/**
+ * @brief Returns the descriptive fields of a node.  The pointer stays valid until the tree is destroyed.
+ */
+struct dir_node_info *dir_tree_info(struct dir_tree *tree, uint32_t index){
+    return &tree->infos[index >> NODE_BLOCK_SHIFT][index & (NODE_BLOCK_SIZE - 1)];
+}
+
+/**
+ * @brief Returns an interned name
+ *
+ * @param tree
+ * @param name string pool reference
+ * @return const char* : NULL for DIR_TREE_NO_NAME
+ */
+const char *dir_tree_name(struct dir_tree *tree, uint32_t name){
+    if (name == DIR_TREE_NO_NAME)
+        return NULL;
+    return tree->strings[name >> STRING_BLOCK_SHIFT] + (name & (STRING_BLOCK_SIZE - 1));
+}
+
+/**
+ * @brief Checks if a node is a directory
+ */
+bool dir_tree_is_directory(struct dir_tree *tree, uint32_t index){
+    return dir_tree_node(tree, index)->file_attributes & 0x10;
+}
+
+static uint32_t hash_name(const char *name){
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (; *name; name++)
+        hash = (hash ^ (uint8_t)*name) * 16777619u;
+    return hash;
+}
+
+/**
+ * @brief Doubles the name hash table.  Called with the lock held.
+ *
+ * @return int : 0 if successful, -1 if out of memory, the table is left as it was
+ */
+static int grow_names(struct dir_tree *tree){
+    uint32_t old_mask = tree->name_mask;
+    uint32_t *old_slots = tree->name_slots;
+    uint32_t *old_hashes = tree->name_hashes;
+    uint32_t *slots = malloc(((size_t)old_mask * 2 + 2) * sizeof(uint32_t));
+    uint32_t *hashes = malloc(((size_t)old_mask * 2 + 2) * sizeof(uint32_t));
+
+    if (slots == NULL || hashes == NULL){
+        free(slots);
+        free(hashes);
+        return -1;
+    }
+    tree->name_mask = old_mask * 2 + 1;
+    tree->name_slots = slots;
+    tree->name_hashes = hashes;
+    memset(tree->name_slots, 0xff, (tree->name_mask + 1) * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i <= old_mask; i++){
+        if (old_slots[i] == EMPTY_SLOT)
+            continue;
+        uint32_t slot = old_hashes[i] & tree->name_mask;
+        while (tree->name_slots[slot] != EMPTY_SLOT)
+            slot = (slot + 1) & tree->name_mask;
+        tree->name_slots[slot] = old_slots[i];
+        tree->name_hashes[slot] = old_hashes[i];
+    }
+    free(old_slots);
+    free(old_hashes);
+    return 0;
+}
+
+/**
+ * @brief Finds the string pool reference of name, adding it if it is not in the pool yet.
+ * Called with the lock held.
+ *
+ * @param tree
+ * @param name
+ * @param ref set to the reference, DIR_TREE_NO_NAME once the pool is full
+ * @return int : 0 if successful, -1 if out of memory
+ */
+static int intern_name(struct dir_tree *tree, const char *name, uint32_t *ref){
+    uint32_t hash = hash_name(name);
+
+    // Grown before probing so the table always has a free slot, and a failure changes nothing
+    if ((tree->name_count + 1) * 2 > tree->name_mask && grow_names(tree) < 0)
+        return -1;
+    uint32_t slot = hash & tree->name_mask;
+    for (; tree->name_slots[slot] != EMPTY_SLOT; slot = (slot + 1) & tree->name_mask){
+        if (tree->name_hashes[slot] == hash && !strcmp(dir_tree_name(tree, tree->name_slots[slot]), name)){
+            *ref = tree->name_slots[slot];
+            return 0;
+        }
+    }
+
+    size_t length = strlen(name) + 1;
+    if (tree->string_block_count == 0 || tree->string_block_used + length > STRING_BLOCK_SIZE){
+        if (tree->string_block_count == STRING_BLOCK_COUNT){
+            *ref = DIR_TREE_NO_NAME; // 4 GiB of distinct names
+            return 0;
+        }
+        // Zeroed so the unused tail of the block is saved as zeros
+        char *block = calloc(1, STRING_BLOCK_SIZE);
+        if (block == NULL)
+            return -1;
+        tree->strings[tree->string_block_count++] = block;
+        tree->string_block_used = 0;
+    }
+    *ref = ((tree->string_block_count - 1) << STRING_BLOCK_SHIFT) | tree->string_block_used;
+    memcpy(tree->strings[tree->string_block_count - 1] + tree->string_block_used, name, length);
+    tree->string_block_used += length;
+
+    tree->name_slots[slot] = *ref;
+    tree->name_hashes[slot] = hash;
+    tree->name_count++;
+    return 0;
+}
+
+/**
+ * @brief Adds the entries of a directory as its children, in order.  Nodes already in the tree can
+ * be read by other threads while this runs.
+ *
+ * @param tree
+ * @param parent the directory read
+ * @param entries
+ * @param count
+ * @param long_names buffer the long_name_offset of the entries point into
+ * @return uint32_t : index of the first child, DIR_TREE_NONE if out of memory, the directory is
+ * then left without children
+ */
+uint32_t dir_tree_add_children(struct dir_tree *tree, uint32_t parent, const struct dir_tree_entry *entries, uint32_t count, const char *long_names){
+    pthread_mutex_lock(&tree->lock);
+    uint32_t first = reserve_nodes(tree, count);
+    for (uint32_t i = 0; first != DIR_TREE_NONE && i < count; i++){
+        struct dir_node *node = dir_tree_node(tree, first + i);
+        struct dir_node_info *info = dir_tree_info(tree, first + i);
+        *node = entries[i].node;
+        *info = entries[i].info;
+        node->parent = parent;
+        info->long_name = DIR_TREE_NO_NAME;
+        if (intern_name(tree, entries[i].short_name, &info->short_name) < 0
+            || (entries[i].long_name_offset != DIR_TREE_NO_NAME
+                && intern_name(tree, long_names + entries[i].long_name_offset, &info->long_name) < 0))
+            first = DIR_TREE_NONE;
+    }
+    if (first == DIR_TREE_NONE){
+        pthread_mutex_unlock(&tree->lock);
+        return DIR_TREE_NONE;
+    }
+    struct dir_node *dir = dir_tree_node(tree, parent);
+    dir->first_child = first;
+    dir->child_count = count;
+    pthread_mutex_unlock(&tree->lock);
+    return first;
+}
+
+/**
+ * @brief Records what was found in the slack of a file
+ *
+ * @param tree
+ * @param index
+ * @param finding must stay valid as long as the tree is, it is not freed with the tree
+ * @return int : 0 if successful, -1 if out of memory
+ */
+int dir_tree_set_finding(struct dir_tree *tree, uint32_t index, struct slack_finding *finding){
+    pthread_mutex_lock(&tree->lock);
+    if (tree->finding_count == tree->finding_capacity){
+        uint32_t capacity = tree->finding_capacity ? tree->finding_capacity * 2 : 16;
+        struct slack_finding **findings = realloc(tree->findings, capacity * sizeof(struct slack_finding *));
+        if (findings == NULL){
+            pthread_mutex_unlock(&tree->lock);
+            return -1;
+        }
+        tree->findings = findings;
+        tree->finding_capacity = capacity;
+    }
+    tree->findings[tree->finding_count++] = finding;
+    dir_tree_node(tree, index)->finding = tree->finding_count;
+    pthread_mutex_unlock(&tree->lock);
+    return 0;
+}
+
+/**
+ * @brief Returns what was found in the slack of a file
+ *
+ * @return struct slack_finding* : NULL if nothing was found
+ */
+struct slack_finding *dir_tree_finding(struct dir_tree *tree, uint32_t index){
+    uint32_t finding = dir_tree_node(tree, index)->finding;
+    return finding ? tree->findings[finding - 1] : NULL;
+}
+
+/**
+ * @brief Writes count bytes, and zeros up to the next SAVED_ALIGNMENT boundary once the section
+ * is complete
+ *
+ * @param file
+ * @param data
+ * @param count
+ * @param written running # of bytes written, used to work out the padding
+ * @param end_section pad after the data
+ * @return int : 0 if successful, -1 on a write error
+ */
+static int write_section(FILE *file, const void *data, size_t count, size_t *written, bool end_section){
+    static const uint8_t zeros[SAVED_ALIGNMENT];
+    if (fwrite(data, 1, count, file) != count)
+        return -1;
+    *written += count;
+    if (!end_section)
+        return 0;
+    size_t padding = (SAVED_ALIGNMENT - *written % SAVED_ALIGNMENT) % SAVED_ALIGNMENT;
+    if (fwrite(zeros, 1, padding, file) != padding)
+        return -1;
+    *written += padding;
+    return 0;
+}
+
+/**
+ * @brief Writes the nodes and names of the tree so dir_tree_load can use them in place.  Findings
+ * are not saved, every node's finding must be set again after loading.
+ *
+ * @param tree
+ * @param file positioned on a multiple of SAVED_ALIGNMENT bytes
+ * @return int : 0 if successful, -1 on a write error
+ */
+int dir_tree_save(struct dir_tree *tree, FILE *file){
+    struct saved_tree_header header = {sizeof(struct dir_node), sizeof(struct dir_node_info), tree->node_count, tree->string_block_count, tree->string_block_used, 0};
+    size_t written = 0;
+
+    if (write_section(file, &header, sizeof(header), &written, true) < 0)
+        return -1;
+    // The blocks are written back to back, which makes them one flat array
+    for (uint32_t i = 0; i < tree->node_count; i += NODE_BLOCK_SIZE){
+        uint32_t count = (tree->node_count - i < NODE_BLOCK_SIZE) ? tree->node_count - i : NODE_BLOCK_SIZE;
+        if (write_section(file, dir_tree_node(tree, i), count * sizeof(struct dir_node), &written, i + count == tree->node_count) < 0)
+            return -1;
+    }
+    for (uint32_t i = 0; i < tree->node_count; i += NODE_BLOCK_SIZE){
+        uint32_t count = (tree->node_count - i < NODE_BLOCK_SIZE) ? tree->node_count - i : NODE_BLOCK_SIZE;
+        if (write_section(file, dir_tree_info(tree, i), count * sizeof(struct dir_node_info), &written, i + count == tree->node_count) < 0)
+            return -1;
+    }
+    for (uint32_t i = 0; i < tree->string_block_count; i++){
+        if (write_section(file, tree->strings[i], STRING_BLOCK_SIZE, &written, true) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Returns the size in bytes of a tree saved with node_count nodes and string_block_count
+ * string blocks
+ */
+static size_t saved_size(uint32_t node_count, uint32_t string_block_count){
+    size_t header = (sizeof(struct saved_tree_header) + SAVED_ALIGNMENT - 1) / SAVED_ALIGNMENT * SAVED_ALIGNMENT;
+    size_t nodes = ((size_t)node_count * sizeof(struct dir_node) + SAVED_ALIGNMENT - 1) / SAVED_ALIGNMENT * SAVED_ALIGNMENT;
+    size_t infos = ((size_t)node_count * sizeof(struct dir_node_info) + SAVED_ALIGNMENT - 1) / SAVED_ALIGNMENT * SAVED_ALIGNMENT;
+    return header + nodes + infos + (size_t)string_block_count * STRING_BLOCK_SIZE;
+}
+
+/**
+ * @brief Opens a tree written by dir_tree_save without copying it.  The nodes and names are used
+ * in place, so data must stay mapped, and writable for findings to be set, until the tree is
+ * destroyed.  Children can not be added to a loaded tree.
+ *
+ * @param data start of the saved tree, aligned to SAVED_ALIGNMENT
+ * @param length bytes available at data
+ * @param memory_error set to true if NULL is returned because the tree could not be allocated
+ * @return struct dir_tree* : NULL if the saved tree is truncated or inconsistent, or out of memory
+ */
+struct dir_tree *dir_tree_load(uint8_t *data, size_t length, bool *memory_error){
+    struct saved_tree_header header;
+
+    *memory_error = false;
+    if (length < sizeof(header))
+        return NULL;
+    memcpy(&header, data, sizeof(header));
+    if (header.node_size != sizeof(struct dir_node) || header.info_size != sizeof(struct dir_node_info)
+        || header.node_count == 0 || header.string_block_count > STRING_BLOCK_COUNT
+        || header.string_block_used > STRING_BLOCK_SIZE || saved_size(header.node_count, header.string_block_count) > length)
+        return NULL;
+
+    size_t header_size = (sizeof(header) + SAVED_ALIGNMENT - 1) / SAVED_ALIGNMENT * SAVED_ALIGNMENT;
+    struct dir_node *nodes = (struct dir_node *)(data + header_size);
+    struct dir_node_info *infos = (struct dir_node_info *)((uint8_t *)nodes + ((size_t)header.node_count * sizeof(struct dir_node) + SAVED_ALIGNMENT - 1) / SAVED_ALIGNMENT * SAVED_ALIGNMENT);
+    char *strings = (char *)infos + ((size_t)header.node_count * sizeof(struct dir_node_info) + SAVED_ALIGNMENT - 1) / SAVED_ALIGNMENT * SAVED_ALIGNMENT;
+    uint64_t string_bytes = (uint64_t)header.string_block_count * STRING_BLOCK_SIZE;
+
+    // Make sure walking the tree and looking up names stays inside the saved tree
+    for (uint32_t i = 0; i < header.node_count; i++){
+        uint32_t names[2] = {infos[i].short_name, infos[i].long_name};
+        if ((uint64_t)nodes[i].first_child + nodes[i].child_count > header.node_count
+            || (nodes[i].child_count && nodes[i].first_child <= i))
+            return NULL;
+        for (int j = 0; j < 2; j++){
+            if (names[j] == DIR_TREE_NO_NAME)
+                continue;
+            uint64_t offset = (uint64_t)(names[j] >> STRING_BLOCK_SHIFT) * STRING_BLOCK_SIZE + (names[j] & (STRING_BLOCK_SIZE - 1));
+            uint64_t block_end = ((uint64_t)(names[j] >> STRING_BLOCK_SHIFT) + 1) * STRING_BLOCK_SIZE;
+            if (block_end > string_bytes || memchr(strings + offset, '\0', block_end - offset) == NULL)
+                return NULL;
+        }
+    }
+
+    struct dir_tree *tree = calloc(1, sizeof(struct dir_tree));
+    if (tree == NULL){
+        *memory_error = true;
+        return NULL;
+    }
+    pthread_mutex_init(&tree->lock, NULL);
+    tree->borrowed = true;
+    tree->node_count = header.node_count;
+    tree->nodes = calloc(NODE_BLOCK_COUNT, sizeof(struct dir_node *));
+    tree->infos = calloc(NODE_BLOCK_COUNT, sizeof(struct dir_node_info *));
+    tree->strings = calloc(STRING_BLOCK_COUNT, sizeof(char *));
+    if (tree->nodes == NULL || tree->infos == NULL || tree->strings == NULL){
+        dir_tree_destroy(tree);
+        *memory_error = true;
+        return NULL;
+    }
+    for (uint32_t i = 0; i < header.node_count; i += NODE_BLOCK_SIZE){
+        tree->nodes[i >> NODE_BLOCK_SHIFT] = nodes + i;
+        tree->infos[i >> NODE_BLOCK_SHIFT] = infos + i;
+    }
+    tree->string_block_count = header.string_block_count;
+    tree->string_block_used = header.string_block_used;
+    for (uint32_t i = 0; i < header.string_block_count; i++)
+        tree->strings[i] = strings + (size_t)i * STRING_BLOCK_SIZE;
+
+    // Findings are set again by the caller
+    for (uint32_t i = 0; i < header.node_count; i++)
+        nodes[i].finding = 0;
+    return tree;
+}
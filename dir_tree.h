@@ -0,0 +1,73 @@
+/**
+ * @file dir_tree.h
+ * @brief Compact directory tree.  Nodes live in flat arrays addressed by 32 bit indices, with the
+ * fields the walk, slack check and report touch kept apart from the ones that only describe an
+ * entry.  The children of a directory are stored next to each other, and every name (short and
+ * long) is interned in one string pool.  Storage is allocated in large blocks that never move, so
+ * nodes can be read while other threads add children, and the whole tree is released at once.
+ * A saved tree is used in place from a mapping of the file it was saved to.
+ */
+#ifndef DIR_TREE_H
+#define DIR_TREE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Index of no node, e.g. the parent of the root
+#define DIR_TREE_NONE UINT32_MAX
+
+// Name reference of an entry without a long file name
+#define DIR_TREE_NO_NAME UINT32_MAX
+
+typedef struct dir_tree dir_tree;
+struct slack_finding;
+
+// Fields used while walking and checking the tree
+typedef struct dir_node {
+    uint32_t cluster_addr; // first cluster
+    uint32_t last_cluster; // Store the last cluster of the file/dir for feeler gauge checks
+    uint32_t file_size; // in bytes
+    uint32_t parent;
+    uint32_t first_child; // children are stored at [first_child, first_child + child_count)
+    uint32_t child_count;
+    uint32_t finding; // slack finding + 1, 0 if the slack held no data
+    uint8_t file_attributes;
+} dir_node;
+
+// Fields that only describe an entry
+typedef struct dir_node_info {
+    uint32_t short_name; // string pool reference of the 8.3 name as stored on disk (11 characters)
+    uint32_t long_name; // string pool reference of the assembled long file name (UTF-8), or DIR_TREE_NO_NAME
+    uint8_t created_time_tenths;
+    uint16_t created_time_hms;
+    uint16_t created_day;
+    uint16_t accessed_day;
+    uint16_t written_time_hms;
+    uint16_t written_day;
+    uint32_t content_crc; // CRC32 of a directory's clusters as read, or of a file's slack when it is kept for an index or a re-scan
+} dir_node_info;
+
+// A decoded directory entry waiting to be added to the tree
+typedef struct dir_tree_entry {
+    struct dir_node node;
+    struct dir_node_info info;
+    char short_name[12];
+    uint32_t long_name_offset; // offset of the long name in the caller's name buffer, or DIR_TREE_NO_NAME
+} dir_tree_entry;
+
+struct dir_tree *dir_tree_create(uint32_t root_cluster);
+void dir_tree_destroy(struct dir_tree *tree);
+uint32_t dir_tree_node_count(struct dir_tree *tree);
+struct dir_node *dir_tree_node(struct dir_tree *tree, uint32_t index);
+struct dir_node_info *dir_tree_info(struct dir_tree *tree, uint32_t index);
+const char *dir_tree_name(struct dir_tree *tree, uint32_t name);
+bool dir_tree_is_directory(struct dir_tree *tree, uint32_t index);
+uint32_t dir_tree_add_children(struct dir_tree *tree, uint32_t parent, const struct dir_tree_entry *entries, uint32_t count, const char *long_names);
+int dir_tree_set_finding(struct dir_tree *tree, uint32_t index, struct slack_finding *finding);
+struct slack_finding *dir_tree_finding(struct dir_tree *tree, uint32_t index);
+int dir_tree_save(struct dir_tree *tree, FILE *file);
+struct dir_tree *dir_tree_load(uint8_t *data, size_t length, bool *memory_error);
+
+#endif
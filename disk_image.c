@@ -0,0 +1,410 @@
+/**
+ * @file disk_image.c
+ * @brief Read-only access layer for disk images
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "disk_image.h"
+#include "compressed_image.h"
+#include "perf_stats.h"
+
+/**
+ * @brief Opens one file of an image and appends it as the next segment
+ *
+ * @param disk
+ * @param path
+ * @return int : 0 if successful, -1 if the file could not be opened or sized
+ */
+static int add_segment(struct disk_image *disk, const char *path){
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &st) == -1){
+        close(fd);
+        return -1;
+    }
+
+    struct disk_segment *segments = realloc(disk->segments, (disk->segment_count + 1) * sizeof(struct disk_segment));
+    if (segments == NULL){
+        close(fd);
+        return -1;
+    }
+    disk->segments = segments;
+
+    struct disk_segment *segment = &disk->segments[disk->segment_count++];
+    segment->fd = fd;
+    segment->start = disk->size;
+    // Block devices report a size of 0 through fstat
+    segment->size = st.st_size;
+    if (segment->size == 0)
+        segment->size = lseek(fd, 0, SEEK_END);
+    if (segment->size < 0){
+        // Only a plain image can do without a size, pread finds its end
+        disk->size = -1;
+        return disk->segment_count == 1 ? 0 : -1;
+    }
+    disk->size += segment->size;
+    return 0;
+}
+
+// Split images are numbered with zero padded extensions of at least this many digits (.001)
+#define SPLIT_EXTENSION_MIN_DIGITS 3
+
+/**
+ * @brief Checks if a path ends in the zero padded numeric extension of a split raw image segment,
+ * e.g. .001 or .0002
+ *
+ * @param path
+ * @param digits receives the # of digits in the extension
+ * @return unsigned long : the segment number, 0 if the extension is not a segment number
+ */
+static unsigned long split_extension(const char *path, int *digits){
+    const char *dot = strrchr(path, '.');
+    if (dot == NULL || strchr(dot, '/') != NULL || strlen(dot + 1) < SPLIT_EXTENSION_MIN_DIGITS)
+        return 0;
+    for (const char *c = dot + 1; *c; c++){
+        if (!isdigit((unsigned char)*c))
+            return 0;
+    }
+    *digits = strlen(dot + 1);
+    return strtoul(dot + 1, NULL, 10);
+}
+
+/**
+ * @brief Tells whether a path names a segment of a split raw image after the first one, i.e. it
+ * has a zero padded numeric extension greater than 1 and the first segment (.001) exists next
+ * to it.  Such files are read through the first segment.
+ *
+ * @param path
+ * @return bool
+ */
+bool disk_image_is_later_segment(const char *path){
+    int digits = 0;
+    unsigned long number = split_extension(path, &digits);
+    if (number < 2)
+        return false;
+    size_t stem_length = strlen(path) - digits;
+    char *first = malloc(stem_length + digits + 1);
+    if (first == NULL)
+        return false;
+    snprintf(first, stem_length + digits + 1, "%.*s%0*d", (int)stem_length, path, digits, 1);
+    bool exists = access(first, F_OK) == 0;
+    free(first);
+    return exists;
+}
+
+/**
+ * @brief Maps the whole image into one contiguous range of memory.  The segments of a split
+ * image are mapped back to back into a reserved range, which is only possible when every segment
+ * but the last ends on a page boundary.  Images that can not be mapped are left to pread.
+ *
+ * @param disk
+ */
+static void map_image(struct disk_image *disk){
+    long page = sysconf(_SC_PAGESIZE);
+
+    // A 32 bit process cannot map an image larger than its address space, pread is used instead
+    if (disk->size <= 0 || (uint64_t)disk->size > SIZE_MAX)
+        return;
+    if (disk->segment_count == 1){
+        void *map = mmap(NULL, disk->size, PROT_READ, MAP_SHARED, disk->segments[0].fd, 0);
+        if (map != MAP_FAILED)
+            disk->map = map;
+        return;
+    }
+
+    for (int i = 0; i < disk->segment_count - 1; i++){
+        if (disk->segments[i].size % page)
+            return;
+    }
+    uint8_t *map = mmap(NULL, disk->size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED)
+        return;
+    for (int i = 0; i < disk->segment_count; i++){
+        struct disk_segment *segment = &disk->segments[i];
+        if (segment->size == 0)
+            continue;
+        if (mmap(map + segment->start, segment->size, PROT_READ, MAP_SHARED | MAP_FIXED, segment->fd, 0) == MAP_FAILED){
+            munmap(map, disk->size);
+            return;
+        }
+    }
+    disk->map = map;
+}
+
+/**
+ * @brief Opens a disk image and maps it read-only.  A path ending in the zero padded extension of
+ * a first segment (.001) opens every consecutively numbered file that exists as one split raw image, presented
+ * to readers as a single image, and a compressed image (see compressed_image.h) is presented as
+ * the raw image it holds.  If the image can not be mapped (pipes, some network file systems,
+ * etc.) the handle is still returned and reads fall back to pread.
+ *
+ * @param path path to the disk image, or to the first segment of a split image
+ * @return struct disk_image* : NULL if the image could not be opened
+ */
+struct disk_image *disk_image_open(const char *path){
+    struct disk_image *disk = calloc(1, sizeof(struct disk_image));
+    if (disk == NULL)
+        return NULL;
+
+    if (add_segment(disk, path) == -1){
+        disk_image_close(disk);
+        return NULL;
+    }
+
+    // Compressed images are read through their chunk cache and are never mapped
+    if (compressed_image_detect(disk->segments[0].fd)){
+        disk->compressed = compressed_image_open(disk->segments[0].fd);
+        if (disk->compressed == NULL){
+            disk_image_close(disk);
+            return NULL;
+        }
+        disk->size = compressed_image_size(disk->compressed);
+        return disk;
+    }
+
+    // Only the first segment opens a split image, any other numbered file is a plain image
+    int digits = 0;
+    unsigned long number = split_extension(path, &digits);
+    if (number == 1){
+        size_t stem_length = strlen(path) - digits;
+        char *segment_path = malloc(stem_length + 32);
+        if (segment_path == NULL){
+            disk_image_close(disk);
+            return NULL;
+        }
+
+        for (;;){
+            snprintf(segment_path, stem_length + 32, "%.*s%0*lu", (int)stem_length, path, digits, ++number);
+            if (access(segment_path, F_OK) == -1)
+                break;
+            if (add_segment(disk, segment_path) == -1){
+                free(segment_path);
+                disk_image_close(disk);
+                return NULL;
+            }
+        }
+        free(segment_path);
+    }
+
+    map_image(disk);
+    return disk;
+}
+
+/**
+ * @brief Unmaps and closes a disk image
+ *
+ * @param disk
+ */
+void disk_image_close(struct disk_image *disk){
+    if (disk == NULL)
+        return;
+    if (disk->map != NULL)
+        munmap((void *)disk->map, disk->size);
+    compressed_image_close(disk->compressed);
+    for (int i = 0; i < disk->segment_count; i++){
+        if (disk->segments[i].fd >= 0)
+            close(disk->segments[i].fd);
+    }
+    free(disk->segments);
+    free(disk);
+}
+
+/**
+ * @brief Binary searches for the segment holding the byte at offset
+ *
+ * @param disk
+ * @param offset offset in bytes from the start of the disk image
+ * @return int : index of the last segment starting at or before offset
+ */
+static int find_segment(struct disk_image *disk, off_t offset){
+    int low = 0;
+    int high = disk->segment_count - 1;
+
+    while (low < high){
+        int mid = (low + high + 1) / 2;
+        if (disk->segments[mid].start <= offset)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    return low;
+}
+
+/**
+ * @brief Copies length bytes starting at offset into buffer.  Bytes past the end of the
+ * image read as zero, matching what the parsers saw when a short pread left their zeroed
+ * buffers untouched.  Reads that span segments of a split image are split at the boundaries.
+ *
+ * @param disk
+ * @param buffer
+ * @param length
+ * @param offset offset in bytes from the start of the disk image
+ * @return int : 0 if successful, -1 if the underlying read failed
+ */
+int disk_image_read(struct disk_image *disk, void *buffer, size_t length, off_t offset){
+    size_t available = 0;
+
+    if (offset < 0)
+        return -1;
+    if (disk->size < 0)
+        available = length; // size could not be determined, let pread find the end
+    else if (offset < disk->size)
+        available = (disk->size - offset < (off_t)length) ? (size_t)(disk->size - offset) : length;
+    perf_count_bytes(available);
+
+    if (disk->map != NULL){
+        memcpy(buffer, disk->map + offset, available);
+    }
+    else if (disk->compressed != NULL){
+        if (compressed_image_read(disk->compressed, buffer, available, offset) < 0)
+            return -1;
+    }
+    else{
+        size_t done = 0;
+        int index = find_segment(disk, offset);
+        while (done < available && index < disk->segment_count){
+            struct disk_segment *segment = &disk->segments[index];
+            off_t position = offset + done - segment->start;
+            size_t wanted = available - done;
+
+            // Stop at the end of this segment, the rest comes from the next one
+            if (index < disk->segment_count - 1 && (off_t)wanted > segment->size - position)
+                wanted = segment->size - position;
+
+            uint64_t start = perf_read_begin();
+            ssize_t n = pread(segment->fd, (uint8_t *)buffer + done, wanted, position);
+            perf_read_end(start);
+            if (n < 0)
+                return -1;
+            if (n == 0){
+                if (index == disk->segment_count - 1)
+                    break;
+                // A segment shorter than when it was opened reads as zeros
+                memset((uint8_t *)buffer + done, 0, wanted);
+                n = wanted;
+            }
+            done += n;
+            if (index < disk->segment_count - 1 && offset + (off_t)done >= segment->start + segment->size)
+                index++;
+        }
+        available = done;
+    }
+    memset((uint8_t *)buffer + available, 0, length - available);
+    return 0;
+}
+
+/**
+ * @brief Returns a pointer to length bytes of the image starting at offset.  When the range
+ * is mapped this is a pointer straight into the mapping and no copy or syscall takes place,
+ * otherwise the bytes are read into scratch (which must hold length bytes) and scratch is returned.
+ *
+ * @param disk
+ * @param offset offset in bytes from the start of the disk image
+ * @param length
+ * @param scratch caller supplied buffer used when the range can not be served from the mapping
+ * @return const uint8_t* : NULL if the underlying read failed
+ */
+const uint8_t *disk_image_view(struct disk_image *disk, off_t offset, size_t length, void *scratch){
+    if (disk->map != NULL && offset >= 0 && offset <= disk->size && (off_t)length <= disk->size - offset){
+        perf_count_bytes(length);
+        return disk->map + offset;
+    }
+    if (disk_image_read(disk, scratch, length, offset) < 0)
+        return NULL;
+    return scratch;
+}
+
+/**
+ * @brief Tells the kernel the image is about to be read front to back, so it reads ahead
+ * aggressively and drops pages behind the reader
+ *
+ * @param disk
+ */
+void disk_image_advise_sequential(struct disk_image *disk){
+    if (disk->map != NULL){
+        madvise((void *)disk->map, disk->size, MADV_SEQUENTIAL);
+        perf_count_syscall();
+    }
+    for (int i = 0; i < disk->segment_count; i++){
+        posix_fadvise(disk->segments[i].fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        perf_count_syscall();
+    }
+}
+
+/**
+ * @brief Starts reading a range of the image in the background so it is cached by the time it
+ * is viewed or read
+ *
+ * @param disk
+ * @param offset offset in bytes from the start of the disk image
+ * @param length
+ */
+void disk_image_prefetch(struct disk_image *disk, off_t offset, size_t length){
+    if (offset < 0 || (disk->size >= 0 && offset >= disk->size))
+        return;
+    if (disk->size >= 0 && (off_t)length > disk->size - offset)
+        length = disk->size - offset;
+    if (disk->compressed != NULL)
+        return; // image offsets do not map to file offsets, chunks are inflated on demand
+    if (disk->map != NULL){
+        // madvise needs a page aligned start
+        off_t page = sysconf(_SC_PAGESIZE);
+        off_t start = offset - offset % page;
+        madvise((void *)(disk->map + start), length + (offset - start), MADV_WILLNEED);
+        perf_count_syscall();
+        return;
+    }
+    for (int i = find_segment(disk, offset); i < disk->segment_count && length > 0; i++){
+        struct disk_segment *segment = &disk->segments[i];
+        off_t position = offset - segment->start;
+        size_t piece = (segment->size >= 0 && segment->size - position < (off_t)length) ? (size_t)(segment->size - position) : length;
+        posix_fadvise(segment->fd, position, piece, POSIX_FADV_WILLNEED);
+        perf_count_syscall();
+        offset += piece;
+        length -= piece;
+    }
+}
+
+/**
+ * @brief Sets the memory budget for the inflated chunks of a compressed image.  Does nothing for
+ * other images.  Must be called before the image is read from more than one thread.
+ *
+ * @param disk
+ * @param bytes
+ * @return int : 0 if successful, -1 if out of memory, the cache then keeps its old size
+ */
+int disk_image_set_cache_budget(struct disk_image *disk, size_t bytes){
+    if (disk->compressed != NULL)
+        return compressed_image_set_cache_budget(disk->compressed, bytes);
+    return 0;
+}
+
+/**
+ * @brief Returns the last modification time of the image, the newest of its segments
+ *
+ * @param disk
+ * @param mtime receives the modification time
+ * @return int : 0 if successful, -1 if a segment could not be stat'd
+ */
+int disk_image_mtime(struct disk_image *disk, struct timespec *mtime){
+    mtime->tv_sec = 0;
+    mtime->tv_nsec = 0;
+    for (int i = 0; i < disk->segment_count; i++){
+        struct stat st;
+        if (fstat(disk->segments[i].fd, &st) == -1)
+            return -1;
+        if (st.st_mtim.tv_sec > mtime->tv_sec || (st.st_mtim.tv_sec == mtime->tv_sec && st.st_mtim.tv_nsec > mtime->tv_nsec))
+            *mtime = st.st_mtim;
+    }
+    return 0;
+}
@@ -0,0 +1,43 @@
+/**
+ * @file disk_image.h
+ * @brief Read-only access layer for disk images.  The image is memory mapped when possible so
+ * parsers can work directly on pointers into the mapping, with a pread fallback for files that
+ * can not be mapped.  Split raw images (.001, .002, ...) and compressed images are presented as
+ * one raw image.
+ */
+#ifndef DISK_IMAGE_H
+#define DISK_IMAGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <time.h>
+
+// One file of an image, a plain image is a single segment
+typedef struct disk_segment {
+    int fd;
+    off_t start; // offset of the segment's first byte within the image
+    off_t size;
+} disk_segment;
+
+// Handle to an opened disk image
+typedef struct disk_image {
+    struct disk_segment *segments; // ordered by start
+    int segment_count;
+    off_t size; // size of the image in bytes, the sum of the segment sizes
+    const uint8_t *map; // read-only mapping of the whole image, NULL when using the pread fallback
+    struct compressed_image *compressed; // set when the image is a compressed image
+} disk_image;
+
+struct disk_image *disk_image_open(const char *path);
+void disk_image_close(struct disk_image *disk);
+int disk_image_read(struct disk_image *disk, void *buffer, size_t length, off_t offset);
+const uint8_t *disk_image_view(struct disk_image *disk, off_t offset, size_t length, void *scratch);
+void disk_image_advise_sequential(struct disk_image *disk);
+void disk_image_prefetch(struct disk_image *disk, off_t offset, size_t length);
+int disk_image_set_cache_budget(struct disk_image *disk, size_t bytes);
+int disk_image_mtime(struct disk_image *disk, struct timespec *mtime);
+bool disk_image_is_later_segment(const char *path);
+
+#endif
@@ -0,0 +1,145 @@
+/**
+ * @file fat12.c
+ * @brief Packed FAT12 table decoding kernels with runtime CPU dispatch
+ */
+
+#include <string.h>
+
+#include "fat12.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FAT12_X86
+#endif
+
+// Kernels from slowest to fastest
+typedef enum fat12_level {
+    FAT12_SCALAR,
+    FAT12_SSSE3,
+    FAT12_AVX2
+} fat12_level;
+
+static const char *level_names[] = {"scalar", "ssse3", "avx2"};
+
+// Scalar until fat12_init runs, so early callers are still correct
+static enum fat12_level level = FAT12_SCALAR;
+
+/**
+ * @brief Decodes entries [first, entry_count) one pair of entries (3 bytes) at a time
+ */
+static void unpack_scalar(const uint8_t *packed, size_t first, size_t entry_count, uint16_t *entries){
+    for (size_t i = first; i < entry_count; i++){
+        const uint8_t *p = packed + i / 2 * 3;
+        if (i % 2 == 0)
+            entries[i] = p[0] | ((p[1] & 0x0f) << 8);
+        else
+            entries[i] = (p[1] >> 4) | (p[2] << 4);
+    }
+}
+
+#ifdef FAT12_X86
+/**
+ * @brief Spreads 12 packed bytes (8 entries) over 8 16 bit lanes.  Each 32 bit lane holds one pair of
+ * entries: its low word is bytes 0-1 of the pair masked to 12 bits, its high word is bytes 1-2 shifted
+ * down 4 bits.
+ */
+__attribute__((target("ssse3")))
+static void unpack_ssse3(const uint8_t *packed, size_t entry_count, uint16_t *entries, size_t *done){
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+    const __m128i even = _mm_set1_epi32(0x00000fff);
+    const __m128i odd = _mm_set1_epi32(0xffff0000);
+    size_t packed_length = (entry_count * 3 + 1) / 2;
+    size_t i = 0;
+
+    // 16 byte loads of which 12 are used, so stop while a whole load still fits in the table
+    for (; i + 8 <= entry_count && i / 2 * 3 + 16 <= packed_length; i += 8){
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(packed + i / 2 * 3)), shuffle);
+        v = _mm_or_si128(_mm_and_si128(v, even), _mm_and_si128(_mm_srli_epi16(v, 4), odd));
+        _mm_storeu_si128((__m128i *)(entries + i), v);
+    }
+    *done = i;
+}
+
+/**
+ * @brief Same as unpack_ssse3, 16 entries at a time.  The shuffle can not cross 128 bit lanes, so
+ * each lane is loaded with its own 12 bytes.
+ */
+__attribute__((target("avx2")))
+static void unpack_avx2(const uint8_t *packed, size_t entry_count, uint16_t *entries, size_t *done){
+    const __m256i shuffle = _mm256_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11,
+                                             0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+    const __m256i even = _mm256_set1_epi32(0x00000fff);
+    const __m256i odd = _mm256_set1_epi32(0xffff0000);
+    size_t packed_length = (entry_count * 3 + 1) / 2;
+    size_t i = 0;
+
+    for (; i + 16 <= entry_count && i / 2 * 3 + 28 <= packed_length; i += 16){
+        const uint8_t *p = packed + i / 2 * 3;
+        __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)p)),
+                                            _mm_loadu_si128((const __m128i *)(p + 12)), 1);
+        v = _mm256_shuffle_epi8(v, shuffle);
+        v = _mm256_or_si256(_mm256_and_si256(v, even), _mm256_and_si256(_mm256_srli_epi16(v, 4), odd));
+        _mm256_storeu_si256((__m256i *)(entries + i), v);
+    }
+    *done = i;
+}
+#endif
+
+/**
+ * @brief Returns the fastest kernel the CPU supports
+ */
+static enum fat12_level fastest_level(void){
+#ifdef FAT12_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return FAT12_AVX2;
+    if (__builtin_cpu_supports("ssse3"))
+        return FAT12_SSSE3;
+#endif
+    return FAT12_SCALAR;
+}
+
+/**
+ * @brief Picks the fastest kernel the CPU supports.  Must be called once at startup before any
+ * threads are started.
+ */
+void fat12_init(void){
+    level = fastest_level();
+}
+
+/**
+ * @brief Switches to the named kernel ("scalar", "ssse3" or "avx2"), so every kernel can be checked
+ * against the scalar one.  Like fat12_init, not to be called while tables are being unpacked.
+ *
+ * @param name
+ * @return bool : false if there is no such kernel or the CPU does not support it
+ */
+bool fat12_select_kernel(const char *name){
+    for (int named = FAT12_SCALAR; named <= FAT12_AVX2; named++){
+        if (!strcmp(name, level_names[named])){
+            if (named > (int)fastest_level())
+                return false;
+            level = named;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Unpacks a FAT12 table into one uint16_t per entry
+ *
+ * @param packed the FAT as stored on disk, must hold (entry_count * 3 + 1) / 2 bytes
+ * @param entry_count # of entries to unpack
+ * @param entries receives entry_count entries
+ */
+void fat12_unpack(const uint8_t *packed, size_t entry_count, uint16_t *entries){
+    size_t done = 0;
+#ifdef FAT12_X86
+    if (level == FAT12_AVX2)
+        unpack_avx2(packed, entry_count, entries, &done);
+    else if (level == FAT12_SSSE3)
+        unpack_ssse3(packed, entry_count, entries, &done);
+#endif
+    unpack_scalar(packed, done, entry_count, entries);
+}
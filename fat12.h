@@ -0,0 +1,18 @@
+/**
+ * @file fat12.h
+ * @brief Unpacks FAT12 tables, where two 12 bit entries share three bytes, into one uint16_t per
+ * entry so FAT12 chains can be walked like FAT16 ones.  The fastest kernel supported by the CPU
+ * (AVX2, SSSE3 or scalar) is selected once at startup.
+ */
+#ifndef FAT12_H
+#define FAT12_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+void fat12_init(void);
+void fat12_unpack(const uint8_t *packed, size_t entry_count, uint16_t *entries);
+bool fat12_select_kernel(const char *name);
+
+#endif
@@ -0,0 +1,349 @@
+/**
+ * @file fat_dump.c
+ * @brief Run-length FAT table dump with runtime CPU dispatch of the run finding kernels
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fat_dump.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FAT_DUMP_X86
+#endif
+
+// Size of the output buffer, written out with one fwrite whenever it fills up
+#define FAT_DUMP_BUFFER_BYTES (1024 * 1024)
+
+// Room for the longest line of any format
+#define FAT_DUMP_LINE_BYTES 128
+
+static const char *run_type_names[] = {"free", "next", "link", "eof", "bad", "reserved"};
+
+// The run finding searches, each returns the length of the prefix of entries that matches
+typedef struct run_kernel {
+    const char *name;
+    size_t (*equal_run)(const uint32_t *entries, size_t count, uint32_t value);
+    size_t (*next_run)(const uint32_t *entries, size_t count, uint32_t first_index); // entries[i] == first_index + i + 1
+    size_t (*at_least_run)(const uint32_t *entries, size_t count, uint32_t threshold);
+} run_kernel;
+
+struct fat_dump {
+    FILE *out;
+    enum fat_dump_format format;
+    int fat_bits;
+    uint32_t entry_count;
+    uint32_t eoc; // smallest end of chain value
+    uint32_t bad;
+    uint32_t reserved; // smallest reserved value
+    const struct run_kernel *kernel;
+    uint32_t position; // index of the next entry passed in
+    uint32_t run_first; // the run being extended, run_count is 0 if there is none
+    uint32_t run_count;
+    enum fat_run_type run_type;
+    uint32_t run_value;
+    uint64_t runs; // runs written
+    char *buffer;
+    size_t used;
+    int error;
+};
+
+//-------------------------------------------------------------------------
+// Scalar kernel
+//-------------------------------------------------------------------------
+static size_t equal_run_scalar(const uint32_t *entries, size_t count, uint32_t value){
+    size_t i = 0;
+    for (; i < count && entries[i] == value; i++);
+    return i;
+}
+
+static size_t next_run_scalar(const uint32_t *entries, size_t count, uint32_t first_index){
+    size_t i = 0;
+    for (; i < count && entries[i] == first_index + i + 1; i++);
+    return i;
+}
+
+static size_t at_least_run_scalar(const uint32_t *entries, size_t count, uint32_t threshold){
+    size_t i = 0;
+    for (; i < count && entries[i] >= threshold; i++);
+    return i;
+}
+
+#ifdef FAT_DUMP_X86
+//-------------------------------------------------------------------------
+// AVX2 kernel, 8 entries at a time
+//-------------------------------------------------------------------------
+__attribute__((target("avx2")))
+static size_t equal_run_avx2(const uint32_t *entries, size_t count, uint32_t value){
+    const __m256i v = _mm256_set1_epi32(value);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8){
+        unsigned mask = ~(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(entries + i)), v))) & 0xff;
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + equal_run_scalar(entries + i, count - i, value);
+}
+
+__attribute__((target("avx2")))
+static size_t next_run_avx2(const uint32_t *entries, size_t count, uint32_t first_index){
+    const __m256i step = _mm256_set1_epi32(8);
+    __m256i expected = _mm256_add_epi32(_mm256_set1_epi32(first_index + 1), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8){
+        unsigned mask = ~(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)(entries + i)), expected))) & 0xff;
+        if (mask)
+            return i + __builtin_ctz(mask);
+        expected = _mm256_add_epi32(expected, step);
+    }
+    return i + next_run_scalar(entries + i, count - i, first_index + i);
+}
+
+__attribute__((target("avx2")))
+static size_t at_least_run_avx2(const uint32_t *entries, size_t count, uint32_t threshold){
+    const __m256i t = _mm256_set1_epi32(threshold);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8){
+        __m256i e = _mm256_loadu_si256((const __m256i *)(entries + i));
+        // Unsigned e >= t is max(e, t) == e
+        unsigned mask = ~(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_max_epu32(e, t), e))) & 0xff;
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + at_least_run_scalar(entries + i, count - i, threshold);
+}
+#endif
+
+static const struct run_kernel scalar_kernel = {"scalar", equal_run_scalar, next_run_scalar, at_least_run_scalar};
+#ifdef FAT_DUMP_X86
+static const struct run_kernel avx2_kernel = {"avx2", equal_run_avx2, next_run_avx2, at_least_run_avx2};
+#endif
+
+// Scalar until fat_dump_init runs, so early callers are still correct
+static const struct run_kernel *kernel = &scalar_kernel;
+
+/**
+ * @brief Picks the fastest kernel the CPU supports.  Must be called once at startup before any
+ * threads are started.
+ */
+void fat_dump_init(void){
+#ifdef FAT_DUMP_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        kernel = &avx2_kernel;
+#endif
+}
+
+/**
+ * @brief Switches the dumps created from now on to the named kernel ("scalar" or "avx2"), so every
+ * kernel can be checked against the scalar one.  Like fat_dump_init, not to be called while dumps
+ * are being created.
+ *
+ * @param name
+ * @return bool : false if there is no such kernel or the CPU does not support it
+ */
+bool fat_dump_select_kernel(const char *name){
+    if (!strcmp(name, scalar_kernel.name)){
+        kernel = &scalar_kernel;
+        return true;
+    }
+#ifdef FAT_DUMP_X86
+    __builtin_cpu_init();
+    if (!strcmp(name, avx2_kernel.name) && __builtin_cpu_supports("avx2")){
+        kernel = &avx2_kernel;
+        return true;
+    }
+#endif
+    return false;
+}
+
+/**
+ * @brief Writes out the buffered output
+ */
+static void flush_buffer(struct fat_dump *dump){
+    if (dump->used && fwrite(dump->buffer, 1, dump->used, dump->out) != dump->used)
+        dump->error = -1;
+    dump->used = 0;
+}
+
+/**
+ * @brief Reserves room for one line or record, flushing the buffer first if it is nearly full
+ */
+static char *reserve(struct fat_dump *dump){
+    if (FAT_DUMP_BUFFER_BYTES - dump->used < FAT_DUMP_LINE_BYTES)
+        flush_buffer(dump);
+    return dump->buffer + dump->used;
+}
+
+static void put_le32(char *p, uint32_t value){
+    for (int i = 0; i < 4; i++)
+        p[i] = value >> (i * 8);
+}
+
+/**
+ * @brief Writes the run that was being extended
+ */
+static void write_run(struct fat_dump *dump){
+    char *line = reserve(dump);
+    uint32_t last = dump->run_first + dump->run_count - 1;
+    const char *type = run_type_names[dump->run_type];
+
+    switch (dump->format){
+        case FAT_DUMP_TEXT:
+            if (dump->run_type == FAT_RUN_LINK)
+                dump->used += sprintf(line, "0x%08x  0x%08x  %10u  %-8s -> 0x%08x\n", dump->run_first, last, dump->run_count, type, dump->run_value);
+            else
+                dump->used += sprintf(line, "0x%08x  0x%08x  %10u  %s\n", dump->run_first, last, dump->run_count, type);
+            break;
+        case FAT_DUMP_CSV:
+            if (dump->run_type == FAT_RUN_FREE || dump->run_type == FAT_RUN_NEXT)
+                dump->used += sprintf(line, "%u,%u,%u,%s,\n", dump->run_first, last, dump->run_count, type);
+            else
+                dump->used += sprintf(line, "%u,%u,%u,%s,%u\n", dump->run_first, last, dump->run_count, type, dump->run_value);
+            break;
+        case FAT_DUMP_BINARY:
+            put_le32(line, dump->run_first);
+            put_le32(line + 4, dump->run_count);
+            put_le32(line + 8, dump->run_type);
+            put_le32(line + 12, dump->run_type == FAT_RUN_FREE || dump->run_type == FAT_RUN_NEXT ? 0 : dump->run_value);
+            dump->used += 16;
+            break;
+    }
+    dump->runs++;
+}
+
+/**
+ * @brief Starts a dump and writes its header
+ *
+ * @param out where the dump is written, owned by the caller
+ * @param format
+ * @param fat_bits 12, 16 or 32
+ * @param entry_count # of entries that will be passed in
+ * @return struct fat_dump* : NULL if out of memory, nothing was written then
+ */
+struct fat_dump *fat_dump_create(FILE *out, enum fat_dump_format format, int fat_bits, uint32_t entry_count){
+    struct fat_dump *dump = calloc(1, sizeof(struct fat_dump));
+    if (dump == NULL)
+        return NULL;
+    dump->buffer = malloc(FAT_DUMP_BUFFER_BYTES);
+    if (dump->buffer == NULL){
+        free(dump);
+        return NULL;
+    }
+    dump->out = out;
+    dump->format = format;
+    dump->fat_bits = fat_bits;
+    dump->entry_count = entry_count;
+    // End of chain, bad and reserved markers are the top values of the entry width
+    uint32_t max = fat_bits == 32 ? 0x0FFFFFFF : (1u << fat_bits) - 1;
+    dump->eoc = max - 7;
+    dump->bad = max - 8;
+    dump->reserved = max - 15;
+
+    dump->kernel = kernel;
+
+    char *header = reserve(dump);
+    switch (format){
+        case FAT_DUMP_TEXT:
+            dump->used += sprintf(header, "FAT 1 (FAT%d), %u entries\n%-12s%-12s%10s  %s\n", fat_bits, entry_count, "First", "Last", "Entries", "Type");
+            break;
+        case FAT_DUMP_CSV:
+            dump->used += sprintf(header, "first,last,count,type,value\n");
+            break;
+        case FAT_DUMP_BINARY:
+            memset(header, 0, 32);
+            memcpy(header, FAT_DUMP_MAGIC, 8);
+            put_le32(header + 8, 1);
+            put_le32(header + 12, fat_bits);
+            put_le32(header + 16, entry_count);
+            dump->used += 32;
+            break;
+    }
+    return dump;
+}
+
+/**
+ * @brief Passes the next entries of the table to the dump, in order.  The table can be passed in
+ * as many pieces as is convenient, runs carry on across them.
+ *
+ * @param dump
+ * @param entries values of the entries, already masked to the FAT's width (28 bits for FAT32)
+ * @param count
+ */
+void fat_dump_entries(struct fat_dump *dump, const uint32_t *entries, size_t count){
+    size_t i = 0;
+    while (i < count){
+        uint32_t index = dump->position + i;
+        uint32_t value = entries[i];
+        enum fat_run_type type;
+        size_t length;
+
+        if (index < 2){
+            type = FAT_RUN_RESERVED;
+            length = 1;
+        }
+        else if (value == 0){
+            type = FAT_RUN_FREE;
+            length = dump->kernel->equal_run(entries + i, count - i, 0);
+        }
+        else if (value >= dump->eoc){
+            type = FAT_RUN_EOF;
+            length = dump->kernel->at_least_run(entries + i, count - i, dump->eoc);
+        }
+        else if (value == dump->bad){
+            type = FAT_RUN_BAD;
+            length = dump->kernel->equal_run(entries + i, count - i, dump->bad);
+        }
+        else if (value >= dump->reserved){
+            type = FAT_RUN_RESERVED;
+            for (length = 1; i + length < count && entries[i + length] >= dump->reserved && entries[i + length] < dump->bad; length++);
+        }
+        else if (value == index + 1){
+            type = FAT_RUN_NEXT;
+            length = dump->kernel->next_run(entries + i, count - i, index);
+        }
+        else{
+            type = FAT_RUN_LINK;
+            length = 1;
+        }
+
+        // A run carries on from the previous piece or the previous entry of the same type, entries
+        // 0 and 1 are kept apart from reserved values in the rest of the table
+        if (dump->run_count && dump->run_type == type && type != FAT_RUN_LINK && (dump->run_first < 2) == (index < 2)){
+            dump->run_count += length;
+        }
+        else{
+            if (dump->run_count)
+                write_run(dump);
+            dump->run_first = index;
+            dump->run_count = length;
+            dump->run_type = type;
+            dump->run_value = value;
+        }
+        i += length;
+    }
+    dump->position += count;
+}
+
+/**
+ * @brief Writes the last run and the trailer, flushes the output and frees the dump
+ *
+ * @param dump
+ * @return int : 0 if successful, -1 if writing failed
+ */
+int fat_dump_finish(struct fat_dump *dump){
+    if (dump->run_count)
+        write_run(dump);
+    if (dump->format == FAT_DUMP_TEXT){
+        char *line = reserve(dump);
+        dump->used += sprintf(line, "End of FAT at 0x%08x, %ju runs\n", dump->position, (uintmax_t)dump->runs);
+    }
+    flush_buffer(dump);
+    if (fflush(dump->out) != 0)
+        dump->error = -1;
+    int error = dump->error;
+    free(dump->buffer);
+    free(dump);
+    return error;
+}
@@ -0,0 +1,50 @@
+/**
+ * @file fat_dump.h
+ * @brief Run-length dump of a FAT table.  Entries are grouped into runs of free, end of chain,
+ * bad, reserved and "next cluster" entries (each pointing at the entry right after it), so a
+ * mostly contiguous or empty table dumps in a few lines no matter its size.  An entry pointing
+ * anywhere else is a run of its own.  Runs are found with vectorized kernels and written through
+ * a large buffer as text, CSV or binary records.  The fastest kernel supported by the CPU (AVX2 or
+ * scalar) is selected once at startup.
+ *
+ * The binary form is a 32 byte header followed by one 16 byte record per run, all little endian:
+ *   header: char magic[8] = FAT_DUMP_MAGIC, uint32_t version = 1, uint32_t fat_bits (12, 16 or 32),
+ *           uint32_t entry_count, 12 bytes of zeros
+ *   record: uint32_t first_entry, uint32_t entry_count, uint32_t type (enum fat_run_type),
+ *           uint32_t value (target of a link run, the first entry's value for end of chain, bad
+ *           and reserved runs, 0 otherwise)
+ */
+#ifndef FAT_DUMP_H
+#define FAT_DUMP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define FAT_DUMP_MAGIC "FGFATRUN"
+
+typedef enum fat_run_type {
+    FAT_RUN_FREE,
+    FAT_RUN_NEXT, // every entry points at the one after it
+    FAT_RUN_LINK, // one entry pointing anywhere else
+    FAT_RUN_EOF,
+    FAT_RUN_BAD,
+    FAT_RUN_RESERVED // entries 0 and 1, and the reserved values just below the bad cluster marker
+} fat_run_type;
+
+typedef enum fat_dump_format {
+    FAT_DUMP_TEXT,
+    FAT_DUMP_CSV,
+    FAT_DUMP_BINARY
+} fat_dump_format;
+
+typedef struct fat_dump fat_dump;
+
+void fat_dump_init(void);
+struct fat_dump *fat_dump_create(FILE *out, enum fat_dump_format format, int fat_bits, uint32_t entry_count);
+void fat_dump_entries(struct fat_dump *dump, const uint32_t *entries, size_t count);
+int fat_dump_finish(struct fat_dump *dump);
+bool fat_dump_select_kernel(const char *name);
+
+#endif
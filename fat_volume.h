@@ -0,0 +1,442 @@
+/**
+ * @file fat_volume.h
+ * @brief Internals of libfeelergauge: on-disk offsets and signatures, the volume handle, and the
+ * structures of the extent index, the tree walk and the volume index.  Not installed with the
+ * library, callers only see struct fat_volume as the opaque fg_volume of libfeelergauge.h.
+ */
+#ifndef FAT_VOLUME_H
+#define FAT_VOLUME_H
+
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#include <pthread.h>
+
+#include "libfeelergauge.h"
+#include "disk_image.h"
+#include "scan.h"
+#include "work_pool.h"
+#include "fat12.h"
+#include "page_cache.h"
+#include "dir_tree.h"
+#include "arena.h"
+#include "buffer_pool.h"
+#include "perf_stats.h"
+#include "fat_dump.h"
+
+// Size of the buffer used to read MBR, EBR and boot sectors
+#define SECTOR_BUFFER_SIZE 512
+
+// Longest EBR chain followed, a guard against chains that loop
+#define MAX_LOGICAL_PARTITIONS 128
+
+// Maximum number of non-zero runs listed per finding
+#define MAX_REPORTED_RANGES 8
+
+// Largest single read issued by the slack check, adjacent clusters are merged up to this size
+#define SLACK_BATCH_MAX_BYTES (1024 * 1024)
+
+// Volume index files (fg_options.index_path) start with this magic
+#define VOLUME_INDEX_MAGIC "FGIDX003"
+
+// Size of the FAT1 regions hashed separately, so a re-scan (--rescan) can tell which parts changed
+#define FAT_HASH_REGION_BYTES (64 * 1024)
+
+// Size of the blocks the per-volume arena carves parse-lifetime objects out of
+#define VOLUME_ARENA_BLOCK_BYTES (1024 * 1024)
+
+// Size of the pieces FAT1 is paged in as with --max-mem
+#define FAT_PAGE_BYTES (64 * 1024)
+
+// # of FAT entries decoded at a time for a FAT dump (--dump-fat, -v), must be even
+#define FAT_DUMP_CHUNK_ENTRIES (64 * 1024)
+
+// Size of the chunks FAT copies are streamed in while comparing them against FAT1
+#define FAT_COMPARE_CHUNK_BYTES (1024 * 1024)
+
+// Size of the chunks the clustered area is streamed in by the sequential slack pass (-s)
+#define SEQUENTIAL_READ_BYTES (8 * 1024 * 1024)
+
+// # of FAT entries mapped at a time when the free cluster map is built from a paged FAT1, a
+// multiple of 64
+#define FREE_MAP_CHUNK_ENTRIES (64 * 1024)
+
+// Largest single read issued by the unallocated cluster check (-u)
+#define UNALLOCATED_READ_BYTES (8 * 1024 * 1024)
+
+// Longest run of allocated clusters the unallocated cluster check reads through rather than
+// skips, so the free runs on either side of it are checked with one read
+#define UNALLOCATED_GAP_BYTES (256 * 1024)
+
+
+// Room for the description of a volume's error
+#define VOLUME_ERROR_BYTES 512
+
+/**
+ * @brief Common offsets within MBR/EBR table
+ */
+enum offsets {
+    // Master Boot Record Offsets
+    MBR_SIG_OFF = 0x1FE, // MBR Signature Field Offset
+    MBR_PART1_OFF = 0x1BE, // MBR Partition 1 Field Offset
+    MBR_PART2_OFF = 0x1CE, // MBR Partition 2 Field Offset
+    MBR_PART3_OFF = 0x1DE, // MBR Partition 3 Field Offset
+    MBR_PART4_OFF = 0x1EE, // MBR Partition 4 Field Offset
+
+    // MBR Partition Table Entry Relative Offsets
+    BOOT_INDICATOR = 0,
+    PARTITION_TYPE = 4,
+    STARTING_SECTOR = 8,
+    PARTITION_SIZE = 12,
+
+    // Extended Boot Record Offsets
+    EBR_PART_TABLE_OFF = 0x1BE,
+    EBR_ENTRY_OFF = 0x1BE,
+    EBR_NEXT_PART_OFF = 0x1CE,
+    ERB_SIG_OFF = 0x1FE,
+
+    // FAT Boot Sector Offsets
+    OEM_NAME = 3,
+    BYTES_PER_SECTOR = 11,
+    SECTORS_PER_CLUSTER = 13,
+    RESERVED_AREA_SIZE = 14,
+    NUMBER_OF_FATS = 16,
+    MAX_FILES_IN_ROOT = 17,
+    SECTOR_COUNT_16B = 19,
+    MEDIA_TYPE = 21,
+    FAT_SIZE_IN_SECTORS = 22,
+    SECTORS_PER_TRACK = 24,
+    HEAD_NUMBER = 26,
+    SECTORS_BEFORE_PARTITION = 28,
+    SECTOR_COUNT_32B = 32,
+    BIOS_DRIVE_NUMBER = 36,
+    EXTENDED_BOOT_SIG = 38,
+    VOLUME_SERIAL = 39,
+    VOLUME_LABEL = 43,
+    FS_TYPE_LABEL = 54,
+    FS_SIGNATURE = 510,
+
+    // FAT32 Boot Sector Extended Offsets
+    FAT32_SIZE_IN_SECTORS = 36,
+    FAT_MODE = 40,
+    FAT32_VERSION = 42,
+    ROOT_DIR_CLUSTER = 44,
+    FSINFO_SECTOR = 48,
+    BACKUP_BOOT_SECTOR_ADDR = 50,
+    FAT32_BIOS_DRIVE_NUMBER = 64,
+    FAT32_EXTENDED_BOOT_SIG = 66,
+    FAT32_VOLUME_SERIAL= 67,
+    FAT32_VOLUME_LABEL =  71,
+    FAT32_FS_TYPE_LABEL = 82,
+
+    // FAT Directory Entry
+    ALLOCATION_STATUS = 0,
+    FILE_NAME = 0,
+    FILE_ATTRIBUTES = 11,
+    CREATED_TIME_TENTHS = 13,
+    CREATED_TIME_HMS = 14,
+    CREATED_DAY = 16,
+    ACCESSED_DAY = 18,
+    HIGH_CLUSTER_ADDR = 20,
+    WRITTEN_TIME_HMS = 22,
+    WRITTEN_DAY = 24,
+    LOW_CLUSTER_ADDR = 26,
+    FILE_SIZE = 28,
+
+    // FAT Long File Name Entry
+    LFN_ORDINAL = 0,
+    LFN_NAME_1 = 1, // 5 UCS-2 characters
+    LFN_CHECKSUM = 13,
+    LFN_NAME_2 = 14, // 6 UCS-2 characters
+    LFN_NAME_3 = 28, // 2 UCS-2 characters
+
+
+    // FAT Flag Values
+    FLAG_FAT_READ_ONLY = 0x1,
+    FLAG_FAT_HIDDEN_FILE = 0x2,
+    FLAG_FAT_SYSTEM_FILE = 0x3,
+    FLAG_FAT_VOLUME_LABEL = 0x8,
+    FLAG_FAT_LONG_FILE_NAME = 0x0F,
+    FLAG_FAT_DIRECTORY = 0x10,
+    FLAG_FAT_ARCHIVE = 0x20
+};
+
+/**
+ * @brief
+ */
+enum signatures {
+    MBR_SIG = 0x55AA,
+    NTFS_SIG = 0xEB5290,
+    FAT12_SIG = 0xEB3F90,
+    FAT16_SIG = 0xEB3C90,
+    FAT32_SIG = 0xEB5890
+};
+
+/**
+ * @brief
+ */
+enum eof {
+    FAT12_EOF = 0xff8,
+    FAT16_EOF = 0xfff8,
+    FAT32_EOF = 0x0ffffff8
+};
+
+/**
+ * @brief
+ */
+enum bad_sector {
+    FAT12_BAD = 0xff7,
+    FAT16_BAD = 0xfff7,
+    FAT32_BAD = 0x0ffffff7
+};
+
+/**
+ * @brief
+ */
+enum file_allocation_status {
+    UNALLOCATED = 0xe5
+};
+
+// Runs of non-zero bytes found in the slack of a file's last cluster
+typedef struct slack_finding {
+    struct nonzero_ranges ranges;
+    struct nonzero_range range[MAX_REPORTED_RANGES];
+} slack_finding;
+
+// A run of physically contiguous clusters within a cluster chain
+typedef struct fat_extent {
+    uint32_t first_cluster;
+    uint32_t length; // # of clusters in the run
+    uint32_t chain_offset; // index of first_cluster within its chain
+} fat_extent;
+
+// A cluster chain described by its extents
+typedef struct fat_chain {
+    uint32_t head; // first cluster of the chain
+    uint32_t first_extent; // index into fat_extent_index.extents
+    uint32_t extent_count;
+    uint32_t cluster_count; // # of clusters in the chain
+    struct fat_extent *extents; // set by get_chain
+    bool owned; // extents were allocated for this lookup and must be freed with release_chain
+} fat_chain;
+
+// Reusable room for the extents of chains that are not in the extent index
+typedef struct extent_buffer {
+    struct fat_extent *extents;
+    uint32_t capacity;
+} extent_buffer;
+
+// Extent index of every cluster chain in the FAT, built once after the FATs are loaded
+typedef struct fat_extent_index {
+    struct fat_extent *extents;
+    uint32_t extent_count;
+    uint32_t extent_capacity;
+    struct fat_chain *chains;
+    uint32_t chain_count;
+    uint32_t chain_capacity;
+    uint32_t *slots; // open addressing hash table of head cluster -> chain index + 1
+    uint32_t slot_mask;
+} fat_extent_index;
+
+// Header of a volume index (--index).  The first fields are the key the index is only used with:
+// the image it was made from must still have the same size, modification time, boot sector and FAT.
+typedef struct volume_index_header {
+    char magic[8]; // VOLUME_INDEX_MAGIC
+    uint32_t extent_size; // sizeof(struct fat_extent), an index written by a different build is rejected
+    uint32_t chain_size; // sizeof(struct saved_chain)
+    uint64_t image_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t boot_sector_crc;
+    uint32_t fat_crc; // CRC32 of FAT1
+    // Contents
+    uint32_t fat_entry_count;
+    uint32_t extent_count;
+    uint32_t chain_count;
+    uint32_t slot_count; // size of the chain hash table, 0 if there is none
+    uint32_t finding_count;
+    uint32_t has_tree; // the directory tree and slack findings of a -h run are included
+    uint32_t fat_region_count;
+    uint32_t reserved;
+    uint64_t extents_off; // offsets in bytes from the start of the file
+    uint64_t chains_off;
+    uint64_t slots_off;
+    uint64_t findings_off;
+    uint64_t tree_off;
+    uint64_t fat_regions_off; // CRC32 of every FAT region, compared by --rescan
+} volume_index_header;
+
+// Per-volume state, behind the fg_volume handle.  Filled in while the boot sector and FATs are
+// loaded, and read-only from then on so the tree walk can share it between threads.  The only
+// field written during the walk is the status, once, by the first thread to fail.
+typedef struct fat_volume {
+    struct fg_options options; // the paths point at index_path and rescan_path below
+    char index_path[PATH_MAX];
+    char rescan_path[PATH_MAX];
+    struct disk_image *disk;
+    bool disk_borrowed; // a partition sharing the disk image of the raw image's volume
+    int type; // FG_FAT12, FG_FAT16, FG_FAT32, FG_NTFS or FG_RAW as detected by fg_volume_open
+    struct fg_boot_sector *fat_bs;
+    uint32_t bps; // Bytes Per Sector
+    uint32_t spc; // Sectors Per Cluster
+    uint32_t cluster_size; // in bytes
+    off_t reserved_and_fats; // Offset in bytes from the boot sector to the end of the FATs
+    off_t data_off; // Offset in bytes from start of disk image to cluster 2, the start of the clustered area
+    off_t root_dir_off; // Offset in Bytes from start of disk image
+    uint32_t root_dir_size; // Size in bytes of the fixed FAT12/16 root directory, 0 on FAT32
+    off_t fat_off; // Offset in bytes from start of disk image to FAT1
+    uint8_t *fat1; // NULL when FAT1 is paged
+    struct page_cache *fat_cache; // FAT1 pages, set when FAT1 is paged in on demand (--max-mem)
+    uint16_t *fat12; // FAT1 unpacked to one entry per uint16_t, FAT12 only
+    uint32_t fat_size_in_bytes;
+    uint32_t fat_entry_count; // # of FAT entries that describe clusters (including the 2 reserved entries)
+    bool fat_loaded; // set by fg_load_fat
+    struct fat_extent_index fat_index;
+    off_t partition_off; // Offset in bytes from start of disk image to the boot sector
+    struct volume_index_header index_key; // key of the volume index, see volume_index_key
+    bool indexed; // the extent index was loaded from the volume index
+    bool walked; // the tree was walked rather than loaded from the volume index
+    bool rescanned;
+    uint64_t slack_checked;
+    uint64_t slack_reused;
+    uint8_t *index_map; // mapping of the volume index the tree was loaded from, NULL if walked
+    size_t index_map_size;
+    uint32_t *fat_region_crcs; // CRC32 of every FAT_HASH_REGION_BYTES of FAT1, see volume_index_key
+    uint32_t fat_region_count;
+    struct arena *arena; // objects that live as long as the volume, e.g. slack findings
+    struct buffer_pool *buffers; // I/O buffers for directory and cluster reads
+    struct dir_tree *tree; // set once the directory tree was walked or loaded
+    bool unallocated_checked; // set by fg_check_unallocated
+    uint64_t free_clusters;
+    uint32_t free_runs; // runs of adjacent free clusters
+    struct unallocated_finding **unallocated; // free runs holding data, in cluster order
+    uint32_t unallocated_count;
+    struct perf_stats perf; // per-phase statistics (collect_stats)
+    int status; // fg_status of the first error, FG_OK until then
+    unsigned warnings; // fg_warning bits
+    char error[VOLUME_ERROR_BYTES]; // description of the first error
+} fat_volume;
+
+// A file whose last cluster is to be checked for hidden data
+typedef struct slack_item {
+    uint32_t last_cluster;
+    uint32_t slack_start; // offset of the slack within the cluster
+    uint32_t node; // the file in the directory tree
+    uint32_t base_node; // the baseline's node of an unchanged file, DIR_TREE_NONE if there is none
+} slack_item;
+
+// Slack items whose clusters are adjacent on disk, checked with a single read
+typedef struct slack_batch {
+    struct slack_item *items;
+    uint32_t item_count;
+    uint32_t first_cluster;
+    uint32_t cluster_count;
+} slack_batch;
+
+// Data found in a run of free clusters.  A run longer than one read is checked in pieces, which
+// are joined once the check is complete.
+typedef struct unallocated_finding {
+    uint32_t first_cluster; // of the whole run
+    uint32_t cluster_count;
+    uint32_t piece; // first cluster of the piece the ranges were found in
+    struct nonzero_ranges ranges; // offsets are from the start of the image
+    struct nonzero_range range[MAX_REPORTED_RANGES];
+    struct unallocated_finding *next; // next finding of the same worker
+} unallocated_finding;
+
+// Free clusters checked with one read.  The read covers [first_cluster, first_cluster +
+// cluster_count), including any short runs of allocated clusters between the free runs in it.
+typedef struct unallocated_window {
+    uint32_t first_cluster; // always free
+    uint32_t cluster_count; // the last cluster is always free
+    uint32_t run_first; // first cluster of the free run first_cluster is in, can be in an earlier window
+    uint32_t run_end; // one past the free run the last cluster is in, can be in a later window
+} unallocated_window;
+
+// Shared by every worker of the unallocated cluster check
+typedef struct unallocated_context {
+    struct fat_volume *vol;
+    const uint64_t *free_map; // one bit per FAT entry, set for free clusters
+    struct unallocated_window *windows;
+    uint32_t window_count;
+    uint8_t **buffers; // one per worker, NULL when the image is memory mapped
+    size_t *buffer_sizes;
+    struct unallocated_finding **findings; // one list per worker
+} unallocated_context;
+
+// A volume index mapped into memory, with pointers to its sections
+typedef struct volume_index_map {
+    uint8_t *map;
+    size_t size;
+    struct volume_index_header header;
+    struct fat_extent *extents;
+    struct saved_chain *chains;
+    uint32_t *slots;
+    struct saved_finding *findings;
+    uint32_t *fat_region_crcs;
+} volume_index_map;
+
+// Earlier acquisition of a volume an incremental re-scan (--rescan) is compared against
+typedef struct rescan_baseline {
+    struct volume_index_map index; // kept mapped, the tree is used in place
+    struct dir_tree *tree;
+    uint8_t *changed_regions; // 1 for every FAT region whose CRC differs from the baseline's
+    uint32_t *dir_slots; // open addressing hash table of directory cluster -> baseline node + 1
+    uint32_t dir_slot_mask;
+} rescan_baseline;
+
+// A cluster chain as kept in a volume index, the fields of struct fat_chain that describe the chain
+typedef struct saved_chain {
+    uint32_t head;
+    uint32_t first_extent;
+    uint32_t extent_count;
+    uint32_t cluster_count;
+} saved_chain;
+
+// A slack finding as kept in a volume index
+typedef struct saved_finding {
+    uint32_t node;
+    uint32_t stored;
+    uint64_t found;
+    uint64_t nonzero_bytes;
+    struct nonzero_range range[MAX_REPORTED_RANGES];
+} saved_finding;
+
+// Per-thread scratch space for the tree walk and the slack check
+typedef struct walk_scratch {
+    uint8_t *dir_buffer; // from the volume's buffer pool
+    size_t dir_buffer_size;
+    uint8_t *slack_buffer; // from the volume's buffer pool, only used when the image is not memory mapped
+    size_t slack_buffer_size;
+    struct extent_buffer extents; // extents of chains starting mid chain
+    struct slack_item *slack_items; // files found by this worker that need their slack checked
+    uint32_t slack_item_count;
+    uint32_t slack_item_capacity;
+    struct dir_tree_entry *entries; // entries of the directory being read
+    uint32_t entry_capacity;
+    char *long_names; // long file names of the directory being read
+    uint32_t long_names_used;
+    uint32_t long_names_capacity;
+    uint64_t slack_checked; // files whose slack was scanned
+    uint64_t slack_reused; // files whose slack result was taken over from a re-scan baseline
+} walk_scratch;
+
+// Shared by every worker of the tree walk
+typedef struct walk_context {
+    struct fat_volume *vol;
+    struct dir_tree *tree;
+    struct walk_scratch *scratch; // one per worker
+    struct rescan_baseline *baseline; // earlier acquisition of the volume, NULL unless --rescan
+} walk_context;
+
+#endif
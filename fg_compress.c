@@ -0,0 +1,132 @@
+/**
+ * @file fg_compress.c
+ * @brief Converts a raw (or split raw) disk image into the seekable compressed image format
+ * read by feeler gauge (see compressed_image.h)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "disk_image.h"
+#include "compressed_image.h"
+
+const char usage[] = "-i <path_to_raw_image> -o <path_to_compressed_image> -c <chunk_size_in_KiB> {default 64}\n";
+
+static void put_le32(uint8_t *p, uint32_t value){
+    for (int i = 0; i < 4; i++)
+        p[i] = value >> (i * 8);
+}
+
+static void put_le64(uint8_t *p, uint64_t value){
+    put_le32(p, (uint32_t)value);
+    put_le32(p + 4, (uint32_t)(value >> 32));
+}
+
+/**
+ * @brief Writes the compressed image.  Chunks are written as they are compressed, the header and
+ * offset table are written last once every chunk's position is known.
+ *
+ * @param disk image to compress
+ * @param out
+ * @param chunk_size
+ * @return int : 0 if successful, -1 on a read or write error
+ */
+int write_compressed_image(struct disk_image *disk, FILE *out, uint32_t chunk_size){
+    uint64_t chunk_count = (disk->size + chunk_size - 1) / chunk_size;
+    size_t table_size = (chunk_count + 1) * 8;
+    uint8_t header[COMPRESSED_IMAGE_HEADER_SIZE] = {0};
+    uint8_t *table = calloc(1, table_size);
+    uint8_t *chunk = malloc(chunk_size);
+    uLong bound = compressBound(chunk_size);
+    uint8_t *compressed = malloc(bound);
+    uint64_t position = COMPRESSED_IMAGE_HEADER_SIZE + table_size;
+    int result = -1;
+
+    // Reserve room for the header and table
+    if (fseeko(out, position, SEEK_SET) != 0)
+        goto CLEANUP;
+
+    for (uint64_t i = 0; i < chunk_count; i++){
+        uint64_t length = disk->size - i * chunk_size;
+        if (length > chunk_size)
+            length = chunk_size;
+        if (disk_image_read(disk, chunk, length, i * chunk_size) < 0)
+            goto CLEANUP;
+
+        uLongf compressed_length = bound;
+        const uint8_t *stored = compressed;
+        if (compress2(compressed, &compressed_length, chunk, length, Z_DEFAULT_COMPRESSION) != Z_OK || compressed_length >= length){
+            // Not worth compressing, store the chunk as is
+            stored = chunk;
+            compressed_length = length;
+        }
+        if (fwrite(stored, 1, compressed_length, out) != compressed_length)
+            goto CLEANUP;
+        put_le64(table + i * 8, position);
+        position += compressed_length;
+    }
+    put_le64(table + chunk_count * 8, position);
+
+    memcpy(header, COMPRESSED_IMAGE_MAGIC, 8);
+    put_le32(header + 8, chunk_size);
+    put_le64(header + 16, disk->size);
+    put_le64(header + 24, chunk_count);
+    if (fseeko(out, 0, SEEK_SET) != 0 || fwrite(header, 1, sizeof(header), out) != sizeof(header) || fwrite(table, 1, table_size, out) != table_size)
+        goto CLEANUP;
+    result = 0;
+
+CLEANUP:
+    free(compressed);
+    free(chunk);
+    free(table);
+    return result;
+}
+
+int main(int argc, char *argv[]){
+    char *input = NULL;
+    char *output = NULL;
+    long chunk_kib = COMPRESSED_IMAGE_DEFAULT_CHUNK_SIZE / 1024;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:o:c:")) != -1) {
+        switch (opt) {
+        case 'i':
+            input = optarg;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'c':
+            chunk_kib = atol(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s %s", argv[0], usage);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (input == NULL || output == NULL || chunk_kib < 1 || chunk_kib > 65536){
+        fprintf(stderr, "Usage: %s %s", argv[0], usage);
+        exit(EXIT_FAILURE);
+    }
+
+    struct disk_image *disk = disk_image_open(input);
+    if (disk == NULL || disk->size < 0){
+        fprintf(stderr, "Aborting... Could not read/access the file located at: %s\n", input);
+        exit(EXIT_FAILURE);
+    }
+    FILE *out = fopen(output, "wb");
+    if (out == NULL){
+        fprintf(stderr, "Aborting... Could not create the file: %s\n", output);
+        exit(EXIT_FAILURE);
+    }
+
+    if (write_compressed_image(disk, out, chunk_kib * 1024) < 0 || fclose(out) != 0){
+        fprintf(stderr, "Aborting... Failed while writing the compressed image: %s\n", output);
+        exit(EXIT_FAILURE);
+    }
+    disk_image_close(disk);
+    return 0;
+}
@@ -0,0 +1,379 @@
+/**
+ * @file fg_kernel_check.c
+ * @brief Checks every SIMD kernel the CPU supports against the scalar one.  The non-zero scan,
+ * FAT copy comparison and free entry map kernels of scan.c, the FAT12 unpacking kernels of fat12.c
+ * and the run finding kernels of fat_dump.c are run on random inputs of every length up to a few
+ * vector widths, at every alignment, and on a few large inputs, and their results are compared
+ * with the scalar kernel's.  Run through `make check`.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "scan.h"
+#include "fat12.h"
+#include "fat_dump.h"
+
+const char usage[] = "-S <seed>\n";
+
+// Inputs up to this many bytes or entries are checked at every length
+#define SHORT_LENGTHS 260
+
+// Longer inputs, around the block sizes the callers use
+static const size_t long_lengths[] = {1000, 4095, 4096, 4097, 65536 + 13};
+
+// Percent of non-zero (or differing) bytes in the random inputs
+static const int densities[] = {0, 1, 10, 50, 100};
+
+#define LONG_LENGTH_COUNT (sizeof(long_lengths) / sizeof(long_lengths[0]))
+#define DENSITY_COUNT (sizeof(densities) / sizeof(densities[0]))
+
+// Largest input, plus room for the misalignment
+#define MAX_LENGTH (65536 + 13)
+#define MAX_MISALIGNMENT 64
+
+static uint64_t rng = 0x9E3779B97F4A7C15ULL;
+
+/**
+ * @brief xorshift64*, the same generator as fg_mkimage
+ */
+static uint32_t next_random(void){
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (uint32_t)((rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/**
+ * @brief Fills a buffer with zeros, density percent of the bytes replaced by random non-zero ones.
+ * Non-zero bytes come in runs of up to 40 so runs cross the vector widths.
+ */
+static void fill_random(uint8_t *buffer, size_t length, int density){
+    memset(buffer, 0, length);
+    if (density == 0)
+        return;
+    for (size_t i = 0; i < length;){
+        size_t run = 1 + next_random() % 40;
+        bool nonzero = (int)(next_random() % 100) < density;
+        for (size_t j = 0; j < run && i < length; j++, i++)
+            buffer[i] = nonzero ? 1 + next_random() % 255 : 0;
+    }
+}
+
+// Results of the scan.c kernels for one input
+typedef struct scan_result {
+    bool is_zero;
+    struct nonzero_ranges ranges;
+    size_t difference_count; // runs of differing bytes
+    uint64_t differences[2 * 1024]; // start and length of the first runs
+    uint64_t bitmap16[MAX_LENGTH / 64 + 1];
+    uint64_t bitmap28[MAX_LENGTH / 64 + 1];
+} scan_result;
+
+/**
+ * @brief Runs the selected scan.c kernel over one input
+ *
+ * @param a
+ * @param b a with some bytes changed
+ * @param length
+ * @param result
+ * @param range storage for the non-zero runs, room for length runs
+ */
+static void run_scan(const uint8_t *a, const uint8_t *b, size_t length, struct scan_result *result, struct nonzero_range *range){
+    result->is_zero = scan_is_zero(a, length);
+
+    memset(&result->ranges, 0, sizeof(result->ranges));
+    result->ranges.range = range;
+    result->ranges.capacity = length;
+    // Scanned in two pieces so runs are joined across the boundary
+    scan_nonzero_ranges(a, length / 3, 0, &result->ranges);
+    scan_nonzero_ranges(a + length / 3, length - length / 3, length / 3, &result->ranges);
+
+    result->difference_count = 0;
+    for (size_t i = 0; i < length;){
+        size_t run = 0;
+        i += scan_next_difference(a + i, b + i, length - i, &run);
+        if (run == 0)
+            break;
+        if (result->difference_count < sizeof(result->differences) / sizeof(result->differences[0]) / 2){
+            result->differences[result->difference_count * 2] = i;
+            result->differences[result->difference_count * 2 + 1] = run;
+        }
+        result->difference_count++;
+        i += run;
+    }
+
+    memset(result->bitmap16, 0, sizeof(result->bitmap16));
+    memset(result->bitmap28, 0, sizeof(result->bitmap28));
+    scan_zero_entries(a, length / 2, 16, result->bitmap16);
+    scan_zero_entries(a, length / 4, 28, result->bitmap28);
+}
+
+/**
+ * @brief Compares the results of a kernel with the scalar kernel's
+ *
+ * @return bool : true if they agree
+ */
+static bool same_scan_result(const struct scan_result *x, const struct scan_result *y, size_t length){
+    if (x->is_zero != y->is_zero)
+        return false;
+    if (x->ranges.stored != y->ranges.stored || x->ranges.found != y->ranges.found
+        || x->ranges.nonzero_bytes != y->ranges.nonzero_bytes || x->ranges.last_end != y->ranges.last_end)
+        return false;
+    if (memcmp(x->ranges.range, y->ranges.range, x->ranges.stored * sizeof(struct nonzero_range)))
+        return false;
+    if (x->difference_count != y->difference_count)
+        return false;
+    size_t stored = x->difference_count < sizeof(x->differences) / sizeof(x->differences[0]) / 2 ? x->difference_count : sizeof(x->differences) / sizeof(x->differences[0]) / 2;
+    if (memcmp(x->differences, y->differences, stored * 2 * sizeof(uint64_t)))
+        return false;
+    if (memcmp(x->bitmap16, y->bitmap16, (length / 2 + 63) / 64 * sizeof(uint64_t)))
+        return false;
+    return !memcmp(x->bitmap28, y->bitmap28, (length / 4 + 63) / 64 * sizeof(uint64_t));
+}
+
+/**
+ * @brief Checks one scan.c kernel against the scalar one on one input
+ *
+ * @return int : 1 if the results differ, 0 if not
+ */
+static int check_scan_input(const char *name, size_t length, size_t misalignment, int density){
+    static uint8_t a_storage[MAX_LENGTH + MAX_MISALIGNMENT];
+    static uint8_t b_storage[MAX_LENGTH + MAX_MISALIGNMENT];
+    static struct nonzero_range scalar_range[MAX_LENGTH];
+    static struct nonzero_range kernel_range[MAX_LENGTH];
+    static struct scan_result scalar;
+    static struct scan_result kernel;
+    uint8_t *a = a_storage + misalignment;
+    uint8_t *b = b_storage + misalignment;
+
+    fill_random(a, length, density);
+    // b differs from a at density percent of the bytes, differing bytes again come in runs
+    memcpy(b, a, length);
+    for (size_t i = 0; i < length;){
+        size_t run = 1 + next_random() % 40;
+        bool differ = (int)(next_random() % 100) < density;
+        for (size_t j = 0; j < run && i < length; j++, i++){
+            if (differ)
+                b[i] = a[i] ^ (1 + next_random() % 255);
+        }
+    }
+
+    scan_select_kernel("scalar");
+    run_scan(a, b, length, &scalar, scalar_range);
+    scan_select_kernel(name);
+    run_scan(a, b, length, &kernel, kernel_range);
+    if (same_scan_result(&scalar, &kernel, length))
+        return 0;
+    fprintf(stderr, "scan %s differs from scalar: %zu bytes, misaligned by %zu, %d%% non-zero\n", name, length, misalignment, density);
+    return 1;
+}
+
+/**
+ * @brief Checks one scan.c kernel against the scalar one
+ *
+ * @return int : # of inputs the kernel got wrong
+ */
+static int check_scan(const char *name){
+    int failures = 0;
+
+    for (size_t length = 0; length <= SHORT_LENGTHS; length++){
+        for (size_t d = 0; d < DENSITY_COUNT; d++)
+            failures += check_scan_input(name, length, next_random() % MAX_MISALIGNMENT, densities[d]);
+    }
+    for (size_t misalignment = 0; misalignment < MAX_MISALIGNMENT; misalignment++){
+        for (size_t d = 0; d < DENSITY_COUNT; d++)
+            failures += check_scan_input(name, 200, misalignment, densities[d]);
+    }
+    for (size_t i = 0; i < LONG_LENGTH_COUNT; i++){
+        for (size_t d = 0; d < DENSITY_COUNT; d++)
+            failures += check_scan_input(name, long_lengths[i], next_random() % MAX_MISALIGNMENT, densities[d]);
+    }
+    return failures;
+}
+
+/**
+ * @brief Checks one fat12.c kernel against the scalar one on one table
+ *
+ * @return int : 1 if the entries differ, 0 if not
+ */
+static int check_fat12_input(const char *name, size_t entry_count){
+    size_t packed_length = (entry_count * 3 + 1) / 2;
+    // Exactly the bytes the table holds, so reading past it would be caught by a memory checker
+    uint8_t *packed = malloc(packed_length ? packed_length : 1);
+    uint16_t *scalar = malloc((entry_count ? entry_count : 1) * sizeof(uint16_t));
+    uint16_t *kernel = malloc((entry_count ? entry_count : 1) * sizeof(uint16_t));
+    int failed = 0;
+
+    for (size_t i = 0; i < packed_length; i++)
+        packed[i] = next_random();
+    fat12_select_kernel("scalar");
+    fat12_unpack(packed, entry_count, scalar);
+    fat12_select_kernel(name);
+    fat12_unpack(packed, entry_count, kernel);
+    if (memcmp(scalar, kernel, entry_count * sizeof(uint16_t))){
+        fprintf(stderr, "fat12 %s differs from scalar: %zu entries\n", name, entry_count);
+        failed = 1;
+    }
+    free(packed);
+    free(scalar);
+    free(kernel);
+    return failed;
+}
+
+/**
+ * @brief Checks one fat12.c kernel against the scalar one
+ *
+ * @return int : # of tables the kernel got wrong
+ */
+static int check_fat12(const char *name){
+    int failures = 0;
+
+    for (size_t entry_count = 0; entry_count <= SHORT_LENGTHS; entry_count++)
+        failures += check_fat12_input(name, entry_count);
+    for (size_t i = 0; i < LONG_LENGTH_COUNT; i++)
+        failures += check_fat12_input(name, long_lengths[i]);
+    return failures;
+}
+
+/**
+ * @brief Fills a FAT with runs of free, chained, end of chain, bad, reserved and linked entries,
+ * masked to the FAT's width
+ */
+static void fill_fat(uint32_t *entries, size_t count, int fat_bits){
+    uint32_t max = fat_bits == 32 ? 0x0FFFFFFF : (1u << fat_bits) - 1;
+
+    for (size_t i = 0; i < count;){
+        size_t run = 1 + next_random() % 40;
+        uint32_t kind = next_random() % 6;
+        for (size_t j = 0; j < run && i < count; j++, i++){
+            switch (kind){
+                case 0: entries[i] = 0; break;
+                case 1: entries[i] = (i + 1) & max; break;
+                case 2: entries[i] = max - next_random() % 8; break; // end of chain
+                case 3: entries[i] = max - 8; break; // bad
+                case 4: entries[i] = max - 15 + next_random() % 7; break; // reserved
+                default: entries[i] = next_random() & max; break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Dumps a FAT with the selected kernel, passing it in pieces of the given sizes
+ *
+ * @return char* : the text dump, to be freed by the caller
+ */
+static char *dump_fat(const uint32_t *entries, size_t count, int fat_bits, const size_t *pieces, size_t *dump_length){
+    char *text = NULL;
+    FILE *out = open_memstream(&text, dump_length);
+    struct fat_dump *dump = (out != NULL) ? fat_dump_create(out, FAT_DUMP_TEXT, fat_bits, count) : NULL;
+    if (dump == NULL){
+        fprintf(stderr, "Aborting... Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0, p = 0; i < count; i += pieces[p++])
+        fat_dump_entries(dump, entries + i, (count - i < pieces[p]) ? count - i : pieces[p]);
+    fat_dump_finish(dump);
+    fclose(out);
+    return text;
+}
+
+/**
+ * @brief Checks one fat_dump.c kernel against the scalar one on one table
+ *
+ * @return int : 1 if the dumps differ, 0 if not
+ */
+static int check_fat_dump_input(const char *name, size_t count, int fat_bits){
+    uint32_t *entries = malloc((count ? count : 1) * sizeof(uint32_t));
+    size_t *pieces = malloc((count ? count : 1) * sizeof(size_t));
+    size_t scalar_length = 0;
+    size_t kernel_length = 0;
+    int failed = 0;
+
+    fill_fat(entries, count, fat_bits);
+    for (size_t i = 0; i < count; i++)
+        pieces[i] = 1 + next_random() % (count < 300 ? 300 : count / 4);
+
+    fat_dump_select_kernel("scalar");
+    char *scalar = dump_fat(entries, count, fat_bits, pieces, &scalar_length);
+    fat_dump_select_kernel(name);
+    char *kernel = dump_fat(entries, count, fat_bits, pieces, &kernel_length);
+    if (scalar_length != kernel_length || memcmp(scalar, kernel, scalar_length)){
+        fprintf(stderr, "fat_dump %s differs from scalar: FAT%d, %zu entries\n", name, fat_bits, count);
+        failed = 1;
+    }
+    free(scalar);
+    free(kernel);
+    free(pieces);
+    free(entries);
+    return failed;
+}
+
+/**
+ * @brief Checks one fat_dump.c kernel against the scalar one
+ *
+ * @return int : # of tables the kernel got wrong
+ */
+static int check_fat_dump(const char *name){
+    static const int widths[] = {12, 16, 32};
+    int failures = 0;
+
+    for (int w = 0; w < 3; w++){
+        for (size_t count = 0; count <= SHORT_LENGTHS; count++)
+            failures += check_fat_dump_input(name, count, widths[w]);
+        for (size_t i = 0; i < LONG_LENGTH_COUNT; i++)
+            failures += check_fat_dump_input(name, long_lengths[i], widths[w]);
+    }
+    return failures;
+}
+
+/**
+ * @brief Checks every kernel of one module the CPU supports and prints the outcome
+ *
+ * @return int : # of kernels that got an input wrong
+ */
+static int check_module(const char *module, const char *const *names, bool (*select)(const char *), int (*check)(const char *)){
+    int failed_kernels = 0;
+
+    for (int i = 0; names[i] != NULL; i++){
+        if (!select(names[i])){
+            printf("%-9s %-9s skipped, not supported by this CPU\n", module, names[i]);
+            continue;
+        }
+        int failures = check(names[i]);
+        printf("%-9s %-9s %s\n", module, names[i], failures ? "FAILED" : "ok");
+        failed_kernels += (failures != 0);
+    }
+    select("scalar");
+    return failed_kernels;
+}
+
+int main(int argc, char *argv[]){
+    static const char *const scan_kernels[] = {"sse2", "avx2", "avx512bw", NULL};
+    static const char *const fat12_kernels[] = {"ssse3", "avx2", NULL};
+    static const char *const fat_dump_kernels[] = {"avx2", NULL};
+    int opt_char;
+
+    while ((opt_char = getopt(argc, argv, "S:")) != -1){
+        if (opt_char != 'S'){
+            fprintf(stderr, "Usage: %s %s", argv[0], usage);
+            exit(EXIT_FAILURE);
+        }
+        rng ^= strtoull(optarg, NULL, 10);
+    }
+
+    int failed = check_module("scan", scan_kernels, scan_select_kernel, check_scan);
+    failed += check_module("fat12", fat12_kernels, fat12_select_kernel, check_fat12);
+    failed += check_module("fat_dump", fat_dump_kernels, fat_dump_select_kernel, check_fat_dump);
+    if (failed){
+        fprintf(stderr, "%d kernels disagree with the scalar kernel\n", failed);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,688 @@
+/**
+ * @file fg_mkimage.c
+ * @brief Writes synthetic FAT12/16/32 images, optionally inside an MBR partitioned raw image, for
+ * benchmarking and exercising feeler gauge.  The directory tree, file count, fragmentation,
+ * cluster size, long file name density and planted slack payloads are all configurable, and the
+ * same seed always produces the same image.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+const char usage[] = "-o <path_to_image> -t <fat12|fat16|fat32> {default fat32} -s <volume_size_in_MiB> {default sized for the type and cluster size} -c <cluster_size_in_bytes> {default 4096} " \
+    "-n <files> {default 1000} -d <directory_depth> {default 2} -w <sub_directories_per_directory> {default 4} -F <percent_of_files_fragmented> {default 0} " \
+    "-l <percent_of_files_with_long_names> {default 50} -p <percent_of_files_with_slack_payloads> {default 1} -m {wrap the volume in an MBR partitioned raw image} -S <seed>\n";
+
+#define SECTOR_SIZE 512
+
+// Clusters of a volume when no size is given, e.g. 15 MiB, 64 MiB and 512 MiB at 4 KiB clusters
+#define DEFAULT_FAT12_CLUSTERS 4000
+#define DEFAULT_FAT16_CLUSTERS 16384
+#define DEFAULT_FAT32_CLUSTERS 131072
+
+// Sectors in front of the partition of an MBR image (-m), the usual 1 MiB alignment
+#define MBR_PARTITION_START 2048
+
+// Files are 1 to this many clusters long
+#define MAX_FILE_CLUSTERS 4
+
+// Entries of the fixed FAT12/16 root directory
+#define ROOT_DIR_ENTRIES 512
+
+// Written in the slack of the files picked for a payload, and in the gap in front of an MBR partition
+static const char payload[] = "FEELER GAUGE PLANTED SLACK PAYLOAD ";
+
+enum fat_type {
+    FAT12 = 12,
+    FAT16 = 16,
+    FAT32 = 32
+};
+
+typedef struct image_options {
+    const char *path;
+    enum fat_type type;
+    uint32_t size_mib;
+    uint32_t cluster_size;
+    uint32_t file_count;
+    uint32_t depth;
+    uint32_t width; // sub directories per directory
+    uint32_t fragmented_percent;
+    uint32_t long_name_percent;
+    uint32_t payload_percent;
+    bool mbr;
+    uint32_t seed;
+} image_options;
+
+// An entry of a directory that has been planned but not written yet
+typedef struct child_plan {
+    bool directory;
+    bool long_name;
+    uint32_t number; // names are made from this, unique across the image
+    uint32_t long_name_length; // extra characters padding the long name
+} child_plan;
+
+// A directory whose clusters are allocated and whose entries are picked
+typedef struct dir_plan {
+    uint32_t first_cluster; // 0 for the fixed FAT12/16 root directory
+    uint32_t parent_cluster;
+    uint32_t cluster_count;
+    uint32_t depth;
+    struct child_plan *children;
+    uint32_t child_count;
+} dir_plan;
+
+// Everything needed while the image is written
+typedef struct image_writer {
+    struct image_options *opt;
+    int fd;
+    uint64_t volume_off; // offset of the boot sector in the image
+    uint32_t spc;
+    uint32_t reserved_sectors;
+    uint32_t fat_sectors;
+    uint32_t root_dir_sectors;
+    uint32_t total_sectors;
+    uint32_t cluster_count; // # of data clusters
+    uint32_t *fat; // one entry per cluster including the two reserved ones
+    uint32_t next_cluster; // allocation cursor
+    uint8_t *cluster; // scratch of one cluster
+    uint64_t rng;
+    uint32_t next_number;
+    uint32_t files_left;
+    uint32_t dirs_left; // directories not planned yet, including the root
+    // Totals printed once the image is written
+    uint32_t dirs;
+    uint32_t files;
+    uint32_t fragmented;
+    uint32_t long_names;
+    uint32_t payloads;
+} image_writer;
+
+/**
+ * @brief xorshift64*, good enough for picking sizes and names and the same on every platform
+ */
+static uint32_t next_random(struct image_writer *w){
+    w->rng ^= w->rng >> 12;
+    w->rng ^= w->rng << 25;
+    w->rng ^= w->rng >> 27;
+    return (uint32_t)((w->rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/**
+ * @brief Returns true for percent out of every 100 calls
+ */
+static bool chance(struct image_writer *w, uint32_t percent){
+    return next_random(w) % 100 < percent;
+}
+
+static void put_le16(uint8_t *p, uint16_t value){
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t value){
+    for (int i = 0; i < 4; i++)
+        p[i] = value >> (i * 8);
+}
+
+/**
+ * @brief Writes to the image, exiting on failure
+ */
+static void write_at(struct image_writer *w, const void *data, size_t length, uint64_t offset){
+    if (pwrite(w->fd, data, length, offset) != (ssize_t)length){
+        fprintf(stderr, "Aborting... Failed while writing the image: %s\n", w->opt->path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * @brief Offset in the image of a data cluster
+ */
+static uint64_t cluster_offset(struct image_writer *w, uint32_t cluster){
+    uint64_t data_sector = w->reserved_sectors + (uint64_t)w->fat_sectors * 2 + w->root_dir_sectors;
+    return w->volume_off + (data_sector + (uint64_t)(cluster - 2) * w->spc) * SECTOR_SIZE;
+}
+
+/**
+ * @brief Value of an end of chain FAT entry for the volume's FAT type
+ */
+static uint32_t end_of_chain(struct image_writer *w){
+    return w->opt->type == FAT32 ? 0x0FFFFFFF : (w->opt->type == FAT16 ? 0xFFFF : 0xFFF);
+}
+
+/**
+ * @brief Works out the volume layout.  The FAT has to cover the clusters left over once the FATs
+ * themselves are taken out, so its size is iterated until it settles.
+ *
+ * @param w
+ * @return int : 0 if successful, -1 if the cluster count does not fit the FAT type
+ */
+static int plan_layout(struct image_writer *w){
+    struct image_options *opt = w->opt;
+
+    w->spc = opt->cluster_size / SECTOR_SIZE;
+    w->total_sectors = opt->size_mib * (1024 * 1024 / SECTOR_SIZE);
+    w->reserved_sectors = opt->type == FAT32 ? 32 : 1;
+    w->root_dir_sectors = opt->type == FAT32 ? 0 : ROOT_DIR_ENTRIES * 32 / SECTOR_SIZE;
+    w->fat_sectors = 1;
+    for (int i = 0; i < 8; i++){
+        uint32_t data_sectors = w->total_sectors - w->reserved_sectors - w->fat_sectors * 2 - w->root_dir_sectors;
+        w->cluster_count = data_sectors / w->spc;
+        uint64_t fat_bytes = opt->type == FAT32 ? (uint64_t)(w->cluster_count + 2) * 4 : (opt->type == FAT16 ? (uint64_t)(w->cluster_count + 2) * 2 : (uint64_t)(w->cluster_count + 2) * 3 / 2 + 1);
+        w->fat_sectors = (fat_bytes + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    }
+    // The same thresholds feeler gauge tells the FAT types apart by
+    if (opt->type == FAT12 && w->cluster_count >= 4085)
+        return -1;
+    if (opt->type == FAT16 && (w->cluster_count < 4085 || w->cluster_count >= 65525))
+        return -1;
+    if (opt->type == FAT32 && w->cluster_count < 65525)
+        return -1;
+    return 0;
+}
+
+/**
+ * @brief Picks a volume size for when -s is not given: one holding about DEFAULT_CLUSTERS of the
+ * type's clusters, which sits well inside the cluster count range plan_layout checks for
+ *
+ * @param opt
+ * @return uint32_t : size in MiB
+ */
+static uint32_t default_size_mib(const struct image_options *opt){
+    uint64_t clusters = opt->type == FAT32 ? DEFAULT_FAT32_CLUSTERS : (opt->type == FAT16 ? DEFAULT_FAT16_CLUSTERS : DEFAULT_FAT12_CLUSTERS);
+    uint64_t size_mib = clusters * opt->cluster_size / (1024 * 1024);
+    return size_mib ? (uint32_t)size_mib : 1;
+}
+
+/**
+ * @brief Allocates a chain of count clusters.  A fragmented chain leaves a few free clusters
+ * between each of its clusters.
+ *
+ * @param w
+ * @param count
+ * @param fragmented
+ * @return uint32_t : the first cluster of the chain
+ */
+static uint32_t allocate_chain(struct image_writer *w, uint32_t count, bool fragmented){
+    uint32_t first = w->next_cluster;
+    uint32_t previous = 0;
+
+    for (uint32_t i = 0; i < count; i++){
+        if (w->next_cluster >= w->cluster_count + 2){
+            fprintf(stderr, "Aborting... The volume is full, use a larger -s or fewer -n\n");
+            exit(EXIT_FAILURE);
+        }
+        uint32_t cluster = w->next_cluster;
+        if (previous)
+            w->fat[previous] = cluster;
+        w->fat[cluster] = end_of_chain(w);
+        previous = cluster;
+        w->next_cluster += fragmented ? 2 + next_random(w) % 3 : 1;
+    }
+    return first;
+}
+
+/**
+ * @brief Fills in the 8.3 name of a planned entry, e.g. "F0000042TXT"
+ */
+static void short_name(const struct child_plan *child, uint8_t name[11]){
+    char text[12];
+    snprintf(text, sizeof(text), "%c%07u%s", child->directory ? 'D' : 'F', child->number % 10000000, child->directory ? "   " : "TXT");
+    memcpy(name, text, 11);
+}
+
+/**
+ * @brief Builds the long file name of a planned entry
+ *
+ * @return uint32_t : length of the name
+ */
+static uint32_t long_name(const struct child_plan *child, char *name, size_t size){
+    int length = snprintf(name, size, "%s %u %.*s%s", child->directory ? "Directory" : "Long file name", child->number,
+        (int)child->long_name_length, "padding the name out to a realistic length", child->directory ? "" : ".txt");
+    return (uint32_t)length;
+}
+
+/**
+ * @brief # of 32 byte directory entries a planned entry takes
+ */
+static uint32_t entry_slots(const struct child_plan *child){
+    char name[128];
+    if (!child->long_name)
+        return 1;
+    return 1 + (long_name(child, name, sizeof(name)) + 1 + 12) / 13;
+}
+
+/**
+ * @brief Picks the entries of a directory and allocates its clusters.  Files are spread evenly
+ * over the directories, except the fixed FAT12/16 root directory only holds sub directories when
+ * there are any.
+ *
+ * @param w
+ * @param dir receives the plan
+ * @param parent_cluster
+ * @param depth 0 for the root directory
+ */
+static void plan_directory(struct image_writer *w, struct dir_plan *dir, uint32_t parent_cluster, uint32_t depth){
+    struct image_options *opt = w->opt;
+    bool fixed_root = (depth == 0 && opt->type != FAT32);
+    uint32_t subdirs = depth < opt->depth ? opt->width : 0;
+    uint32_t files = (fixed_root && subdirs) ? 0 : w->files_left / w->dirs_left;
+    uint32_t slots = depth ? 2 : 0; // . and ..
+
+    w->dirs_left--;
+    w->files_left -= files;
+    memset(dir, 0, sizeof(struct dir_plan));
+    dir->parent_cluster = parent_cluster;
+    dir->depth = depth;
+    dir->child_count = subdirs + files;
+    dir->children = calloc(dir->child_count ? dir->child_count : 1, sizeof(struct child_plan));
+    for (uint32_t i = 0; i < dir->child_count; i++){
+        struct child_plan *child = &dir->children[i];
+        child->directory = i < subdirs;
+        child->number = ++w->next_number;
+        child->long_name = chance(w, opt->long_name_percent);
+        child->long_name_length = next_random(w) % 32;
+        slots += entry_slots(child);
+    }
+
+    if (fixed_root){
+        if (slots > ROOT_DIR_ENTRIES){
+            fprintf(stderr, "Aborting... %u files do not fit the FAT12/16 root directory, use -d 1 or more\n", files);
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+    dir->cluster_count = ((uint64_t)slots * 32 + opt->cluster_size - 1) / opt->cluster_size;
+    if (dir->cluster_count == 0)
+        dir->cluster_count = 1;
+    dir->first_cluster = allocate_chain(w, dir->cluster_count, false);
+}
+
+/**
+ * @brief Appends a directory entry to a directory buffer
+ */
+static void add_entry(uint8_t *entry, const uint8_t name[11], uint8_t attributes, uint32_t cluster, uint32_t size){
+    memcpy(entry, name, 11);
+    entry[11] = attributes;
+    put_le16(entry + 14, 0x6000); // 12:00:00
+    put_le16(entry + 16, 0x5021); // 2020-01-01
+    put_le16(entry + 18, 0x5021);
+    put_le16(entry + 20, cluster >> 16);
+    put_le16(entry + 22, 0x6000);
+    put_le16(entry + 24, 0x5021);
+    put_le16(entry + 26, cluster & 0xFFFF);
+    put_le32(entry + 28, size);
+}
+
+/**
+ * @brief Writes the long file name entries of a name in front of its 8.3 entry
+ *
+ * @return uint32_t : # of entries written
+ */
+static uint32_t add_long_name(uint8_t *entries, const char *name, uint32_t length, const uint8_t short_name[11]){
+    uint8_t checksum = 0;
+    uint32_t count = (length + 1 + 12) / 13;
+    static const int offsets[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+
+    for (int i = 0; i < 11; i++)
+        checksum = ((checksum & 1) << 7) + (checksum >> 1) + short_name[i];
+    for (uint32_t part = 0; part < count; part++){
+        // Stored last part first
+        uint8_t *entry = entries + (count - 1 - part) * 32;
+        entry[0] = (part + 1) | (part == count - 1 ? 0x40 : 0);
+        entry[11] = 0x0F;
+        entry[13] = checksum;
+        for (int i = 0; i < 13; i++){
+            uint32_t position = part * 13 + i;
+            uint16_t unit = position < length ? (uint8_t)name[position] : (position == length ? 0x0000 : 0xFFFF);
+            put_le16(entry + offsets[i], unit);
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Writes the clusters of a file: a pattern up to the file size, and with a payload planted
+ * in the slack of the last cluster
+ */
+static void write_file(struct image_writer *w, uint32_t first_cluster, uint32_t size, bool plant_payload, uint8_t pattern){
+    uint32_t cluster_size = w->opt->cluster_size;
+    uint32_t written = 0;
+
+    for (uint32_t cluster = first_cluster; ; cluster = w->fat[cluster]){
+        uint32_t length = (size - written < cluster_size) ? size - written : cluster_size;
+        memset(w->cluster, pattern, length);
+        memset(w->cluster + length, 0, cluster_size - length);
+        written += length;
+        if (written == size && plant_payload){
+            for (uint32_t i = length; i < cluster_size; i++)
+                w->cluster[i] = payload[(i - length) % (sizeof(payload) - 1)];
+        }
+        write_at(w, w->cluster, cluster_size, cluster_offset(w, cluster));
+        if (written == size)
+            break;
+    }
+}
+
+/**
+ * @brief Writes the files and entries of a planned directory, then plans and writes its sub
+ * directories depth first
+ *
+ * @param w
+ * @param dir
+ */
+static void write_directory(struct image_writer *w, struct dir_plan *dir){
+    struct image_options *opt = w->opt;
+    size_t length = dir->first_cluster ? (size_t)dir->cluster_count * opt->cluster_size : ROOT_DIR_ENTRIES * 32;
+    uint8_t *entries = calloc(1, length);
+    struct dir_plan *subdirs = calloc(dir->child_count ? dir->child_count : 1, sizeof(struct dir_plan));
+    uint32_t subdir_count = 0;
+    uint32_t slot = 0;
+    uint8_t name[11];
+
+    if (dir->depth){
+        uint8_t dot[11] = ".          ";
+        uint8_t dotdot[11] = "..         ";
+        add_entry(entries, dot, 0x10, dir->first_cluster, 0);
+        add_entry(entries + 32, dotdot, 0x10, dir->depth == 1 ? 0 : dir->parent_cluster, 0);
+        slot = 2;
+    }
+    for (uint32_t i = 0; i < dir->child_count; i++){
+        struct child_plan *child = &dir->children[i];
+        uint32_t cluster;
+        uint32_t size = 0;
+
+        short_name(child, name);
+        if (child->directory){
+            plan_directory(w, &subdirs[subdir_count], dir->first_cluster, dir->depth + 1);
+            cluster = subdirs[subdir_count++].first_cluster;
+            w->dirs++;
+        }
+        else{
+            bool fragmented = chance(w, opt->fragmented_percent);
+            bool plant_payload = chance(w, opt->payload_percent);
+            size = 1 + next_random(w) % (MAX_FILE_CLUSTERS * opt->cluster_size);
+            // A payload needs slack to hide in
+            if (plant_payload && size % opt->cluster_size == 0)
+                size--;
+            cluster = allocate_chain(w, (size + opt->cluster_size - 1) / opt->cluster_size, fragmented);
+            write_file(w, cluster, size, plant_payload, 'A' + child->number % 26);
+            w->files++;
+            w->fragmented += fragmented;
+            w->payloads += plant_payload;
+        }
+        if (child->long_name){
+            char long_text[128];
+            slot += add_long_name(entries + slot * 32, long_text, long_name(child, long_text, sizeof(long_text)), name);
+            w->long_names++;
+        }
+        add_entry(entries + slot * 32, name, child->directory ? 0x10 : 0x20, cluster, size);
+        slot++;
+    }
+
+    if (dir->first_cluster){
+        uint32_t cluster = dir->first_cluster;
+        for (uint32_t i = 0; i < dir->cluster_count; i++, cluster = w->fat[cluster])
+            write_at(w, entries + (size_t)i * opt->cluster_size, opt->cluster_size, cluster_offset(w, cluster));
+    }
+    else{
+        write_at(w, entries, length, w->volume_off + (uint64_t)(w->reserved_sectors + w->fat_sectors * 2) * SECTOR_SIZE);
+    }
+    free(entries);
+    free(dir->children);
+
+    for (uint32_t i = 0; i < subdir_count; i++)
+        write_directory(w, &subdirs[i]);
+    free(subdirs);
+}
+
+/**
+ * @brief Writes the boot sector, and for FAT32 the FSInfo sector and the backup boot sector
+ */
+static void write_boot_sector(struct image_writer *w){
+    struct image_options *opt = w->opt;
+    uint8_t sector[SECTOR_SIZE] = {0};
+    uint8_t *label = opt->type == FAT32 ? sector + 71 : sector + 43;
+
+    // feeler gauge tells the FAT types apart by their jump instructions
+    sector[0] = 0xEB;
+    sector[1] = opt->type == FAT32 ? 0x58 : (opt->type == FAT16 ? 0x3C : 0x3F);
+    sector[2] = 0x90;
+    memcpy(sector + 3, "FGMKIMG ", 8);
+    put_le16(sector + 11, SECTOR_SIZE);
+    sector[13] = w->spc;
+    put_le16(sector + 14, w->reserved_sectors);
+    sector[16] = 2;
+    put_le16(sector + 17, opt->type == FAT32 ? 0 : ROOT_DIR_ENTRIES);
+    if (opt->type != FAT32 && w->total_sectors < 65536)
+        put_le16(sector + 19, w->total_sectors);
+    else
+        put_le32(sector + 32, w->total_sectors);
+    sector[21] = 0xF8;
+    if (opt->type != FAT32)
+        put_le16(sector + 22, w->fat_sectors);
+    put_le16(sector + 24, 63);
+    put_le16(sector + 26, 255);
+    put_le32(sector + 28, opt->mbr ? MBR_PARTITION_START : 0);
+    if (opt->type == FAT32){
+        put_le32(sector + 36, w->fat_sectors);
+        put_le32(sector + 44, 2); // root directory cluster
+        put_le16(sector + 48, 1); // FSInfo sector
+        put_le16(sector + 50, 6); // backup boot sector
+        sector[64] = 0x80;
+        sector[66] = 0x29;
+        put_le32(sector + 67, opt->seed);
+        memcpy(sector + 82, "FAT32   ", 8);
+    }
+    else{
+        sector[36] = 0x80;
+        sector[38] = 0x29;
+        put_le32(sector + 39, opt->seed);
+        memcpy(sector + 54, opt->type == FAT16 ? "FAT16   " : "FAT12   ", 8);
+    }
+    memcpy(label, "FG SYNTH   ", 11);
+    sector[510] = 0x55;
+    sector[511] = 0xAA;
+    write_at(w, sector, SECTOR_SIZE, w->volume_off);
+
+    if (opt->type == FAT32){
+        write_at(w, sector, SECTOR_SIZE, w->volume_off + 6 * SECTOR_SIZE);
+        uint8_t fsinfo[SECTOR_SIZE] = {0};
+        put_le32(fsinfo, 0x41615252);
+        put_le32(fsinfo + 484, 0x61417272);
+        put_le32(fsinfo + 488, w->cluster_count + 2 - w->next_cluster);
+        put_le32(fsinfo + 492, w->next_cluster);
+        fsinfo[510] = 0x55;
+        fsinfo[511] = 0xAA;
+        write_at(w, fsinfo, SECTOR_SIZE, w->volume_off + SECTOR_SIZE);
+    }
+}
+
+/**
+ * @brief Encodes the FAT for the volume's FAT type and writes both copies
+ */
+static void write_fats(struct image_writer *w){
+    size_t length = (size_t)w->fat_sectors * SECTOR_SIZE;
+    uint8_t *fat = calloc(1, length);
+
+    for (uint32_t i = 0; i < w->cluster_count + 2; i++){
+        if (w->opt->type == FAT32)
+            put_le32(fat + (size_t)i * 4, w->fat[i]);
+        else if (w->opt->type == FAT16)
+            put_le16(fat + (size_t)i * 2, w->fat[i]);
+        else{
+            // Two 12 bit entries share three bytes
+            uint8_t *p = fat + (size_t)i * 3 / 2;
+            if (i & 1){
+                p[0] = (p[0] & 0x0F) | ((w->fat[i] & 0x0F) << 4);
+                p[1] = w->fat[i] >> 4;
+            }
+            else{
+                p[0] = w->fat[i];
+                p[1] = (p[1] & 0xF0) | ((w->fat[i] >> 8) & 0x0F);
+            }
+        }
+    }
+    for (int copy = 0; copy < 2; copy++)
+        write_at(w, fat, length, w->volume_off + ((uint64_t)w->reserved_sectors + (uint64_t)copy * w->fat_sectors) * SECTOR_SIZE);
+    free(fat);
+}
+
+/**
+ * @brief Writes the MBR of a raw image holding the volume as its only partition, and plants a
+ * payload in the gap in front of the partition when payloads were asked for
+ */
+static void write_mbr(struct image_writer *w){
+    uint8_t sector[SECTOR_SIZE] = {0};
+    uint8_t *entry = sector + 446;
+
+    entry[4] = w->opt->type == FAT32 ? 0x0C : (w->opt->type == FAT16 ? 0x0E : 0x01);
+    put_le32(entry + 8, MBR_PARTITION_START);
+    put_le32(entry + 12, w->total_sectors);
+    sector[510] = 0x55;
+    sector[511] = 0xAA;
+    write_at(w, sector, SECTOR_SIZE, 0);
+    if (w->opt->payload_percent)
+        write_at(w, payload, sizeof(payload) - 1, 100 * SECTOR_SIZE);
+}
+
+/**
+ * @brief Parses a non-negative number argument, exiting with the usage on anything else
+ */
+static uint32_t number_arg(const char *arg, const char *argv0){
+    char *end;
+    long value = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || value < 0 || value > UINT32_MAX){
+        fprintf(stderr, "Usage: %s %s", argv0, usage);
+        exit(EXIT_FAILURE);
+    }
+    return value;
+}
+
+int main(int argc, char *argv[]){
+    struct image_options opt = {NULL, FAT32, 0, 4096, 1000, 2, 4, 0, 50, 1, false, 1};
+    struct image_writer w = {&opt};
+    struct dir_plan root;
+    int opt_char;
+
+    while ((opt_char = getopt(argc, argv, "o:t:s:c:n:d:w:F:l:p:mS:")) != -1) {
+        switch (opt_char) {
+        case 'o':
+            opt.path = optarg;
+            break;
+        case 't':
+            if (!strcasecmp(optarg, "fat12"))
+                opt.type = FAT12;
+            else if (!strcasecmp(optarg, "fat16"))
+                opt.type = FAT16;
+            else if (!strcasecmp(optarg, "fat32"))
+                opt.type = FAT32;
+            else{
+                fprintf(stderr, "Usage: %s %s", argv[0], usage);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 's':
+            opt.size_mib = number_arg(optarg, argv[0]);
+            break;
+        case 'c':
+            opt.cluster_size = number_arg(optarg, argv[0]);
+            break;
+        case 'n':
+            opt.file_count = number_arg(optarg, argv[0]);
+            break;
+        case 'd':
+            opt.depth = number_arg(optarg, argv[0]);
+            break;
+        case 'w':
+            opt.width = number_arg(optarg, argv[0]);
+            break;
+        case 'F':
+            opt.fragmented_percent = number_arg(optarg, argv[0]);
+            break;
+        case 'l':
+            opt.long_name_percent = number_arg(optarg, argv[0]);
+            break;
+        case 'p':
+            opt.payload_percent = number_arg(optarg, argv[0]);
+            break;
+        case 'm':
+            opt.mbr = true;
+            break;
+        case 'S':
+            opt.seed = number_arg(optarg, argv[0]);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s %s", argv[0], usage);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (opt.size_mib == 0)
+        opt.size_mib = default_size_mib(&opt);
+    // Cluster sizes feeler gauge accepts: a power of two number of sectors, at most 32 KiB
+    if (opt.path == NULL || opt.cluster_size < SECTOR_SIZE || opt.cluster_size > 32768 || (opt.cluster_size & (opt.cluster_size - 1))
+        || opt.size_mib < 1 || opt.size_mib > 1024 * 1024 || opt.fragmented_percent > 100 || opt.long_name_percent > 100 || opt.payload_percent > 100
+        || (opt.depth && opt.width == 0)){
+        fprintf(stderr, "Usage: %s %s", argv[0], usage);
+        exit(EXIT_FAILURE);
+    }
+    if (plan_layout(&w) < 0){
+        fprintf(stderr, "Aborting... %u clusters of %u bytes do not make a FAT%d volume, change -s or -c\n", w.cluster_count, opt.cluster_size, opt.type);
+        exit(EXIT_FAILURE);
+    }
+
+    w.fd = open(opt.path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (w.fd == -1){
+        fprintf(stderr, "Aborting... Could not create the file: %s\n", opt.path);
+        exit(EXIT_FAILURE);
+    }
+    w.volume_off = opt.mbr ? (uint64_t)MBR_PARTITION_START * SECTOR_SIZE : 0;
+    if (ftruncate(w.fd, w.volume_off + (uint64_t)w.total_sectors * SECTOR_SIZE) != 0){
+        fprintf(stderr, "Aborting... Failed while writing the image: %s\n", opt.path);
+        exit(EXIT_FAILURE);
+    }
+    w.fat = calloc(w.cluster_count + 2, sizeof(uint32_t));
+    w.cluster = malloc(opt.cluster_size);
+    w.rng = 0x9E3779B97F4A7C15ULL ^ opt.seed;
+    w.files_left = opt.file_count;
+    w.fat[0] = 0xFFFFFF00 | 0xF8;
+    w.fat[1] = 0xFFFFFFFF;
+    if (opt.type != FAT32){
+        w.fat[0] &= end_of_chain(&w);
+        w.fat[1] &= end_of_chain(&w);
+    }
+    else{
+        w.fat[0] &= 0x0FFFFFFF;
+        w.fat[1] &= 0x0FFFFFFF;
+    }
+    w.next_cluster = 2;
+
+    // Every level holds width times as many directories as the one above it
+    w.dirs_left = 1;
+    for (uint32_t level = 1, count = 1; level <= opt.depth; level++){
+        count *= opt.width;
+        w.dirs_left += count;
+    }
+
+    plan_directory(&w, &root, 0, 0);
+    write_directory(&w, &root);
+    write_fats(&w);
+    write_boot_sector(&w);
+    if (opt.mbr)
+        write_mbr(&w);
+    if (close(w.fd) != 0){
+        fprintf(stderr, "Aborting... Failed while writing the image: %s\n", opt.path);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Wrote %s: FAT%d%s, %u clusters of %u bytes, %u directories, %u files (%u fragmented, %u with slack payloads), %u long file names\n",
+        opt.path, opt.type, opt.mbr ? " in an MBR partition" : "", w.cluster_count, opt.cluster_size, w.dirs, w.files, w.fragmented, w.payloads, w.long_names);
+    free(w.fat);
+    free(w.cluster);
+    return 0;
+}
@@ -0,0 +1,3548 @@
+/**
+ * @file libfeelergauge.c
+ * @brief Feeler Gauge library: MBR and boot sector parsing, FAT loading, the tree walk, the slack
+ * checks and the volume index, behind the fg_volume handle of libfeelergauge.h
+ */
+
+#include "fat_volume.h"
+
+/**
+ * @brief Lookup table for partition code -> txt string
+ */
+static const char partition_type_txt [256][20]={
+    "EMPTY",            // [0] -> 0x00
+    "FAT12",            // [1] -> 0x01
+    "XENIX ROOT",       // [2] -> 0x2
+    "XENIX USR",        // [3] -> 0x3
+    "FAT16 (CHS)",      // [4] -> 0x4
+    "EXTENDED (CHS)",   // [5] -> 0x5
+    "FAT16B (CHS)",     // [6] -> 0x6
+    "NTFS",             // [7] -> 0x7
+    "IBM AIX",          // [8] -> 0x8
+    "IBM AIX",          // [9] -> 0x9
+    "IBM OS/2",         // [10] -> 0xA
+    "FAT32 (CHS)",      // [11] -> 0xB
+    "FAT32 (LBA)",      // [12] -> 0xC
+    "????",             // [13] -> 0xD
+    "FAT16 (LBA)",      // [14] -> 0xE
+    "EXTENDED (LBA)",   // [15] -> 0xF
+    "Hidden IBM OS/2",  // [16] -> 0x10
+    "Hidden FAT12",     // [17] -> 0x11
+    "????",             // [18] -> 0x12
+    "????",             // [19] -> 0x13
+    "Hidden FAT16 (CHS)", // [20] -> 0x14
+    "????",             // [21] -> 0x15
+    "Hidden FAT16B",    // [22] -> 0x16
+    "Hidden NTFS",      // [23] -> 0x17
+    "????",             // [24] -> 0x18
+    "????",             // [25] -> 0x19
+    "????",             // [26] -> 0x1A
+    "Hidden FAT32 (CHS)", // [27] -> 0x1B
+    "Hidden FAT32 (LBA)", // [28] -> 0x1C
+    "????",             // [29] -> 0x1D
+    "Hidden FAT16 (LBA)", // [30] -> 0x1E
+    "????",             // [31] -> 0x1F
+    "????",             // [32] -> 0x20
+    "????",             // [33] -> 0x21
+    "????",             // [34] -> 0x22
+    "????",             // [35] -> 0x23
+    "????",             // [36] -> 0x24
+    "????",             // [37] -> 0x25
+    "????",             // [38] -> 0x26
+    "????",             // [39] -> 0x27
+    "????",             // [40] -> 0x28
+    "????",             // [41] -> 0x29
+    "MBR Dynamic",      // [42] -> 0x2A
+    "????",             // [43] -> 0x2B
+    "????",             // [44] -> 0x2C
+    "????",             // [45] -> 0x2D
+    "????",             // [46] -> 0x2E
+    "????",             // [47] -> 0x2F
+    "????",             // [48] -> 0x30
+    "????",             // [49] -> 0x31
+    "????",             // [50] -> 0x32
+    "????",             // [51] -> 0x33
+    "????",             // [52] -> 0x34
+    "????",             // [53] -> 0x35
+    "????",             // [54] -> 0x36
+    "????",             // [55] -> 0x37
+    "????",             // [56] -> 0x38
+    "????",             // [57] -> 0x39
+    "????",             // [58] -> 0x3A
+    "????",             // [59] -> 0x3B
+    "????",             // [60] -> 0x3C
+    "????",             // [61] -> 0x3D
+    "????",             // [62] -> 0x3E
+    "????",             // [63] -> 0x3F
+    "????",             // [64] -> 0x40
+    "????",             // [65] -> 0x41
+    "????",             // [66] -> 0x42
+    "????",             // [67] -> 0x43
+    "????",             // [68] -> 0x44
+    "????",             // [69] -> 0x45
+    "????",             // [70] -> 0x46
+    "????",             // [71] -> 0x47
+    "????",             // [72] -> 0x48
+    "????",             // [73] -> 0x49
+    "????",             // [74] -> 0x4A
+    "????",             // [75] -> 0x4B
+    "????",             // [76] -> 0x4C
+    "????",             // [77] -> 0x4D
+    "????",             // [78] -> 0x4E
+    "????",             // [79] -> 0x4F
+    "????",             // [80] -> 0x50
+    "????",             // [81] -> 0x51
+    "????",             // [82] -> 0x52
+    "????",             // [83] -> 0x53
+    "????",             // [84] -> 0x54
+    "????",             // [85] -> 0x55
+    "????",             // [86] -> 0x56
+    "????",             // [87] -> 0x57
+    "????",             // [88] -> 0x58
+    "????",             // [89] -> 0x59
+    "????",             // [90] -> 0x5A
+    "????",             // [91] -> 0x5B
+    "????",             // [92] -> 0x5C
+    "????",             // [93] -> 0x5D
+    "????",             // [94] -> 0x5E
+    "????",             // [95] -> 0x5F
+    "????",             // [96] -> 0x60
+    "????",             // [97] -> 0x61
+    "????",             // [98] -> 0x62
+    "????",             // [99] -> 0x63
+    "????",             // [100] -> 0x64
+    "????",             // [101] -> 0x65
+    "????",             // [102] -> 0x66
+    "????",             // [103] -> 0x67
+    "????",             // [104] -> 0x68
+    "????",             // [105] -> 0x69
+    "????",             // [106] -> 0x6A
+    "????",             // [107] -> 0x6B
+    "????",             // [108] -> 0x6C
+    "????",             // [109] -> 0x6D
+    "????",             // [110] -> 0x6E
+    "????",             // [111] -> 0x6F
+    "????",             // [112] -> 0x70
+    "????",             // [113] -> 0x71
+    "????",             // [114] -> 0x72
+    "????",             // [115] -> 0x73
+    "????",             // [116] -> 0x74
+    "????",             // [117] -> 0x75
+    "????",             // [118] -> 0x76
+    "????",             // [119] -> 0x77
+    "????",             // [120] -> 0x78
+    "????",             // [121] -> 0x79
+    "????",             // [122] -> 0x7A
+    "????",             // [123] -> 0x7B
+    "????",             // [124] -> 0x7C
+    "????",             // [125] -> 0x7D
+    "????",             // [126] -> 0x7E
+    "????",             // [127] -> 0x7F
+    "????",             // [128] -> 0x80
+    "????",             // [129] -> 0x81
+    "Linux Swap",       // [130] -> 0x82
+    "Linux",            // [131] -> 0x83
+    "Hibernation",      // [132] -> 0x84
+    "EXTENDED (Linux)", // [133] -> 0x85
+    "NTFS Vol Set",     // [134] -> 0x86
+    "NTFS Vol Set",     // [135] -> 0x87
+    "????",             // [136] -> 0x88
+    "????",             // [137] -> 0x89
+    "????",             // [138] -> 0x8A
+    "????",             // [139] -> 0x8B
+    "????",             // [140] -> 0x8C
+    "????",             // [141] -> 0x8D
+    "????",             // [142] -> 0x8E
+    "????",             // [143] -> 0x8F
+    "????",             // [144] -> 0x90
+    "????",             // [145] -> 0x91
+    "????",             // [146] -> 0x92
+    "????",             // [147] -> 0x93
+    "????",             // [148] -> 0x94
+    "????",             // [149] -> 0x95
+    "????",             // [150] -> 0x96
+    "????",             // [151] -> 0x97
+    "????",             // [152] -> 0x98
+    "????",             // [153] -> 0x99
+    "????",             // [154] -> 0x9A
+    "????",             // [155] -> 0x9B
+    "????",             // [156] -> 0x9C
+    "????",             // [157] -> 0x9D
+    "????",             // [158] -> 0x9E
+    "????",             // [159] -> 0x9F
+    "Hibernation",      // [160] -> 0xA0
+    "Hibernation",      // [161] -> 0xA1
+    "????",             // [162] -> 0xA2
+    "????",             // [163] -> 0xA3
+    "????",             // [164] -> 0xA4
+    "FreeBSD",          // [165] -> 0xA5
+    "OpenBSD",          // [166] -> 0xA6
+    "????",             // [167] -> 0xA7
+    "MacOS X",          // [168] -> 0xA8
+    "NetBSD",           // [169] -> 0xA9
+    "????",             // [170] -> 0xAA
+    "MacOS X Boot",     // [171] -> 0xAB
+    "????",             // [172] -> 0xAC
+    "????",             // [173] -> 0xAD
+    "????",             // [174] -> 0xAE
+    "????",             // [175] -> 0xAF
+    "????",             // [176] -> 0xB0
+    "????",             // [177] -> 0xB1
+    "????",             // [178] -> 0xB2
+    "????",             // [179] -> 0xB3
+    "????",             // [180] -> 0xB4
+    "????",             // [181] -> 0xB5
+    "????",             // [182] -> 0xB6
+    "????",             // [183] -> 0xB7
+    "????",             // [184] -> 0xB8
+    "????",             // [185] -> 0xB9
+    "????",             // [186] -> 0xBA
+    "????",             // [187] -> 0xBB
+    "????",             // [188] -> 0xBC
+    "????",             // [189] -> 0xBD
+    "????",             // [190] -> 0xBE
+    "????",             // [191] -> 0xBF
+    "????",             // [192] -> 0xC0
+    "????",             // [193] -> 0xC1
+    "????",             // [194] -> 0xC2
+    "????",             // [195] -> 0xC3
+    "????",             // [196] -> 0xC4
+    "????",             // [197] -> 0xC5
+    "????",             // [198] -> 0xC6
+    "????",             // [199] -> 0xC7
+    "????",             // [200] -> 0xC8
+    "????",             // [201] -> 0xC9
+    "????",             // [202] -> 0xCA
+    "????",             // [203] -> 0xCB
+    "????",             // [204] -> 0xCC
+    "????",             // [205] -> 0xCD
+    "????",             // [206] -> 0xCE
+    "????",             // [207] -> 0xCF
+    "????",             // [208] -> 0xD0
+    "????",             // [209] -> 0xD1
+    "????",             // [210] -> 0xD2
+    "????",             // [211] -> 0xD3
+    "????",             // [212] -> 0xD4
+    "????",             // [213] -> 0xD5
+    "????",             // [214] -> 0xD6
+    "????",             // [215] -> 0xD7
+    "????",             // [216] -> 0xD8
+    "????",             // [217] -> 0xD9
+    "????",             // [218] -> 0xDA
+    "????",             // [219] -> 0xDB
+    "????",             // [220] -> 0xDC
+    "????",             // [221] -> 0xDD
+    "????",             // [222] -> 0xDE
+    "????",             // [223] -> 0xDF
+    "????",             // [224] -> 0xE0
+    "????",             // [225] -> 0xE1
+    "????",             // [226] -> 0xE2
+    "????",             // [227] -> 0xE3
+    "????",             // [228] -> 0xE4
+    "????",             // [229] -> 0xE5
+    "????",             // [230] -> 0xE6
+    "????",             // [231] -> 0xE7
+    "????",             // [232] -> 0xE8
+    "????",             // [233] -> 0xE9
+    "????",             // [234] -> 0xEA
+    "????",             // [235] -> 0xEB
+    "????",             // [236] -> 0xEC
+    "????",             // [237] -> 0xED
+    "????",             // [238] -> 0xEE
+    "????",             // [239] -> 0xEF
+    "????",             // [240] -> 0xF0
+    "????",             // [241] -> 0xF1
+    "????",             // [242] -> 0xF2
+    "????",             // [243] -> 0xF3
+    "????",             // [244] -> 0xF4
+    "????",             // [245] -> 0xF5
+    "????",             // [246] -> 0xF6
+    "????",             // [247] -> 0xF7
+    "????",             // [248] -> 0xF8
+    "????",             // [249] -> 0xF9
+    "????",             // [250] -> 0xFA
+    "????",             // [251] -> 0xFB
+    "????",             // [252] -> 0xFC
+    "????",             // [253] -> 0xFD
+    "????",             // [254] -> 0xFE
+    "????"              // [255] -> 0xFF
+};
+
+/**
+ * @brief Records the first error of a volume.  Safe to call from every thread of the tree walk,
+ * the first error is kept and later ones are dropped.
+ *
+ * @param vol
+ * @param status
+ * @param format printf style description of the error
+ * @return fg_status : the volume's status, i.e. its first error
+ */
+static fg_status volume_fail(struct fat_volume *vol, fg_status status, const char *format, ...){
+    int first = FG_OK;
+
+    if (!__atomic_compare_exchange_n(&vol->status, &first, status, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return first;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(vol->error, sizeof(vol->error), format, args);
+    va_end(args);
+    return status;
+}
+
+/**
+ * @brief Records a read of the disk image that failed
+ *
+ * @param vol
+ * @return fg_status : the volume's status
+ */
+static fg_status read_error(struct fat_volume *vol){
+    return volume_fail(vol, FG_ERROR_READ, "Unable to read disk image. Please make sure the file has not been moved or deleted.");
+}
+
+/**
+ * @brief Records an allocation that failed
+ *
+ * @param vol
+ * @return fg_status : the volume's status
+ */
+static fg_status memory_error(struct fat_volume *vol){
+    return volume_fail(vol, FG_ERROR_MEMORY, "Out of memory while scanning the disk image.");
+}
+
+/**
+ * @brief Returns the status of a volume, FG_OK until its first error
+ */
+static fg_status volume_status(struct fat_volume *vol){
+    return __atomic_load_n(&vol->status, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Name of an image type as given to -f
+ */
+static const char *fs_type_name(int type){
+    switch (type){
+        case FG_FAT32:
+            return "fat32";
+        case FG_FAT16:
+            return "fat16";
+        case FG_FAT12:
+            return "fat12";
+        case FG_NTFS:
+            return "ntfs";
+        default:
+            return "raw";
+    }
+}
+
+/**
+ * @brief Convert Cluster to Sector
+ * 
+ * @param vol 
+ * @param cluster 
+ * @return off_t offset in bytes of the cluster from the start of the disk image
+ */
+static off_t cts(struct fat_volume *vol, uint32_t cluster){
+    return ((off_t)(cluster - 2) * vol->cluster_size + vol->data_off);
+}
+
+/**
+ * @brief Reads one sector from the disk image into an aligned buffer with a single read
+ *
+ * @param vol
+ * @param offset offset in bytes from the start of the disk image to the sector
+ * @param sector buffer of SECTOR_BUFFER_SIZE bytes
+ * @return int : 0 if successful, -1 if the read failed (recorded in the volume)
+ */
+static int read_sector(struct fat_volume *vol, off_t offset, uint8_t *sector){
+    if (disk_image_read(vol->disk, sector, SECTOR_BUFFER_SIZE, offset) < 0){
+        read_error(vol);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Bounds checked little endian field accessors for decoding sectors held in memory.
+ * Fields that would run past the end of the buffer decode as 0.
+ */
+static uint8_t get_u8(const uint8_t *sector, size_t length, uint32_t offset){
+    if (offset + 1 > length)
+        return 0;
+    return sector[offset];
+}
+
+static uint16_t get_le16(const uint8_t *sector, size_t length, uint32_t offset){
+    if (offset + 2 > length)
+        return 0;
+    return sector[offset] | (sector[offset + 1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *sector, size_t length, uint32_t offset){
+    if (offset + 4 > length)
+        return 0;
+    return (uint32_t)sector[offset] | ((uint32_t)sector[offset + 1] << 8) |
+        ((uint32_t)sector[offset + 2] << 16) | ((uint32_t)sector[offset + 3] << 24);
+}
+
+static void get_str(const uint8_t *sector, size_t length, uint32_t offset, char *dest, size_t count){
+    memset(dest, 0, count + 1);
+    if (offset + count > length)
+        return;
+    memcpy(dest, sector + offset, count);
+}
+
+/**
+ * @brief Decodes the partition table of an MBR sector held in memory
+ *
+ * @param sector
+ * @param length number of valid bytes in sector
+ * @param mbr struct to store the decoded entries
+ * @return int : 0 if successful, -1 if the buffer is too short to hold an MBR
+ */
+static int decode_mbr_sector(const uint8_t *sector, size_t length, struct fg_mbr_sector *mbr){
+    int mbr_sector_offsets[4] = {MBR_PART1_OFF, MBR_PART2_OFF, MBR_PART3_OFF, MBR_PART4_OFF};
+
+    if (length < MBR_SIG_OFF + 2)
+        return -1;
+
+    for (int i = 0; i < 4; i++){
+        mbr->entry[i].boot_indicator = get_u8(sector, length, mbr_sector_offsets[i] + BOOT_INDICATOR);
+        mbr->entry[i].partition_type = get_u8(sector, length, mbr_sector_offsets[i] + PARTITION_TYPE);
+        mbr->entry[i].starting_sector = get_le32(sector, length, mbr_sector_offsets[i] + STARTING_SECTOR);
+        mbr->entry[i].partition_size = get_le32(sector, length, mbr_sector_offsets[i] + PARTITION_SIZE);
+    }
+    return 0;
+}
+
+/**
+ * @brief Decodes an EBR sector held in memory
+ *
+ * @param sector
+ * @param length number of valid bytes in sector
+ * @param ebr_lba the lba the EBR was read from
+ * @param ebr struct to store the decoded fields
+ * @return int : 0 if successful, -1 if the buffer is too short or the EBR signature is missing
+ */
+static int decode_ebr_sector(const uint8_t *sector, size_t length, uint32_t ebr_lba, struct fg_ebr_table *ebr){
+    if (length < ERB_SIG_OFF + 2)
+        return -1;
+    if (((get_u8(sector, length, ERB_SIG_OFF) << 8) | get_u8(sector, length, ERB_SIG_OFF + 1)) != MBR_SIG)
+        return -1;
+
+    ebr->offset = ebr_lba;
+    ebr->partition_type = get_u8(sector, length, EBR_ENTRY_OFF + PARTITION_TYPE);
+    ebr->starting_sector = get_le32(sector, length, EBR_ENTRY_OFF + STARTING_SECTOR);
+    ebr->partition_size = get_le32(sector, length, EBR_ENTRY_OFF + PARTITION_SIZE);
+    ebr->next_partition_ebr = get_le32(sector, length, EBR_NEXT_PART_OFF + STARTING_SECTOR);
+    ebr->next_ebr_table = NULL;
+    return 0;
+}
+
+/**
+ * @brief Follows the chain of EBRs of an extended partition.  Each EBR describes one logical
+ * partition, relative to the EBR itself, and links to the next EBR, relative to the start of the
+ * extended partition.  A chain that breaks, leaves the extended partition or runs backwards is
+ * cut short with FG_WARNING_EBR_CHAIN.
+ *
+ * @param vol
+ * @param extended the MBR entry of the extended partition
+ * @return int : 0 if successful, -1 if a read failed
+ */
+static int read_ebr_chain(struct fat_volume *vol, struct fg_partition_table *extended){
+    _Alignas(64) uint8_t sector[SECTOR_BUFFER_SIZE];
+    struct fg_ebr_table **link = &extended->ebr_table;
+    uint32_t next = 0;
+
+    for (int count = 0; count < MAX_LOGICAL_PARTITIONS; count++){
+        struct fg_ebr_table *ebr = arena_alloc(vol->arena, sizeof(struct fg_ebr_table));
+        uint32_t ebr_lba = extended->starting_sector + next;
+
+        if (ebr == NULL){
+            memory_error(vol);
+            return -1;
+        }
+
+        if (read_sector(vol, (off_t)ebr_lba * FG_MBR_BYTES_PER_SECTOR, sector) < 0)
+            return -1;
+        if (decode_ebr_sector(sector, sizeof(sector), ebr_lba, ebr) < 0){
+            vol->warnings |= FG_WARNING_EBR_CHAIN;
+            return 0;
+        }
+        *link = ebr;
+        link = &ebr->next_ebr_table;
+        if (ebr->next_partition_ebr == 0)
+            return 0;
+        // Each EBR lies past the one before it, which also rules out loops
+        if (ebr->next_partition_ebr <= next || ebr->next_partition_ebr >= extended->partition_size){
+            vol->warnings |= FG_WARNING_EBR_CHAIN;
+            return 0;
+        }
+        next = ebr->next_partition_ebr;
+    }
+    vol->warnings |= FG_WARNING_EBR_CHAIN;
+    return 0;
+}
+
+/**
+ * @brief Reads and decodes the MBR of a raw image, and the EBR chains of its extended partitions
+ *
+ * @param vol
+ * @param mbr struct to store the decoded entries, the EBR chains are allocated from the volume
+ * @return int : 0 if successful, -1 if the read failed
+ */
+static int read_mbr_sector(struct fat_volume *vol, struct fg_mbr_sector *mbr){
+    _Alignas(64) uint8_t sector[SECTOR_BUFFER_SIZE];
+
+    // Parse MBR
+    if (read_sector(vol, 0, sector) < 0)
+        return -1;
+    decode_mbr_sector(sector, sizeof(sector), mbr);
+
+    // Check for extended partitions within MBR
+    for (int i = 0; i < 4; i++){
+        mbr->entry[i].ebr_table = NULL;
+        if (mbr->entry[i].partition_type == FG_EXTENDED || mbr->entry[i].partition_type == FG_EXTENDED_LBA){
+            if (read_ebr_chain(vol, &mbr->entry[i]) < 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Runs a series of calculations to determine FAT File System Type.  Can differentiate
+ * between FAT12, FAT16, and FAT32.  Formula based on page 229 of File System Forensic Analysis 
+ * book by Brian Carrier
+ * 
+ * @param fat_sector 
+ */
+static void calc_fat_type(struct fg_boot_sector *fat_sector){
+    // Corrupt sectors are caught by validate_fat_boot_sector, just avoid dividing by zero here
+    uint32_t bps = fat_sector->bytes_per_sector ? fat_sector->bytes_per_sector : 512;
+    uint32_t spc = fat_sector->sectors_per_cluster ? fat_sector->sectors_per_cluster : 1;
+    uint32_t root_dir_sectors = ((fat_sector->max_files_in_root * 32) + (bps - 1)) / bps;
+    uint32_t sectors_to_clusters;
+    if (fat_sector->sector_count_16b)
+        sectors_to_clusters = fat_sector->sector_count_16b - fat_sector->reserved_area_size - (fat_sector->number_of_fats * fat_sector->fat_size_in_sectors) - root_dir_sectors;
+    else
+        sectors_to_clusters = fat_sector->sector_count_32b - fat_sector->reserved_area_size - (fat_sector->number_of_fats * fat_sector->fat_size_in_sectors) - root_dir_sectors;
+    
+    uint32_t final_value = sectors_to_clusters/spc;
+
+    if (final_value < 4085)
+        fat_sector->is_fat12 = true;
+    if (final_value >= 4085 && final_value < 65525)
+        fat_sector->is_fat16 = true;
+    if (final_value >= 65525)
+        fat_sector->is_fat32 = true;
+    // printf("Sectors in Root Dir: %d\n", root_dir_sectors);
+    // printf("Sectors allocated to clusters: %ju\n", sectors_to_clusters/fat_sector->sectors_per_cluster);
+}
+
+/**
+ * @brief Decodes a FAT boot sector held in memory
+ *
+ * @param sector
+ * @param length number of valid bytes in sector
+ * @param fat_sector struct to store the decoded fields
+ * @return int : 0 if successful, -1 if the buffer is too short to hold a boot sector
+ */
+static int decode_fat_boot_sector(const uint8_t *sector, size_t length, struct fg_boot_sector *fat_sector){
+    if (length < FS_SIGNATURE + 2)
+        return -1;
+
+    get_str(sector, length, OEM_NAME, fat_sector->oem_name, 8);
+    fat_sector->bytes_per_sector = get_le16(sector, length, BYTES_PER_SECTOR);
+    fat_sector->sectors_per_cluster = get_u8(sector, length, SECTORS_PER_CLUSTER);
+    fat_sector->reserved_area_size = get_le16(sector, length, RESERVED_AREA_SIZE);
+    fat_sector->number_of_fats = get_u8(sector, length, NUMBER_OF_FATS);
+    fat_sector->max_files_in_root = get_le16(sector, length, MAX_FILES_IN_ROOT);
+    fat_sector->sector_count_16b = get_le16(sector, length, SECTOR_COUNT_16B);
+    fat_sector->media_type = get_u8(sector, length, MEDIA_TYPE);
+    fat_sector->fat_size_in_sectors = get_le16(sector, length, FAT_SIZE_IN_SECTORS);
+    fat_sector->sectors_per_track = get_le16(sector, length, SECTORS_PER_TRACK);
+    fat_sector->head_number = get_le16(sector, length, HEAD_NUMBER);
+    fat_sector->sectors_before_partition = get_le32(sector, length, SECTORS_BEFORE_PARTITION);
+    fat_sector->sector_count_32b = get_le32(sector, length, SECTOR_COUNT_32B);
+    fat_sector->bios_drive_number = get_u8(sector, length, BIOS_DRIVE_NUMBER);
+    fat_sector->extended_boot_sig = get_u8(sector, length, EXTENDED_BOOT_SIG);
+    fat_sector->volume_serial = get_le32(sector, length, VOLUME_SERIAL);
+    get_str(sector, length, VOLUME_LABEL, fat_sector->volume_label, 11);
+    get_str(sector, length, FS_TYPE_LABEL, fat_sector->fs_type_label, 8);
+    fat_sector->fs_signature = get_le16(sector, length, FS_SIGNATURE);
+
+    // Determine FAT Type (i.e. FAT12, FAT16, or FAT32)
+    calc_fat_type(fat_sector);
+
+    // If FAT32 is detected, decode the extended FAT32 fields
+    if (fat_sector->is_fat32){
+        fat_sector->fat32_size_in_sectors = get_le32(sector, length, FAT32_SIZE_IN_SECTORS);
+        fat_sector->fat_mode = get_le16(sector, length, FAT_MODE);
+        fat_sector->fat32_version = get_le16(sector, length, FAT32_VERSION);
+        fat_sector->root_dir_cluster = get_le32(sector, length, ROOT_DIR_CLUSTER);
+        fat_sector->fsinfo_sector_addr = get_le16(sector, length, FSINFO_SECTOR);
+        fat_sector->backup_boot_sector_addr = get_le16(sector, length, BACKUP_BOOT_SECTOR_ADDR);
+        fat_sector->fat32_bios_drive_number = get_u8(sector, length, FAT32_BIOS_DRIVE_NUMBER);
+        fat_sector->fat32_extended_boot_sig = get_u8(sector, length, FAT32_EXTENDED_BOOT_SIG);
+        fat_sector->fat32_volume_serial = get_le32(sector, length, FAT32_VOLUME_SERIAL);
+        get_str(sector, length, FAT32_VOLUME_LABEL, fat_sector->fat32_volume_label, 11);
+        get_str(sector, length, FAT32_FS_TYPE_LABEL, fat_sector->fat32_fs_type_label, 8);
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads the FAT boot sector with a single read and decodes it, then fills in the
+ * volume geometry derived from it
+ * 
+ * @param vol 
+ * @param fat_sector
+ * @param partition_offset If a raw/full disk image is used, this is
+ * the offset within the disk image to the FAT boot sector
+ * @return int : 0 if successful, -1 if the read failed
+ */
+static int read_fat_boot_sector(struct fat_volume *vol, struct fg_boot_sector *fat_sector, off_t partition_offset){
+    _Alignas(64) uint8_t sector[SECTOR_BUFFER_SIZE];
+
+    if (read_sector(vol, partition_offset, sector) < 0)
+        return -1;
+    decode_fat_boot_sector(sector, sizeof(sector), fat_sector);
+
+    vol->partition_off = partition_offset;
+    vol->fat_bs = fat_sector;
+    vol->bps = fat_sector->bytes_per_sector;
+    vol->spc = fat_sector->sectors_per_cluster;
+    vol->cluster_size = vol->bps * vol->spc;
+    vol->fat_off = partition_offset + (off_t)fat_sector->reserved_area_size * vol->bps;
+    if (fat_sector->is_fat32)
+        vol->fat_size_in_bytes = fat_sector->fat32_size_in_sectors * vol->bps;
+    else
+        vol->fat_size_in_bytes = fat_sector->fat_size_in_sectors * vol->bps;
+
+    if (fat_sector->is_fat32)
+        vol->reserved_and_fats = ((off_t)fat_sector->reserved_area_size * vol->bps) + ((off_t)fat_sector->fat32_size_in_sectors * vol->bps * fat_sector->number_of_fats);
+    else
+        vol->reserved_and_fats = ((off_t)fat_sector->reserved_area_size * vol->bps) + ((off_t)fat_sector->fat_size_in_sectors * vol->bps * fat_sector->number_of_fats);
+
+    // FAT12/16 keep the root directory in a fixed region between the FATs and the clustered area,
+    // the FAT32 root directory is a cluster chain located once the volume is loaded
+    vol->data_off = partition_offset + vol->reserved_and_fats;
+    if (!fat_sector->is_fat32){
+        vol->root_dir_off = partition_offset + vol->reserved_and_fats;
+        vol->root_dir_size = fat_sector->max_files_in_root * 32;
+        if (vol->bps)
+            vol->data_off += (off_t)(vol->root_dir_size + vol->bps - 1) / vol->bps * vol->bps;
+    }
+    
+    return 0;
+}
+/**
+ * @brief Run a few checks to ensure partition data is valid.  Invalid geometry fails the volume
+ * with FG_ERROR_BOOT_SECTOR, oddities the scan can live with are added to its warnings.
+ * 
+ * @param vol 
+ * @param fat_sector 
+ * @return int : 0 if the boot sector can be used, -1 if not
+ */
+static int validate_fat_boot_sector(struct fat_volume *vol, struct fg_boot_sector *fat_sector){
+    uint32_t bps = fat_sector->bytes_per_sector;
+
+    // Check that Bytes Per Sector is Valid
+    switch (bps){
+        case 512:
+            break;
+        case 1024:
+            break;
+        case 2048:
+            break;
+        case 4096:
+            break;
+        default:
+            volume_fail(vol, FG_ERROR_BOOT_SECTOR, "\nError!  Detected bytes per sector of: %d which is invalid."  \
+            "Must be 512, 1024, 2048, or 4096.  This indicates the disk image or file system might be corrupted", 
+            bps);
+            return -1;
+    }
+
+    // Check that Sectors Cluster is a Power of 2 and less than 32KB
+    uint8_t sec_per_clus = fat_sector->sectors_per_cluster;
+    if(!(sec_per_clus != 0) && ((sec_per_clus &(sec_per_clus - 1)) == 0)){
+        volume_fail(vol, FG_ERROR_BOOT_SECTOR, "\nError!  Detected sectors per cluster of: %d which is invalid.  It must be a power of 2.  \
+                This indicates the disk image or file system might be corrupted", sec_per_clus);
+        return -1;
+    }
+    if (sec_per_clus * bps > 32768){
+        volume_fail(vol, FG_ERROR_BOOT_SECTOR, "\nError!  Detected sector size of: %d which is invalid.  It must be a power of 2.  \
+                This indicates the disk image or file system might be corrupted", sec_per_clus * bps);
+        return -1;
+    }
+
+    // Check Number of FATS > 0
+    if (fat_sector->number_of_fats < 1){
+        volume_fail(vol, FG_ERROR_BOOT_SECTOR, "\nError!  No FATs found. This indicates the disk image or file system might be corrupted");
+        return -1;
+    }
+
+    // Check that the FATs lie inside the image, their size is taken from the boot sector as is
+    uint64_t fat_bytes = (uint64_t)(fat_sector->is_fat32 ? fat_sector->fat32_size_in_sectors : fat_sector->fat_size_in_sectors) * bps;
+    uint64_t fats_end = vol->partition_off + (uint64_t)fat_sector->reserved_area_size * bps + fat_bytes * fat_sector->number_of_fats;
+    if (fat_bytes == 0 || fat_bytes > UINT32_MAX || (vol->disk->size >= 0 && fats_end > (uint64_t)vol->disk->size)){
+        volume_fail(vol, FG_ERROR_BOOT_SECTOR, "\nError!  Detected FATs of %llu bytes ending at offset %llu, which do not fit inside the disk image.  " \
+            "This indicates the disk image is truncated or the file system might be corrupted", (unsigned long long)fat_bytes, (unsigned long long)fats_end);
+        return -1;
+    }
+    
+    // Check that Max Number of Files in Root Director is 0 when FAT32 detected
+    if (fat_sector->max_files_in_root && !fat_sector->fat_size_in_sectors)
+        vol->warnings |= FG_WARNING_FAT_TYPE_CONFLICT;
+
+    // Check media type
+    if (fat_sector->media_type != FG_MEDIA_FIXED && fat_sector->media_type != FG_MEDIA_REMOVABLE)
+        vol->warnings |= FG_WARNING_MEDIA_TYPE;
+
+    // Check that only one sector count is present (16 bits for FAT12/FAT16, or 32 bits for FAT32)
+    if (fat_sector->sector_count_16b && fat_sector->sector_count_32b)
+        vol->warnings |= FG_WARNING_SECTOR_COUNTS;
+    return 0;
+}
+
+/**
+ * @brief Checks supplied disk image to ensure 0x55AA signature found, and then attempts to
+ * determine if the disk is a full disk image (i.e. still has MBR), or is just an image of a 
+ * single file system/partition.  Unless the options require a type, whatever is detected is
+ * accepted.
+ * 
+ * @param vol 
+ * @param path path the image was opened with, for the error description
+ * @param offset offset in bytes of the partition to check, 0 for the image itself
+ * @return int : return 0 if disk image with MBR detected, return file system enum if detected.
+ * The volume's status tells whether the image was accepted.
+ */
+static int verify_disk_image(struct fat_volume *vol, const char *path, off_t offset){
+    _Alignas(64) uint8_t sector[SECTOR_BUFFER_SIZE];
+    unsigned short mbr_sig = 0;
+    unsigned int fs_type_sig = 0;
+    int type = FG_RAW;
+
+    // Both signatures live in the first sector, read it once
+    if (read_sector(vol, offset, sector) < 0)
+        return FG_RAW;
+
+    // Begin checks for 0x55AA signature at offset 0x01FE
+    mbr_sig = (sector[MBR_SIG_OFF] << 8) | sector[MBR_SIG_OFF + 1]; // OR both bytes into short
+    if (mbr_sig != MBR_SIG){
+        volume_fail(vol, FG_ERROR_NOT_IMAGE, "Aborting... %s does not appear to be a valid partition or MBR disk image.", path);
+        return FG_RAW;
+    }
+
+    // File system signatures are 3 bytes at offset 0
+    fs_type_sig = (sector[0] << 16) | (sector[1] << 8) | sector[2]; // Combine three bytes into int
+    
+    switch (fs_type_sig){
+        case NTFS_SIG:
+            type = FG_NTFS;
+            break;
+        case FAT32_SIG:
+            type = FG_FAT32;
+            break;
+        case FAT16_SIG:
+            type = FG_FAT16;
+            break;
+        case FAT12_SIG:
+            type = FG_FAT12;
+            break;
+        default:
+            // A possible disk image with MBR (aka use -f raw)
+            type = FG_RAW;
+            break;
+    }
+
+    if (vol->options.require_type && vol->options.expected_type != type){
+        volume_fail(vol, FG_ERROR_TYPE_MISMATCH, "Detected File System: %s\n" \
+            "Aborting... Detected file system type does not match the expected type: %s",
+            fs_type_name(type), fs_type_name(vol->options.expected_type));
+    }
+    return type;
+}
+
+/**
+ * @brief Dumps FAT1 as runs of free, end of chain, bad, reserved and contiguous entries (see
+ * fat_dump.h), one line or record per run instead of one per entry.  The table is fed to the dump
+ * FAT_DUMP_CHUNK_ENTRIES entries at a time, from memory when FAT1 was loaded and straight from the
+ * image when it is paged (--max-mem).
+ * 
+ * @param vol 
+ * @param out 
+ * @param format 
+ * @return fg_status : FG_OK, FG_ERROR_WRITE if writing the dump failed, or the read error the
+ * dump stopped at
+ */
+static fg_status dump_fat_table(struct fat_volume *vol, FILE *out, enum fat_dump_format format){
+    struct fg_boot_sector *fat_sector = vol->fat_bs;
+    int bits = fat_sector->is_fat32 ? 32 : (fat_sector->is_fat16 ? 16 : 12);
+    uint64_t entry_count = (bits == 12) ? vol->fat_size_in_bytes * 2 / 3 : vol->fat_size_in_bytes / (bits / 8);
+    uint32_t *entries = malloc(FAT_DUMP_CHUNK_ENTRIES * sizeof(uint32_t));
+    uint16_t *unpacked = (bits == 12) ? malloc(FAT_DUMP_CHUNK_ENTRIES * sizeof(uint16_t)) : NULL;
+    uint8_t *scratch = NULL;
+    size_t scratch_size = 0;
+    fg_status status = FG_OK;
+
+    if (vol->fat1 == NULL)
+        scratch = buffer_pool_acquire(vol->buffers, FAT_DUMP_CHUNK_ENTRIES * sizeof(uint32_t), &scratch_size);
+    struct fat_dump *dump = NULL;
+    if (entries != NULL && (bits != 12 || unpacked != NULL) && (vol->fat1 != NULL || scratch != NULL))
+        dump = fat_dump_create(out, format, bits, entry_count);
+    if (dump == NULL){
+        buffer_pool_release(vol->buffers, scratch, scratch_size);
+        free(unpacked);
+        free(entries);
+        return memory_error(vol);
+    }
+
+    // Chunks hold an even # of entries, so FAT12 chunks start on a whole pair of entries
+    for (uint64_t first = 0; first < entry_count && status == FG_OK; first += FAT_DUMP_CHUNK_ENTRIES){
+        size_t count = (entry_count - first < FAT_DUMP_CHUNK_ENTRIES) ? entry_count - first : FAT_DUMP_CHUNK_ENTRIES;
+        if (bits == 12 && vol->fat12 != NULL){
+            for (size_t i = 0; i < count; i++)
+                entries[i] = vol->fat12[first + i];
+        }
+        else{
+            uint64_t offset = (bits == 12) ? first / 2 * 3 : first * (bits / 8);
+            size_t length = (bits == 12) ? (count * 3 + 1) / 2 : count * (bits / 8);
+            const uint8_t *table = vol->fat1 ? vol->fat1 + offset : disk_image_view(vol->disk, vol->fat_off + offset, length, scratch);
+            if (table == NULL){
+                status = read_error(vol);
+                break;
+            }
+            if (bits == 32){
+                for (size_t i = 0; i < count; i++){
+                    uint32_t value;
+                    memcpy(&value, table + i * 4, 4);
+                    entries[i] = value & 0x0FFFFFFF;
+                }
+            }
+            else if (bits == 16){
+                for (size_t i = 0; i < count; i++)
+                    entries[i] = table[i * 2] | (table[i * 2 + 1] << 8);
+            }
+            else{
+                fat12_unpack(table, count, unpacked);
+                for (size_t i = 0; i < count; i++)
+                    entries[i] = unpacked[i];
+            }
+        }
+        fat_dump_entries(dump, entries, count);
+    }
+
+    buffer_pool_release(vol->buffers, scratch, scratch_size);
+    free(unpacked);
+    free(entries);
+    if (fat_dump_finish(dump) != 0 && status == FG_OK)
+        status = FG_ERROR_WRITE;
+    return status;
+}
+
+/**
+ * @brief Copies FAT1 from the disk image into memory
+ * 
+ * @param vol volume to load the FAT of
+ * @return int : 0 if successful, -1 if the read failed
+ */
+static int copy_fat_into_memory(struct fat_volume *vol){
+    uint8_t *fat1 = calloc(1, vol->fat_size_in_bytes);
+    vol->fat1 = fat1;
+
+    if (fat1 == NULL){
+        memory_error(vol);
+        return -1;
+    }
+    if (disk_image_read(vol->disk, fat1, vol->fat_size_in_bytes, vol->fat_off) < 0){
+        read_error(vol);
+        return -1;
+    }
+
+    // Unpack FAT12 once so chain walks can index it like a FAT16
+    if (vol->fat_bs->is_fat12){
+        uint32_t entry_count = vol->fat_size_in_bytes * 2 / 3;
+        vol->fat12 = malloc((entry_count ? entry_count : 1) * sizeof(uint16_t));
+        if (vol->fat12 == NULL){
+            memory_error(vol);
+            return -1;
+        }
+        fat12_unpack(fat1, entry_count, vol->fat12);
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads one page of FAT1 from the disk image, the load function of the FAT page cache
+ * 
+ * @param context the volume
+ * @param page 
+ * @param data receives FAT_PAGE_BYTES bytes, zero padded past the end of the FAT
+ * @return int : 0 if successful, -1 if the read failed
+ */
+static int load_fat_page(void *context, uint64_t page, uint8_t *data){
+    struct fat_volume *vol = context;
+    uint64_t start = page * FAT_PAGE_BYTES;
+    size_t length = FAT_PAGE_BYTES;
+
+    if (start >= vol->fat_size_in_bytes){
+        memset(data, 0, FAT_PAGE_BYTES);
+        return 0;
+    }
+    if (start + length > vol->fat_size_in_bytes)
+        length = vol->fat_size_in_bytes - start;
+    if (disk_image_read(vol->disk, data, length, vol->fat_off + start) < 0)
+        return -1;
+    memset(data + length, 0, FAT_PAGE_BYTES - length);
+    return 0;
+}
+
+/**
+ * @brief Sets the volume up to page FAT1 in from the disk image on demand instead of holding all
+ * of it in memory (--max-mem).  FAT12 tables are at most a few KiB and are always loaded whole.
+ * 
+ * @param vol 
+ * @param budget bytes of FAT pages to keep cached
+ * @return int : 0 if successful, -1 if a FAT12 table could not be read or out of memory
+ */
+static int page_fat_from_disk(struct fat_volume *vol, size_t budget){
+    if (vol->fat_bs->is_fat12)
+        return copy_fat_into_memory(vol);
+    vol->fat_cache = page_cache_create(FAT_PAGE_BYTES, budget, load_fat_page, vol);
+    if (vol->fat_cache == NULL){
+        memory_error(vol);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Copies the runs a check listed into the form callbacks are handed
+ *
+ * @param ranges
+ * @param listed receives the listed runs, MAX_REPORTED_RANGES long
+ * @return struct fg_ranges : its range points at listed
+ */
+static struct fg_ranges export_ranges(const struct nonzero_ranges *ranges, struct fg_range *listed){
+    size_t stored = (ranges->stored < MAX_REPORTED_RANGES) ? ranges->stored : MAX_REPORTED_RANGES;
+
+    for (size_t i = 0; i < stored; i++)
+        listed[i] = (struct fg_range){ranges->range[i].start, ranges->range[i].length};
+    return (struct fg_ranges){listed, stored, ranges->found, ranges->nonzero_bytes};
+}
+
+/**
+ * @brief Adds the FAT entries covered by the bytes [start, end) of a FAT to a list of entry
+ * ranges, joining it with the previous range when they overlap or touch
+ * 
+ * @param vol 
+ * @param start offset of the first byte from the start of the FAT
+ * @param end offset one past the last byte
+ * @param ranges entry ranges, nonzero_bytes counts the entries covered
+ */
+static void add_fat_entry_range(struct fat_volume *vol, uint64_t start, uint64_t end, struct nonzero_ranges *ranges){
+    uint64_t first = 0;
+    uint64_t last = 0;
+
+    if (vol->fat_bs->is_fat12){
+        // Every 3 bytes hold 2 entries, the middle byte is shared by both
+        first = start / 3 * 2 + (start % 3 == 2);
+        last = (end - 1) / 3 * 2 + ((end - 1) % 3 != 0);
+    }
+    else{
+        uint32_t width = vol->fat_bs->is_fat32 ? 4 : 2;
+        first = start / width;
+        last = (end - 1) / width;
+    }
+
+    if (ranges->found && first <= ranges->last_end){
+        if (last + 1 > ranges->last_end){
+            if (ranges->stored == ranges->found)
+                ranges->range[ranges->stored - 1].length = last + 1 - ranges->range[ranges->stored - 1].start;
+            ranges->nonzero_bytes += last + 1 - ranges->last_end;
+            ranges->last_end = last + 1;
+        }
+        return;
+    }
+    if (ranges->stored < ranges->capacity){
+        ranges->range[ranges->stored].start = first;
+        ranges->range[ranges->stored].length = last + 1 - first;
+        ranges->stored++;
+    }
+    ranges->found++;
+    ranges->nonzero_bytes += last + 1 - first;
+    ranges->last_end = last + 1;
+}
+
+/**
+ * @brief Compares every copy of the FAT against FAT1 and reports the ranges of entries that differ.
+ * The copies are streamed through in FAT_COMPARE_CHUNK_BYTES chunks, so at most FAT1 is ever held
+ * in memory in full, and when FAT1 is paged it is streamed alongside them.
+ * 
+ * @param vol 
+ * @param fn called for every copy that differs from FAT1, may be NULL
+ * @param context passed to fn
+ * @return int : 0 if successful, -1 if a read failed or if out of memory
+ */
+static int compare_fat_copies(struct fat_volume *vol, fg_fat_mismatch_fn fn, void *context){
+    struct fg_boot_sector *fat_sector = vol->fat_bs;
+    uint8_t *scratch = NULL;
+    uint8_t *fat1_scratch = NULL;
+
+    // Ranges past the end of a truncated image are read into scratch even when the image is mapped
+    scratch = malloc(FAT_COMPARE_CHUNK_BYTES);
+    if (vol->fat1 == NULL)
+        fat1_scratch = malloc(FAT_COMPARE_CHUNK_BYTES);
+    if (scratch == NULL || (vol->fat1 == NULL && fat1_scratch == NULL)){
+        memory_error(vol);
+        free(scratch);
+        free(fat1_scratch);
+        return -1;
+    }
+
+    for (int copy = 1; copy < fat_sector->number_of_fats; copy++){
+        off_t copy_offset = vol->fat_off + (off_t)copy * vol->fat_size_in_bytes;
+        struct nonzero_range range[MAX_REPORTED_RANGES];
+        struct nonzero_ranges ranges = {range, MAX_REPORTED_RANGES};
+
+        for (uint32_t position = 0; position < vol->fat_size_in_bytes; position += FAT_COMPARE_CHUNK_BYTES){
+            size_t length = vol->fat_size_in_bytes - position;
+            if (length > FAT_COMPARE_CHUNK_BYTES)
+                length = FAT_COMPARE_CHUNK_BYTES;
+            const uint8_t *chunk = disk_image_view(vol->disk, copy_offset + position, length, scratch);
+            const uint8_t *fat1 = vol->fat1 ? vol->fat1 + position : disk_image_view(vol->disk, vol->fat_off + position, length, fat1_scratch);
+            if (chunk == NULL || fat1 == NULL){
+                read_error(vol);
+                free(scratch);
+                free(fat1_scratch);
+                return -1;
+            }
+
+            size_t i = 0;
+            while (i < length){
+                size_t run = 0;
+                i += scan_next_difference(fat1 + i, chunk + i, length - i, &run);
+                if (run == 0)
+                    break;
+                add_fat_entry_range(vol, position + i, position + i + run, &ranges);
+                i += run;
+            }
+        }
+
+        if (ranges.found && fn != NULL){
+            struct fg_range listed[MAX_REPORTED_RANGES];
+            struct fg_ranges entries = export_ranges(&ranges, listed);
+            struct fg_fat_mismatch mismatch = {copy + 1, &entries};
+            fn(&mismatch, context);
+        }
+    }
+    free(scratch);
+    free(fat1_scratch);
+    return 0;
+}
+
+/**
+ * @brief Returns the value stored within a given FAT table entry
+ * 
+ * @param vol 
+ * @param cluster entry to be read 
+ * @return uint32_t : 0 (a free entry, which ends any chain) if a paged FAT could not be read
+ */
+
+static uint32_t read_alloctable(struct fat_volume *vol, uint32_t cluster){
+    if (vol->fat_cache != NULL){
+        // Paged FAT (--max-mem), FAT12 is never paged.  A chain walk reads the same page over and
+        // over, page_cache_read serves those reads from the thread's last page without locking.
+        uint32_t width = vol->fat_bs->is_fat32 ? 4 : 2;
+        uint8_t value[4];
+        if (page_cache_read(vol->fat_cache, value, width, (uint64_t)cluster * width) < 0){
+            read_error(vol);
+            return 0;
+        }
+        return width == 4 ? get_le32(value, 4, 0) : get_le16(value, 2, 0);
+    }
+    if (vol->fat_bs->is_fat32){
+        uint32_t *fat32 = (uint32_t *) vol->fat1;
+        return fat32[cluster];
+    }
+    if (vol->fat_bs->is_fat16){
+        uint16_t *fat16 = (uint16_t *) vol->fat1;
+        return fat16[cluster];
+    }
+    if (vol->fat_bs->is_fat12)
+        return vol->fat12[cluster];
+    return 0;
+}
+
+/**
+ * @brief Checks if a FAT entry value marks the end of a cluster chain
+ * 
+ * @param vol 
+ * @param value value read from the FAT
+ * @return bool 
+ */
+static bool is_end_of_chain(struct fat_volume *vol, uint32_t value){
+    if (vol->fat_bs->is_fat32)
+        return (value & 0x0fffffff) >= FAT32_EOF;
+    if (vol->fat_bs->is_fat16)
+        return value >= FAT16_EOF;
+    return value >= FAT12_EOF;
+}
+
+/**
+ * @brief Returns the cluster that follows the given cluster in its chain
+ * 
+ * @param vol 
+ * @param cluster 
+ * @return uint32_t the next cluster, or 0 if the chain ends here (EOF marker, or a free, bad or out of range entry)
+ */
+static uint32_t next_cluster_in_chain(struct fat_volume *vol, uint32_t cluster){
+    uint32_t next = read_alloctable(vol, cluster);
+    if (vol->fat_bs->is_fat32)
+        next &= 0x0fffffff;
+    if (next < 2 || next >= vol->fat_entry_count || is_end_of_chain(vol, next))
+        return 0;
+    return next;
+}
+
+/**
+ * @brief Hash table slot for a chain's first cluster
+ */
+static uint32_t chain_slot(struct fat_extent_index *index, uint32_t head){
+    return (head * 0x9E3779B1u) & index->slot_mask;
+}
+
+/**
+ * @brief Adds a chain to the head cluster -> chain hash table, growing the table when it is half full
+ * 
+ * @param index 
+ * @param chain_number index of the chain in index->chains
+ * @return int : 0 if successful, -1 if out of memory, the table is then left as it was
+ */
+static int chain_hash_insert(struct fat_extent_index *index, uint32_t chain_number){
+    if ((index->chain_count + 1) * 2 > index->slot_mask + 1 || index->slots == NULL){
+        uint32_t old_size = index->slots ? index->slot_mask + 1 : 0;
+        uint32_t *old_slots = index->slots;
+        uint32_t new_size = old_size ? old_size * 2 : 1024;
+
+        uint32_t *new_slots = calloc(new_size, sizeof(uint32_t));
+        if (new_slots == NULL)
+            return -1;
+        index->slots = new_slots;
+        index->slot_mask = new_size - 1;
+        for (uint32_t i = 0; i < old_size; i++){
+            if (old_slots[i]){
+                uint32_t slot = chain_slot(index, index->chains[old_slots[i] - 1].head);
+                while (index->slots[slot])
+                    slot = (slot + 1) & index->slot_mask;
+                index->slots[slot] = old_slots[i];
+            }
+        }
+        free(old_slots);
+    }
+    uint32_t slot = chain_slot(index, index->chains[chain_number].head);
+    while (index->slots[slot])
+        slot = (slot + 1) & index->slot_mask;
+    index->slots[slot] = chain_number + 1; // 0 marks an empty slot
+    return 0;
+}
+
+/**
+ * @brief Walks the chain starting at head once and appends it to an extent list as runs of
+ * physically contiguous clusters
+ * 
+ * @param vol 
+ * @param head first cluster of the chain
+ * @param chain receives the extent and cluster counts, first_extent must already be set
+ * @param extents extent list to append to, grown as needed
+ * @param extent_count # of extents in the list
+ * @param extent_capacity # of extents the list has room for
+ * @return int : 0 if successful, -1 if out of memory
+ */
+static int walk_chain_extents(struct fat_volume *vol, uint32_t head, struct fat_chain *chain,
+    struct fat_extent **extents, uint32_t *extent_count, uint32_t *extent_capacity){
+    uint32_t cluster = head;
+    uint32_t next;
+
+    chain->head = head;
+    chain->extent_count = 0;
+    chain->cluster_count = 0;
+    do{
+        // Start a new extent unless this cluster directly follows the previous one on disk
+        struct fat_extent *last = chain->extent_count ? &(*extents)[*extent_count - 1] : NULL;
+        if (last != NULL && cluster == last->first_cluster + last->length){
+            last->length++;
+        }
+        else{
+            if (*extent_count == *extent_capacity){
+                uint32_t capacity = *extent_capacity ? *extent_capacity * 2 : 16;
+                struct fat_extent *grown = realloc(*extents, capacity * sizeof(struct fat_extent));
+                if (grown == NULL){
+                    memory_error(vol);
+                    return -1;
+                }
+                *extents = grown;
+                *extent_capacity = capacity;
+            }
+            struct fat_extent *extent = &(*extents)[(*extent_count)++];
+            extent->first_cluster = cluster;
+            extent->length = 1;
+            extent->chain_offset = chain->cluster_count;
+            chain->extent_count++;
+        }
+        chain->cluster_count++;
+        next = next_cluster_in_chain(vol, cluster);
+        cluster = next;
+    } while (next && chain->cluster_count < vol->fat_entry_count); // the count check stops FAT loops
+    return 0;
+}
+
+/**
+ * @brief Indexes the chain starting at head
+ * 
+ * @param vol 
+ * @param head first cluster of the chain
+ * @return int : 0 if successful, -1 if out of memory
+ */
+static int index_chain(struct fat_volume *vol, uint32_t head){
+    struct fat_extent_index *index = &vol->fat_index;
+    if (index->chain_count == index->chain_capacity){
+        uint32_t capacity = index->chain_capacity ? index->chain_capacity * 2 : 1024;
+        struct fat_chain *chains = realloc(index->chains, capacity * sizeof(struct fat_chain));
+        if (chains == NULL){
+            memory_error(vol);
+            return -1;
+        }
+        index->chains = chains;
+        index->chain_capacity = capacity;
+    }
+    uint32_t chain_number = index->chain_count;
+    struct fat_chain *chain = &index->chains[chain_number];
+    chain->first_extent = index->extent_count;
+    chain->extents = NULL;
+    chain->owned = false;
+    if (walk_chain_extents(vol, head, chain, &index->extents, &index->extent_count, &index->extent_capacity) < 0)
+        return -1;
+
+    if (chain_hash_insert(index, chain_number) < 0){
+        memory_error(vol);
+        return -1;
+    }
+    index->chain_count++;
+    return 0;
+}
+
+/**
+ * @brief Works out how many FAT entries describe clusters of the volume
+ * 
+ * @param vol 
+ */
+static void count_fat_entries(struct fat_volume *vol){
+    struct fg_boot_sector *fat_sector = vol->fat_bs;
+    uint32_t bps = vol->bps;
+    uint32_t root_dir_sectors = ((fat_sector->max_files_in_root * 32) + (bps - 1)) / bps;
+    uint32_t sector_count = fat_sector->sector_count_32b ? fat_sector->sector_count_32b : fat_sector->sector_count_16b;
+    uint32_t data_sectors = sector_count - (vol->reserved_and_fats / bps) - root_dir_sectors;
+    uint32_t entries_in_fat = 0;
+
+    if (fat_sector->is_fat32)
+        entries_in_fat = vol->fat_size_in_bytes / 4;
+    else if (fat_sector->is_fat16)
+        entries_in_fat = vol->fat_size_in_bytes / 2;
+    else
+        entries_in_fat = vol->fat_size_in_bytes * 2 / 3;
+
+    // The FAT is usually a little larger than the number of clusters it has to describe
+    vol->fat_entry_count = data_sectors / vol->spc + 2;
+    if (vol->fat_entry_count > entries_in_fat)
+        vol->fat_entry_count = entries_in_fat;
+}
+
+/**
+ * @brief Builds the extent index for every cluster chain in FAT1.  Chain heads are the allocated
+ * clusters no other FAT entry points to, so the whole FAT is read twice and each chain walked once.
+ * Must run after copy_fat_into_memory and count_fat_entries.
+ * 
+ * @param vol 
+ */
+static void build_fat_extent_index(struct fat_volume *vol){
+    struct fg_boot_sector *fat_sector = vol->fat_bs;
+
+    // Mark every cluster that is the target of another entry, what remains allocated is a chain head
+    uint8_t *pointed_to = calloc(vol->fat_entry_count / 8 + 1, 1);
+    if (pointed_to == NULL){
+        memory_error(vol);
+        return;
+    }
+    for (uint32_t cluster = 2; cluster < vol->fat_entry_count; cluster++){
+        uint32_t next = next_cluster_in_chain(vol, cluster);
+        if (next)
+            pointed_to[next / 8] |= 1 << (next % 8);
+    }
+    for (uint32_t cluster = 2; cluster < vol->fat_entry_count; cluster++){
+        if (pointed_to[cluster / 8] & (1 << (cluster % 8)))
+            continue;
+        uint32_t value = read_alloctable(vol, cluster);
+        if (fat_sector->is_fat32)
+            value &= 0x0fffffff;
+        // Free and bad clusters do not start chains
+        if (value == 0 || value == FAT32_BAD || (fat_sector->is_fat16 && value == FAT16_BAD) || (fat_sector->is_fat12 && value == FAT12_BAD))
+            continue;
+        if (index_chain(vol, cluster) < 0)
+            break;
+    }
+    free(pointed_to);
+}
+
+/**
+ * @brief Frees the extent index of a volume
+ * 
+ * @param vol 
+ */
+static void free_fat_extent_index(struct fat_volume *vol){
+    free(vol->fat_index.extents);
+    free(vol->fat_index.chains);
+    free(vol->fat_index.slots);
+    memset(&vol->fat_index, 0, sizeof(struct fat_extent_index));
+}
+
+/**
+ * @brief Looks up the chain that starts at first_cluster.  The index is never modified once
+ * built, so this is safe to call from several threads.  Chains that do not start at a chain head
+ * (e.g. an entry that points into the middle of another file) are walked on the spot into extents
+ * owned by the caller, which must hand them back with release_chain.  With a spare buffer those
+ * are walked into it instead, and stay valid until the buffer is used again.
+ * 
+ * @param vol 
+ * @param first_cluster 
+ * @param chain receives the chain and a pointer to its extents
+ * @param spare reusable room for extents that are not in the index, NULL to allocate them
+ * @return bool false if first_cluster is not a valid cluster, or if out of memory (the volume's
+ * status is then set)
+ */
+static bool get_chain(struct fat_volume *vol, uint32_t first_cluster, struct fat_chain *chain, struct extent_buffer *spare){
+    struct fat_extent_index *index = &vol->fat_index;
+
+    if (first_cluster < 2 || first_cluster >= vol->fat_entry_count)
+        return false;
+    if (index->slots != NULL){
+        uint32_t slot = chain_slot(index, first_cluster);
+        while (index->slots[slot]){
+            if (index->chains[index->slots[slot] - 1].head == first_cluster){
+                *chain = index->chains[index->slots[slot] - 1];
+                chain->extents = &index->extents[chain->first_extent];
+                return true;
+            }
+            slot = (slot + 1) & index->slot_mask;
+        }
+    }
+
+    uint32_t extent_count = 0;
+    uint32_t extent_capacity = 0;
+    chain->first_extent = 0;
+    if (spare != NULL){
+        int result = walk_chain_extents(vol, first_cluster, chain, &spare->extents, &extent_count, &spare->capacity);
+        chain->extents = spare->extents;
+        chain->owned = false;
+        return result == 0;
+    }
+    chain->extents = NULL;
+    chain->owned = false;
+    if (walk_chain_extents(vol, first_cluster, chain, &chain->extents, &extent_count, &extent_capacity) < 0){
+        free(chain->extents);
+        chain->extents = NULL;
+        return false;
+    }
+    chain->owned = true;
+    return true;
+}
+
+/**
+ * @brief Frees the extents of a chain returned by get_chain if they were allocated for it
+ * 
+ * @param chain 
+ */
+static void release_chain(struct fat_chain *chain){
+    if (chain->owned)
+        free(chain->extents);
+    chain->extents = NULL;
+    chain->owned = false;
+}
+
+/**
+ * @brief Returns the last cluster used by a file
+ * 
+ * @param vol 
+ * @param first_cluster The starting cluster
+ * @param spare see get_chain
+ * @return uint32_t the last cluster, or 0 if first_cluster is not a valid cluster (e.g. empty files)
+ */
+static uint32_t get_last_cluster(struct fat_volume *vol, uint32_t first_cluster, struct extent_buffer *spare){
+    struct fat_chain chain;
+    if (!get_chain(vol, first_cluster, &chain, spare))
+        return 0;
+    struct fat_extent *last = &chain.extents[chain.extent_count - 1];
+    uint32_t last_cluster = last->first_cluster + last->length - 1;
+    release_chain(&chain);
+    return last_cluster;
+}
+
+/**
+ * @brief Loads every cluster of a file or directory into one contiguous buffer.  Each extent of
+ * the chain is fetched with a single read, and a chain that is one extent in a memory mapped
+ * image is returned without copying at all.
+ * 
+ * @param vol 
+ * @param chain chain to load
+ * @param buffer room for chain->cluster_count clusters, used unless the chain can be viewed in place
+ * @return const uint8_t* pointer to the chain's data, NULL if a read failed
+ */
+static const uint8_t *load_cluster_chain(struct fat_volume *vol, struct fat_chain *chain, uint8_t *buffer){
+    struct fat_extent *extents = chain->extents;
+
+    if (chain->extent_count == 1){
+        const uint8_t *data = disk_image_view(vol->disk, cts(vol, extents[0].first_cluster), (size_t)extents[0].length * vol->cluster_size, buffer);
+        if (data == NULL)
+            read_error(vol);
+        return data;
+    }
+    for (uint32_t i = 0; i < chain->extent_count; i++){
+        if (disk_image_read(vol->disk, buffer + (size_t)extents[i].chain_offset * vol->cluster_size, (size_t)extents[i].length * vol->cluster_size, cts(vol, extents[i].first_cluster)) < 0){
+            read_error(vol);
+            return NULL;
+        }
+    }
+    return buffer;
+}
+
+/**
+ * @brief Function walks Long File Name (LFN) entires within a directory held in memory to find the
+ * Short File Name (SFN) entry which actually contains the information like time stamps, size, and first cluster.
+ * 
+ * @param dir contents of the directory
+ * @param dir_length size in bytes of the directory
+ * @param offset offset of the first entry to look at
+ * @return uint32_t The offset to the short file name record (relative to the offset passed in)
+ */
+static uint32_t walk_lfn_entries(const uint8_t *dir, uint32_t dir_length, uint32_t offset){
+    uint32_t current_lfn_offset = 0;
+    while (offset + current_lfn_offset + 32 < dir_length &&
+        dir[offset + current_lfn_offset + FILE_ATTRIBUTES] == FLAG_FAT_LONG_FILE_NAME){
+        current_lfn_offset += 32; //increment to the next directory entry
+    }
+    return current_lfn_offset;
+}
+
+/**
+ * @brief Assembles the long file name held by the LFN entries in front of a short file name entry
+ * into the worker's name buffer as UTF-8.  The LFN entries are ignored if their checksum does not
+ * match the short name, e.g. when they were left behind by a file that was renamed.
+ * 
+ * @param vol 
+ * @param scratch the calling worker's scratch space
+ * @param lfn the first LFN entry
+ * @param lfn_count # of LFN entries
+ * @param sfn the short file name entry
+ * @return uint32_t offset of the name in scratch->long_names, DIR_TREE_NO_NAME if there is none
+ */
+static uint32_t assemble_long_name(struct fat_volume *vol, struct walk_scratch *scratch, const uint8_t *lfn, uint32_t lfn_count, const uint8_t *sfn){
+    static const uint8_t char_offsets[13] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+    uint8_t checksum = 0;
+
+    if (lfn_count == 0)
+        return DIR_TREE_NO_NAME;
+    for (int i = 0; i < 11; i++)
+        checksum = ((checksum & 1) << 7) + (checksum >> 1) + sfn[FILE_NAME + i];
+
+    // Every UCS-2 character takes at most 3 bytes of UTF-8
+    uint32_t needed = scratch->long_names_used + lfn_count * 13 * 3 + 1;
+    if (needed > scratch->long_names_capacity){
+        char *long_names = realloc(scratch->long_names, needed * 2);
+        if (long_names == NULL){
+            memory_error(vol);
+            return DIR_TREE_NO_NAME;
+        }
+        scratch->long_names = long_names;
+        scratch->long_names_capacity = needed * 2;
+    }
+    uint32_t start = scratch->long_names_used;
+    char *name = scratch->long_names + start;
+    uint32_t length = 0;
+
+    // The entry closest to the short name holds the start of the name
+    for (uint32_t i = lfn_count; i-- > 0;){
+        const uint8_t *entry = lfn + i * 32;
+        if (entry[LFN_CHECKSUM] != checksum)
+            return DIR_TREE_NO_NAME;
+        for (int j = 0; j < 13; j++){
+            uint16_t c = get_le16(entry, 32, char_offsets[j]);
+            if (c == 0x0000 || c == 0xffff)
+                break;
+            if (c < 0x80){
+                name[length++] = c;
+            }
+            else if (c < 0x800){
+                name[length++] = 0xc0 | (c >> 6);
+                name[length++] = 0x80 | (c & 0x3f);
+            }
+            else{
+                name[length++] = 0xe0 | (c >> 12);
+                name[length++] = 0x80 | ((c >> 6) & 0x3f);
+                name[length++] = 0x80 | (c & 0x3f);
+            }
+        }
+    }
+    name[length] = '\0';
+    scratch->long_names_used += length + 1;
+    return start;
+}
+
+/**
+ * @brief Decodes a directory entry (and its long file name) from a directory held in memory
+ * 
+ * @param vol 
+ * @param dir contents of the directory
+ * @param dir_length size in bytes of the directory
+ * @param offset offset of the entry (or its first LFN entry) within the directory
+ * @param entry receives the decoded entry
+ * @param scratch the calling worker's scratch space, receives the long file name
+ * @return uint32_t Return the number of bytes to advance to reach the next file record entry
+ */
+static uint32_t read_fat_dir_entry(struct fat_volume *vol, const uint8_t *dir, uint32_t dir_length, uint32_t offset, struct dir_tree_entry *entry, struct walk_scratch *scratch){
+    // Traverse the LFN entries to get to the SFN entry
+    uint32_t LFN = walk_lfn_entries(dir, dir_length, offset);
+    const uint8_t *sfn = dir + offset + LFN;
+
+    memset(entry, 0, sizeof(struct dir_tree_entry));
+    memcpy(entry->short_name, sfn + FILE_NAME, 11);
+    entry->short_name[11] = '\0';
+    entry->node.file_attributes = sfn[FILE_ATTRIBUTES];
+    entry->node.cluster_addr = get_le16(sfn, 32, LOW_CLUSTER_ADDR) | ((uint32_t)get_le16(sfn, 32, HIGH_CLUSTER_ADDR) << 16);
+    entry->node.file_size = get_le32(sfn, 32, FILE_SIZE);
+    entry->info.created_time_tenths = sfn[CREATED_TIME_TENTHS];
+    entry->info.created_time_hms = get_le16(sfn, 32, CREATED_TIME_HMS);
+    entry->info.created_day = get_le16(sfn, 32, CREATED_DAY);
+    entry->info.accessed_day = get_le16(sfn, 32, ACCESSED_DAY);
+    entry->info.written_time_hms = get_le16(sfn, 32, WRITTEN_TIME_HMS);
+    entry->info.written_day = get_le16(sfn, 32, WRITTEN_DAY);
+    entry->long_name_offset = DIR_TREE_NO_NAME;
+
+    // Deleted and blank entries are skipped, so don't bother with their names
+    if (sfn[ALLOCATION_STATUS] != 0 && sfn[ALLOCATION_STATUS] != UNALLOCATED)
+        entry->long_name_offset = assemble_long_name(vol, scratch, dir + offset, LFN / 32, sfn);
+
+    return LFN + 32;
+}
+
+/**
+ * @brief Queues a file to have the slack of its last cluster checked for hidden data once the
+ * walk is complete
+ * 
+ * @param vol 
+ * @param scratch the calling worker's scratch space
+ * @param index the file's node
+ * @param node 
+ * @param base_index the baseline's node of the file if it is unchanged, DIR_TREE_NONE otherwise
+ */
+static void queue_slack_check(struct fat_volume *vol, struct walk_scratch *scratch, uint32_t index, struct dir_node *node, uint32_t base_index){
+    if (scratch->slack_item_count == scratch->slack_item_capacity){
+        uint32_t capacity = scratch->slack_item_capacity ? scratch->slack_item_capacity * 2 : 256;
+        struct slack_item *items = realloc(scratch->slack_items, capacity * sizeof(struct slack_item));
+        if (items == NULL){
+            memory_error(vol);
+            return;
+        }
+        scratch->slack_items = items;
+        scratch->slack_item_capacity = capacity;
+    }
+    struct slack_item *item = &scratch->slack_items[scratch->slack_item_count++];
+    item->last_cluster = node->last_cluster;
+    item->slack_start = node->file_size % vol->cluster_size;
+    item->node = index;
+    item->base_node = base_index;
+}
+
+/**
+ * @brief qsort comparator, orders slack items by their position on disk
+ */
+static int compare_slack_items(const void *a, const void *b){
+    const struct slack_item *x = a;
+    const struct slack_item *y = b;
+    return (x->last_cluster > y->last_cluster) - (x->last_cluster < y->last_cluster);
+}
+
+/**
+ * @brief Groups offset sorted slack items into batches of adjacent clusters so each batch can be
+ * checked with one read of at most max_clusters clusters
+ * 
+ * @param items slack items sorted by last_cluster
+ * @param item_count 
+ * @param max_clusters 
+ * @param batch_count receives the # of batches
+ * @return struct slack_batch* : NULL if out of memory
+ */
+static struct slack_batch *build_slack_batches(struct slack_item *items, uint32_t item_count, uint32_t max_clusters, uint32_t *batch_count){
+    struct slack_batch *batches = calloc(item_count ? item_count : 1, sizeof(struct slack_batch));
+    struct slack_batch *batch = NULL;
+
+    *batch_count = 0;
+    if (batches == NULL)
+        return NULL;
+    for (uint32_t i = 0; i < item_count; i++){
+        uint32_t cluster = items[i].last_cluster;
+        if (batch != NULL){
+            uint32_t batch_end = batch->first_cluster + batch->cluster_count;
+            // Files sharing a last cluster (cross linked chains) ride along in the same batch
+            if (cluster < batch_end){
+                batch->item_count++;
+                continue;
+            }
+            if (cluster == batch_end && batch->cluster_count < max_clusters){
+                batch->item_count++;
+                batch->cluster_count++;
+                continue;
+            }
+        }
+        batch = &batches[(*batch_count)++];
+        batch->items = &items[i];
+        batch->item_count = 1;
+        batch->first_cluster = cluster;
+        batch->cluster_count = 1;
+    }
+    return batches;
+}
+
+/**
+ * @brief Reads the clusters of a batch with one read and checks the slack of every file in it.
+ * Anything found is recorded in the file's node and reported once the check is complete.  When
+ * the tree goes into a volume index or is compared with a baseline, the CRC32 of every slack is
+ * kept in the file's node, and a file unchanged since the baseline takes over the baseline's
+ * result only if its slack still hashes the same.
+ * 
+ * @param walk 
+ * @param scratch the calling worker's scratch space
+ * @param batch 
+ */
+static void check_slack_batch(struct walk_context *walk, struct walk_scratch *scratch, struct slack_batch *batch){
+    struct fat_volume *vol = walk->vol;
+    struct dir_tree *tree = walk->tree;
+    bool keep_crc = vol->options.index_path != NULL || walk->baseline != NULL;
+
+    if (volume_status(vol) != FG_OK)
+        return;
+    const uint8_t *clusters = disk_image_view(vol->disk, cts(vol, batch->first_cluster), (size_t)batch->cluster_count * vol->cluster_size, scratch->slack_buffer);
+    if (clusters == NULL){
+        read_error(vol);
+        return;
+    }
+    perf_count_entries(batch->item_count);
+    perf_count_clusters(batch->cluster_count);
+
+    for (uint32_t i = 0; i < batch->item_count; i++){
+        struct slack_item *item = &batch->items[i];
+        const uint8_t *slack = clusters + (size_t)(item->last_cluster - batch->first_cluster) * vol->cluster_size + item->slack_start;
+        size_t slack_length = vol->cluster_size - item->slack_start;
+        struct nonzero_range range[MAX_REPORTED_RANGES];
+        struct nonzero_ranges ranges = {range, MAX_REPORTED_RANGES};
+
+        if (keep_crc){
+            uint32_t slack_crc = crc32(0, slack, slack_length);
+            dir_tree_info(tree, item->node)->content_crc = slack_crc;
+            if (item->base_node != DIR_TREE_NONE && dir_tree_info(walk->baseline->tree, item->base_node)->content_crc == slack_crc){
+                struct slack_finding *finding = dir_tree_finding(walk->baseline->tree, item->base_node);
+                if (finding != NULL && dir_tree_set_finding(tree, item->node, finding) < 0){
+                    memory_error(vol);
+                    return;
+                }
+                scratch->slack_reused++;
+                continue;
+            }
+        }
+        scratch->slack_checked++;
+        scan_nonzero_ranges(slack, slack_length, item->slack_start, &ranges);
+        if (ranges.found){
+            struct slack_finding *finding = arena_alloc(vol->arena, sizeof(struct slack_finding));
+            if (finding == NULL){
+                memory_error(vol);
+                return;
+            }
+            finding->ranges = ranges;
+            finding->ranges.range = finding->range;
+            memcpy(finding->range, range, sizeof(range));
+            if (dir_tree_set_finding(tree, item->node, finding) < 0){
+                memory_error(vol);
+                return;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Work pool task: check one slack batch
+ */
+static void slack_batch_task(struct work_pool *pool, int worker, void *task, void *context){
+    struct walk_context *walk = context;
+    perf_thread_attach(&walk->vol->perf, PERF_PHASE_SLACK_CHECK);
+    check_slack_batch(walk, &walk->scratch[worker], task);
+}
+
+/**
+ * @brief Gathers the slack items queued by every worker into one list sorted by the position of
+ * their last cluster.  The sorted list doubles as the cluster -> owning entry map of the
+ * sequential pass.
+ * 
+ * @param walk 
+ * @param threads # of workers
+ * @param item_count receives the # of items
+ * @return struct slack_item* : NULL if out of memory
+ */
+static struct slack_item *gather_slack_items(struct walk_context *walk, int threads, uint32_t *item_count){
+    *item_count = 0;
+    for (int i = 0; i < threads; i++)
+        *item_count += walk->scratch[i].slack_item_count;
+    struct slack_item *items = malloc((*item_count ? *item_count : 1) * sizeof(struct slack_item));
+    *item_count = 0;
+    if (items == NULL){
+        memory_error(walk->vol);
+        return NULL;
+    }
+    for (int i = 0; i < threads; i++){
+        if (walk->scratch[i].slack_item_count)
+            memcpy(&items[*item_count], walk->scratch[i].slack_items, walk->scratch[i].slack_item_count * sizeof(struct slack_item));
+        *item_count += walk->scratch[i].slack_item_count;
+        walk->scratch[i].slack_item_count = 0;
+    }
+    qsort(items, *item_count, sizeof(struct slack_item), compare_slack_items);
+    return items;
+}
+
+/**
+ * @brief Gets a worker a slack buffer of at least length bytes from the volume's buffer pool
+ * 
+ * @param vol 
+ * @param scratch the worker's scratch space
+ * @param length 
+ * @return int : 0 if successful, -1 if out of memory
+ */
+static int reserve_slack_buffer(struct fat_volume *vol, struct walk_scratch *scratch, size_t length){
+    scratch->slack_buffer = buffer_pool_acquire(vol->buffers, length, &scratch->slack_buffer_size);
+    if (scratch->slack_buffer == NULL){
+        scratch->slack_buffer_size = 0;
+        memory_error(vol);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks the slack of every file queued during the walk.  The files are sorted by the
+ * position of their last cluster and merged into batches of adjacent clusters, which turns the
+ * directory ordered random reads of the walk into mostly sequential ones, and the batches are
+ * checked by a pool of threads.
+ * 
+ * @param walk 
+ * @param threads # of workers
+ */
+static void check_queued_slack(struct walk_context *walk, int threads){
+    struct fat_volume *vol = walk->vol;
+    uint32_t item_count = 0;
+    uint32_t batch_count = 0;
+    uint32_t max_clusters = SLACK_BATCH_MAX_BYTES / vol->cluster_size;
+
+    if (max_clusters == 0)
+        max_clusters = 1;
+
+    struct slack_item *items = gather_slack_items(walk, threads, &item_count);
+    if (items == NULL)
+        return;
+    struct slack_batch *batches = build_slack_batches(items, item_count, max_clusters, &batch_count);
+    if (batches == NULL){
+        memory_error(vol);
+        free(items);
+        return;
+    }
+
+    for (int i = 0; i < threads; i++){
+        if (reserve_slack_buffer(vol, &walk->scratch[i], (size_t)max_clusters * vol->cluster_size) < 0)
+            break;
+    }
+    struct work_pool *pool = work_pool_create(threads, slack_batch_task, walk);
+    if (pool == NULL)
+        memory_error(vol);
+    // Push in reverse so worker 0 pops the batches in disk order, thieves take from the far end
+    for (uint32_t i = batch_count; pool != NULL && i > 0; i--){
+        if (work_pool_push(pool, 0, &batches[i - 1]) < 0){
+            memory_error(vol);
+            break;
+        }
+    }
+    // Batches are skipped once the volume failed, so a partly queued pool finishes right away
+    if (pool != NULL)
+        work_pool_run(pool);
+    work_pool_destroy(pool);
+
+    free(batches);
+    free(items);
+}
+
+/**
+ * @brief Checks the slack of every file queued during the walk with one front to back pass over
+ * the clustered area, for storage that is only fast when read sequentially.  The area is read in
+ * SEQUENTIAL_READ_BYTES chunks with the next chunk always being read ahead, and the slack of every
+ * last cluster is checked as the pass goes by it, so the run time is the size of the clustered area
+ * over the sequential bandwidth of the device no matter how the files are laid out.
+ * 
+ * @param walk 
+ * @param threads # of workers the items were queued by
+ */
+static void check_slack_sequentially(struct walk_context *walk, int threads){
+    struct fat_volume *vol = walk->vol;
+    struct walk_scratch *scratch = &walk->scratch[0];
+    uint32_t item_count = 0;
+    uint32_t next_item = 0;
+    uint32_t chunk_clusters = SEQUENTIAL_READ_BYTES / vol->cluster_size;
+
+    if (chunk_clusters == 0)
+        chunk_clusters = 1;
+
+    struct slack_item *items = gather_slack_items(walk, threads, &item_count);
+    if (items == NULL)
+        return;
+    if (reserve_slack_buffer(vol, scratch, (size_t)chunk_clusters * vol->cluster_size) < 0){
+        free(items);
+        return;
+    }
+    disk_image_advise_sequential(vol->disk);
+
+    for (uint32_t cluster = 2; cluster < vol->fat_entry_count; cluster += chunk_clusters){
+        struct slack_batch chunk = {&items[next_item], 0, cluster, chunk_clusters};
+        if (cluster + chunk_clusters > vol->fat_entry_count)
+            chunk.cluster_count = vol->fat_entry_count - cluster;
+
+        // Keep the device busy with the next chunk while this one is checked
+        if (cluster + chunk.cluster_count < vol->fat_entry_count)
+            disk_image_prefetch(vol->disk, cts(vol, cluster + chunk.cluster_count), (size_t)chunk_clusters * vol->cluster_size);
+
+        while (next_item < item_count && items[next_item].last_cluster < cluster + chunk.cluster_count){
+            chunk.item_count++;
+            next_item++;
+        }
+        check_slack_batch(walk, scratch, &chunk);
+    }
+    free(items);
+}
+
+/**
+ * @brief Looks up the baseline's copy of a directory.  A copy only counts if the directory's
+ * clusters hash the same, in which case it holds the same entries in the same order.
+ * 
+ * @param baseline 
+ * @param cluster first cluster of the directory
+ * @param content_crc CRC32 of the directory's clusters
+ * @param child_count # of entries found in the directory
+ * @return uint32_t the baseline's node of the directory, DIR_TREE_NONE if it changed or is new
+ */
+static uint32_t match_baseline_directory(struct rescan_baseline *baseline, uint32_t cluster, uint32_t content_crc, uint32_t child_count){
+    uint32_t slot = (cluster * 2654435761u) & baseline->dir_slot_mask;
+
+    for (; baseline->dir_slots[slot]; slot = (slot + 1) & baseline->dir_slot_mask){
+        uint32_t node = baseline->dir_slots[slot] - 1;
+        if (dir_tree_node(baseline->tree, node)->cluster_addr != cluster)
+            continue;
+        if (dir_tree_info(baseline->tree, node)->content_crc == content_crc && dir_tree_node(baseline->tree, node)->child_count == child_count)
+            return node;
+    }
+    return DIR_TREE_NONE;
+}
+
+/**
+ * @brief Checks whether every FAT entry of a chain lies in a FAT region that did not change since
+ * the baseline, i.e. the chain is the same as it was
+ * 
+ * @param vol 
+ * @param baseline 
+ * @param scratch the calling worker's scratch space
+ * @param first_cluster 
+ * @return bool 
+ */
+static bool chain_unchanged(struct fat_volume *vol, struct rescan_baseline *baseline, struct walk_scratch *scratch, uint32_t first_cluster){
+    struct fat_chain chain;
+
+    if (!get_chain(vol, first_cluster, &chain, &scratch->extents))
+        return true;
+    for (uint32_t i = 0; i < chain.extent_count; i++){
+        uint64_t first = chain.extents[i].first_cluster;
+        uint64_t last = first + chain.extents[i].length - 1;
+        uint64_t first_byte;
+        uint64_t last_byte;
+        if (vol->fat_bs->is_fat32){
+            first_byte = first * 4;
+            last_byte = last * 4 + 3;
+        }
+        else if (vol->fat_bs->is_fat16){
+            first_byte = first * 2;
+            last_byte = last * 2 + 1;
+        }
+        else{
+            first_byte = first * 3 / 2;
+            last_byte = last * 3 / 2 + 1;
+        }
+        for (uint64_t region = first_byte / FAT_HASH_REGION_BYTES; region <= last_byte / FAT_HASH_REGION_BYTES && region < vol->fat_region_count; region++){
+            if (baseline->changed_regions[region]){
+                release_chain(&chain);
+                return false;
+            }
+        }
+    }
+    release_chain(&chain);
+    return true;
+}
+
+/**
+ * @brief Checks if a file's metadata is unchanged since the baseline: the same directory entry,
+ * and a cluster chain whose FAT entries did not change.  The baseline's result is only taken over
+ * once the slack is read and hashes the same as the baseline's, see check_slack_batch.
+ * 
+ * @param walk 
+ * @param scratch the calling worker's scratch space
+ * @param index the file's node
+ * @param base_index the baseline's node of the file
+ * @return bool : true if the file is unchanged, false if it has to be checked in full
+ */
+static bool file_unchanged(struct walk_context *walk, struct walk_scratch *scratch, uint32_t index, uint32_t base_index){
+    struct rescan_baseline *baseline = walk->baseline;
+    struct dir_node *node = dir_tree_node(walk->tree, index);
+    struct dir_node *base = dir_tree_node(baseline->tree, base_index);
+
+    return node->cluster_addr == base->cluster_addr && node->file_size == base->file_size && node->last_cluster == base->last_cluster
+        && chain_unchanged(walk->vol, baseline, scratch, node->cluster_addr);
+}
+
+/**
+ * @brief Grows a worker's directory buffer to hold at least length bytes
+ * 
+ * @param vol 
+ * @param scratch the calling worker's scratch space
+ * @param length 
+ * @return int : 0 if successful, -1 if out of memory
+ */
+static int reserve_dir_buffer(struct fat_volume *vol, struct walk_scratch *scratch, size_t length){
+    if (length <= scratch->dir_buffer_size)
+        return 0;
+    buffer_pool_release(vol->buffers, scratch->dir_buffer, scratch->dir_buffer_size);
+    scratch->dir_buffer = buffer_pool_acquire(vol->buffers, length, &scratch->dir_buffer_size);
+    if (scratch->dir_buffer == NULL){
+        scratch->dir_buffer_size = 0;
+        memory_error(vol);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads one directory into memory: its entries become the children of entry (in on-disk
+ * order), sub directories are pushed onto the worker's deque to be read by whichever worker gets
+ * to them first, and files are checked for hidden data when -h is set.  On a re-scan, files of a
+ * directory that is unchanged since the baseline keep the baseline's result if their chain and
+ * the CRC of their slack are unchanged too.
+ * 
+ * @param walk 
+ * @param index the node of the directory to read
+ * @param pool 
+ * @param worker 
+ */
+static void read_fat_directory(struct walk_context *walk, uint32_t index, struct work_pool *pool, int worker){
+    struct fat_volume *vol = walk->vol;
+    struct dir_tree *tree = walk->tree;
+    struct walk_scratch *scratch = &walk->scratch[worker];
+    uint32_t base_dir = DIR_TREE_NONE;
+    struct fat_chain chain;
+    struct dir_node *entry = dir_tree_node(tree, index);
+    const uint8_t *dir = NULL;
+    uint32_t dir_length = 0;
+    uint32_t count = 0;
+
+    // Once a read failed the volume is not worth finishing, the queued directories are dropped
+    if (volume_status(vol) != FG_OK)
+        return;
+
+    if (entry->parent == DIR_TREE_NONE && vol->root_dir_size){
+        //-------------------------------------------------------------------------
+        // The FAT12/16 root directory is a fixed region rather than a cluster chain
+        //-------------------------------------------------------------------------
+        dir_length = vol->root_dir_size;
+        if (reserve_dir_buffer(vol, scratch, dir_length) < 0)
+            return;
+        dir = disk_image_view(vol->disk, vol->root_dir_off, dir_length, scratch->dir_buffer);
+        if (dir == NULL){
+            read_error(vol);
+            return;
+        }
+    }
+    else{
+        //-------------------------------------------------------------------------
+        // First look up the extents of the directory we will be reading
+        //-------------------------------------------------------------------------
+        if (!get_chain(vol, entry->cluster_addr, &chain, &scratch->extents))
+            return;
+        
+        // Store the last cluster for future reference to save us time 
+        struct fat_extent *last = &chain.extents[chain.extent_count - 1];
+        entry->last_cluster = last->first_cluster + last->length - 1;
+
+        // Pull the whole directory into memory, entries are decoded from this buffer
+        dir_length = chain.cluster_count * vol->cluster_size;
+        if (reserve_dir_buffer(vol, scratch, dir_length) < 0){
+            release_chain(&chain);
+            return;
+        }
+        dir = load_cluster_chain(vol, &chain, scratch->dir_buffer);
+        perf_count_clusters(chain.cluster_count);
+        release_chain(&chain);
+        if (dir == NULL)
+            return;
+    }
+
+    //-------------------------------------------------------------------------
+    // Begin reading the contents of the directory (entries) into memory, 
+    // queue sub directories for the workers
+    //-------------------------------------------------------------------------
+    scratch->long_names_used = 0;
+    for (uint32_t i = 0; i < dir_length;){
+        if (count == scratch->entry_capacity){
+            uint32_t capacity = scratch->entry_capacity ? scratch->entry_capacity * 2 : 64;
+            struct dir_tree_entry *entries = realloc(scratch->entries, capacity * sizeof(struct dir_tree_entry));
+            if (entries == NULL){
+                memory_error(vol);
+                return;
+            }
+            scratch->entries = entries;
+            scratch->entry_capacity = capacity;
+        }
+        // Read the file/directory entry
+        struct dir_tree_entry *sub_entry = &scratch->entries[count];
+        int x = read_fat_dir_entry(vol, dir, dir_length, i, sub_entry, scratch);
+        i += x;
+        // If the entry was blank, marked unallocated, or was the . entry (self pointer), skip to next entry
+        if (sub_entry->short_name[0] == 0 || sub_entry->short_name[0] == UNALLOCATED || !strncmp(sub_entry->short_name, ".          ", 12) || !strncmp(sub_entry->short_name, "..         ", 12))
+            continue;
+        sub_entry->node.last_cluster = get_last_cluster(vol, sub_entry->node.cluster_addr, &scratch->extents);
+        count++;
+    }
+
+    // Add the entries to the tree in one go, keeping the on-disk order
+    uint32_t first = dir_tree_add_children(tree, index, scratch->entries, count, scratch->long_names);
+    if (first == DIR_TREE_NONE){
+        memory_error(vol);
+        return;
+    }
+    perf_count_entries(count);
+    uint32_t content_crc = crc32(0, dir, dir_length);
+    dir_tree_info(tree, index)->content_crc = content_crc;
+    if (walk->baseline != NULL)
+        base_dir = match_baseline_directory(walk->baseline, dir_tree_node(tree, index)->cluster_addr, content_crc, count);
+
+    for (uint32_t i = 0; i < count; i++){
+        struct dir_node *sub_entry = &scratch->entries[i].node;
+        // If the entry we just read is a directory, queue it up to be read (tasks are node index + 1, NULL means no task)
+        if (sub_entry->file_attributes & 0x10){
+            if (work_pool_push(pool, worker, (void *)(uintptr_t)(first + i + 1)) < 0){
+                memory_error(vol);
+                return;
+            }
+        }
+        // If the user specified the -h flag, queue the slack space of the last cluster to be checked for hidden data
+        else if (vol->options.check_slack && sub_entry->last_cluster){
+            uint32_t base_file = DIR_TREE_NONE;
+            if (base_dir != DIR_TREE_NONE && file_unchanged(walk, scratch, first + i, dir_tree_node(walk->baseline->tree, base_dir)->first_child + i))
+                base_file = dir_tree_node(walk->baseline->tree, base_dir)->first_child + i;
+            queue_slack_check(vol, scratch, first + i, sub_entry, base_file);
+        }
+    }
+}
+
+/**
+ * @brief Work pool task: read one directory
+ */
+static void walk_directory_task(struct work_pool *pool, int worker, void *task, void *context){
+    struct walk_context *walk = context;
+    perf_thread_attach(&walk->vol->perf, PERF_PHASE_TREE_WALK);
+    read_fat_directory(walk, (uintptr_t)task - 1, pool, worker);
+}
+
+/**
+ * @brief Reads a FAT file system directory/file structure into memory.  Directories are read
+ * by a work-stealing pool of threads (-j), each with its own scratch buffers, while the volume
+ * itself is shared read-only.  Every directory only ever links its own children, so the tree
+ * comes out the same no matter which thread read which directory.  With check_slack (-h), the
+ * slack of the files found is checked in a second stage once the walk is complete (see
+ * check_queued_slack, or check_slack_sequentially with -s).  The counts of files checked and
+ * taken over from the baseline are kept in the volume.
+ * 
+ * @param vol 
+ * @param entry_start_cluster first cluster of the root directory, 0 for the fixed FAT12/16 root directory
+ * @param threads # of workers
+ * @param baseline earlier acquisition to take unchanged files' results from, NULL to check every file
+ * @return struct dir_tree* the directory tree, the root directory is node 0.  NULL if out of memory.
+ */
+static struct dir_tree *read_fat_filesystem(struct fat_volume *vol, uint32_t entry_start_cluster, int threads, struct rescan_baseline *baseline){
+    struct dir_tree *tree = dir_tree_create(entry_start_cluster);
+    struct walk_context walk = {vol, tree, calloc(threads, sizeof(struct walk_scratch)), baseline};
+
+    if (tree == NULL || walk.scratch == NULL){
+        dir_tree_destroy(tree);
+        free(walk.scratch);
+        memory_error(vol);
+        return NULL;
+    }
+
+    perf_phase_begin(&vol->perf, PERF_PHASE_TREE_WALK);
+    struct work_pool *pool = work_pool_create(threads, walk_directory_task, &walk);
+    if (pool == NULL || work_pool_push(pool, 0, (void *)(uintptr_t)1) < 0)
+        memory_error(vol);
+    else
+        work_pool_run(pool);
+    work_pool_destroy(pool);
+    perf_phase_end(&vol->perf, PERF_PHASE_TREE_WALK);
+
+    if (vol->options.check_slack && volume_status(vol) == FG_OK){
+        perf_phase_begin(&vol->perf, PERF_PHASE_SLACK_CHECK);
+        if (vol->options.sequential_slack)
+            check_slack_sequentially(&walk, threads);
+        else
+            check_queued_slack(&walk, threads);
+        perf_phase_end(&vol->perf, PERF_PHASE_SLACK_CHECK);
+    }
+
+    for (int i = 0; i < threads; i++){
+        vol->slack_checked += walk.scratch[i].slack_checked;
+        vol->slack_reused += walk.scratch[i].slack_reused;
+        buffer_pool_release(vol->buffers, walk.scratch[i].dir_buffer, walk.scratch[i].dir_buffer_size);
+        buffer_pool_release(vol->buffers, walk.scratch[i].slack_buffer, walk.scratch[i].slack_buffer_size);
+        free(walk.scratch[i].extents.extents);
+        free(walk.scratch[i].slack_items);
+        free(walk.scratch[i].entries);
+        free(walk.scratch[i].long_names);
+    }
+    free(walk.scratch);
+    return tree;
+}
+
+/**
+ * @brief Fills in the key a volume index is only valid for: the size and modification time of
+ * the image, and CRC32s of the boot sector and FAT1.  FAT1 is hashed in FAT_HASH_REGION_BYTES
+ * regions, kept in vol->fat_region_crcs so an incremental re-scan can tell which parts of the FAT
+ * changed, and the FAT's CRC is the CRC of the region CRCs.
+ * 
+ * @param vol the volume, with FAT1 loaded or paged
+ * @param key receives the key, the rest of the header is zeroed
+ * @return int : 0 if successful, -1 if a read failed
+ */
+static int volume_index_key(struct fat_volume *vol, struct volume_index_header *key){
+    _Alignas(64) uint8_t sector[SECTOR_BUFFER_SIZE];
+    struct timespec mtime;
+    uint8_t *scratch = NULL;
+    size_t scratch_size = 0;
+
+    memset(key, 0, sizeof(struct volume_index_header));
+    memcpy(key->magic, VOLUME_INDEX_MAGIC, sizeof(key->magic));
+    key->extent_size = sizeof(struct fat_extent);
+    key->chain_size = sizeof(struct saved_chain);
+    key->image_size = vol->disk->size;
+    if (disk_image_mtime(vol->disk, &mtime) < 0 || read_sector(vol, vol->partition_off, sector) < 0){
+        read_error(vol);
+        return -1;
+    }
+    key->mtime_sec = mtime.tv_sec;
+    key->mtime_nsec = mtime.tv_nsec;
+
+    key->boot_sector_crc = crc32(0, sector, sizeof(sector));
+
+    vol->fat_region_count = (vol->fat_size_in_bytes + FAT_HASH_REGION_BYTES - 1) / FAT_HASH_REGION_BYTES;
+    vol->fat_region_crcs = arena_alloc(vol->arena, (vol->fat_region_count ? vol->fat_region_count : 1) * sizeof(uint32_t));
+    if (vol->fat_region_crcs == NULL){
+        memory_error(vol);
+        return -1;
+    }
+    if (vol->fat1 == NULL && (scratch = buffer_pool_acquire(vol->buffers, FAT_COMPARE_CHUNK_BYTES, &scratch_size)) == NULL){
+        memory_error(vol);
+        return -1;
+    }
+    for (uint64_t position = 0; position < vol->fat_size_in_bytes; position += FAT_COMPARE_CHUNK_BYTES){
+        size_t length = (vol->fat_size_in_bytes - position < FAT_COMPARE_CHUNK_BYTES) ? vol->fat_size_in_bytes - position : FAT_COMPARE_CHUNK_BYTES;
+        const uint8_t *fat1 = vol->fat1 ? vol->fat1 + position : disk_image_view(vol->disk, vol->fat_off + position, length, scratch);
+        if (fat1 == NULL){
+            buffer_pool_release(vol->buffers, scratch, scratch_size);
+            read_error(vol);
+            return -1;
+        }
+        // FAT_COMPARE_CHUNK_BYTES is a multiple of FAT_HASH_REGION_BYTES
+        for (size_t i = 0; i < length; i += FAT_HASH_REGION_BYTES){
+            size_t region_length = (length - i < FAT_HASH_REGION_BYTES) ? length - i : FAT_HASH_REGION_BYTES;
+            vol->fat_region_crcs[(position + i) / FAT_HASH_REGION_BYTES] = crc32(0, fat1 + i, region_length);
+        }
+    }
+    key->fat_crc = crc32(0, (const uint8_t *)vol->fat_region_crcs, vol->fat_region_count * sizeof(uint32_t));
+    key->fat_region_count = vol->fat_region_count;
+    buffer_pool_release(vol->buffers, scratch, scratch_size);
+    return 0;
+}
+
+/**
+ * @brief Checks that a section of count items of size bytes lies inside the index file
+ */
+static bool volume_index_section_fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t file_size){
+    return offset <= file_size && count <= (file_size - offset) / size;
+}
+
+/**
+ * @brief Unmaps a volume index
+ * 
+ * @param index 
+ */
+static void close_volume_index(struct volume_index_map *index){
+    if (index->map != NULL)
+        munmap(index->map, index->size);
+    index->map = NULL;
+}
+
+/**
+ * @brief Maps a volume index and checks that its sections are consistent with each other and with
+ * the volume.  Whether it was made from this image is up to the caller.
+ * 
+ * @param vol 
+ * @param path 
+ * @param index receives the mapping and pointers to its sections
+ * @return bool : false if the file does not exist, is from a different build, or is damaged
+ */
+static bool open_volume_index(struct fat_volume *vol, const char *path, struct volume_index_map *index){
+    struct volume_index_header *header = &index->header;
+    struct stat st;
+
+    memset(index, 0, sizeof(struct volume_index_map));
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return false;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct volume_index_header)){
+        close(fd);
+        return false;
+    }
+    // Private and writable, the findings of a loaded tree are set in place
+    index->map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (index->map == MAP_FAILED){
+        index->map = NULL;
+        return false;
+    }
+    index->size = st.st_size;
+
+    memcpy(header, index->map, sizeof(struct volume_index_header));
+    uint64_t size = index->size;
+    if (memcmp(header->magic, VOLUME_INDEX_MAGIC, sizeof(header->magic)) || header->extent_size != sizeof(struct fat_extent)
+        || header->chain_size != sizeof(struct saved_chain) || header->fat_entry_count != vol->fat_entry_count
+        || (header->slot_count & (header->slot_count - 1)) || (header->has_tree && header->tree_off >= size)
+        || !volume_index_section_fits(header->extents_off, header->extent_count, sizeof(struct fat_extent), size)
+        || !volume_index_section_fits(header->chains_off, header->chain_count, sizeof(struct saved_chain), size)
+        || !volume_index_section_fits(header->slots_off, header->slot_count, sizeof(uint32_t), size)
+        || !volume_index_section_fits(header->findings_off, header->finding_count, sizeof(struct saved_finding), size)
+        || !volume_index_section_fits(header->fat_regions_off, header->fat_region_count, sizeof(uint32_t), size)){
+        close_volume_index(index);
+        return false;
+    }
+    index->extents = (struct fat_extent *)(index->map + header->extents_off);
+    index->chains = (struct saved_chain *)(index->map + header->chains_off);
+    index->slots = (uint32_t *)(index->map + header->slots_off);
+    index->findings = (struct saved_finding *)(index->map + header->findings_off);
+    index->fat_region_crcs = (uint32_t *)(index->map + header->fat_regions_off);
+
+    // Everything the chain lookups index with has to stay inside the FAT and the index
+    bool valid = true;
+    for (uint32_t i = 0; valid && i < header->extent_count; i++)
+        valid = index->extents[i].length && (uint64_t)index->extents[i].first_cluster + index->extents[i].length <= vol->fat_entry_count;
+    for (uint32_t i = 0; valid && i < header->chain_count; i++)
+        valid = index->chains[i].extent_count && (uint64_t)index->chains[i].first_extent + index->chains[i].extent_count <= header->extent_count;
+    for (uint32_t i = 0; valid && i < header->slot_count; i++)
+        valid = index->slots[i] <= header->chain_count;
+    for (uint32_t i = 0; valid && i < header->finding_count; i++)
+        valid = index->findings[i].stored <= MAX_REPORTED_RANGES && index->findings[i].stored <= index->findings[i].found;
+    if (!valid)
+        close_volume_index(index);
+    return valid;
+}
+
+/**
+ * @brief Opens the directory tree of a volume index in place and attaches its slack findings.
+ * The index must stay mapped for as long as the tree is used.
+ * 
+ * @param vol 
+ * @param index 
+ * @return struct dir_tree* : NULL if the index has no tree, the tree is damaged or out of memory
+ */
+static struct dir_tree *load_saved_tree(struct fat_volume *vol, struct volume_index_map *index){
+    struct volume_index_header *header = &index->header;
+    bool out_of_memory;
+
+    if (!header->has_tree)
+        return NULL;
+    struct dir_tree *tree = dir_tree_load(index->map + header->tree_off, index->size - header->tree_off, &out_of_memory);
+    if (tree == NULL){
+        if (out_of_memory)
+            memory_error(vol);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < header->finding_count; i++){
+        if (index->findings[i].node >= dir_tree_node_count(tree)){
+            dir_tree_destroy(tree);
+            return NULL;
+        }
+    }
+    for (uint32_t i = 0; i < header->finding_count; i++){
+        struct saved_finding *saved = &index->findings[i];
+        struct slack_finding *finding = arena_alloc(vol->arena, sizeof(struct slack_finding));
+        if (finding == NULL){
+            dir_tree_destroy(tree);
+            memory_error(vol);
+            return NULL;
+        }
+        finding->ranges.range = finding->range;
+        finding->ranges.capacity = MAX_REPORTED_RANGES;
+        finding->ranges.stored = saved->stored;
+        finding->ranges.found = saved->found;
+        finding->ranges.nonzero_bytes = saved->nonzero_bytes;
+        memcpy(finding->range, saved->range, sizeof(finding->range));
+        if (dir_tree_set_finding(tree, saved->node, finding) < 0){
+            dir_tree_destroy(tree);
+            memory_error(vol);
+            return NULL;
+        }
+    }
+    return tree;
+}
+
+/**
+ * @brief Loads the extent index, and with check_slack the directory tree and slack findings, from the
+ * volume index if it was written for the image as it is now.  The tree is used in place from a
+ * mapping of the index, which is kept in vol->index_map until the volume is done.
+ * 
+ * @param vol 
+ * @param path path of the volume index
+ * @param key key of the image as it is now, see volume_index_key
+ * @param tree receives the directory tree, NULL if the index has none or check_slack is not set
+ * @return bool : true if the extent index was loaded
+ */
+static bool load_volume_index(struct fat_volume *vol, const char *path, const struct volume_index_header *key, struct dir_tree **tree){
+    struct volume_index_map index;
+    struct fat_extent_index *extent_index = &vol->fat_index;
+
+    *tree = NULL;
+    if (!open_volume_index(vol, path, &index))
+        return false;
+    // The index must have been made from this image as it is now
+    if (memcmp(&index.header, key, offsetof(struct volume_index_header, fat_entry_count))){
+        close_volume_index(&index);
+        return false;
+    }
+    if (vol->options.check_slack && index.header.has_tree){
+        *tree = load_saved_tree(vol, &index);
+        if (*tree == NULL){
+            close_volume_index(&index);
+            return false;
+        }
+    }
+
+    uint32_t extent_count = index.header.extent_count;
+    uint32_t chain_count = index.header.chain_count;
+    extent_index->extents = malloc((extent_count ? extent_count : 1) * sizeof(struct fat_extent));
+    extent_index->chains = malloc((chain_count ? chain_count : 1) * sizeof(struct fat_chain));
+    if (index.header.slot_count)
+        extent_index->slots = malloc(index.header.slot_count * sizeof(uint32_t));
+    if (extent_index->extents == NULL || extent_index->chains == NULL || (index.header.slot_count && extent_index->slots == NULL)){
+        free(extent_index->extents);
+        free(extent_index->chains);
+        free(extent_index->slots);
+        extent_index->extents = NULL;
+        extent_index->chains = NULL;
+        extent_index->slots = NULL;
+        dir_tree_destroy(*tree);
+        *tree = NULL;
+        close_volume_index(&index);
+        memory_error(vol);
+        return false;
+    }
+    memcpy(extent_index->extents, index.extents, extent_count * sizeof(struct fat_extent));
+    for (uint32_t i = 0; i < chain_count; i++){
+        struct saved_chain *saved = &index.chains[i];
+        extent_index->chains[i] = (struct fat_chain){saved->head, saved->first_extent, saved->extent_count, saved->cluster_count, NULL, false};
+    }
+    extent_index->extent_count = extent_index->extent_capacity = extent_count;
+    extent_index->chain_count = extent_index->chain_capacity = chain_count;
+    if (index.header.slot_count){
+        memcpy(extent_index->slots, index.slots, index.header.slot_count * sizeof(uint32_t));
+        extent_index->slot_mask = index.header.slot_count - 1;
+    }
+
+    if (*tree == NULL){
+        close_volume_index(&index);
+        return true;
+    }
+    vol->index_map = index.map;
+    vol->index_map_size = index.size;
+    return true;
+}
+
+/**
+ * @brief Frees a re-scan baseline
+ * 
+ * @param baseline may be NULL
+ */
+static void free_rescan_baseline(struct rescan_baseline *baseline){
+    if (baseline == NULL)
+        return;
+    dir_tree_destroy(baseline->tree);
+    close_volume_index(&baseline->index);
+    free(baseline->dir_slots);
+    free(baseline);
+}
+
+/**
+ * @brief Loads the volume index of an earlier acquisition of the same volume as the baseline of an
+ * incremental re-scan (--rescan).  The boot sector and the geometry must match.  Every FAT region
+ * whose hash differs from the baseline's is marked changed, and the baseline's directories are
+ * hashed by first cluster so the walk can find them.
+ * 
+ * @param vol 
+ * @param path path of the baseline's volume index
+ * @param key key of the image being scanned, see volume_index_key
+ * @return struct rescan_baseline* : NULL if the baseline can not be used, every file is then
+ * checked and FG_WARNING_BASELINE_UNUSABLE is set.  Also NULL if out of memory, the volume then
+ * fails with FG_ERROR_MEMORY.
+ */
+static struct rescan_baseline *load_rescan_baseline(struct fat_volume *vol, const char *path, const struct volume_index_header *key){
+    struct rescan_baseline *baseline = calloc(1, sizeof(struct rescan_baseline));
+    if (baseline == NULL){
+        memory_error(vol);
+        return NULL;
+    }
+    struct volume_index_header *header = &baseline->index.header;
+
+    if (!open_volume_index(vol, path, &baseline->index) || header->boot_sector_crc != key->boot_sector_crc
+        || header->fat_region_count != vol->fat_region_count || (baseline->tree = load_saved_tree(vol, &baseline->index)) == NULL){
+        vol->warnings |= FG_WARNING_BASELINE_UNUSABLE;
+        close_volume_index(&baseline->index);
+        free(baseline);
+        return NULL;
+    }
+
+    baseline->changed_regions = arena_alloc(vol->arena, vol->fat_region_count + 1);
+    if (baseline->changed_regions == NULL){
+        free_rescan_baseline(baseline);
+        memory_error(vol);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < vol->fat_region_count; i++)
+        baseline->changed_regions[i] = (baseline->index.fat_region_crcs[i] != vol->fat_region_crcs[i]);
+
+    uint32_t node_count = dir_tree_node_count(baseline->tree);
+    uint32_t slot_count = 16;
+    while (slot_count < node_count * 2)
+        slot_count *= 2;
+    baseline->dir_slots = calloc(slot_count, sizeof(uint32_t));
+    if (baseline->dir_slots == NULL){
+        free_rescan_baseline(baseline);
+        memory_error(vol);
+        return NULL;
+    }
+    baseline->dir_slot_mask = slot_count - 1;
+    for (uint32_t i = 0; i < node_count; i++){
+        if (!dir_tree_is_directory(baseline->tree, i))
+            continue;
+        uint32_t cluster = dir_tree_node(baseline->tree, i)->cluster_addr;
+        uint32_t slot = (cluster * 2654435761u) & baseline->dir_slot_mask;
+        while (baseline->dir_slots[slot])
+            slot = (slot + 1) & baseline->dir_slot_mask;
+        baseline->dir_slots[slot] = i + 1;
+    }
+    return baseline;
+}
+
+/**
+ * @brief Writes one section of the volume index and pads it out to a multiple of 64 bytes
+ * 
+ * @param file 
+ * @param data 
+ * @param length 
+ * @param written running # of bytes written, receives the offset the section was written at
+ * @param offset 
+ * @return int : 0 if successful, -1 on a write error
+ */
+static int write_volume_index_section(FILE *file, const void *data, size_t length, uint64_t *written, uint64_t *offset){
+    static const uint8_t zeros[64];
+    size_t padding = (64 - (*written + length) % 64) % 64;
+
+    if (offset != NULL)
+        *offset = *written;
+    if ((length && fwrite(data, 1, length, file) != length) || fwrite(zeros, 1, padding, file) != padding)
+        return -1;
+    *written += length + padding;
+    return 0;
+}
+
+/**
+ * @brief Writes the extent index, and the directory tree and slack findings if the tree was
+ * walked, to the volume index.  The index is written to a temporary file that replaces the old
+ * one once complete.  An index that can not be written only costs later runs the time to parse
+ * the volume, so failures only set FG_WARNING_INDEX_NOT_WRITTEN.
+ * 
+ * @param vol 
+ * @param path path of the volume index
+ * @param key key of the image, see volume_index_key
+ * @param tree the directory tree, NULL if it was not walked
+ */
+static void save_volume_index(struct fat_volume *vol, const char *path, const struct volume_index_header *key, struct dir_tree *tree){
+    struct fat_extent_index *index = &vol->fat_index;
+    struct volume_index_header header = *key;
+    char temp_path[PATH_MAX + 8];
+    uint64_t written = 0;
+    int result = 0;
+
+    header.fat_entry_count = vol->fat_entry_count;
+    header.extent_count = index->extent_count;
+    header.chain_count = index->chain_count;
+    header.slot_count = index->slots ? index->slot_mask + 1 : 0;
+    header.has_tree = (tree != NULL);
+
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE *file = fopen(temp_path, "wb");
+    if (file == NULL){
+        vol->warnings |= FG_WARNING_INDEX_NOT_WRITTEN;
+        return;
+    }
+
+    // The header is written again once the section offsets are known
+    result |= write_volume_index_section(file, &header, sizeof(header), &written, NULL);
+    result |= write_volume_index_section(file, index->extents, header.extent_count * sizeof(struct fat_extent), &written, &header.extents_off);
+
+    // Only the fields that describe a chain are kept, the extents pointer is set again on lookup
+    header.chains_off = written;
+    for (uint32_t i = 0; i < header.chain_count; i++){
+        struct fat_chain *chain = &index->chains[i];
+        struct saved_chain saved = {chain->head, chain->first_extent, chain->extent_count, chain->cluster_count};
+        if (fwrite(&saved, sizeof(saved), 1, file) != 1)
+            result = -1;
+        written += sizeof(saved);
+    }
+    result |= write_volume_index_section(file, NULL, 0, &written, NULL);
+    result |= write_volume_index_section(file, index->slots, header.slot_count * sizeof(uint32_t), &written, &header.slots_off);
+    result |= write_volume_index_section(file, vol->fat_region_crcs, header.fat_region_count * sizeof(uint32_t), &written, &header.fat_regions_off);
+
+    header.findings_off = written;
+    for (uint32_t i = 0; tree != NULL && i < dir_tree_node_count(tree); i++){
+        struct slack_finding *finding = dir_tree_finding(tree, i);
+        if (finding == NULL)
+            continue;
+        struct saved_finding saved = {i, finding->ranges.stored, finding->ranges.found, finding->ranges.nonzero_bytes};
+        memcpy(saved.range, finding->range, sizeof(saved.range));
+        if (fwrite(&saved, sizeof(saved), 1, file) != 1)
+            result = -1;
+        written += sizeof(saved);
+        header.finding_count++;
+    }
+    result |= write_volume_index_section(file, NULL, 0, &written, NULL);
+
+    header.tree_off = written;
+    if (tree != NULL)
+        result |= dir_tree_save(tree, file);
+    if (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1)
+        result = -1;
+    if (fclose(file) != 0 || result != 0 || rename(temp_path, path) != 0){
+        vol->warnings |= FG_WARNING_INDEX_NOT_WRITTEN;
+        unlink(temp_path);
+    }
+}
+
+/**
+ * @brief Finds the non-zero bytes in the region [start, end) of the disk image.  The region is
+ * walked in large views so the gap between partitions costs no per-byte reads.
+ *
+ * @param vol
+ * @param start offset in bytes of the first byte to check
+ * @param end offset in bytes one past the last byte to check
+ * @param ranges accumulator for the runs of non-zero bytes found
+ * @return bool : true if any byte in the region is non-zero, false as well if a read or allocation failed
+ */
+static bool region_has_data(struct fat_volume *vol, off_t start, off_t end, struct nonzero_ranges *ranges){
+    struct disk_image *disk = vol->disk;
+    size_t chunk_size = 1 << 20;
+    uint8_t *scratch = malloc(chunk_size);
+
+    if (scratch == NULL){
+        memory_error(vol);
+        return false;
+    }
+
+    for (off_t pos = start; pos < end; pos += chunk_size){
+        size_t length = (end - pos < (off_t)chunk_size) ? (size_t)(end - pos) : chunk_size;
+        const uint8_t *region = disk_image_view(disk, pos, length, scratch);
+        if (region == NULL){
+            read_error(vol);
+            free(scratch);
+            return false;
+        }
+        scan_nonzero_ranges(region, length, pos, ranges);
+    }
+    free(scratch);
+    return ranges->found > 0;
+}
+
+/**
+ * @brief Checks the space between partitions on a disk image for hidden data.
+ * 
+ * @param vol the image, a volume with no file system loaded
+ * @param mbr 
+ * @param fn called for every gap that holds data
+ * @param context passed to fn
+ */
+static void check_slack_space(struct fat_volume *vol, const struct fg_mbr_sector *mbr, fg_gap_fn fn, void *context){
+    struct nonzero_range range[MAX_REPORTED_RANGES];
+    struct fg_range listed[MAX_REPORTED_RANGES];
+
+    if (mbr->entry[0].starting_sector > 0){
+        struct nonzero_ranges ranges = {range, MAX_REPORTED_RANGES};
+        if (region_has_data(vol, 512, (off_t)mbr->entry[0].starting_sector * FG_MBR_BYTES_PER_SECTOR, &ranges)){
+            struct fg_ranges found = export_ranges(&ranges, listed);
+            struct fg_gap gap = {-1, &found};
+            fn(&gap, context);
+        }
+    }
+
+    for (int i = 0; i < 3 && volume_status(vol) == FG_OK; i++){
+        struct nonzero_ranges ranges = {range, MAX_REPORTED_RANGES};
+        // 64 bit so a partition ending past 2 TB (start + size > 2^32 sectors) does not wrap around
+        uint64_t partition_end = (uint64_t)mbr->entry[i].starting_sector + mbr->entry[i].partition_size;
+        if (partition_end < mbr->entry[i+1].starting_sector){
+            if (region_has_data(vol, (off_t)partition_end * FG_MBR_BYTES_PER_SECTOR, (off_t)mbr->entry[i+1].starting_sector * FG_MBR_BYTES_PER_SECTOR, &ranges)){
+                struct fg_ranges found = export_ranges(&ranges, listed);
+                struct fg_gap gap = {i, &found};
+                fn(&gap, context);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Maps the free clusters of the volume in one pass over FAT1, one bit per FAT entry.  The
+ * entries are compared against zero by the SIMD kernels of scan.c, straight from FAT1 when it is
+ * in memory and FREE_MAP_CHUNK_ENTRIES at a time when it is paged (--max-mem).  The map takes
+ * an eighth of a byte per cluster, 32 MiB for the largest FAT32 volume.
+ * 
+ * @param vol 
+ * @return uint64_t* : the map, the reserved entries 0 and 1 are never free, NULL if a read or allocation failed
+ */
+static uint64_t *map_free_clusters(struct fat_volume *vol){
+    struct fg_boot_sector *fat_sector = vol->fat_bs;
+    int bits = fat_sector->is_fat32 ? 32 : (fat_sector->is_fat16 ? 16 : 12);
+    uint32_t entry_count = vol->fat_entry_count;
+    uint64_t *map = calloc(entry_count / 64 + 1, sizeof(uint64_t));
+    uint16_t *unpacked = NULL;
+    uint8_t *scratch = NULL;
+    size_t scratch_size = 0;
+
+    if (map == NULL){
+        memory_error(vol);
+        return NULL;
+    }
+
+    if (bits == 12 && vol->fat12 == NULL)
+        unpacked = malloc(FREE_MAP_CHUNK_ENTRIES * sizeof(uint16_t));
+    if (vol->fat1 == NULL)
+        scratch = buffer_pool_acquire(vol->buffers, FREE_MAP_CHUNK_ENTRIES * sizeof(uint32_t), &scratch_size);
+    if ((bits == 12 && vol->fat12 == NULL && unpacked == NULL) || (vol->fat1 == NULL && scratch == NULL)){
+        memory_error(vol);
+        buffer_pool_release(vol->buffers, scratch, scratch_size);
+        free(unpacked);
+        free(map);
+        return NULL;
+    }
+
+    // FAT1 in memory is mapped in one go, FREE_MAP_CHUNK_ENTRIES is even so FAT12 chunks start on
+    // a whole pair of entries
+    uint32_t chunk = (vol->fat1 != NULL || vol->fat12 != NULL) ? entry_count : FREE_MAP_CHUNK_ENTRIES;
+    for (uint32_t first = 0; first < entry_count; first += chunk){
+        size_t count = (entry_count - first < chunk) ? entry_count - first : chunk;
+        const uint8_t *table;
+        if (bits == 12 && vol->fat12 != NULL){
+            table = (const uint8_t *)(vol->fat12 + first);
+        }
+        else{
+            uint64_t offset = (bits == 12) ? first / 2 * 3 : (uint64_t)first * (bits / 8);
+            size_t length = (bits == 12) ? (count * 3 + 1) / 2 : count * (bits / 8);
+            table = vol->fat1 ? vol->fat1 + offset : disk_image_view(vol->disk, vol->fat_off + offset, length, scratch);
+            if (table == NULL){
+                read_error(vol);
+                free(map);
+                map = NULL;
+                break;
+            }
+            if (bits == 12){
+                fat12_unpack(table, count, unpacked);
+                table = (const uint8_t *)unpacked;
+            }
+        }
+        scan_zero_entries(table, count, bits == 32 ? 28 : 16, map + first / 64);
+    }
+    if (map != NULL)
+        map[0] &= ~(uint64_t)3;
+
+    buffer_pool_release(vol->buffers, scratch, scratch_size);
+    free(unpacked);
+    return map;
+}
+
+/**
+ * @brief Finds the next cluster that is free, or allocated, in the free cluster map.  Whole words
+ * of the other kind are skipped 64 clusters at a time.
+ * 
+ * @param map 
+ * @param from first cluster to look at
+ * @param end one past the last cluster to look at
+ * @param is_free look for a free cluster rather than an allocated one
+ * @return uint32_t : the cluster, end if there is none
+ */
+static uint32_t next_in_free_map(const uint64_t *map, uint32_t from, uint32_t end, bool is_free){
+    while (from < end){
+        uint64_t word = is_free ? map[from / 64] : ~map[from / 64];
+        word &= ~(uint64_t)0 << (from % 64);
+        if (word){
+            uint32_t cluster = from / 64 * 64 + __builtin_ctzll(word);
+            return cluster < end ? cluster : end;
+        }
+        from = from / 64 * 64 + 64;
+    }
+    return end;
+}
+
+/**
+ * @brief Turns the free cluster map into the reads of the unallocated cluster check.  Adjacent
+ * free clusters make up runs, and runs are merged into windows of at most
+ * UNALLOCATED_READ_BYTES as long as the allocated clusters between them are no more than
+ * UNALLOCATED_GAP_BYTES.  Longer runs are split over several windows.
+ * 
+ * @param vol 
+ * @param map 
+ * @param window_count receives the # of windows
+ * @return struct unallocated_window* : NULL if out of memory
+ */
+static struct unallocated_window *build_unallocated_windows(struct fat_volume *vol, const uint64_t *map, uint32_t *window_count){
+    uint32_t end = vol->fat_entry_count;
+    uint32_t max_clusters = UNALLOCATED_READ_BYTES / vol->cluster_size;
+    uint32_t gap_clusters = UNALLOCATED_GAP_BYTES / vol->cluster_size;
+    uint32_t capacity = 64;
+    struct unallocated_window *windows = malloc(capacity * sizeof(struct unallocated_window));
+    struct unallocated_window *window = NULL;
+
+    if (max_clusters == 0)
+        max_clusters = 1;
+    *window_count = 0;
+    vol->free_clusters = 0;
+    vol->free_runs = 0;
+    if (windows == NULL){
+        memory_error(vol);
+        return NULL;
+    }
+
+    uint32_t run_first = next_in_free_map(map, 2, end, true);
+    while (run_first < end){
+        uint32_t run_end = next_in_free_map(map, run_first, end, false);
+        vol->free_clusters += run_end - run_first;
+        vol->free_runs++;
+
+        for (uint32_t cluster = run_first; cluster < run_end;){
+            if (window != NULL && cluster - (window->first_cluster + window->cluster_count) <= gap_clusters
+                && cluster - window->first_cluster < max_clusters){
+                uint32_t window_end = window->first_cluster + max_clusters;
+                cluster = (run_end < window_end) ? run_end : window_end;
+                window->cluster_count = cluster - window->first_cluster;
+                window->run_end = run_end;
+                continue;
+            }
+            if (*window_count == capacity){
+                struct unallocated_window *grown = realloc(windows, capacity * 2 * sizeof(struct unallocated_window));
+                if (grown == NULL){
+                    memory_error(vol);
+                    free(windows);
+                    *window_count = 0;
+                    return NULL;
+                }
+                windows = grown;
+                capacity *= 2;
+            }
+            window = &windows[(*window_count)++];
+            window->first_cluster = cluster;
+            window->cluster_count = (run_end - cluster < max_clusters) ? run_end - cluster : max_clusters;
+            window->run_first = run_first;
+            window->run_end = run_end;
+            cluster += window->cluster_count;
+        }
+        run_first = next_in_free_map(map, run_end, end, true);
+    }
+    return windows;
+}
+
+/**
+ * @brief Reads one window with one read and checks every free run in it.  Anything found is kept
+ * on the calling worker's list of findings.
+ * 
+ * @param check 
+ * @param worker 
+ * @param window 
+ */
+static void check_unallocated_window(struct unallocated_context *check, int worker, struct unallocated_window *window){
+    struct fat_volume *vol = check->vol;
+    uint32_t window_end = window->first_cluster + window->cluster_count;
+
+    if (volume_status(vol) != FG_OK)
+        return;
+    // Keep the device busy with the next window while this one is checked
+    if (window + 1 < check->windows + check->window_count)
+        disk_image_prefetch(vol->disk, cts(vol, window[1].first_cluster), (size_t)window[1].cluster_count * vol->cluster_size);
+    const uint8_t *clusters = disk_image_view(vol->disk, cts(vol, window->first_cluster), (size_t)window->cluster_count * vol->cluster_size, check->buffers[worker]);
+    if (clusters == NULL){
+        read_error(vol);
+        return;
+    }
+    perf_count_clusters(window->cluster_count);
+
+    uint32_t first = window->first_cluster;
+    while (first < window_end){
+        uint32_t end = next_in_free_map(check->free_map, first, window_end, false);
+        struct nonzero_range range[MAX_REPORTED_RANGES];
+        struct nonzero_ranges ranges = {range, MAX_REPORTED_RANGES};
+
+        perf_count_entries(end - first);
+        scan_nonzero_ranges(clusters + (size_t)(first - window->first_cluster) * vol->cluster_size, (size_t)(end - first) * vol->cluster_size, cts(vol, first), &ranges);
+        if (ranges.found){
+            struct unallocated_finding *finding = arena_alloc(vol->arena, sizeof(struct unallocated_finding));
+            if (finding == NULL){
+                memory_error(vol);
+                return;
+            }
+            // Only the runs at the ends of a window can carry on into the windows next to it
+            finding->first_cluster = (first == window->first_cluster) ? window->run_first : first;
+            finding->cluster_count = ((end == window_end) ? window->run_end : end) - finding->first_cluster;
+            finding->piece = first;
+            finding->ranges = ranges;
+            finding->ranges.range = finding->range;
+            memcpy(finding->range, range, sizeof(range));
+            finding->next = check->findings[worker];
+            check->findings[worker] = finding;
+        }
+        first = next_in_free_map(check->free_map, end, window_end, true);
+    }
+}
+
+/**
+ * @brief Work pool task: check one window of free clusters
+ */
+static void unallocated_window_task(struct work_pool *pool, int worker, void *task, void *context){
+    struct unallocated_context *check = context;
+    perf_thread_attach(&check->vol->perf, PERF_PHASE_UNALLOCATED);
+    check_unallocated_window(check, worker, task);
+}
+
+static int compare_unallocated_findings(const void *a, const void *b){
+    const struct unallocated_finding *x = *(struct unallocated_finding *const *)a;
+    const struct unallocated_finding *y = *(struct unallocated_finding *const *)b;
+    return (x->piece > y->piece) - (x->piece < y->piece);
+}
+
+/**
+ * @brief Gathers the findings of every worker in cluster order, and joins the pieces of runs that
+ * were checked in more than one window
+ * 
+ * @param vol 
+ * @param check 
+ * @param threads # of workers
+ */
+static void gather_unallocated_findings(struct fat_volume *vol, struct unallocated_context *check, int threads){
+    uint32_t count = 0;
+
+    for (int i = 0; i < threads; i++){
+        for (struct unallocated_finding *finding = check->findings[i]; finding != NULL; finding = finding->next)
+            count++;
+    }
+    vol->unallocated = malloc((count ? count : 1) * sizeof(struct unallocated_finding *));
+    vol->unallocated_count = 0;
+    if (vol->unallocated == NULL){
+        memory_error(vol);
+        return;
+    }
+    count = 0;
+    for (int i = 0; i < threads; i++){
+        for (struct unallocated_finding *finding = check->findings[i]; finding != NULL; finding = finding->next)
+            vol->unallocated[count++] = finding;
+    }
+    qsort(vol->unallocated, count, sizeof(struct unallocated_finding *), compare_unallocated_findings);
+
+    vol->unallocated_count = 0;
+    for (uint32_t i = 0; i < count; i++){
+        struct unallocated_finding *last = vol->unallocated_count ? vol->unallocated[vol->unallocated_count - 1] : NULL;
+        if (last != NULL && last->first_cluster == vol->unallocated[i]->first_cluster)
+            scan_join_ranges(&last->ranges, &vol->unallocated[i]->ranges);
+        else
+            vol->unallocated[vol->unallocated_count++] = vol->unallocated[i];
+    }
+}
+
+/**
+ * @brief Reads and checks the windows of free clusters with a pool of threads workers, and
+ * gathers what they found
+ * 
+ * @param vol 
+ * @param check the windows, with room for the buffers and findings of every worker
+ * @param threads # of workers
+ */
+static void run_unallocated_check(struct fat_volume *vol, struct unallocated_context *check, int threads){
+    uint32_t max_clusters = UNALLOCATED_READ_BYTES / vol->cluster_size;
+    for (int i = 0; i < threads; i++){
+        check->buffers[i] = buffer_pool_acquire(vol->buffers, (size_t)(max_clusters ? max_clusters : 1) * vol->cluster_size, &check->buffer_sizes[i]);
+        if (check->buffers[i] == NULL){
+            check->buffer_sizes[i] = 0;
+            memory_error(vol);
+        }
+    }
+    if (vol->options.sequential_slack)
+        disk_image_advise_sequential(vol->disk);
+
+    struct work_pool *pool = work_pool_create(threads, unallocated_window_task, check);
+    if (pool == NULL)
+        memory_error(vol);
+    // Push in reverse so worker 0 pops the windows in disk order, thieves take from the far end
+    for (uint32_t i = check->window_count; pool != NULL && i > 0; i--){
+        if (work_pool_push(pool, 0, &check->windows[i - 1]) < 0){
+            memory_error(vol);
+            break;
+        }
+    }
+    // Windows are skipped once the volume failed, so a pool left partly queued finishes right away
+    if (pool != NULL)
+        work_pool_run(pool);
+    work_pool_destroy(pool);
+
+    if (volume_status(vol) == FG_OK)
+        gather_unallocated_findings(vol, check, threads);
+    for (int i = 0; i < threads; i++)
+        buffer_pool_release(vol->buffers, check->buffers[i], check->buffer_sizes[i]);
+}
+
+/**
+ * @brief Checks every cluster FAT1 marks free for data.  The free clusters are found with one
+ * vectorized pass over FAT1 (map_free_clusters), grouped into large windows of nearby free runs,
+ * and the windows are read with one read each and checked by a pool of threads, so the cost is a
+ * handful of syscalls per UNALLOCATED_READ_BYTES of free space no matter how many clusters there
+ * are.  With sequential_slack (-s) the windows are read in disk order by a single thread.
+ * 
+ * @param vol the volume, with the FAT loaded
+ * @param threads # of workers
+ */
+static void check_unallocated_clusters(struct fat_volume *vol, int threads){
+    struct unallocated_context check = {vol};
+    uint64_t *map = map_free_clusters(vol);
+
+    if (map == NULL)
+        return;
+    check.free_map = map;
+    check.windows = build_unallocated_windows(vol, map, &check.window_count);
+    check.buffers = calloc(threads, sizeof(uint8_t *));
+    check.buffer_sizes = calloc(threads, sizeof(size_t));
+    check.findings = calloc(threads, sizeof(struct unallocated_finding *));
+    if (check.windows != NULL && check.buffers != NULL && check.buffer_sizes != NULL && check.findings != NULL)
+        run_unallocated_check(vol, &check, threads);
+    else
+        memory_error(vol);
+
+    free(check.findings);
+    free(check.buffer_sizes);
+    free(check.buffers);
+    free(check.windows);
+    free(map);
+}
+
+/**
+ * @brief Fills in the description of an entry handed to fg_entry_fn callbacks
+ *
+ * @param vol
+ * @param index the entry's node
+ * @param depth
+ * @param entry receives the description
+ */
+static void describe_entry(struct fat_volume *vol, uint32_t index, uint32_t depth, struct fg_entry *entry){
+    struct dir_node *node = dir_tree_node(vol->tree, index);
+    struct dir_node_info *info = dir_tree_info(vol->tree, index);
+
+    entry->index = index;
+    entry->parent = node->parent;
+    entry->depth = depth;
+    entry->short_name = dir_tree_name(vol->tree, info->short_name);
+    entry->long_name = info->long_name == DIR_TREE_NO_NAME ? NULL : dir_tree_name(vol->tree, info->long_name);
+    entry->attributes = node->file_attributes;
+    entry->is_directory = (node->file_attributes & FLAG_FAT_DIRECTORY) != 0;
+    entry->first_cluster = node->cluster_addr;
+    entry->last_cluster = node->last_cluster;
+    entry->file_size = node->file_size;
+    entry->created_time_tenths = info->created_time_tenths;
+    entry->created_time_hms = info->created_time_hms;
+    entry->created_day = info->created_day;
+    entry->accessed_day = info->accessed_day;
+    entry->written_time_hms = info->written_time_hms;
+    entry->written_day = info->written_day;
+}
+
+/**
+ * @brief Hands the entries under dir to a callback, in directory order (each directory is
+ * followed by its contents)
+ *
+ * @param vol
+ * @param dir index of the directory
+ * @param depth depth of the directory's entries
+ * @param fn
+ * @param context
+ * @return int : the nonzero value fn stopped the iteration with, 0 otherwise
+ */
+static int visit_entries(struct fat_volume *vol, uint32_t dir, uint32_t depth, fg_entry_fn fn, void *context){
+    struct dir_node *node = dir_tree_node(vol->tree, dir);
+    for (uint32_t i = node->first_child; i < node->first_child + node->child_count; i++){
+        struct fg_entry entry;
+        int stop;
+        describe_entry(vol, i, depth, &entry);
+        if ((stop = fn(&entry, context)) != 0)
+            return stop;
+        if (entry.is_directory && (stop = visit_entries(vol, i, depth + 1, fn, context)) != 0)
+            return stop;
+    }
+    return 0;
+}
+
+/**
+ * @brief Hands the slack findings of the files under dir to a callback, in directory order
+ *
+ * @param vol
+ * @param dir index of the directory
+ * @param depth depth of the directory's entries
+ * @param fn
+ * @param context
+ * @return int : the nonzero value fn stopped the iteration with, 0 otherwise
+ */
+static int visit_findings(struct fat_volume *vol, uint32_t dir, uint32_t depth, fg_finding_fn fn, void *context){
+    struct dir_node *node = dir_tree_node(vol->tree, dir);
+    for (uint32_t i = node->first_child; i < node->first_child + node->child_count; i++){
+        struct dir_node *entry = dir_tree_node(vol->tree, i);
+        int stop;
+        if (entry->file_attributes & FLAG_FAT_DIRECTORY){
+            if ((stop = visit_findings(vol, i, depth + 1, fn, context)) != 0)
+                return stop;
+            continue;
+        }
+        struct slack_finding *slack = dir_tree_finding(vol->tree, i);
+        if (slack == NULL)
+            continue;
+        struct fg_entry described;
+        describe_entry(vol, i, depth, &described);
+        struct fg_range listed[MAX_REPORTED_RANGES];
+        struct fg_ranges ranges = export_ranges(&slack->ranges, listed);
+        struct fg_finding finding = {&described, cts(vol, entry->last_cluster), &ranges};
+        if ((stop = fn(&finding, context)) != 0)
+            return stop;
+    }
+    return 0;
+}
+
+//-------------------------------------------------------------------------
+// Library API, see libfeelergauge.h
+//-------------------------------------------------------------------------
+static pthread_once_t library_init = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Picks the fastest kernels the CPU supports, run once before the first volume is created
+ */
+static void init_kernels(void){
+    scan_init();
+    fat12_init();
+    fat_dump_init();
+}
+
+/**
+ * @brief Creates a volume handle, nothing is opened until fg_volume_open
+ *
+ * @param options copied into the volume, NULL for the defaults
+ * @return fg_volume* : free with fg_volume_close, NULL if out of memory
+ */
+fg_volume *fg_volume_create(const struct fg_options *options){
+    struct fat_volume *vol = calloc(1, sizeof(struct fat_volume));
+
+    pthread_once(&library_init, init_kernels);
+    if (vol == NULL)
+        return NULL;
+    if (options != NULL)
+        vol->options = *options;
+    if (vol->options.threads < 1)
+        vol->options.threads = 1;
+    if (vol->options.index_path != NULL){
+        snprintf(vol->index_path, sizeof(vol->index_path), "%s", vol->options.index_path);
+        vol->options.index_path = vol->index_path;
+    }
+    if (vol->options.rescan_path != NULL){
+        snprintf(vol->rescan_path, sizeof(vol->rescan_path), "%s", vol->options.rescan_path);
+        vol->options.rescan_path = vol->rescan_path;
+    }
+    perf_stats_init(&vol->perf, vol->options.collect_stats, vol->options.concurrent_stats);
+    vol->arena = arena_create(VOLUME_ARENA_BLOCK_BYTES);
+    vol->buffers = buffer_pool_create();
+    if (vol->arena == NULL || vol->buffers == NULL){
+        fg_volume_close(vol);
+        return NULL;
+    }
+    return vol;
+}
+
+/**
+ * @brief Opens a disk image (raw, split or compressed) and detects what it holds
+ *
+ * @param vol
+ * @param path
+ * @return fg_status
+ */
+fg_status fg_volume_open(fg_volume *vol, const char *path){
+    if (vol->disk != NULL)
+        return volume_fail(vol, FG_ERROR_STATE, "The volume already has an image open");
+    if (volume_status(vol) != FG_OK)
+        return volume_status(vol);
+    perf_phase_begin(&vol->perf, PERF_PHASE_OTHER);
+    vol->disk = disk_image_open(path);
+    perf_phase_end(&vol->perf, PERF_PHASE_OTHER);
+    // Ensure the file open was successful
+    if (vol->disk == NULL)
+        return volume_fail(vol, FG_ERROR_OPEN, "Aborting... Could not read/access the file located at: %s", path);
+    if (vol->options.cache_bytes && disk_image_set_cache_budget(vol->disk, vol->options.cache_bytes) < 0)
+        return memory_error(vol);
+
+    perf_phase_begin(&vol->perf, PERF_PHASE_VERIFY_IMAGE);
+    vol->type = verify_disk_image(vol, path, 0);
+    perf_phase_end(&vol->perf, PERF_PHASE_VERIFY_IMAGE);
+    return volume_status(vol);
+}
+
+/**
+ * @brief Opens the volume of a partition of a raw image.  The partition shares the raw image's
+ * disk image (mapping, chunk cache and read ahead) instead of opening the image again, so the
+ * partitions of one image can be scanned at once, each through a handle of its own.
+ *
+ * @param vol
+ * @param image the raw image, opened with fg_volume_open and kept open until vol is closed
+ * @param offset offset in bytes of the partition's boot sector from the start of the image
+ * @return fg_status
+ */
+fg_status fg_volume_open_partition(fg_volume *vol, fg_volume *image, uint64_t offset){
+    char description[64];
+
+    if (vol->disk != NULL)
+        return volume_fail(vol, FG_ERROR_STATE, "The volume already has an image open");
+    if (volume_status(vol) != FG_OK)
+        return volume_status(vol);
+    if (image->disk == NULL || image->type != FG_RAW)
+        return volume_fail(vol, FG_ERROR_STATE, "Partitions can only be opened on a raw image");
+    if (offset + SECTOR_BUFFER_SIZE > (uint64_t)image->disk->size)
+        return volume_fail(vol, FG_ERROR_OPEN, "Aborting... The partition at offset 0x%jx lies past the end of the image", (uintmax_t)offset);
+    vol->disk = image->disk;
+    vol->disk_borrowed = true;
+    vol->partition_off = offset;
+
+    snprintf(description, sizeof(description), "The partition at offset 0x%jx", (uintmax_t)offset);
+    perf_phase_begin(&vol->perf, PERF_PHASE_VERIFY_IMAGE);
+    vol->type = verify_disk_image(vol, description, offset);
+    perf_phase_end(&vol->perf, PERF_PHASE_VERIFY_IMAGE);
+    return volume_status(vol);
+}
+
+/**
+ * @brief Returns what fg_volume_open detected: FG_FAT12, FG_FAT16, FG_FAT32, FG_NTFS or FG_RAW (an image with an MBR)
+ */
+int fg_volume_type(fg_volume *vol){
+    return vol->type;
+}
+
+/**
+ * @brief Returns the description of the volume's first error, "" if there is none
+ */
+const char *fg_volume_error(fg_volume *vol){
+    return vol->error;
+}
+
+/**
+ * @brief Returns the fg_warning bits collected so far
+ */
+unsigned fg_volume_warnings(fg_volume *vol){
+    return vol->warnings;
+}
+
+/**
+ * @brief Reads the MBR of a raw image, and follows the EBR chains of its extended partitions
+ *
+ * @param vol
+ * @param mbr receives the partition table, its EBR chains stay valid until the volume is closed
+ * @return fg_status
+ */
+fg_status fg_read_mbr(fg_volume *vol, struct fg_mbr_sector *mbr){
+    if (volume_status(vol) != FG_OK)
+        return volume_status(vol);
+    if (vol->disk == NULL || vol->type != FG_RAW)
+        return volume_fail(vol, FG_ERROR_STATE, "The image has no MBR to read");
+    memset(mbr, 0, sizeof(struct fg_mbr_sector));
+    perf_phase_begin(&vol->perf, PERF_PHASE_BOOT_SECTOR);
+    read_mbr_sector(vol, mbr);
+    perf_phase_end(&vol->perf, PERF_PHASE_BOOT_SECTOR);
+    return volume_status(vol);
+}
+
+/**
+ * @brief Checks the space around the partitions of a raw image for hidden data
+ *
+ * @param vol
+ * @param mbr as read by fg_read_mbr
+ * @param fn called for every gap that holds data
+ * @param context passed to fn
+ * @return fg_status
+ */
+fg_status fg_check_partition_gaps(fg_volume *vol, const struct fg_mbr_sector *mbr, fg_gap_fn fn, void *context){
+    if (volume_status(vol) != FG_OK)
+        return volume_status(vol);
+    if (vol->disk == NULL || vol->type != FG_RAW)
+        return volume_fail(vol, FG_ERROR_STATE, "The image has no partitions to check");
+    perf_phase_begin(&vol->perf, PERF_PHASE_PARTITION_GAP);
+    check_slack_space(vol, mbr, fn, context);
+    perf_phase_end(&vol->perf, PERF_PHASE_PARTITION_GAP);
+    return volume_status(vol);
+}
+
+/**
+ * @brief Reads and validates the boot sector of a FAT volume, and works out its geometry.
+ * Oddities that do not stop the scan are added to the volume's warnings.
+ *
+ * @param vol
+ * @param boot_sector receives a copy of the decoded boot sector, may be NULL
+ * @return fg_status
+ */
+fg_status fg_read_boot_sector(fg_volume *vol, struct fg_boot_sector *boot_sector){
+    if (volume_status(vol) != FG_OK)
+        return volume_status(vol);
+    if (vol->disk == NULL || (vol->type != FG_FAT12 && vol->type != FG_FAT16 && vol->type != FG_FAT32) || vol->fat_bs != NULL)
+        return volume_fail(vol, FG_ERROR_STATE, "The image is not a FAT volume, or its boot sector was already read");
+    struct fg_boot_sector *fat_bs = arena_alloc(vol->arena, sizeof(struct fg_boot_sector));
+    if (fat_bs == NULL)
+        return memory_error(vol);
+    memset(fat_bs, 0, sizeof(struct fg_boot_sector));
+    perf_phase_begin(&vol->perf, PERF_PHASE_BOOT_SECTOR);
+    if (read_fat_boot_sector(vol, fat_bs, vol->partition_off) == 0)
+        validate_fat_boot_sector(vol, fat_bs);
+    perf_phase_end(&vol->perf, PERF_PHASE_BOOT_SECTOR);
+    if (boot_sector != NULL)
+        *boot_sector = *fat_bs;
+    return volume_status(vol);
+}
+
+/**
+ * @brief Loads FAT1 (or sets it up to be paged with max_fat_bytes), compares the other copies
+ * against it and builds the extent index of every cluster chain.  With an index_path the extent
+ * index, and with check_slack the directory tree, are taken from the volume index when it was
+ * made from the image as it is now.
+ *
+ * @param vol
+ * @param fn called for every FAT copy that differs from FAT1, may be NULL
+ * @param context passed to fn
+ * @return fg_status
+ */
+fg_status fg_load_fat(fg_volume *vol, fg_fat_mismatch_fn fn, void *context){
+    if (volume_status(vol) != FG_OK)
+        return volume_status(vol);
+    if (vol->fat_bs == NULL || vol->fat_loaded)
+        return volume_fail(vol, FG_ERROR_STATE, "The boot sector was not read yet, or the FAT was already loaded");
+
+    perf_phase_begin(&vol->perf, PERF_PHASE_FAT_LOAD);
+    int result = 0;
+    if (vol->options.max_fat_bytes){
+        // Split the budget with the chunk cache when reading a compressed image, the cache of a
+        // shared image is left to the raw image's volume
+        size_t budget = vol->options.max_fat_bytes;
+        if (vol->disk->compressed != NULL){
+            size_t cache_budget = vol->options.cache_bytes ? vol->options.cache_bytes : budget / 2;
+            if (!vol->options.cache_bytes && !vol->disk_borrowed && disk_image_set_cache_budget(vol->disk, cache_budget) < 0){
+                memory_error(vol);
+                result = -1;
+            }
+            budget = (cache_budget < budget) ? budget - cache_budget : 0;
+        }
+        if (result == 0)
+            result = page_fat_from_disk(vol, budget);
+    }
+    else{
+        result = copy_fat_into_memory(vol);
+    }
+    if (result == 0)
+        result = compare_fat_copies(vol, fn, context);
+    if (result == 0){
+        count_fat_entries(vol);
+        if (vol->options.index_path != NULL || vol->options.rescan_path != NULL)
+            result = volume_index_key(vol, &vol->index_key);
+    }
+    if (result == 0){
+        if (vol->options.index_path != NULL)
+            vol->indexed = load_volume_index(vol, vol->index_path, &vol->index_key, &vol->tree);
+        if (!vol->indexed)
+            build_fat_extent_index(vol);
+        perf_count_entries(vol->fat_entry_count);
+    }
+    perf_phase_end(&vol->perf, PERF_PHASE_FAT_LOAD);
+    vol->fat_loaded = (volume_status(vol) == FG_OK);
+    return volume_status(vol);
+}
+
+// fg_dump_format is handed to fat_dump as it is
+_Static_assert((int)FG_DUMP_TEXT == (int)FAT_DUMP_TEXT && (int)FG_DUMP_CSV == (int)FAT_DUMP_CSV && (int)FG_DUMP_BINARY == (int)FAT_DUMP_BINARY, "fg_dump_format does not match fat_dump_format");
+
+/**
+ * @brief Writes FAT1 as runs of entries, see fat_dump.h.  A dump that could not be written
+ * returns FG_ERROR_WRITE but leaves the volume usable.
+ *
+ * @param vol
+ * @param out owned by the caller
+ * @param format
+ * @return fg_status
+ */
+fg_status fg_dump_fat(fg_volume *vol, FILE *out, enum fg_dump_format format){
+    if (volume_status(vol) != FG_OK)
+        return volume_status(vol);
+    if (!vol->fat_loaded)
+        return volume_fail(vol, FG_ERROR_STATE, "The FAT was not loaded yet");
+    perf_phase_begin(&vol->perf, PERF_PHASE_OTHER);
+    fg_status status = dump_fat_table(vol, out, (enum fat_dump_format)format);
+    perf_phase_end(&vol->perf, PERF_PHASE_OTHER);
+    return status;
+}
+
+/**
+ * @brief Walks the directory tree with the volume's threads, and with check_slack checks the
+ * slack of every file.  Does nothing if the tree was loaded from the volume index or already
+ * walked.
+ *
+ * @param vol
+ * @return fg_status
+ */
+fg_status fg_walk(fg_volume *vol){
+    if (volume_status(vol) != FG_OK)
+        return volume_status(vol);
+    if (!vol->fat_loaded)
+        return volume_fail(vol, FG_ERROR_STATE, "The FAT was not loaded yet");
+    if (vol->tree != NULL)
+        return FG_OK;
+
+    if (vol->fat_bs->is_fat32)
+        vol->root_dir_off = cts(vol, vol->fat_bs->root_dir_cluster);
+    struct rescan_baseline *baseline = vol->options.rescan_path ? load_rescan_baseline(vol, vol->rescan_path, &vol->index_key) : NULL;
+    if (volume_status(vol) != FG_OK)
+        return volume_status(vol);
+    vol->tree = read_fat_filesystem(vol, vol->fat_bs->is_fat32 ? vol->fat_bs->root_dir_cluster : 0, vol->options.threads, baseline);
+    vol->rescanned = (baseline != NULL);
+    vol->walked = true;
+    free_rescan_baseline(baseline);
+    return volume_status(vol);
+}
+
+/**
+ * @brief Saves the volume to the volume index (index_path) for later runs.  The index is only
+ * rewritten when there is something new to keep: the extent index was built rather than loaded,
+ * or the tree was walked.  A tree is only kept if its slack was checked.  An index that can not be
+ * written sets FG_WARNING_INDEX_NOT_WRITTEN.
+ *
+ * @param vol
+ * @return fg_status
+ */
+fg_status fg_save_index(fg_volume *vol){
+    if (volume_status(vol) != FG_OK || vol->options.index_path == NULL)
+        return volume_status(vol);
+    if (!vol->fat_loaded)
+        return volume_fail(vol, FG_ERROR_STATE, "The FAT was not loaded yet");
+    if (vol->indexed && !vol->walked)
+        return FG_OK;
+    save_volume_index(vol, vol->index_path, &vol->index_key, vol->walked && vol->options.check_slack ? vol->tree : NULL);
+    return FG_OK;
+}
+
+/**
+ * @brief Hands every file and directory found by fg_walk to a callback, in directory order
+ *
+ * @param vol
+ * @param fn return nonzero to stop
+ * @param context passed to fn
+ * @return fg_status
+ */
+fg_status fg_for_each_entry(fg_volume *vol, fg_entry_fn fn, void *context){
+    if (volume_status(vol) != FG_OK)
+        return volume_status(vol);
+    if (vol->tree == NULL)
+        return volume_fail(vol, FG_ERROR_STATE, "The directory tree was not walked yet");
+    visit_entries(vol, 0, 1, fn, context);
+    return FG_OK;
+}
+
+/**
+ * @brief Hands every file with data in the slack of its last cluster to a callback, in directory
+ * order
+ *
+ * @param vol
+ * @param fn return nonzero to stop
+ * @param context passed to fn
+ * @return fg_status
+ */
+fg_status fg_for_each_finding(fg_volume *vol, fg_finding_fn fn, void *context){
+    if (volume_status(vol) != FG_OK)
+        return volume_status(vol);
+    if (vol->tree == NULL)
+        return volume_fail(vol, FG_ERROR_STATE, "The directory tree was not walked yet");
+    visit_findings(vol, 0, 1, fn, context);
+    return FG_OK;
+}
+
+/**
+ * @brief Checks every cluster the FAT marks free for data, and hands every run of free clusters
+ * that holds any to a callback, in cluster order.  The check is only made on the first call,
+ * later calls hand out the same runs again.
+ *
+ * @param vol
+ * @param fn return nonzero to stop
+ * @param context passed to fn
+ * @return fg_status
+ */
+fg_status fg_check_unallocated(fg_volume *vol, fg_unallocated_fn fn, void *context){
+    if (volume_status(vol) != FG_OK)
+        return volume_status(vol);
+    if (!vol->fat_loaded)
+        return volume_fail(vol, FG_ERROR_STATE, "The FAT was not loaded yet");
+
+    if (!vol->unallocated_checked){
+        perf_phase_begin(&vol->perf, PERF_PHASE_UNALLOCATED);
+        check_unallocated_clusters(vol, vol->options.sequential_slack ? 1 : vol->options.threads);
+        perf_phase_end(&vol->perf, PERF_PHASE_UNALLOCATED);
+        vol->unallocated_checked = true;
+    }
+    if (volume_status(vol) != FG_OK)
+        return volume_status(vol);
+    for (uint32_t i = 0; i < vol->unallocated_count; i++){
+        struct unallocated_finding *finding = vol->unallocated[i];
+        struct fg_range listed[MAX_REPORTED_RANGES];
+        struct fg_ranges ranges = export_ranges(&finding->ranges, listed);
+        struct fg_unallocated run = {finding->first_cluster, finding->cluster_count, &ranges};
+        if (fn(&run, context))
+            break;
+    }
+    return FG_OK;
+}
+
+// fg_volume_stats holds the phases and the latency histogram of perf_stats one to one
+_Static_assert(FG_PHASE_COUNT == PERF_PHASE_COUNT && FG_LATENCY_BUCKETS == PERF_LATENCY_BUCKETS, "fg_volume_stats does not match perf_stats");
+
+/**
+ * @brief Reports what the volume's index, walk and allocators did, and with collect_stats the
+ * time and I/O of each phase
+ *
+ * @param vol
+ * @param stats
+ */
+void fg_volume_get_stats(fg_volume *vol, struct fg_volume_stats *stats){
+    struct arena_stats arena;
+    struct buffer_pool_stats buffers;
+
+    memset(stats, 0, sizeof(struct fg_volume_stats));
+    stats->chain_count = vol->fat_index.chain_count;
+    stats->extent_count = vol->fat_index.extent_count;
+    stats->index_loaded = vol->indexed;
+    stats->tree_loaded = vol->tree != NULL && !vol->walked;
+    stats->rescanned = vol->rescanned;
+    stats->slack_checked = vol->slack_checked;
+    stats->slack_reused = vol->slack_reused;
+    stats->unallocated_checked = vol->unallocated_checked;
+    stats->free_clusters = vol->free_clusters;
+    stats->free_runs = vol->free_runs;
+    stats->unallocated_findings = vol->unallocated_count;
+    arena_get_stats(vol->arena, &arena);
+    buffer_pool_get_stats(vol->buffers, &buffers);
+    stats->arena_allocations = arena.allocations;
+    stats->arena_bytes = arena.bytes;
+    stats->arena_blocks = arena.blocks;
+    stats->buffers_acquired = buffers.acquired;
+    stats->buffers_allocated = buffers.allocated;
+    stats->buffer_bytes = buffers.bytes;
+    for (int i = 0; i < PERF_PHASE_COUNT; i++){
+        struct perf_phase_stats *phase = &vol->perf.phases[i];
+        stats->phases[i] = (struct fg_phase_stats){__atomic_load_n(&phase->wall_ns, __ATOMIC_RELAXED), __atomic_load_n(&phase->cpu_ns, __ATOMIC_RELAXED),
+            __atomic_load_n(&phase->syscalls, __ATOMIC_RELAXED), __atomic_load_n(&phase->bytes_read, __ATOMIC_RELAXED),
+            __atomic_load_n(&phase->entries, __ATOMIC_RELAXED), __atomic_load_n(&phase->clusters, __ATOMIC_RELAXED)};
+    }
+    for (int i = 0; i < PERF_LATENCY_BUCKETS; i++)
+        stats->read_latency[i] = __atomic_load_n(&vol->perf.latency[i], __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Lookup of an MBR partition type code's name
+ */
+const char *fg_partition_type_name(uint8_t type){
+    return partition_type_txt[type];
+}
+
+/**
+ * @brief Tells whether an MBR or EBR partition type code is one of the FAT types, hidden ones included
+ */
+bool fg_is_fat_partition(uint8_t type){
+    // The hidden types are the visible ones with 0x10 set
+    if (type == FG_HIDDEN_FAT12 || type == FG_HIDDEN_FAT16 || type == FG_HIDDEN_FAT16B || type == FG_HIDDEN_FAT16_LBA || type == FG_HIDDEN_FAT32_CHS || type == FG_HIDDEN_FAT32)
+        type &= ~0x10;
+    return type == FG_FAT12 || type == FG_FAT16 || type == FG_FAT16B || type == FG_FAT16_LBA || type == FG_FAT32_CHS || type == FG_FAT32;
+}
+
+/**
+ * @brief Tells whether a file is a segment of a split raw image after the first one (.002, ...),
+ * which is read as part of the image opened through the first segment (.001)
+ */
+bool fg_is_later_segment(const char *path){
+    return disk_image_is_later_segment(path);
+}
+
+/**
+ * @brief Returns the name of a phase of fg_volume_stats.phases, e.g. "tree_walk"
+ */
+const char *fg_phase_name(int phase){
+    return (phase >= 0 && phase < FG_PHASE_COUNT) ? perf_phase_name(phase) : "";
+}
+
+/**
+ * @brief Releases everything the volume holds, and the handle itself
+ *
+ * @param vol may be NULL
+ */
+void fg_volume_close(fg_volume *vol){
+    if (vol == NULL)
+        return;
+    if (!vol->disk_borrowed)
+        disk_image_close(vol->disk); // unmap and close the image
+    free(vol->fat1);
+    free(vol->fat12);
+    page_cache_destroy(vol->fat_cache);
+    free_fat_extent_index(vol);
+    dir_tree_destroy(vol->tree);
+    free(vol->unallocated);
+    if (vol->index_map != NULL)
+        munmap(vol->index_map, vol->index_map_size);
+    buffer_pool_destroy(vol->buffers);
+    arena_destroy(vol->arena);
+    free(vol);
+}
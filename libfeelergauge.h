@@ -0,0 +1,314 @@
+/**
+ * @file libfeelergauge.h
+ * @brief Feeler Gauge as a library (libfeelergauge.a / libfeelergauge.so).  Everything a scan
+ * needs lives in an opaque volume handle, so any number of images can be scanned at once from
+ * different threads, one handle per image.  The steps of a scan are separate calls made in order:
+ *
+ *   fg_volume_create -> fg_volume_open -> raw images:  fg_read_mbr -> fg_check_partition_gaps
+ *                                         FAT volumes: fg_read_boot_sector -> fg_load_fat
+ *                                                      -> fg_walk -> fg_save_index
+ *                                                      -> fg_check_unallocated
+ *
+ * The FAT partitions of a raw image are scanned through handles of their own, opened with
+ * fg_volume_open_partition on the raw image's handle so they all share its reads.
+ *   results: fg_for_each_entry, fg_for_each_finding, fg_volume_get_stats, then fg_volume_close
+ *
+ * Nothing is printed and nothing exits.  Every call returns an fg_status, and the first error a
+ * volume runs into sticks to it: later calls on the volume return the same status, and
+ * fg_volume_error describes it.  Oddities that do not stop a scan are collected as fg_warning bits.
+ * Results are handed to callbacks as they are found, and point into the volume, so they are only
+ * valid until the callback returns.
+ *
+ * Only the SIMD kernel selection is process-wide, it is made once on the first fg_volume_create.
+ * Everything else, the per-phase timing and I/O statistics (collect_stats) included, belongs to a
+ * volume and is returned by fg_volume_get_stats.  Callers add the statistics up over volumes.
+ */
+#ifndef LIBFEELERGAUGE_H
+#define LIBFEELERGAUGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+// Functions exported by the shared library, the rest of it is built with hidden visibility
+#define FG_API __attribute__((visibility("default")))
+
+/**
+ * @brief Common partition type codes for MBR entries
+ */
+enum fg_partition_type {
+    FG_FAT12 = 0x1,
+    FG_FAT16 = 0x4,
+    FG_FAT16B = 0x6,
+    FG_FAT16_LBA = 0x0E,
+    FG_FAT32_CHS = 0x0B,
+    FG_FAT32 = 0x0C, //FAT32 with LBA
+    FG_HIDDEN_FAT12 = 0x11,
+    FG_HIDDEN_FAT16 = 0x14,
+    FG_HIDDEN_FAT16B = 0x16,
+    FG_HIDDEN_FAT16_LBA = 0x1E,
+    FG_HIDDEN_FAT32_CHS = 0x1B,
+    FG_HIDDEN_FAT32 = 0x1C,
+    FG_EXTENDED = 0x05,
+    FG_EXTENDED_LBA = 0x0F,
+    FG_NTFS = 0x7,
+    FG_LINUX_SWAP = 0x82,
+    FG_LINUX_FILE_SYS = 0x83,
+    FG_EMPTY_ENTRY = 0x00,
+    FG_RAW = 0
+};
+
+enum fg_media_type{
+    FG_MEDIA_REMOVABLE = 0xf0,
+    FG_MEDIA_FIXED = 0xf8
+};
+
+// Sector size assumed for MBR/EBR partition tables
+#define FG_MBR_BYTES_PER_SECTOR 512
+
+// Reference for MBR and EBR data structure and offsets:
+// https://thestarman.pcministry.com/asm/mbr/PartTables.htm
+typedef struct fg_ebr_table {
+    uint32_t offset; // The lba of this ebr_entry
+    uint8_t partition_type; // of the logical partition
+    uint32_t starting_sector; // add offset + starting sector to find first block of partition
+    uint32_t partition_size;  // size in sectors
+    uint32_t next_partition_ebr; // relative to the start of the extended partition, 0 for the last EBR
+    struct fg_ebr_table *next_ebr_table;
+} fg_ebr_table;
+
+// Struct to store MBR fields
+typedef struct fg_partition_table {
+    // Booleans to specify if flag was present
+    uint8_t boot_indicator;
+    uint8_t partition_type;
+    uint32_t starting_sector;
+    uint32_t partition_size;  // size in sectors
+    struct fg_ebr_table *ebr_table; // chain of logical partitions, NULL if partition is not extended
+} fg_partition_table;
+
+// Struct to store array of MBR Table Entries
+typedef struct fg_mbr_sector {
+    struct fg_partition_table entry[4];
+} fg_mbr_sector;
+
+// Struct to store FAT Boot Sector fields
+typedef struct fg_boot_sector {
+    bool is_fat32;
+    bool is_fat16;
+    bool is_fat12;
+
+    char oem_name[9];
+    uint16_t bytes_per_sector;
+    uint8_t sectors_per_cluster;
+    uint16_t reserved_area_size; // size is in sectors
+    uint8_t number_of_fats;
+    uint16_t max_files_in_root;
+    uint16_t sector_count_16b;
+    uint8_t media_type;
+    uint16_t fat_size_in_sectors;  // used for FAT12/16, will be 0 in FAT32
+    uint16_t sectors_per_track;
+    uint16_t head_number;
+    uint32_t sectors_before_partition;
+    uint32_t sector_count_32b; // if this is set, sector_count must be 0
+    uint8_t bios_drive_number;
+    uint8_t extended_boot_sig;
+    uint32_t volume_serial;
+    char volume_label[12];
+    char fs_type_label[9]; // not required, but can be FAT, FAT12, FAT16
+    uint16_t fs_signature;
+
+    // The below fields only apply to FAT32
+    uint32_t fat32_size_in_sectors;
+    uint16_t fat_mode;
+    uint16_t fat32_version;
+    uint32_t root_dir_cluster;
+    uint16_t fsinfo_sector_addr;
+    uint16_t backup_boot_sector_addr;
+    uint8_t fat32_bios_drive_number;
+    uint8_t fat32_extended_boot_sig;
+    uint32_t fat32_volume_serial;
+    char fat32_volume_label[12];
+    char fat32_fs_type_label[9];
+
+} fg_boot_sector;
+
+typedef struct fat_volume fg_volume;
+
+// Suffix of volume index files, which are conventionally named after the image they were made from
+#define FG_VOLUME_INDEX_SUFFIX ".fgidx"
+
+// Result of every call, the first error of a volume sticks to it
+typedef enum fg_status {
+    FG_OK,
+    FG_ERROR_OPEN, // the image could not be opened
+    FG_ERROR_READ, // a read of the image failed part way through
+    FG_ERROR_NOT_IMAGE, // no partition or MBR signature
+    FG_ERROR_TYPE_MISMATCH, // the detected type is not fg_options.expected_type
+    FG_ERROR_BOOT_SECTOR, // the boot sector is invalid
+    FG_ERROR_STATE, // the call does not apply to the volume, or an earlier step is missing
+    FG_ERROR_WRITE, // an output (FAT dump) could not be written, does not stick to the volume
+    FG_ERROR_MEMORY // an allocation failed
+} fg_status;
+
+// Oddities that do not stop a scan, see fg_volume_warnings
+typedef enum fg_warning {
+    FG_WARNING_FAT_TYPE_CONFLICT = 1 << 0, // indicators for both FAT12/16 and FAT32
+    FG_WARNING_MEDIA_TYPE = 1 << 1, // media type is neither removable nor fixed
+    FG_WARNING_SECTOR_COUNTS = 1 << 2, // both the 16 and 32 bit sector counts are set, the 32 bit one is used
+    FG_WARNING_INDEX_NOT_WRITTEN = 1 << 3, // the volume index could not be written
+    FG_WARNING_BASELINE_UNUSABLE = 1 << 4, // the re-scan baseline does not fit the volume, every file was checked
+    FG_WARNING_EBR_CHAIN = 1 << 5 // an EBR chain is broken or loops, logical partitions past that point are missing
+} fg_warning;
+
+// Options of a volume, zeroed fields take their defaults
+typedef struct fg_options {
+    bool require_type; // fail with FG_ERROR_TYPE_MISMATCH unless the image is expected_type
+    int expected_type; // FG_FAT12, FG_FAT16, FG_FAT32, FG_NTFS or FG_RAW
+    int threads; // # of threads walking the directory tree, 1 if 0
+    bool check_slack; // check the slack of every file's last cluster for hidden data
+    bool sequential_slack; // check slack in one sequential pass over the clustered area
+    size_t cache_bytes; // chunk cache of a compressed image, 0 for the default
+    size_t max_fat_bytes; // page FAT1 through a cache of this size instead of loading it, 0 to load it
+    const char *index_path; // volume index to load and save, NULL for none
+    const char *rescan_path; // volume index of an earlier acquisition to re-scan against, NULL for none
+    bool collect_stats; // time each phase and count its I/O, see fg_volume_stats.phases
+    bool concurrent_stats; // other volumes are scanned at the same time, a phase's CPU time is then that of its own thread
+} fg_options;
+
+// A file or directory, as found by the tree walk
+typedef struct fg_entry {
+    uint32_t index; // stable for the life of the volume, the root directory is 0
+    uint32_t parent;
+    uint32_t depth; // 1 for entries of the root directory
+    const char *short_name; // the 8.3 name as stored on disk (11 characters)
+    const char *long_name; // UTF-8, NULL if the entry has none
+    uint8_t attributes;
+    bool is_directory;
+    uint32_t first_cluster;
+    uint32_t last_cluster; // 0 for empty files
+    uint32_t file_size; // in bytes
+    uint8_t created_time_tenths;
+    uint16_t created_time_hms;
+    uint16_t created_day;
+    uint16_t accessed_day;
+    uint16_t written_time_hms;
+    uint16_t written_day;
+} fg_entry;
+
+// A run of non-zero bytes, or of FAT entries
+typedef struct fg_range {
+    uint64_t start; // offset of the first byte, or the first entry #
+    uint64_t length;
+} fg_range;
+
+// The runs found in a region, only the first few are listed
+typedef struct fg_ranges {
+    const struct fg_range *range;
+    size_t stored; // # of runs listed in range
+    uint64_t found; // # of runs found, can be larger than stored
+    uint64_t nonzero_bytes; // bytes (or entries) covered by every run found
+} fg_ranges;
+
+// Formats of fg_dump_fat
+typedef enum fg_dump_format {
+    FG_DUMP_TEXT,
+    FG_DUMP_CSV,
+    FG_DUMP_BINARY // little endian header and entry runs, see fat_dump.h
+} fg_dump_format;
+
+// Data found in the slack of a file's last cluster
+typedef struct fg_finding {
+    const struct fg_entry *entry;
+    uint64_t cluster_offset; // of the last cluster, in bytes from the start of the image
+    const struct fg_ranges *ranges; // runs of non-zero bytes, offsets are within the cluster
+} fg_finding;
+
+// Data found in the space around the partitions of a raw image
+typedef struct fg_gap {
+    int after_entry; // the gap follows this MBR entry, -1 for the gap in front of entry 0
+    const struct fg_ranges *ranges; // offsets are from the start of the image
+} fg_gap;
+
+// Data found in clusters the FAT marks free
+typedef struct fg_unallocated {
+    uint32_t first_cluster; // of the run of free clusters
+    uint32_t cluster_count; // # of clusters in the run
+    const struct fg_ranges *ranges; // offsets are from the start of the image
+} fg_unallocated;
+
+// Entries of a FAT copy that differ from FAT1
+typedef struct fg_fat_mismatch {
+    int copy; // 2 for FAT2, ...
+    const struct fg_ranges *entries; // ranges of entry numbers, nonzero_bytes counts entries
+} fg_fat_mismatch;
+
+// Phases of a scan, named by fg_phase_name.  Opening the image and FAT dumps count as phase 0, "other".
+#define FG_PHASE_COUNT 8
+// Read latency histogram: bucket 0 counts reads under 1 us, bucket n reads of [2^(n-1), 2^n) us, the last one everything slower
+#define FG_LATENCY_BUCKETS 25
+
+// Time and I/O of one phase of a scan
+typedef struct fg_phase_stats {
+    uint64_t wall_ns;
+    uint64_t cpu_ns;
+    uint64_t syscalls;
+    uint64_t bytes_read; // read through a syscall or viewed through the mapping
+    uint64_t entries; // FAT entries, directory entries or files processed
+    uint64_t clusters;
+} fg_phase_stats;
+
+typedef struct fg_volume_stats {
+    uint32_t chain_count; // cluster chains in the FAT extent index
+    uint32_t extent_count;
+    bool index_loaded; // the extent index came from the volume index
+    bool tree_loaded; // the directory tree and slack findings came from the volume index
+    bool rescanned; // the walk took unchanged files' results from a baseline
+    uint64_t slack_checked; // files whose slack was checked by the walk
+    uint64_t slack_reused; // files whose result was taken over from the baseline
+    bool unallocated_checked; // fg_check_unallocated was run
+    uint64_t free_clusters; // clusters the FAT marks free
+    uint32_t free_runs; // runs of adjacent free clusters
+    uint32_t unallocated_findings; // runs of free clusters holding data
+    uint64_t arena_allocations;
+    uint64_t arena_bytes;
+    uint64_t arena_blocks;
+    uint64_t buffers_acquired;
+    uint64_t buffers_allocated;
+    uint64_t buffer_bytes;
+    struct fg_phase_stats phases[FG_PHASE_COUNT]; // all zero unless collect_stats
+    uint64_t read_latency[FG_LATENCY_BUCKETS]; // reads that went to the operating system
+} fg_volume_stats;
+
+// Callbacks, return nonzero from an entry, finding or unallocated callback to stop the iteration
+typedef int (*fg_entry_fn)(const struct fg_entry *entry, void *context);
+typedef int (*fg_finding_fn)(const struct fg_finding *finding, void *context);
+typedef int (*fg_unallocated_fn)(const struct fg_unallocated *run, void *context);
+typedef void (*fg_gap_fn)(const struct fg_gap *gap, void *context);
+typedef void (*fg_fat_mismatch_fn)(const struct fg_fat_mismatch *mismatch, void *context);
+
+FG_API fg_volume *fg_volume_create(const struct fg_options *options);
+FG_API fg_status fg_volume_open(fg_volume *vol, const char *path);
+FG_API fg_status fg_volume_open_partition(fg_volume *vol, fg_volume *image, uint64_t offset);
+FG_API int fg_volume_type(fg_volume *vol);
+FG_API const char *fg_volume_error(fg_volume *vol);
+FG_API unsigned fg_volume_warnings(fg_volume *vol);
+FG_API fg_status fg_read_mbr(fg_volume *vol, struct fg_mbr_sector *mbr);
+FG_API fg_status fg_check_partition_gaps(fg_volume *vol, const struct fg_mbr_sector *mbr, fg_gap_fn fn, void *context);
+FG_API fg_status fg_read_boot_sector(fg_volume *vol, struct fg_boot_sector *boot_sector);
+FG_API fg_status fg_load_fat(fg_volume *vol, fg_fat_mismatch_fn fn, void *context);
+FG_API fg_status fg_dump_fat(fg_volume *vol, FILE *out, enum fg_dump_format format);
+FG_API fg_status fg_walk(fg_volume *vol);
+FG_API fg_status fg_save_index(fg_volume *vol);
+FG_API fg_status fg_for_each_entry(fg_volume *vol, fg_entry_fn fn, void *context);
+FG_API fg_status fg_for_each_finding(fg_volume *vol, fg_finding_fn fn, void *context);
+FG_API fg_status fg_check_unallocated(fg_volume *vol, fg_unallocated_fn fn, void *context);
+FG_API void fg_volume_get_stats(fg_volume *vol, struct fg_volume_stats *stats);
+FG_API const char *fg_partition_type_name(uint8_t type);
+FG_API bool fg_is_fat_partition(uint8_t type);
+FG_API bool fg_is_later_segment(const char *path);
+FG_API const char *fg_phase_name(int phase);
+FG_API void fg_volume_close(fg_volume *vol);
+
+#endif
@@ -12,15 +12,18 @@
 
 #include "main.h"
 
-cmd_line args = {0};
-bool hidden_data_found = false;
 /**
- * @brief Convert Cluster to Sector
+ * @brief Exits when an allocation failed, there is no sensible way to carry on a scan without it
  * 
- * @return uint32_t sector
+ * @param pointer result of the allocation
+ * @return void* : pointer, which is never NULL
  */
-uint32_t cts(uint32_t cluster){
-    return ((cluster - 2) * (spc * bps) + reserved_and_fats);
+void *check_allocation(void *pointer){
+    if (pointer == NULL){
+        fprintf(stderr, "Aborting... Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+    return pointer;
 }
 
 /**
@@ -33,14 +36,26 @@ uint32_t cts(uint32_t cluster){
  */
 int read_args(struct cmd_line *args, int argc, char *argv[]) {
     int opt;
+    static const struct option long_options[] = {
+        {"max-mem", required_argument, NULL, 'm'},
+        {"index", optional_argument, NULL, 'x'},
+        {"rescan", required_argument, NULL, 'r'},
+        {"stats", optional_argument, NULL, 't'},
+        {"dump-fat", required_argument, NULL, 'd'},
+        {"dump-format", required_argument, NULL, 'o'},
+        {"batch", required_argument, NULL, 'b'},
+        {"io-jobs", required_argument, NULL, 'n'},
+        {NULL, 0, NULL, 0}
+    };
     if (argc == 1){ //runs if no cmd line arguments are provided
         fprintf(stderr, "\nUsage: %s %s", argv[0], cmd_line_error);
         exit(EXIT_FAILURE);
     }
 
     strncpy(args->argv0, argv[0], 255);
+    args->threads = 1;
 
-    while ((opt = getopt(argc, argv, "i:f:vh")) != -1) {
+    while ((opt = getopt_long(argc, argv, "i:f:vhuj:sc:m:", long_options, NULL)) != -1) {
         switch (opt) {
         case 'i':
             args->i_flag = true;
@@ -59,11 +74,100 @@ int read_args(struct cmd_line *args, int argc, char *argv[]) {
         case 'h':
             args->h_flag = true;
             break;
+        case 'u':
+            args->u_flag = true;
+            break;
+        case 's':
+            args->s_flag = true;
+            break;
+        case 'c':
+            args->c_flag = true;
+            args->cache_mib = atol(optarg);
+            if (args->cache_mib < 1){
+                fprintf(stderr, "\nError! The cache size must be at least 1 MiB. < -c >\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'x':
+            args->x_flag = true;
+            if (optarg != NULL)
+                strncpy(args->index_dir, optarg, 254);
+            break;
+        case 'r':
+            // The re-scan is saved as the baseline of the next one
+            args->r_flag = true;
+            args->x_flag = true;
+            strncpy(args->rescan_path, optarg, 254);
+            break;
+        case 't':
+            args->t_flag = true;
+            if (optarg != NULL && strcmp(optarg, "json") && strcmp(optarg, "table")){
+                fprintf(stderr, "\nError! The statistics format must be table or json. < --stats >\n");
+                exit(EXIT_FAILURE);
+            }
+            args->stats_json = (optarg != NULL && !strcmp(optarg, "json"));
+            break;
+        case 'd':
+            args->d_flag = true;
+            strncpy(args->dump_path, optarg, 254);
+            break;
+        case 'o':
+            if (!strcmp(optarg, "text"))
+                args->dump_format = FG_DUMP_TEXT;
+            else if (!strcmp(optarg, "csv"))
+                args->dump_format = FG_DUMP_CSV;
+            else if (!strcmp(optarg, "binary"))
+                args->dump_format = FG_DUMP_BINARY;
+            else{
+                fprintf(stderr, "\nError! The FAT dump format must be text, csv or binary. < --dump-format >\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'b':
+            args->b_flag = true;
+            strncpy(args->batch_path, optarg, 254);
+            break;
+        case 'n':
+            args->io_jobs = atoi(optarg);
+            if (args->io_jobs < 1 || args->io_jobs > 256){
+                fprintf(stderr, "\nError! The number of images reading at once must be between 1 and 256. < --io-jobs >\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'm':
+            args->m_flag = true;
+            args->max_mem_mib = atol(optarg);
+            if (args->max_mem_mib < 1){
+                fprintf(stderr, "\nError! The memory budget must be at least 1 MiB. < --max-mem >\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'j':
+            args->j_flag = true;
+            args->threads = atoi(optarg);
+            if (args->threads < 1 || args->threads > 256){
+                fprintf(stderr, "\nError! The number of threads must be between 1 and 256. < -j >\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
         default:
             fprintf(stderr, "\nUsage: %s %s", argv[0], cmd_line_error);
             exit(EXIT_FAILURE);
         }
     }
+    // The report goes to the same stream, csv and binary records would end up in the middle of it
+    if (args->d_flag && !strcmp(args->dump_path, "-") && args->dump_format != FG_DUMP_TEXT){
+        fprintf(stderr, "\nError! Only the text FAT dump can be written into the report, write csv and binary dumps to a file. < --dump-fat >\n");
+        exit(EXIT_FAILURE);
+    }
+    if (args->b_flag){
+        // The images of a batch come from the manifest, and their types are detected unless -f is given
+        if (args->i_flag || args->r_flag){
+            fprintf(stderr, "\nError! A batch takes its images from the manifest or directory, -i and --rescan are for a single image. < --batch >\n");
+            exit(EXIT_FAILURE);
+        }
+        return 0;
+    }
     if (args->i_flag == false){
         fprintf(stderr, "\nError! You must specify a disk image. < -i >\n");
     }
@@ -84,23 +188,23 @@ int read_args(struct cmd_line *args, int argc, char *argv[]) {
  */
 int verify_fs_arg(struct cmd_line *args){
     if (!strncmp("fat32", args->file_system, 5)){
-        args->fs_type = FAT32;
+        args->fs_type = FG_FAT32;
         return 0;
     }
     if (!strncmp("fat16", args->file_system, 5)){
-        args->fs_type = FAT16;
+        args->fs_type = FG_FAT16;
         return 0;
     }
     if (!strncmp("fat12", args->file_system, 5)){
-        args->fs_type = FAT12;
+        args->fs_type = FG_FAT12;
         return 0;
     }
     if (!strncmp("ntfs", args->file_system, 4)){
-        args->fs_type = NTFS;
+        args->fs_type = FG_NTFS;
         return 0;
     }
     if (!strncmp("raw", args->file_system, 3)){
-        args->fs_type = RAW;
+        args->fs_type = FG_RAW;
         return 0;
     }
 
@@ -112,956 +216,884 @@ int verify_fs_arg(struct cmd_line *args){
 }
 
 /**
- * @brief Attempts to open the disk image supplied by the user.
+ * @brief Prints out information parsed from Fat Boot Sector
  * 
- * @param args : struct containing the various cmd line arguments supplied by the user
- * @return int : return fp if successful, -1 if an error occurs
+ * @param fat_sector 
  */
-int open_disk_image(struct cmd_line *args){
-    int fp = open(args->image_path, O_RDONLY);
-    // Ensure the file open was successful
-    if (fp == -1) {
-        fprintf(stderr,
-            "Aborting... Could not read/access the file located at: %s\n",
-            args->image_path);
-        exit(EXIT_FAILURE);
+void print_fat_boot_sector_info(FILE *out, struct fg_boot_sector *fat_sector){
+    fprintf(out, "\nFAT File System Information\n\n");
+    
+    if (fat_sector->is_fat32)
+        fprintf(out, "File System Type: FAT32\n");
+    if (fat_sector->is_fat16)
+        fprintf(out, "File System Type: FAT16\n");
+    if (fat_sector->is_fat12)
+        fprintf(out, "File System Type: FAT12\n");
+
+    switch (fat_sector->media_type){
+        case FG_MEDIA_FIXED:
+            fprintf(out, "Media Type: Fixed\n");
+            break;
+        case FG_MEDIA_REMOVABLE:
+            fprintf(out, "Media Type: Removable\n");
+            break;
+        default:
+            fprintf(out, "Media Type: Unknown\n");
+            break;
+    }
+    
+    fprintf(out, "OEM Name: %s\n", fat_sector->oem_name);
+    if(fat_sector->is_fat32){
+        fprintf(out, "Volume Serial: 0x%zx\n", (size_t)fat_sector->fat32_volume_serial);
+        fprintf(out, "Volume Label: %s\n", fat_sector->fat32_volume_label);
+        fprintf(out, "File System Label: %s\n", fat_sector->fat32_fs_type_label);
+    }
+    else{
+        fprintf(out, "Volume Serial: 0x%zx\n", (size_t)fat_sector->volume_serial);
+        fprintf(out, "Volume Label: %s\n", fat_sector->volume_label);
+        fprintf(out, "File System Label: %s\n", fat_sector->fs_type_label);
+    }
+    fprintf(out, "Bytes per sector: %d\n", fat_sector->bytes_per_sector);
+    fprintf(out, "Sectors per cluster: %d\n", fat_sector->sectors_per_cluster);
+    fprintf(out, "Size of Reserved Area (in sectors): %d\n", fat_sector->reserved_area_size);
+    fprintf(out, "Number of FATs: %d\n", fat_sector->number_of_fats);
+    
+    if (fat_sector->sector_count_32b)
+        fprintf(out, "Number of sectors: %d\n", fat_sector->sector_count_32b);
+    else
+        fprintf(out, "Number of sectors: %d\n", fat_sector->sector_count_16b);
+
+    fprintf(out, "Sectors before start of partition: %d\n", fat_sector->sectors_before_partition);
+    
+    if(fat_sector->is_fat32){
+        fprintf(out, "FAT size in sectors: %d\n", fat_sector->fat32_size_in_sectors);
+        fprintf(out, "Root Dir Cluster: %d\n", fat_sector->root_dir_cluster);
+    }
+    else{
+        fprintf(out, "FAT size in sectors: %d\n", fat_sector->fat_size_in_sectors);
+        fprintf(out, "Maximum number of files in Root Dir: %d\n", fat_sector->max_files_in_root);
     }
-    return fp;
 }
 
-int read_mbr_sector(int fp, struct mbr_sector *mbr){
-    int mbr_sector_offsets[4] = {MBR_PART1_OFF, MBR_PART2_OFF, MBR_PART3_OFF, MBR_PART4_OFF};
-    uint8_t buf[1] = {0};
-    uint32_t buf32[1] = {0};
-    bool extended_found = false;
-    uint8_t extended_entry[4] = {0};
+/**
+ * @brief Prints out information parsed from MBR
+ * 
+ * @param out 
+ * @param mbr 
+ */
+void print_mbr_info(FILE *out, struct fg_mbr_sector *mbr){
+    // print out the headers first
+    fprintf(out, "%-8s %-4s %12s %12s %12s   %4s   %-25s\n", header[0], header[1], header[2], header[3], header[4], header[5], header[6]);
 
-    // Parse MBR
     for (int i = 0; i < 4; i++){
-        // Check for extended partitions within MBR
-        if (pread(fp, buf, 1, mbr_sector_offsets[i] + PARTITION_TYPE) < 0)
-            read_error();
-        if (buf[0] == EXTENDED || buf[0] == EXTENDED_LBA){
-            extended_found = true;
-            extended_entry[i] = true;
-        }
+        char bootable;
+
+        if (mbr->entry[i].boot_indicator == 0)
+            bootable = 'N';
+        else
+            bootable = 'Y';
 
-        // Get Partiton Type
-        if (pread(fp, buf, 1, mbr_sector_offsets[i] + PARTITION_TYPE) < 0)
-            read_error();
-        mbr->entry[i].partition_type = buf[0];
-
-        // Get Boot Indicator Status
-        if (pread(fp, buf, 1, mbr_sector_offsets[i] + BOOT_INDICATOR) < 0)
-            read_error();
-        mbr->entry[i].boot_indicator = buf[0];
-
-        // Get Starting Sector
-        if (pread(fp, buf32, 4, mbr_sector_offsets[i] + STARTING_SECTOR) < 0)
-            read_error();
-        mbr->entry[i].starting_sector = buf32[0];
-
-        // Get Partition Size
-        if (pread(fp, buf32, 4, mbr_sector_offsets[i] + PARTITION_SIZE) < 0)
-            read_error();
-        mbr->entry[i].partition_size = buf32[0];
+        fprintf(out, "%-8d %-4c %12ju %12ju %12ju   %#04x   %-25s\n", 
+        i, bootable, (uintmax_t)mbr->entry[i].starting_sector, 
+        (uintmax_t)(mbr->entry[i].starting_sector + mbr->entry[i].partition_size), 
+        (uintmax_t)mbr->entry[i].partition_size, mbr->entry[i].partition_type, 
+        fg_partition_type_name(mbr->entry[i].partition_type));
     }
-    
-    // Will be used once extended entry support is added
-    if (extended_found){
-        for (int i = 0; i < 4; i++){
-            if (extended_entry[i])
-                continue;
+
+    // Logical partitions follow, numbered on from the MBR entries, with absolute sectors
+    int number = 4;
+    for (int i = 0; i < 4; i++){
+        for (struct fg_ebr_table *ebr = mbr->entry[i].ebr_table; ebr != NULL; ebr = ebr->next_ebr_table){
+            uint64_t start = (uint64_t)ebr->offset + ebr->starting_sector;
+            fprintf(out, "%-8d %-4c %12ju %12ju %12ju   %#04x   %-25s\n", 
+            number++, 'N', (uintmax_t)start, (uintmax_t)(start + ebr->partition_size), 
+            (uintmax_t)ebr->partition_size, ebr->partition_type, fg_partition_type_name(ebr->partition_type));
         }
     }
-    return 0;
 }
 
+/**
+ * @brief Prints the runs of non-zero bytes found by a scan, one line for each run the library listed
+ *
+ * @param out
+ * @param ranges
+ * @param location describes what the run offsets are relative to (e.g. "cluster offset")
+ */
+void print_nonzero_ranges(FILE *out, const struct fg_ranges *ranges, const char *location){
+    for (size_t i = 0; i < ranges->stored; i++){
+        fprintf(out, "    Non-zero bytes at %s 0x%jx - 0x%jx (%ju bytes)\n", location,
+            (uintmax_t)ranges->range[i].start,
+            (uintmax_t)(ranges->range[i].start + ranges->range[i].length - 1),
+            (uintmax_t)ranges->range[i].length);
+    }
+    if (ranges->found > ranges->stored)
+        fprintf(out, "    ... %ju more runs, %ju non-zero bytes in total\n",
+            (uintmax_t)(ranges->found - ranges->stored), (uintmax_t)ranges->nonzero_bytes);
+}
 
 /**
- * @brief Runs a series of calculations to determine FAT File System Type.  Can differentiate
- * between FAT12, FAT16, and FAT32.  Formula based on page 229 of File System Forensic Analysis 
- * book by Brian Carrier
+ * @brief Builds the path of the volume index: the image path plus FG_VOLUME_INDEX_SUFFIX, in the
+ * --index directory if one was given.  A partition's index is told apart by its entry # (.p<n>).
  * 
- * @param fat_sector 
+ * @param args 
+ * @param partition entry # of the partition, -1 for an image of a single volume
+ * @param path receives the path
+ * @param size size of path
  */
-void calc_fat_type(struct fat_boot_sector *fat_sector){
-    uint32_t root_dir_sectors = ((fat_sector->max_files_in_root * 32) + (bps - 1)) / bps;
-    uint32_t sectors_to_clusters;
-    if (fat_sector->sector_count_16b)
-        sectors_to_clusters = fat_sector->sector_count_16b - fat_sector->reserved_area_size - (fat_sector->number_of_fats * fat_sector->fat_size_in_sectors) - root_dir_sectors;
+void volume_index_path(const struct cmd_line *args, int partition, char *path, size_t size){
+    const char *slash = strrchr(args->image_path, '/');
+    char suffix[32];
+
+    if (partition < 0)
+        snprintf(suffix, sizeof(suffix), "%s", FG_VOLUME_INDEX_SUFFIX);
     else
-        sectors_to_clusters = fat_sector->sector_count_32b - fat_sector->reserved_area_size - (fat_sector->number_of_fats * fat_sector->fat_size_in_sectors) - root_dir_sectors;
-    
-    uint32_t final_value = sectors_to_clusters/fat_sector->sectors_per_cluster;
-
-    if (final_value < 4085)
-        fat_sector->is_fat12 = true;
-    if (final_value >= 4085 && final_value < 65525)
-        fat_sector->is_fat16 = true;
-    if (final_value >= 65525)
-        fat_sector->is_fat32 = true;
-    // printf("Sectors in Root Dir: %d\n", root_dir_sectors);
-    // printf("Sectors allocated to clusters: %ju\n", sectors_to_clusters/fat_sector->sectors_per_cluster);
+        snprintf(suffix, sizeof(suffix), ".p%d%s", partition, FG_VOLUME_INDEX_SUFFIX);
+    if (args->index_dir[0] == '\0')
+        snprintf(path, size, "%s%s", args->image_path, suffix);
+    else
+        snprintf(path, size, "%s/%s%s", args->index_dir, slash ? slash + 1 : args->image_path, suffix);
 }
 
 /**
- * @brief 
+ * @brief fg_fat_mismatch_fn: prints the entries a FAT copy differs from FAT1 in
  * 
- * @param fp 
- * @param mbr
- * @param partition_offset If a raw/full disk image is used, this is
- * the offset within the disk image to the FAT boot sector
- * @return int 
+ * @param mismatch 
+ * @param context the image_scan
  */
-int read_fat_boot_sector(int fp, struct fat_boot_sector *fat_sector, int partition_offset){
-    char str_buf[12];
+void print_fat_mismatch(const struct fg_fat_mismatch *mismatch, void *context){
+    struct image_scan *scan = context;
+    const struct fg_ranges *ranges = mismatch->entries;
+
+    fprintf(scan->out, "Detected discrepencies between FAT1 and FAT%d in the following entries.\n", mismatch->copy);
+    for (size_t i = 0; i < ranges->stored; i++){
+        fprintf(scan->out, "    Entries 0x%jx - 0x%jx (%ju entries)\n", (uintmax_t)ranges->range[i].start,
+            (uintmax_t)(ranges->range[i].start + ranges->range[i].length - 1), (uintmax_t)ranges->range[i].length);
+    }
+    if (ranges->found > ranges->stored)
+        fprintf(scan->out, "    ... %ju more ranges\n", (uintmax_t)(ranges->found - ranges->stored));
+    fprintf(scan->out, "Total # of discrepencies identified between FAT1 and FAT%d: %ju entries in %ju ranges\n",
+        mismatch->copy, (uintmax_t)ranges->nonzero_bytes, (uintmax_t)ranges->found);
+}
 
-    // Get OEM Name
-    if (pread(fp, str_buf, 8, partition_offset + OEM_NAME) < 0)
-        read_error();
-    strncpy(fat_sector->oem_name, str_buf, 8);
+/**
+ * @brief fg_gap_fn: prints data found in the space around the partitions of a disk image
+ * 
+ * @param gap 
+ * @param context the image_scan
+ */
+void print_gap(const struct fg_gap *gap, void *context){
+    struct image_scan *scan = context;
 
-    // Get Bytes Per Sector
-    if (pread(fp, &fat_sector->bytes_per_sector, 2, partition_offset + BYTES_PER_SECTOR) < 0)
-        read_error();
-    
-    // Get Sectors Per Cluster
-    if (pread(fp, &fat_sector->sectors_per_cluster, 1, partition_offset + SECTORS_PER_CLUSTER) < 0)
-        read_error();
-    
-    // Get Reserved Area Size
-    if (pread(fp, &fat_sector->reserved_area_size, 2, partition_offset + RESERVED_AREA_SIZE) < 0)
-        read_error();
-    
-    // Get Number of Fats
-    if (pread(fp, &fat_sector->number_of_fats, 1, partition_offset + NUMBER_OF_FATS) < 0)
-        read_error();
-    
-    // Get Max Files in Root
-    if (pread(fp, &fat_sector->max_files_in_root, 2, partition_offset + MAX_FILES_IN_ROOT) < 0)
-        read_error();
-    
-    // Get Sector Count
-    if (pread(fp, &fat_sector->sector_count_16b, 2, partition_offset + SECTOR_COUNT_16B) < 0)
-        read_error();
-    
-    // Get Media Type
-    if (pread(fp, &fat_sector->media_type, 1, partition_offset + MEDIA_TYPE) < 0)
-        read_error();
-    
-    // Get Fat Size in Sectors
-    if (pread(fp, &fat_sector->fat_size_in_sectors, 2, partition_offset + FAT_SIZE_IN_SECTORS) < 0)
-        read_error();
-    
-    // Get Sectors Per Track
-    if (pread(fp, &fat_sector->sectors_per_track, 2, partition_offset + SECTORS_PER_TRACK) < 0)
-        read_error();
-    
-    // Get Number of Heads
-    if (pread(fp, &fat_sector->head_number, 2, partition_offset + HEAD_NUMBER) < 0)
-        read_error();
-    
-    // Get Sectors Before Partition
-    if (pread(fp, &fat_sector->sectors_before_partition, 4, partition_offset + SECTORS_BEFORE_PARTITION) < 0)
-        read_error();
-    
-    // Get Sector Count FAT32
-    if (pread(fp, &fat_sector->sector_count_32b, 4, partition_offset + SECTOR_COUNT_32B) < 0)
-        read_error();
-    
-    // Get BIOS Drive Number
-    if (pread(fp, &fat_sector->bios_drive_number, 1, partition_offset + BIOS_DRIVE_NUMBER) < 0)
-        read_error();
-    
-    // Get Extended Boot Signature
-    if (pread(fp, &fat_sector->extended_boot_sig, 1, partition_offset + EXTENDED_BOOT_SIG) < 0)
-        read_error();
-    
-    // Get Volume Serial
-    if (pread(fp, &fat_sector->volume_serial, 4, partition_offset + VOLUME_SERIAL) < 0)
-        read_error();
-    
-    // Get Volume Label
-    if (pread(fp, str_buf, 11, partition_offset + VOLUME_LABEL) < 0)
-        read_error();
-    strncpy(fat_sector->volume_label, str_buf, 11);
-
-    // Get File System Label
-    if (pread(fp, str_buf, 8, partition_offset + FS_TYPE_LABEL) < 0)
-        read_error();
-    strncpy(fat_sector->fs_type_label, str_buf, 8);
-
-    // Get File System Signature
-    if (pread(fp, &fat_sector->fs_signature, 2, partition_offset + FS_SIGNATURE) < 0)
-        read_error();
-
-    //Write Global VAR 'bps' - shortcut for Bytes Per Sector
-    bps = fat_sector->bytes_per_sector;
-
-    //Write Global VAR 'spc' - shortcut for Sectors Per Cluster
-    spc = fat_sector->sectors_per_cluster;
-
-
-    // Determine FAT Type (i.e. FAT12, FAT16, or FAT32)
-    calc_fat_type(fat_sector);
-
-    // If FAT32 is detected, read in extended FAT32 fields
-    if (fat_sector->is_fat32){
-
-        // Get FAT32 Size in Sectors
-        if (pread(fp, &fat_sector->fat32_size_in_sectors, 4, partition_offset + FAT32_SIZE_IN_SECTORS) < 0)
-            read_error();
-        
-        // Get FAT Mode
-        if (pread(fp, &fat_sector->fat_mode, 2, partition_offset + FAT_MODE) < 0)
-            read_error();
-
-        // Get FAT32 Version
-        if (pread(fp, &fat_sector->fat32_version, 2, partition_offset + FAT32_VERSION) < 0)
-            read_error();
-        
-        // Get Root Dir Cluster
-        if (pread(fp, &fat_sector->root_dir_cluster, 4, partition_offset + ROOT_DIR_CLUSTER) < 0)
-            read_error();
-        
-        // Get FSINFO
-        if (pread(fp, &fat_sector->fsinfo_sector_addr, 2, partition_offset + FSINFO_SECTOR) < 0)
-            read_error();
-        
-        // Get Backup Boot Sector Addr
-        if (pread(fp, &fat_sector->backup_boot_sector_addr, 2, partition_offset + BACKUP_BOOT_SECTOR_ADDR) < 0)
-            read_error();
-        
-        // Get FAT32 BIOS Drive Number
-        if (pread(fp, &fat_sector->fat32_bios_drive_number, 1, partition_offset + FAT32_BIOS_DRIVE_NUMBER) < 0)
-            read_error();
-        
-        // Get FAT32 Extended Boot Sig
-        if (pread(fp, &fat_sector->fat32_extended_boot_sig, 1, partition_offset + FAT32_EXTENDED_BOOT_SIG) < 0)
-            read_error();
-        
-        // Get FAT32 Volume Serial
-        if (pread(fp, &fat_sector->fat32_volume_serial, 4, partition_offset + FAT32_VOLUME_SERIAL) < 0)
-            read_error();
-        
-        // Get FAT32 Volume Label
-        if (pread(fp, str_buf, 11, partition_offset + FAT32_VOLUME_LABEL) < 0)
-            read_error();
-        strncpy(fat_sector->fat32_volume_label, str_buf, 11);
-
-        // Get FAT32 File System Label
-        if (pread(fp, str_buf, 8, partition_offset + FAT32_FS_TYPE_LABEL) < 0)
-            read_error();
-        strncpy(fat_sector->fat32_fs_type_label, str_buf, 8);
-    }
+    scan->hidden_data_found = true;
+    if (gap->after_entry < 0)
+        fprintf(scan->out, "Data potentially hidden before partition entry 0.\n");
+    else
+        fprintf(scan->out, "Data potentially hidden between partition entries %i and %i.\n", gap->after_entry, gap->after_entry + 1);
+    print_nonzero_ranges(scan->out, gap->ranges, "image offset");
+}
 
-    //Write Global VAR 'reserved_and_fats'
-    if (fat_sector->is_fat32)
-        reserved_and_fats = (fat_sector->reserved_area_size * bps) + (fat_sector->fat32_size_in_sectors * bps * fat_sector->number_of_fats);
-    if (fat_sector->is_fat16)
-        reserved_and_fats = (fat_sector->reserved_area_size * bps) + (fat_sector->fat_size_in_sectors * bps * fat_sector->number_of_fats);
-    
+/**
+ * @brief fg_finding_fn: prints a file with data in the slack of its last cluster
+ * 
+ * @param finding 
+ * @param context the image_scan
+ * @return int : 0 to carry on with the next finding
+ */
+int print_finding(const struct fg_finding *finding, void *context){
+    struct image_scan *scan = context;
+
+    scan->hidden_data_found = true;
+    fprintf(scan->out, "Possible hidden data found in the slack space of %s in sector 0x%jx / cluster: 0x%x\n", finding->entry->short_name, (uintmax_t)finding->cluster_offset, finding->entry->last_cluster);
+    print_nonzero_ranges(scan->out, finding->ranges, "cluster offset");
+    fprintf(scan->out, "\n");
     return 0;
 }
+
 /**
- * @brief Run a few checks to ensure partition data is valid
- * 
+ * @brief fg_check_unallocated callback: prints a run of free clusters that holds data
  */
-void validate_fat_boot_sector(struct fat_boot_sector *fat_sector){
-    // Check that Bytes Per Sector is Valid
-    switch (bps){
-        case 512:
-            break;
-        case 1024:
-            break;
-        case 2048:
-            break;
-        case 4096:
-            break;
-        default:
-            fprintf(stderr, "\nError!  Detected bytes per sector of: %d which is invalid."  \
-            "Must be 512, 1024, 2048, or 4096.  This indicates the disk image or file system might be corrupted", 
-            bps);
-            exit(EXIT_FAILURE);
-            break;
-    }
+int print_unallocated(const struct fg_unallocated *run, void *context){
+    struct image_scan *scan = context;
 
-    // Check that Sectors Cluster is a Power of 2 and less than 32KB
-    uint8_t sec_per_clus = fat_sector->sectors_per_cluster;
-    if(!(sec_per_clus != 0) && ((sec_per_clus &(sec_per_clus - 1)) == 0)){
-        fprintf(stderr, "\nError!  Detected sectors per cluster of: %d which is invalid.  It must be a power of 2.  \
-                This indicates the disk image or file system might be corrupted", sec_per_clus);
-        exit(EXIT_FAILURE);
-    }
-    if (sec_per_clus * bps > 32768){
-        fprintf(stderr, "\nError!  Detected sector size of: %d which is invalid.  It must be a power of 2.  \
-                This indicates the disk image or file system might be corrupted", sec_per_clus * bps);
-        exit(EXIT_FAILURE);
-    }
+    scan->hidden_data_found = true;
+    fprintf(scan->out, "Possible hidden data found in unallocated clusters 0x%x - 0x%x (%u clusters)\n", run->first_cluster, run->first_cluster + run->cluster_count - 1, run->cluster_count);
+    print_nonzero_ranges(scan->out, run->ranges, "image offset");
+    fprintf(scan->out, "\n");
+    return 0;
+}
 
-    // Check Number of FATS > 0
-    if (fat_sector->number_of_fats < 1){
-        fprintf(stderr, "\nError!  No FATs found. This indicates the disk image or file system might be corrupted");
-        exit(EXIT_FAILURE);
-    }
-    
-    // Check that Max Number of Files in Root Director is 0 when FAT32 detected
-    if (fat_sector->max_files_in_root && !fat_sector->fat_size_in_sectors){
+/**
+ * @brief Prints the oddities found in the boot sector that do not stop the scan
+ * 
+ * @param warnings fg_warning bits of the volume
+ */
+void print_boot_sector_warnings(unsigned warnings){
+    if (warnings & FG_WARNING_FAT_TYPE_CONFLICT)
         fprintf(stderr, "\nWarning!  Conflicting indicators for FAT12/16 and FAT32.  The disk image or file system might be corrupted, proceed with caution.");
-    }
-
-    // Check media type
-    if (fat_sector->media_type != FIXED && fat_sector->media_type != REMOVABLE)
+    if (warnings & FG_WARNING_MEDIA_TYPE)
         fprintf(stderr, "\nWarning!  Media type (removable/fixed) could not be detected.  The disk image or file system might be corrupted, proceed with caution.");
-
-    // Check that only one sector count is present (16 bits for FAT12/FAT16, or 32 bits for FAT32)
-    if (fat_sector->sector_count_16b && fat_sector->sector_count_32b){
+    if (warnings & FG_WARNING_SECTOR_COUNTS)
         fprintf(stderr, "\nWarning!  Conflicting sector counts (both 16 bit and 32 bit fields contained values).  This tool will continue using the 32 bit sector count, but the disk image or file system might be corrupted, proceed with caution.");
-    }
 }
 
 /**
- * @brief Checks supplied disk image to ensure 0x55AA signature found, and then attempts to
- * determine if the disk is a full disk image (i.e. still has MBR), or is just an image of a 
- * single file system/partition
+ * @brief Prints how much the volume's arena and buffer pool handed out, so runs can be checked
+ * for allocations creeping back onto the walk and slack check
  * 
- * @param fp 
- * @param args 
- * @return int : return 0 if disk image with MBR detected, return file system enum if detected
+ * @param out 
+ * @param stats 
  */
-int verify_disk_image(int fp, struct cmd_line *args){
-    uint8_t buf[3];
-    unsigned short mbr_sig = 0;
-    unsigned int fs_type_sig = 0;
-
-    void fs_mismatch(char fs_type[15]){
-        fprintf(stderr, "Detected File System: %s\n", fs_type);
-        fprintf(stderr,
-            "Aborting... Detected file system type does not match your -f command line argument: %s\n",
-            args->file_system);
-        fprintf(stderr, "\nUsage: %s %s\n", args->argv0, cmd_line_error);
-        exit(EXIT_FAILURE);
-    }
-
-    // Begin checks for 0x55AA signature at offset 0x01FE
-    if (pread(fp, buf, 2, MBR_SIG_OFF) < 0)
-        read_error();
-
-    mbr_sig = (buf[0] << 8) | buf[1]; // OR both bytes into short
-    if (mbr_sig != MBR_SIG){
-        fprintf(stderr,
-            "Aborting... %s does not appear to be a valid partition or MBR disk image.\n",
-            args->image_path);
-        exit(EXIT_FAILURE);
-    }
-
-    // Read the File System Signature at Offset 0
-    if (pread(fp, buf, 3, 0) < 0)
-        read_error();
+void print_allocation_stats(FILE *out, const struct fg_volume_stats *stats){
+    fprintf(out, "Arena: %ju allocations, %ju bytes in %ju blocks\n", (uintmax_t)stats->arena_allocations, (uintmax_t)stats->arena_bytes, (uintmax_t)stats->arena_blocks);
+    fprintf(out, "I/O buffers: %ju acquired, %ju allocated (%ju bytes)\n", (uintmax_t)stats->buffers_acquired, (uintmax_t)stats->buffers_allocated, (uintmax_t)stats->buffer_bytes);
+}
 
-    // File system signatures are 3 bytes
-    fs_type_sig = (buf[0] << 16) | (buf[1] << 8) | buf[2]; // Combine three bytes into int
-    
-    switch (fs_type_sig){
-        case NTFS_SIG:
-            // printf("Detected NTFS Partition.\n\n");
-            if (args->fs_type != NTFS)
-                fs_mismatch("ntfs");
-            return NTFS;
-        case FAT32_SIG:
-            // printf("Detected FAT32 Partition.\n\n");
-            if (args->fs_type != FAT32)
-                fs_mismatch("fat32");
-            return FAT32;
-        case FAT16_SIG:
-            // printf("Detected FAT12/FAT16 Partition.\n\n");
-            if (args->fs_type != FAT16 )
-                fs_mismatch("fat16");
-            return FAT16;
-        case FAT12_SIG:
-            // printf("Detected FAT12/FAT16 Partition.\n\n");
-            if (args->fs_type != FAT12 )
-                fs_mismatch("fat12");
-            return FAT12;
-        default:
-            // printf("Detected a possible disk image with MBR (aka use -f raw)\n\n");
-            if (args->fs_type != RAW)
-                fs_mismatch("raw");
-            return RAW;
-            break;
+/**
+ * @brief Adds the per-phase statistics of a volume to the totals of --stats
+ * 
+ * @param totals 
+ * @param vol 
+ */
+void add_scan_stats(struct scan_stats *totals, fg_volume *vol){
+    struct fg_volume_stats stats;
+
+    fg_volume_get_stats(vol, &stats);
+    pthread_mutex_lock(&totals->lock);
+    for (int i = 0; i < FG_PHASE_COUNT; i++){
+        totals->phases[i].wall_ns += stats.phases[i].wall_ns;
+        totals->phases[i].cpu_ns += stats.phases[i].cpu_ns;
+        totals->phases[i].syscalls += stats.phases[i].syscalls;
+        totals->phases[i].bytes_read += stats.phases[i].bytes_read;
+        totals->phases[i].entries += stats.phases[i].entries;
+        totals->phases[i].clusters += stats.phases[i].clusters;
     }
+    for (int i = 0; i < FG_LATENCY_BUCKETS; i++)
+        totals->read_latency[i] += stats.read_latency[i];
+    pthread_mutex_unlock(&totals->lock);
+}
 
-    return 0;
+/**
+ * @brief Reads a clock in nanoseconds
+ */
+uint64_t clock_ns(clockid_t clock){
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
 }
 
 /**
- * @brief Print FAT Tables
- * I know, this code is horrible.  Formatting tables with variable widths based on file system type is hard.
- * It works for now.....
+ * @brief Prints the statistics of --stats as a table, or as one JSON object for collection by
+ * other tools.  The phases add up over every volume scanned, the total is the run's own time.
+ *
+ * @param out
+ * @param totals
+ * @param wall_ns wall time of the whole run
+ * @param cpu_ns CPU time of the whole run
+ * @param json
  */
-void print_full_fat_tables(uint8_t* fat1_ptr, uint8_t* fat2_ptr, struct fat_boot_sector *fat_sector){
-    bool empty_row = false;
-    bool printing_empty_block = false;
-    char dash[] = "-----------------------------------------------------------------------------------------------------------";
-    char space[] = "                                                                                                                       ";
-    char fat32_banner[] = "            |                                             FAT 1 (FAT32)                                             | \n";
-    char fat16_banner[] = "            |                             FAT 1 (FAT16)                             | \n";
-    char *fat_banner;
-    uint32_t fat_entries = 0;
-    uint16_t *fat1_16 = (uint16_t *)fat1_ptr;
-    // uint16_t *fat2_16 = (uint16_t *)fat2_ptr;
-    uint32_t *fat1_32 = (uint32_t *)fat1_ptr;
-    // uint32_t *fat2_32 = (uint32_t *)fat2_ptr;
-    uint32_t i = 0;
-
-    int width = 0;
-    int dash_width = 0;
-    int space_width = 0;
-    if (fat_sector->is_fat16){
-        width = 4;
-        dash_width = 71;
-        space_width = 11;
-        fat_entries = fat_sector->fat_size_in_sectors * fat_sector->bytes_per_sector / 16;
-        fat_banner = fat16_banner;
+void print_scan_stats(FILE *out, const struct scan_stats *totals, uint64_t wall_ns, uint64_t cpu_ns, bool json){
+    const struct fg_phase_stats *phases = totals->phases;
+    const uint64_t *latency = totals->read_latency;
+    struct fg_phase_stats total = {wall_ns, cpu_ns};
+    int last_bucket = -1; // no reads went to the operating system, e.g. the image is memory mapped
+
+    for (int i = 0; i < FG_PHASE_COUNT; i++){
+        total.syscalls += phases[i].syscalls;
+        total.bytes_read += phases[i].bytes_read;
+        total.entries += phases[i].entries;
+        total.clusters += phases[i].clusters;
     }
-    if (fat_sector->is_fat32){
-        width = 8;
-        dash_width = 103;
-        space_width = 27;
-        fat_entries = fat_sector->fat32_size_in_sectors * fat_sector->bytes_per_sector / 32;
-        fat_banner = fat32_banner;
+    for (int i = 0; i < FG_LATENCY_BUCKETS; i++){
+        if (latency[i])
+            last_bucket = i;
     }
-
-    if (fat_sector->is_fat12){
-        //Need to implement special logic for fat12 since 12 bits does not fit cleanly into a normal c datatype.
+    if (json){
+        fprintf(out, "{\"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, \"syscalls\": %ju, \"bytes_read\": %ju, \"phases\": [",
+            total.wall_ns / 1e9, total.cpu_ns / 1e9, (uintmax_t)total.syscalls, (uintmax_t)total.bytes_read);
+        for (int i = 0; i < FG_PHASE_COUNT; i++){
+            const struct fg_phase_stats *p = &phases[i];
+            fprintf(out, "%s{\"name\": \"%s\", \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, \"syscalls\": %ju, \"bytes_read\": %ju, \"entries\": %ju, \"clusters\": %ju}",
+                i ? ", " : "", fg_phase_name(i), p->wall_ns / 1e9, p->cpu_ns / 1e9, (uintmax_t)p->syscalls, (uintmax_t)p->bytes_read, (uintmax_t)p->entries, (uintmax_t)p->clusters);
+        }
+        // Each bucket is listed by its upper bound in microseconds, the last one has none
+        fprintf(out, "], \"read_latency_us\": [");
+        for (int i = 0; i <= last_bucket; i++){
+            if (i == FG_LATENCY_BUCKETS - 1)
+                fprintf(out, "%s{\"below\": null, \"count\": %ju}", i ? ", " : "", (uintmax_t)latency[i]);
+            else
+                fprintf(out, "%s{\"below\": %ju, \"count\": %ju}", i ? ", " : "", (uintmax_t)1 << i, (uintmax_t)latency[i]);
+        }
+        fprintf(out, "]}\n");
         return;
     }
 
-
-    void print_dash(){
-        printf("%.*s", 13, space);
-        printf("%.*s\n", dash_width, dash);
+    fprintf(out, "\n%-18s %10s %10s %10s %14s %12s %12s\n", "Phase", "Wall (s)", "CPU (s)", "Syscalls", "Bytes read", "Entries", "Clusters");
+    for (int i = 0; i < FG_PHASE_COUNT; i++){
+        const struct fg_phase_stats *p = &phases[i];
+        fprintf(out, "%-18s %10.4f %10.4f %10ju %14ju %12ju %12ju\n", fg_phase_name(i), p->wall_ns / 1e9, p->cpu_ns / 1e9,
+            (uintmax_t)p->syscalls, (uintmax_t)p->bytes_read, (uintmax_t)p->entries, (uintmax_t)p->clusters);
     }
-
-    print_dash();
-    printf("%s", fat_banner);
-    for (; i < fat_entries; i += 8){
-        if (!printing_empty_block){
-            for (uint8_t j = 0; j < 8; j++){
-                if (i+j < fat_entries){
-                    if (fat_sector->is_fat32)
-                        empty_row = empty_row || fat1_32[i+j];
-                    if (fat_sector->is_fat16)
-                        empty_row = empty_row || fat1_16[i+j];
-                }
-            }
-            empty_row = !empty_row;
-
-            if (!empty_row && !printing_empty_block){
-                print_dash();
-                printf(" 0x%08x |", i);
-                for (uint8_t j = 0; j < 8; j++){
-                    if (i+j < fat_entries){
-                        if (fat_sector->is_fat32)
-                            printf(" 0x%0*x |", width, fat1_32[i+j]);
-                        if (fat_sector->is_fat16)
-                            printf(" 0x%0*x |", width, fat1_16[i+j]);
-                    }
-                }
-                printf("\n");
-                continue;
-            }
-            if (empty_row && !printing_empty_block){
-                printing_empty_block = true;
-                continue;
-            }
-            if (!empty_row && printing_empty_block){
-                printing_empty_block = false;
-                printf("<Block of Empty/Zero FAT Entries>");
-                print_dash();
-                printf(" 0x%08x |", i);
-                for (uint8_t j = 0; j < 8; j++){
-                    if (i+j < fat_entries){
-                        if (fat_sector->is_fat32)
-                            printf(" 0x%0*x |", width, fat1_32[i+j]);
-                        if (fat_sector->is_fat16)
-                            printf(" 0x%0*x |", width, fat1_16[i+j]);
-                    }
-                }
-                printf("\n");
-                continue;
-            }
-        }
+    fprintf(out, "%-18s %10.4f %10.4f %10ju %14ju\n", "total", total.wall_ns / 1e9, total.cpu_ns / 1e9, (uintmax_t)total.syscalls, (uintmax_t)total.bytes_read);
+    if (last_bucket < 0){
+        fprintf(out, "\nNo reads went to the operating system, the image was read through its mapping\n");
+        return;
     }
-    print_dash();
-    if (printing_empty_block){
-        printf("            |");
-        printf("%.*s", space_width, space);
-        printf("Contiguous Block of Empty/Unallocated FAT Entries");
-        printf("%.*s|\n", space_width, space);
-        print_dash();
+    fprintf(out, "\nRead latency (us)      Reads\n");
+    for (int i = 0; i <= last_bucket; i++){
+        uint64_t low = i ? (uint64_t)1 << (i - 1) : 0;
+        if (i == FG_LATENCY_BUCKETS - 1)
+            fprintf(out, "%8ju+          %12ju\n", (uintmax_t)low, (uintmax_t)latency[i]);
+        else
+            fprintf(out, "%8ju - %-8ju %12ju\n", (uintmax_t)low, (uintmax_t)1 << i, (uintmax_t)latency[i]);
     }
-    printf(" 0x%08x |", i); // print last address of FAT
-    printf("%.*s", space_width, space);
-    printf("                    End of FAT                   ");
-    printf("%.*s|\n", space_width, space);
-    print_dash();
-
 }
 
 /**
- * @brief Prints out information parsed from Fat Boot Sector
+ * @brief Writes the FAT dump asked for with --dump-fat, "-" writes it (as text) into the image's report.  In
+ * a batch the path is a directory, each image's dump is named after the image.  The dump of a
+ * partition of a raw image is told apart by its entry # (.p<n>).
  * 
- * @param fat_sector 
+ * @param scan 
+ * @param vol 
+ * @return fg_status : FG_ERROR_WRITE if the dump could not be written, the volume's error otherwise
  */
-void print_fat_boot_sector_info(struct fat_boot_sector *fat_sector){
-    printf("\nFAT File System Information\n\n");
-    
-    if (fat_sector->is_fat32)
-        printf("File System Type: FAT32\n");
-    if (fat_sector->is_fat16)
-        printf("File System Type: FAT16\n");
-    if (fat_sector->is_fat12)
-        printf("File System Type: FAT12\n");
-
-    switch (fat_sector->media_type){
-        case FIXED:
-            printf("Media Type: Fixed\n");
-            break;
-        case REMOVABLE:
-            printf("Media Type: Removable\n");
-            break;
-        default:
-            printf("Media Type: Unknown\n");
-            break;
-    }
-    
-    printf("OEM Name: %s\n", fat_sector->oem_name);
-    if(fat_sector->is_fat32){
-        printf("Volume Serial: 0x%zx\n", (size_t)fat_sector->fat32_volume_serial);
-        printf("Volume Label: %s\n", fat_sector->fat32_volume_label);
-        printf("File System Label: %s\n", fat_sector->fat32_fs_type_label);
+fg_status write_fat_dump(struct image_scan *scan, fg_volume *vol){
+    const struct cmd_line *args = scan->args;
+    static const char *extensions[] = {"txt", "csv", "bin"};
+    bool to_report = !strcmp(args->dump_path, "-");
+    char path[PATH_MAX];
+    char partition[16] = "";
+    fg_status status = FG_ERROR_WRITE;
+
+    if (scan->image != NULL)
+        snprintf(partition, sizeof(partition), ".p%d", scan->partition);
+    if (args->b_flag){
+        const char *slash = strrchr(args->image_path, '/');
+        snprintf(path, sizeof(path), "%s/%s%s.fat.%s", args->dump_path, slash ? slash + 1 : args->image_path, partition, extensions[args->dump_format]);
     }
     else{
-        printf("Volume Serial: 0x%zx\n", (size_t)fat_sector->volume_serial);
-        printf("Volume Label: %s\n", fat_sector->volume_label);
-        printf("File System Label: %s\n", fat_sector->fs_type_label);
+        snprintf(path, sizeof(path), "%s%s", args->dump_path, partition);
     }
-    printf("Bytes per sector: %d\n", bps);
-    printf("Sectors per cluster: %d\n", fat_sector->sectors_per_cluster);
-    printf("Size of Reserved Area (in sectors): %d\n", fat_sector->reserved_area_size);
-    printf("Number of FATs: %d\n", fat_sector->number_of_fats);
-    
-    if (fat_sector->sector_count_32b)
-        printf("Number of sectors: %d\n", fat_sector->sector_count_32b);
-    else
-        printf("Number of sectors: %d\n", fat_sector->sector_count_16b);
+    FILE *out = to_report ? scan->out : fopen(path, args->dump_format == FG_DUMP_BINARY ? "wb" : "w");
 
-    printf("Sectors before start of partition: %d\n", fat_sector->sectors_before_partition);
-    
-    if(fat_sector->is_fat32){
-        printf("FAT size in sectors: %d\n", fat_sector->fat32_size_in_sectors);
-        printf("Root Dir Cluster: %d\n", fat_sector->root_dir_cluster);
+    if (out != NULL){
+        status = fg_dump_fat(vol, out, args->dump_format);
+        if (!to_report && fclose(out) != 0 && status == FG_OK)
+            status = FG_ERROR_WRITE;
     }
-    else{
-        printf("FAT size in sectors: %d\n", fat_sector->fat_size_in_sectors);
-        printf("Maximum number of files in Root Dir: %d\n", fat_sector->max_files_in_root);
+    if (status == FG_ERROR_WRITE){
+        fprintf(stderr, "Aborting... Failed while writing the FAT dump: %s\n", path);
+        scan->error_printed = true;
     }
+    return status;
 }
 
 /**
- * @brief Prints out information parsed from MBR
+ * @brief Takes one of the batch's slots for reading in bulk, held until release_io_slot.  Does
+ * nothing outside of a batch.
  * 
- * @param mbr 
+ * @param scan 
  */
-void print_mbr_info(struct mbr_sector *mbr){
-    // print out the headers first
-    printf("%-8s %-4s %12s %12s %12s   %4s   %-25s\n", header[0], header[1], header[2], header[3], header[4], header[5], header[6]);
-
-    for (int i = 0; i < 4; i++){
-        char bootable;
-
-        if (mbr->entry[i].boot_indicator == 0)
-            bootable = 'N';
-        else
-            bootable = 'Y';
-
-        printf("%-8d %-4c %12ju %12ju %12ju   %#04x   %-25s\n", 
-        i, bootable, (uintmax_t)mbr->entry[i].starting_sector, 
-        (uintmax_t)(mbr->entry[i].starting_sector + mbr->entry[i].partition_size), 
-        (uintmax_t)mbr->entry[i].partition_size, mbr->entry[i].partition_type, 
-        partition_type_txt[mbr->entry[i].partition_type]);
-    }
+void acquire_io_slot(struct image_scan *scan){
+    if (scan->io_slots == NULL || scan->io_slot_held)
+        return;
+    while (sem_wait(scan->io_slots) != 0); // retried when interrupted by a signal
+    scan->io_slot_held = true;
 }
 
 /**
- * @brief Copies the FATs from the disk image into memory, and then compares them to see
- * if there are any differences between FAT1 and FAT2
+ * @brief Gives back the slot taken by acquire_io_slot, if the image holds one
  * 
- * @param fp file pointer to disk image
- * @param fs_type type of file system (enum)
- * @param fat_boot_sector 
- * @param fat1 
- * @param fat2 
+ * @param scan 
  */
-void copy_fats_into_memory(int fp, int fs_type, struct fat_boot_sector* fat_sector, uint8_t **fat1_ptr, uint8_t **fat2_ptr){
-    uint64_t diff = 0;
-    uint32_t reserved_area_size_in_bytes = 0;
-    fat_size_in_bytes = 0;
+void release_io_slot(struct image_scan *scan){
+    if (!scan->io_slot_held)
+        return;
+    sem_post(scan->io_slots);
+    scan->io_slot_held = false;
+}
 
-    reserved_area_size_in_bytes = fat_sector->reserved_area_size * bps;
+/**
+ * @brief work_pool task: scans one FAT partition of a raw image into a report of its own
+ */
+void partition_task(struct work_pool *pool, int worker, void *task, void *context){
+    struct partition_job *job = task;
+    (void)pool;
+    (void)worker;
+    (void)context;
+
+    job->scan.out = check_allocation(open_memstream(&job->report, &job->report_size));
+    job->status = scan_image(&job->scan);
+    if (job->status != FG_OK)
+        fprintf(stderr, "Aborted the scan of partition %d of %s\n", job->scan.partition, job->args.image_path);
+    fclose(job->scan.out);
+}
 
-    if (fs_type == FAT32)
-        fat_size_in_bytes = fat_sector->fat32_size_in_sectors * bps;
-    else
-        fat_size_in_bytes = fat_sector->fat_size_in_sectors * bps;
-
-    uint8_t *fat1 = calloc(1, fat_size_in_bytes);
-    uint8_t *fat2 = calloc(1, fat_size_in_bytes);
-    *fat1_ptr = fat1;
-    *fat2_ptr = fat2;
-
-    if (pread(fp, fat1, fat_size_in_bytes, reserved_area_size_in_bytes) < 0)
-        read_error();
-    if (pread(fp, fat2, fat_size_in_bytes, reserved_area_size_in_bytes + fat_size_in_bytes) < 0)
-        read_error();
-
-    for(int i = 0; i < fat_size_in_bytes; i++){
-        if (fat1[i] ^ fat2[i]){
-            diff++;
-            if (diff <= 10){
-                printf("Detected discrepency between FAT1 and FAT2 at the following offsets.  FAT1: %#2x, FAT2: %#02x\n", 
-                reserved_area_size_in_bytes + i, reserved_area_size_in_bytes + fat_size_in_bytes + i);
-            }
-        }
-        if (diff == 11)
-            printf("More than 10 discrepencies between FAT1 and FAT2 detected.  To reduce output clutter, individual discrepencies will no longer be printed.\n");
-    }
-    if (diff > 0)
-        printf("Total # of discrepencies identified between FAT1 and FAT2: %ju\n", diff);
+/**
+ * @brief Adds a partition to the jobs of scan_partitions if it is a FAT partition
+ * 
+ * @param scan the raw image's scan
+ * @param vol the raw image
+ * @param jobs 
+ * @param job_count 
+ * @param number entry # of the partition
+ * @param type 
+ * @param starting_sector 
+ * @param partition_size 
+ */
+void add_partition_job(struct image_scan *scan, fg_volume *vol, struct partition_job *jobs, int *job_count, int number, uint8_t type, uint64_t starting_sector, uint64_t partition_size){
+    if (!fg_is_fat_partition(type))
+        return;
+    struct partition_job *job = &jobs[(*job_count)++];
+    job->args = *scan->args;
+    job->type = type;
+    job->starting_sector = starting_sector;
+    job->partition_size = partition_size;
+    job->scan.args = &job->args;
+    job->scan.image = vol;
+    job->scan.partition = number;
+    job->scan.partition_offset = starting_sector * FG_MBR_BYTES_PER_SECTOR;
+    job->scan.stats = scan->stats;
 }
 
 /**
- * @brief Returns the value stored within a given FAT table entry
+ * @brief Scans every FAT partition of a raw image, primary and logical, each through a volume of
+ * its own sharing the image's reads.  The partitions are scanned at once, -j of them (all CPUs
+ * without -j), and share the I/O slots of the batch the image is part of or, when scanned alone,
+ * --io-jobs slots of their own.  Within a batch the image's partitions are scanned one after the
+ * other, the batch already runs its images at once.  Reports are written out in partition order.
  * 
- * @param cluster entry to be read 
- * @return uint32_t 
+ * @param scan the raw image's scan
+ * @param vol the raw image
+ * @param mbr 
+ * @return fg_status : FG_OK, or the error of the first partition that could not be scanned
  */
+fg_status scan_partitions(struct image_scan *scan, fg_volume *vol, const struct fg_mbr_sector *mbr){
+    const struct cmd_line *args = scan->args;
+    struct partition_job *jobs;
+    int job_count = 0;
+    int capacity = 4;
+    int number = 4;
+    int workers = 1;
+    sem_t io_slots;
+    fg_status status = FG_OK;
 
-uint32_t read_alloctable(uint32_t cluster){
-    /*
-    if (cluster > (fat_size_in_bytes/4)){
-        fprintf(stderr, "Fatal Error.  Attempting to read a FAT entry that doesn't exist.  Program terminated.\n");
-        exit(EXIT_FAILURE);
+    for (int i = 0; i < 4; i++){
+        for (struct fg_ebr_table *ebr = mbr->entry[i].ebr_table; ebr != NULL; ebr = ebr->next_ebr_table)
+            capacity++;
     }
-    */
-    if (fat_bs->is_fat32){
-        uint32_t *fat32 = (uint32_t *) fat1;
-        return fat32[cluster];
+    jobs = check_allocation(calloc(capacity, sizeof(struct partition_job)));
+    for (int i = 0; i < 4; i++)
+        add_partition_job(scan, vol, jobs, &job_count, i, mbr->entry[i].partition_type, mbr->entry[i].starting_sector, mbr->entry[i].partition_size);
+    for (int i = 0; i < 4; i++){
+        for (struct fg_ebr_table *ebr = mbr->entry[i].ebr_table; ebr != NULL; ebr = ebr->next_ebr_table)
+            add_partition_job(scan, vol, jobs, &job_count, number++, ebr->partition_type, (uint64_t)ebr->offset + ebr->starting_sector, ebr->partition_size);
     }
-    if (fat_bs->is_fat16){
-        uint16_t *fat16 = (uint16_t *) fat1;
-        return fat16[cluster];
+    if (job_count == 0){
+        free(jobs);
+        return FG_OK;
     }
-    return 0;
-}
 
-/**
- * @brief Returns the number of clusters a file or directory takes up on the disk.  It does this by
- * traversing the FAT until it hits an EOF marker.
- * 
- * @param cluster 
- * @return uint32_t 
- */
-uint32_t get_entry_size(uint32_t cluster){
-    uint32_t next_cluster = cluster;
-    uint32_t size = 0;
-
-    if(fat_bs->is_fat32){
-        do{
-            next_cluster = read_alloctable(next_cluster);
-            size++;
-        } while (next_cluster < (uint32_t)FAT32_EOF);
+    if (job_count > 1 && scan->io_slots == NULL){
+        workers = args->j_flag ? args->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (workers < 1)
+            workers = 1;
+        if (workers > job_count)
+            workers = job_count;
+    }
+    if (scan->io_slots == NULL)
+        sem_init(&io_slots, 0, args->io_jobs ? args->io_jobs : workers);
+    for (int i = 0; i < job_count; i++){
+        // Partitions scanned at once walk their trees on one thread each, as the images of a batch do
+        if (job_count > 1)
+            jobs[i].args.threads = 1;
+        jobs[i].scan.io_slots = scan->io_slots ? scan->io_slots : &io_slots;
     }
-    return size;
+
+    struct work_pool *pool = check_allocation(work_pool_create(workers, partition_task, NULL));
+    for (int i = 0; i < job_count; i++){
+        if (work_pool_push(pool, 0, &jobs[i]) < 0){
+            fprintf(stderr, "Aborting... Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    work_pool_run(pool);
+    work_pool_destroy(pool);
+
+    for (int i = 0; i < job_count; i++){
+        struct partition_job *job = &jobs[i];
+        fprintf(scan->out, "\n==> Partition %d: %s, sectors %ju - %ju <==\n", job->scan.partition, fg_partition_type_name(job->type),
+            (uintmax_t)job->starting_sector, (uintmax_t)(job->starting_sector + job->partition_size));
+        fwrite(job->report, 1, job->report_size, scan->out);
+        if (job->status != FG_OK){
+            fprintf(scan->out, "\nAborted, the partition could not be scanned.  The error was printed to stderr.\n");
+            if (status == FG_OK)
+                status = job->status;
+        }
+        scan->hidden_data_found |= job->scan.hidden_data_found;
+        free(job->report);
+    }
+    // The partitions' errors were printed as they happened
+    scan->error_printed = (status != FG_OK);
+    if (scan->io_slots == NULL)
+        sem_destroy(&io_slots);
+    free(jobs);
+    return status;
 }
 
 /**
- * @brief Stores a list of the clusters a file or directory occupies up on the disk into a read_parameter
- * structure.  It does this by traversing the FAT until it hits an EOF marker.
+ * @brief Reports on a full disk image: its partition table, with -h data hidden around the
+ * partitions, and then each of its FAT partitions
  * 
- * @param cluster The starting cluster
- * @param cluster_list A poiner to a block/array to store the list of clusters
- * @param max_length Since we pre-allocated memory for the list, this is a safety check to avoid overrunning the buffer
- * @return uint32_t 
+ * @param scan 
+ * @param vol 
+ * @return fg_status 
  */
-void get_cluster_list(struct read_parameters *read){
-    uint32_t next_cluster = read->start_cluster;
-    uint32_t size = 0;
-    do{
-        read->cluster_list[size] = next_cluster;
-        next_cluster = read_alloctable(next_cluster);
-        size++;
-    } while (next_cluster < FAT32_EOF && size < read->list_length);
+fg_status report_disk(struct image_scan *scan, fg_volume *vol){
+    struct fg_mbr_sector mbr;
+    fg_status status = fg_read_mbr(vol, &mbr);
+
+    if (status != FG_OK)
+        return status;
+    print_mbr_info(scan->out, &mbr);
+    if (scan->args->h_flag){
+        fprintf(scan->out, "\nChecking partition slack space for hidden data...\n");
+        acquire_io_slot(scan);
+        status = fg_check_partition_gaps(vol, &mbr, print_gap, scan);
+        release_io_slot(scan);
+        if (status == FG_OK && !scan->hidden_data_found)
+            fprintf(scan->out, "No data was hidden in the space between the partitions of this disk image.\n");
+    }
+    if (fg_volume_warnings(vol) & FG_WARNING_EBR_CHAIN)
+        fprintf(stderr, "Warning!  The chain of extended boot records is broken, logical partitions past the break were not found.\n");
+    if (status == FG_OK)
+        status = scan_partitions(scan, vol, &mbr);
+    return status;
 }
 
 /**
- * @brief Returns the last cluster used by a file
+ * @brief Reports on a FAT volume: its boot sector, FAT copy discrepancies, with -h data hidden in
+ * the slack of its files and with -u data in the clusters the FAT marks free.  The FAT load, the
+ * tree walk and the unallocated cluster check hold an I/O slot when the image is part of a batch.
  * 
- * @param cluster The starting cluster
- * @param cluster_list A poiner to a block/array to store the list of clusters
- * @param max_length Since we pre-allocated memory for the list, this is a safety check to avoid overrunning the buffer
- * @return uint32_t 
+ * @param scan 
+ * @param vol 
+ * @return fg_status 
  */
-uint32_t get_last_cluster(uint32_t first_cluster){
-    struct read_parameters read;
-    read.start_cluster = first_cluster;
-    // Get the number of clusters the directory is usings
-    read.list_length = get_entry_size(read.start_cluster);
-    // Allocate room to store the list of clusters used by the directory/file
-    read.cluster_list = calloc(read.list_length, sizeof(uint32_t));
-    get_cluster_list(&read);
-    return read.cluster_list[read.list_length - 1];
+fg_status report_fat_volume(struct image_scan *scan, fg_volume *vol){
+    const struct cmd_line *args = scan->args;
+    struct fg_boot_sector fat_bs;
+    struct fg_volume_stats stats;
+    fg_status status = fg_read_boot_sector(vol, &fat_bs);
+
+    print_boot_sector_warnings(fg_volume_warnings(vol));
+    if (status != FG_OK)
+        return status;
+    print_fat_boot_sector_info(scan->out, &fat_bs);
+
+    acquire_io_slot(scan);
+    status = fg_load_fat(vol, print_fat_mismatch, scan);
+    release_io_slot(scan);
+    if (status != FG_OK)
+        return status;
+    fg_volume_get_stats(vol, &stats);
+    if (args->v_flag == true && stats.index_loaded)
+        fprintf(scan->out, "Loaded volume index %s%s\n", scan->index_path, stats.tree_loaded ? " (directory tree and slack findings)" : "");
+    if (args->v_flag == true)
+        fprintf(scan->out, "FAT extent index: %u cluster chains in %u extents\n", stats.chain_count, stats.extent_count);
+
+    if (args->v_flag == true) //print fat table in verbose mode
+        fg_dump_fat(vol, scan->out, FG_DUMP_TEXT);
+    if (args->d_flag && (status = write_fat_dump(scan, vol)) != FG_OK)
+        return status;
+
+    if (args->h_flag){
+        fprintf(scan->out, "Starting to read Fat%d filesystem.\n", fat_bs.is_fat32 ? 32 : (fat_bs.is_fat16 ? 16 : 12));
+        acquire_io_slot(scan);
+        status = fg_walk(vol);
+        release_io_slot(scan);
+        if (status != FG_OK)
+            return status;
+        if (fg_volume_warnings(vol) & FG_WARNING_BASELINE_UNUSABLE)
+            fprintf(stderr, "Unable to use %s as the baseline of this volume, every file will be checked\n", args->rescan_path);
+        fg_volume_get_stats(vol, &stats);
+        if (args->v_flag == true && stats.rescanned)
+            fprintf(scan->out, "Re-scan: %ju files checked, %ju unchanged since the baseline\n", (uintmax_t)stats.slack_checked, (uintmax_t)stats.slack_reused);
+    }
+    // The index is rewritten whenever the extent index was built or the walk had to be done
+    fg_save_index(vol);
+    if (fg_volume_warnings(vol) & FG_WARNING_INDEX_NOT_WRITTEN)
+        fprintf(stderr, "Unable to write the volume index %s\n", scan->index_path);
+    if (args->h_flag)
+        fg_for_each_finding(vol, print_finding, scan);
+    if (args->h_flag && !scan->hidden_data_found){
+        fprintf(scan->out, "Completed reading file system.  No data was located in the slack regions of allocated clusters.\n");
+    }
+    if (args->u_flag){
+        fprintf(scan->out, "Checking unallocated clusters for hidden data...\n");
+        acquire_io_slot(scan);
+        status = fg_check_unallocated(vol, print_unallocated, scan);
+        release_io_slot(scan);
+        if (status != FG_OK)
+            return status;
+        fg_volume_get_stats(vol, &stats);
+        if (args->v_flag == true)
+            fprintf(scan->out, "Free cluster map: %ju free clusters in %u runs\n", (uintmax_t)stats.free_clusters, stats.free_runs);
+        if (stats.unallocated_findings == 0)
+            fprintf(scan->out, "No data was located in the %ju unallocated clusters of this volume.\n", (uintmax_t)stats.free_clusters);
+    }
+    if (args->v_flag == true){
+        fg_volume_get_stats(vol, &stats);
+        print_allocation_stats(scan->out, &stats);
+    }
+    return FG_OK;
 }
+
 /**
- * @brief Wrapper function for pread when working in clustered area of the disk.  Has additional logic to 
- * handle moving read position to the next cluster when files/directories span multiple clusters.
+ * @brief Scans one image, or one partition of a raw image, with the options in scan->args and
+ * prints its report to scan->out.  Errors are printed to stderr.
  * 
- * @param fp 
- * @param buffer 
- * @param length 
- * @param offset 
- * @param read 
+ * @param scan with args, out, (in a batch) io_slots and (for a partition) image set
+ * @return fg_status : FG_OK, or the error the scan stopped at
  */
-void read_disk(int fp, void* buffer, int length, uint32_t field_offset, struct read_parameters* read){
-    uint32_t cluster_list_index = (field_offset + read->entry_offset) / (bps * spc);
-    
-    // printf("Cluster: %d\n", read->cluster_list[cluster_list_index]);
-    uint32_t i = length;
-    uint32_t iteration_read_len = 0;
-    // uint32_t cluster_offset = 0;
-    do{
-        if (i == length){ //means this is our first iteration through the loop
-            if (i > (bps * spc))
-                iteration_read_len = (bps * spc) - field_offset + read->entry_offset;
-            else
-                iteration_read_len = i;
-            //if (pread(fp, buffer + (length - i), iteration_read_len, cts(read->cluster_list[cluster_list_index]) + field_offset + read->entry_offset) < 0)
-            if (cluster_list_index == 0){
-                if (pread(fp, buffer + (length - i), iteration_read_len, cts(read->cluster_list[cluster_list_index]) + field_offset + read->entry_offset) < 0)
-                    read_error();
-            }
-            else{
-                 if (pread(fp, buffer + (length - i), iteration_read_len, cts(read->cluster_list[cluster_list_index]) + field_offset) < 0)
-                    read_error();
-            }
-            i -= iteration_read_len;
-            cluster_list_index++;
-        }
-        else{
-            //set iteration_read_length equal to the size of a clutser, or however many bytes should be in the last partially filled cluster
-            if ((bps * spc) < i)
-                iteration_read_len = bps * spc;
-            else
-                iteration_read_len = i; 
-            if (pread(fp, buffer + (length - i), iteration_read_len, cts(read->cluster_list[cluster_list_index])) < 0)
-                read_error();
-            i -= iteration_read_len;
-            cluster_list_index++;
-        }
-    } while (i > 0 && cluster_list_index < read->list_length);
+fg_status scan_image(struct image_scan *scan){
+    const struct cmd_line *args = scan->args;
+    struct fg_options options = {0};
+    fg_status status;
+
+    options.require_type = args->f_flag && scan->image == NULL;
+    options.expected_type = args->fs_type;
+    options.threads = args->threads;
+    options.check_slack = args->h_flag;
+    options.sequential_slack = args->s_flag;
+    if (args->c_flag)
+        options.cache_bytes = (size_t)args->cache_mib * 1024 * 1024;
+    if (args->m_flag)
+        options.max_fat_bytes = (size_t)args->max_mem_mib * 1024 * 1024;
+    if (args->x_flag){
+        volume_index_path(args, scan->image ? scan->partition : -1, scan->index_path, sizeof(scan->index_path));
+        options.index_path = scan->index_path;
+    }
+    if (args->r_flag)
+        options.rescan_path = args->rescan_path;
+    // Partitions scanned at once run on one thread each, their CPU time is taken per thread
+    options.collect_stats = (scan->stats != NULL);
+    options.concurrent_stats = args->b_flag || (scan->image != NULL && args->threads == 1);
+
+    fg_volume *vol = check_allocation(fg_volume_create(&options));
+    if (scan->image != NULL)
+        status = fg_volume_open_partition(vol, scan->image, scan->partition_offset);
+    else
+        status = fg_volume_open(vol, args->image_path);
+    int type = fg_volume_type(vol);
+    if (status == FG_OK && (type == FG_FAT12 || type == FG_FAT16 || type == FG_FAT32))
+        status = report_fat_volume(scan, vol);
+    else if (status == FG_OK && scan->image != NULL)
+        fprintf(scan->out, "No FAT file system was found at the start of the partition.\n");
+    else if (status == FG_OK && type == FG_RAW)
+        status = report_disk(scan, vol);
+    release_io_slot(scan);
+
+    // Errors of a FAT dump or of partitions were printed as they happened, the rest stuck to the volume
+    if (status != FG_OK && !scan->error_printed){
+        fprintf(stderr, "%s\n", fg_volume_error(vol));
+        if (status == FG_ERROR_TYPE_MISMATCH)
+            fprintf(stderr, "\nUsage: %s %s\n", args->argv0, cmd_line_error);
+    }
+    if (scan->stats != NULL)
+        add_scan_stats(scan->stats, vol);
+    fg_volume_close(vol);
+    return status;
 }
 
 /**
- * @brief Function walks Long File Name (LFN) entires within the FAT32 file system to find the Short
- * File Name (SFN) entry which actually contains the information like time stamps, size, and first cluster.
- * 
- * @param fp File Pointer to the disk image
- * @return uint32_t The offset to the short file name record
+ * @brief work_pool task: scans one image of a batch into a report of its own, then writes the
+ * report out as one block of the batch's output.  An image that fails is reported as failed, the
+ * rest of the batch carries on.
  */
-uint32_t walk_lfn_entries(int fp, struct read_parameters* read){
-    uint32_t current_lfn_offset = 0;
-    uint32_t current_entry_attribute = 0;
-    do{
-        read_disk(fp, &current_entry_attribute, 1, FILE_ATTRIBUTES + current_lfn_offset, read);
-        current_lfn_offset += 32; //increment to the next directory entry
-    } while (current_entry_attribute == FLAG_FAT_LONG_FILE_NAME);
-    return (current_lfn_offset - 32);
+void batch_image_task(struct work_pool *pool, int worker, void *task, void *context){
+    struct batch *batch = context;
+    struct batch_job *job = task;
+    struct cmd_line *args = check_allocation(malloc(sizeof(struct cmd_line)));
+    struct image_scan scan = {args};
+    char *report = NULL;
+    size_t report_size = 0;
+    (void)pool;
+    (void)worker;
+
+    // Images are scanned in parallel with each other, each one on the thread it was picked up by
+    *args = *batch->args;
+    strncpy(args->image_path, job->image_path, 254);
+    args->threads = 1;
+    scan.out = check_allocation(open_memstream(&report, &report_size));
+    scan.io_slots = &batch->io_slots;
+    scan.stats = batch->stats;
+
+    bool failed = scan_image(&scan) != FG_OK;
+    if (failed){
+        fprintf(stderr, "Aborted the scan of %s\n", job->image_path);
+        fprintf(scan.out, "\nAborted, the image could not be scanned.  The error was printed to stderr.\n");
+    }
+    fclose(scan.out);
+
+    pthread_mutex_lock(&batch->output_lock);
+    printf("==> Image %u of %u: %s <==\n", job->number, batch->job_count, job->image_path);
+    fwrite(report, 1, report_size, stdout);
+    printf("\n");
+    fflush(stdout);
+    batch->failed_count += failed;
+    batch->hidden_count += scan.hidden_data_found;
+    pthread_mutex_unlock(&batch->output_lock);
+
+    free(report);
+    free(args);
 }
 
 /**
- * @brief Loads a fat_dir_entry struct with directory entry info
+ * @brief Adds an image to the list of a batch
  * 
- * @param fp file pointer to disk image
- * @param entry pointer to entry struct to store read information
- * @param offset in bytes, the offset within the disk image where the dir entry starts
- * @return uint32_t Return the offset to the next file record entry
+ * @param jobs 
+ * @param job_count 
+ * @param capacity 
+ * @param path 
  */
-uint32_t read_fat_dir_entry(int fp, struct fat_dir_entry *entry, struct read_parameters* read){
-    // Traverse the LFN entries to get to the SFN entry
-    uint32_t LFN = walk_lfn_entries(fp, read);
-
-    read_disk(fp, &entry->info.filename, 11, LFN + FILE_NAME, read);
-    read_disk(fp, &entry->file_attributes, 1, LFN + FILE_ATTRIBUTES, read);
-    read_disk(fp, &entry->created_time_tenths, 1, LFN + CREATED_TIME_TENTHS, read);
-    read_disk(fp, &entry->created_time_hms, 2, LFN + CREATED_TIME_HMS, read);
-    read_disk(fp, &entry->created_day, 2, LFN + CREATED_DAY, read);
-    read_disk(fp, &entry->accessed_day, 2, LFN + ACCESSED_DAY, read);
-    read_disk(fp, &entry->low_cluster_addr, 2,  LFN + LOW_CLUSTER_ADDR, read);
-    read_disk(fp, &entry->high_cluster_addr, 2,  LFN + HIGH_CLUSTER_ADDR, read);
-    entry->cluster_addr = entry->low_cluster_addr | (entry->high_cluster_addr << 16);
-    read_disk(fp, &entry->written_time_hms, 2, LFN + WRITTEN_TIME_HMS, read);
-    read_disk(fp, &entry->written_day, 2, LFN + WRITTEN_DAY, read);
-    read_disk(fp, &entry->file_size, 4, LFN + FILE_SIZE, read);
-
-    return LFN + 32;
+void add_batch_job(struct batch_job **jobs, uint32_t *job_count, uint32_t *capacity, const char *path){
+    if (strlen(path) > 254){
+        fprintf(stderr, "Skipping %s, the path is longer than 254 characters\n", path);
+        return;
+    }
+    if (*job_count == *capacity){
+        *capacity = *capacity ? *capacity * 2 : 64;
+        *jobs = check_allocation(realloc(*jobs, *capacity * sizeof(struct batch_job)));
+    }
+    (*jobs)[*job_count].number = *job_count + 1;
+    (*jobs)[*job_count].image_path = check_allocation(strdup(path));
+    (*job_count)++;
 }
 
 /**
- * @brief Checks for data hidden at the end of a partially filled FAT32 cluster
+ * @brief Tells whether a file of a batch directory is not an image of its own: a volume index, or
+ * a segment of a split image after the first one (those are opened with the first segment)
  * 
- * @param fp 
- * @param entry 
+ * @param name 
+ * @param path the file's path
+ * @return bool 
  */
-void check_for_hidden_data(int fp, struct fat_dir_entry *entry){
-    uint32_t slack_start = entry->file_size % (bps * spc);
-    uint32_t last_sector_start = cts(entry->last_cluster);
-    // printf("Slack Start: 0x%x\n", slack_start);
-    uint32_t hidden_found = 0;
-    uint8_t buf = 0;
-
-    // printf("Checking %s\n", entry->info.filename);
-    /*
-    printf("File first cluster: %d\n", entry->cluster_addr);
-    printf("File last cluster: %d\n", entry->last_cluster);
-    printf("Starting to look for hidden data at: %x\n", last_sector_start + slack_start);
-    */
-    for (uint32_t i = slack_start; i < (bps * spc); i++){
-        if (pread(fp, &buf, 1, last_sector_start + i) < 0)
-            read_error();
-        hidden_found = hidden_found | buf;
-        // printf("%x", buf);
-    }
-    if (hidden_found){
-        hidden_data_found = true; // mark the global var as true
-        printf("Possible hidden data found in the slack space of %s in sector 0x%x / cluster: 0x%x\n\n", entry->info.filename, cts(entry->last_cluster), entry->last_cluster);
-    }
+bool skip_batch_file(const char *name, const char *path){
+    size_t suffix = strlen(FG_VOLUME_INDEX_SUFFIX);
+    const char *index_suffix = strstr(name, FG_VOLUME_INDEX_SUFFIX);
+
+    // Indexes, and the temporary files they are written through
+    if (index_suffix != NULL && (index_suffix[suffix] == '\0' || !strcmp(index_suffix + suffix, ".tmp")))
+        return true;
+    return fg_is_later_segment(path);
 }
 
 /**
- * @brief Recursively reads a FAT32 file system directory/file structure into memory
+ * @brief Lists the images of a batch: one per line of a manifest (blank lines and lines starting
+ * with # are skipped), or the files of a directory in name order
  * 
- * @param fp 
- * @param entry_start_cluster 
- * @return struct fat_dir_entry* 
+ * @param path manifest or directory
+ * @param job_count receives the # of images
+ * @return struct batch_job* 
  */
-struct fat_dir_entry* read_fat32_filesystem(int fp, uint32_t entry_start_cluster, struct fat_dir_entry *entry){
-    //-------------------------------------------------------------------------
-    // First setup the data structures and get info like number of clusters
-    // used by the current directory we will be reading
-    //-------------------------------------------------------------------------
-    // Allocate the struct to store the next file/directory information
-    struct read_parameters read_info = {0};
-    // Get the number of clusters the directory is usings
-    read_info.start_cluster = entry_start_cluster;
-    // Get the number of clusters the directory is usings
-    read_info.list_length = get_entry_size(entry_start_cluster);
-    // Allocate room to store the list of clusters used by the directory/file
-    read_info.cluster_list = calloc(read_info.list_length, sizeof(uint32_t));
-    // Get the list of clusters the directory is usings
-    get_cluster_list(&read_info);
-
-    // Special case for root dir since a parent entry* cant be passed to the first call
-    if (entry == NULL){
-        entry = calloc(1, sizeof(struct fat_dir_entry));
+struct batch_job *list_batch_images(const char *path, uint32_t *job_count){
+    struct batch_job *jobs = NULL;
+    uint32_t capacity = 0;
+    struct stat st;
+
+    *job_count = 0;
+    if (stat(path, &st) != 0){
+        fprintf(stderr, "Aborting... Could not read/access the batch located at: %s\n", path);
+        exit(EXIT_FAILURE);
     }
-    
-    // Store the last cluster for future reference to save us time 
-    entry->last_cluster = read_info.cluster_list[read_info.list_length-1];
-
-    //-------------------------------------------------------------------------
-    // Begin reading the contents of the directory (entries) into memory, 
-    // recurse for directories
-    //-------------------------------------------------------------------------
-    for (uint32_t i = 0; i < read_info.list_length * bps * spc;){
-        // Allocate the struct to store the next file/directory information
-        struct fat_dir_entry *sub_entry = calloc(1, sizeof(struct fat_dir_entry));
-        // Read the file/directory entry
-        int x = read_fat_dir_entry(fp, sub_entry, &read_info);
-        sub_entry->last_cluster = get_last_cluster(sub_entry->cluster_addr);
-        // If the entry was blank, marked unallocated, or was the . entry (self pointer), skip to next entry
-        if (sub_entry->info.alloc_status == 0 || sub_entry->info.alloc_status == UNALLOCATED || !strncmp(sub_entry->info.filename, ".          ", 12) || !strncmp(sub_entry->info.filename, "..         ", 12)){
-            free(sub_entry);
-            read_info.entry_offset += x;
-            i += x;
-            continue;
-        }
-        // If the entry we just read is a directory, we need to recurse into the directory
-        if (sub_entry->file_attributes & 0x10){    
-            sub_entry->is_directory = true;
-            // printf("i is: %x.  Jumping to read the dir: %s\n", i, sub_entry->info.filename);
-            read_fat32_filesystem(fp, sub_entry->cluster_addr, sub_entry);
+
+    if (S_ISDIR(st.st_mode)){
+        struct dirent **names;
+        char image_path[PATH_MAX];
+        int count = scandir(path, &names, NULL, alphasort);
+        if (count < 0){
+            fprintf(stderr, "Aborting... Could not list the batch directory: %s\n", path);
+            exit(EXIT_FAILURE);
         }
-        // If the user specified the -h flag, check for hidden data in the slack space of the last cluster
-        if (args.h_flag && !sub_entry->is_directory){
-            check_for_hidden_data(fp, sub_entry);
+        for (int i = 0; i < count; i++){
+            snprintf(image_path, sizeof(image_path), "%s/%s", path, names[i]->d_name);
+            if (names[i]->d_name[0] != '.' && !skip_batch_file(names[i]->d_name, image_path) && stat(image_path, &st) == 0 && S_ISREG(st.st_mode))
+                add_batch_job(&jobs, job_count, &capacity, image_path);
+            free(names[i]);
         }
-        read_info.entry_offset += x;
-        i += x;
+        free(names);
+        return jobs;
     }
 
-    free(read_info.cluster_list);
-    return entry;
+    FILE *manifest = fopen(path, "r");
+    char *line = NULL;
+    size_t line_size = 0;
+    if (manifest == NULL){
+        fprintf(stderr, "Aborting... Could not read/access the batch located at: %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    while (getline(&line, &line_size, manifest) >= 0){
+        char *start = line;
+        size_t length;
+        while (isspace((unsigned char)*start))
+            start++;
+        length = strlen(start);
+        while (length && isspace((unsigned char)start[length - 1]))
+            start[--length] = '\0';
+        if (length && start[0] != '#')
+            add_batch_job(&jobs, job_count, &capacity, start);
+    }
+    free(line);
+    fclose(manifest);
+    return jobs;
 }
 
-
 /**
- * @brief Checks the space between partitions on a disk image for hidden data.
+ * @brief Scans every image of a batch (--batch), -j images at a time and at most --io-jobs of
+ * them reading in bulk at once.  Reports come out whole, one per image in the order the images
+ * finish, headed by the image's position in the batch, followed by a summary line.
  * 
- * @param fp 
- * @param mbr 
+ * @param args 
+ * @param stats totals of --stats, NULL without it
+ * @return int : EXIT_SUCCESS, or EXIT_FAILURE if any image could not be scanned
  */
-void check_slack_space(int fp, struct mbr_sector *mbr){
-    uint8_t buf = 0;
-    uint8_t hidden_found = 0;
-
-    printf("\nChecking partition slack space for hidden data...\n");
-
-    if (mbr->entry[0].starting_sector > 0){
-        for (uint32_t i = 512; i < (mbr->entry[0].starting_sector * bps); i++){
-            if (pread(fp, &buf, 1, i) < 0)
-                read_error();
-            // printf("Reading address: 0x%x     Buffer: 0x%x\n", i, buf);
-            hidden_found = hidden_found | buf;
-            // printf("Hidden Found: 0x%x\n", hidden_found);
-        }
-        if (hidden_found){
-            printf("Data potentially hidden before partition entry 0.\n");
-        }
-    }
+int run_batch(const struct cmd_line *args, struct scan_stats *stats){
+    struct batch batch = {args};
+    int jobs = args->j_flag ? args->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
 
-    for (int i = 0; i < 3; i++){
-        buf = 0;
-        uint8_t save_hidden_found = hidden_found;
-        hidden_found = 0;
-        if ((mbr->entry[i].starting_sector + mbr->entry[i].partition_size) < mbr->entry[i+1].starting_sector){
-            for (uint32_t i = mbr->entry[i].starting_sector + mbr->entry[i].partition_size * bps; i < mbr->entry[i+1].starting_sector * bps; i++){
-                if (pread(fp, &buf, 1, i) < 0)
-                    read_error();
-                // printf("Reading address: 0x%x     Buffer: 0x%x\n", i, buf);
-                hidden_found = hidden_found | buf;
-            }
-                if (hidden_found){
-                    printf("Data potentially hidden between partition entries %i and %i.\n", i, i+1);
-            }
-        }
-        hidden_found = hidden_found | save_hidden_found;
+    batch.jobs = list_batch_images(args->batch_path, &batch.job_count);
+    if (batch.job_count == 0){
+        fprintf(stderr, "Aborting... No images found in the batch: %s\n", args->batch_path);
+        exit(EXIT_FAILURE);
     }
-
-    if (!hidden_found){
-        printf("No data was hidden in the space between the partitions of this disk image.\n");
+    if (jobs < 1)
+        jobs = 1;
+    if (jobs > 256)
+        jobs = 256;
+    if ((uint32_t)jobs > batch.job_count)
+        jobs = batch.job_count;
+    sem_init(&batch.io_slots, 0, args->io_jobs ? args->io_jobs : jobs);
+    pthread_mutex_init(&batch.output_lock, NULL);
+    batch.stats = stats;
+
+    struct work_pool *pool = check_allocation(work_pool_create(jobs, batch_image_task, &batch));
+    for (uint32_t i = 0; i < batch.job_count; i++){
+        if (work_pool_push(pool, 0, &batch.jobs[i]) < 0){
+            fprintf(stderr, "Aborting... Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
     }
+    work_pool_run(pool);
+    work_pool_destroy(pool);
+
+    printf("Batch complete: %u images, %u with possible hidden data, %u could not be scanned\n", batch.job_count, batch.hidden_count, batch.failed_count);
+    for (uint32_t i = 0; i < batch.job_count; i++)
+        free(batch.jobs[i].image_path);
+    free(batch.jobs);
+    pthread_mutex_destroy(&batch.output_lock);
+    sem_destroy(&batch.io_slots);
+    return batch.failed_count ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 /**
@@ -1072,64 +1104,28 @@ void check_slack_space(int fp, struct mbr_sector *mbr){
  * @return int 
  */
 int main(int argc, char *argv[]){
-    int fp = 0;
-    int fs_type = 0;
-    root_dir_off = 0;
-    struct mbr_sector* mbr = calloc(1, sizeof(struct mbr_sector));
-    struct fat_dir_entry *root_dir;
+    struct cmd_line args = {0};
+    struct scan_stats stats = {0};
+    uint64_t wall_start = clock_ns(CLOCK_MONOTONIC);
+    uint64_t cpu_start = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    int status = EXIT_SUCCESS;
 
     read_args(&args, argc, argv);
-    verify_fs_arg(&args);
-
-    fp = open_disk_image(&args);
-
-    fs_type = verify_disk_image(fp, &args);
+    if (args.f_flag)
+        verify_fs_arg(&args);
+    pthread_mutex_init(&stats.lock, NULL);
 
-    if (fs_type == RAW){
-        read_mbr_sector(fp, mbr);
-        print_mbr_info(mbr);
-        if (args.h_flag)
-            check_slack_space(fp, mbr);
+    if (args.b_flag){
+        status = run_batch(&args, args.t_flag ? &stats : NULL);
     }
-
-    if (fs_type == FAT32 || fs_type == FAT16 || fs_type == FAT12){
-        fat_bs = calloc(1, sizeof(struct fat_boot_sector));
-        read_fat_boot_sector(fp, fat_bs, 0);
-        validate_fat_boot_sector(fat_bs);
-        print_fat_boot_sector_info(fat_bs);
-        copy_fats_into_memory(fp, fs_type, fat_bs, &fat1, &fat2);
-        
-        if (args.v_flag == true) //print fat table in verbose mode
-            print_full_fat_tables(fat1, fat2, fat_bs);
-
-        if(fs_type == FAT32){
-            root_dir_off = cts(fat_bs->root_dir_cluster);
-            if (args.h_flag){
-                printf("Starting to read Fat32 filesystem.\n");
-                root_dir = read_fat32_filesystem(fp, fat_bs->root_dir_cluster, NULL);
-            }
-            if (args.h_flag && !hidden_data_found){
-                printf("Completed reading file system.  No data was located in the slack regions of allocated clusters.\n");
-            }
-        }
-        if(fs_type == FAT16){
-            root_dir_off = fat_bs->number_of_fats * (fat_bs->fat_size_in_sectors * bps) + (fat_bs->reserved_area_size * bps);
-        }
+    else{
+        struct image_scan scan = {&args, stdout};
+        scan.stats = args.t_flag ? &stats : NULL;
+        if (scan_image(&scan) != FG_OK)
+            status = EXIT_FAILURE;
     }
-
-    CLEANUP:
-    if (fp > 0)
-        close(fp); // close file
-    if (mbr != NULL)
-        free(mbr);
-    if (fat_bs != NULL)
-        free(fat_bs);
-    if (fat1 != NULL)
-        free(fat1);
-    if (fat2 != NULL)
-        free(fat2);
-    if (root_dir != NULL)
-        free(root_dir);
-    
-    //Need to add code to cleanup MBR Table structs
-}
\ No newline at end of file
+    if (args.t_flag)
+        print_scan_stats(stderr, &stats, clock_ns(CLOCK_MONOTONIC) - wall_start, clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start, args.stats_json);
+    pthread_mutex_destroy(&stats.lock);
+    return status;
+}
@@ -0,0 +1,332 @@
+/**
+ * @file page_cache.c
+ * @brief Thread-safe LRU page cache
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "page_cache.h"
+
+enum page_state {PAGE_EMPTY, PAGE_LOADING, PAGE_READY};
+
+// One cached page
+typedef struct page_slot {
+    uint64_t page;
+    uint8_t *data; // page_size bytes
+    enum page_state state;
+    int pins; // readers currently copying out of data, a pinned slot is never evicted
+    uint32_t version; // odd while the slot is being refilled, see read_last_page
+    int32_t hash_next; // next slot in the same hash bucket, -1 ends the bucket
+    int32_t lru_prev; // more recently used slot, -1 for the most recently used one
+    int32_t lru_next; // less recently used slot, -1 for the least recently used one
+} page_slot;
+
+struct page_cache {
+    size_t page_size;
+    page_cache_load_fn load;
+    void *context;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed; // a slot finished loading or was unpinned
+    struct page_slot *slots;
+    size_t slot_count;
+    int32_t *buckets; // page -> first slot of its bucket, -1 if empty
+    uint32_t bucket_mask;
+    int32_t lru_head; // most recently used slot
+    int32_t lru_tail; // least recently used slot
+    uint64_t id; // changes whenever the slots are reallocated, see last_page
+};
+
+// The slot a thread last read from, checked before taking the lock so runs of small reads from
+// one page (walking a cluster chain) never wait on the lock
+static __thread struct {
+    struct page_cache *cache;
+    uint64_t id;
+    struct page_slot *slot;
+} last_page;
+
+static uint64_t next_cache_id;
+
+/**
+ * @brief Creates a cache of pages of page_size bytes
+ *
+ * @param page_size
+ * @param budget memory budget for the cached pages, see page_cache_set_budget
+ * @param load called to fill a page on a miss
+ * @param context passed through to load
+ * @return struct page_cache* : NULL if out of memory
+ */
+struct page_cache *page_cache_create(size_t page_size, size_t budget, page_cache_load_fn load, void *context){
+    struct page_cache *cache = calloc(1, sizeof(struct page_cache));
+    if (cache == NULL)
+        return NULL;
+    cache->page_size = page_size;
+    cache->load = load;
+    cache->context = context;
+    pthread_mutex_init(&cache->lock, NULL);
+    pthread_cond_init(&cache->changed, NULL);
+    if (page_cache_set_budget(cache, budget) < 0){
+        page_cache_destroy(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+/**
+ * @brief Frees the cache and every cached page
+ *
+ * @param cache
+ */
+void page_cache_destroy(struct page_cache *cache){
+    if (cache == NULL)
+        return;
+    for (size_t i = 0; i < cache->slot_count; i++)
+        free(cache->slots[i].data);
+    free(cache->slots);
+    free(cache->buckets);
+    pthread_mutex_destroy(&cache->lock);
+    pthread_cond_destroy(&cache->changed);
+    free(cache);
+}
+
+/**
+ * @brief Sizes the cache to hold as many pages as fit in budget (at least 4, so a few threads
+ * can always make progress).  Drops every cached page, so it must not be called while other
+ * threads are reading through the cache.
+ *
+ * @param cache
+ * @param budget bytes
+ * @return int : 0 if successful, -1 if out of memory, the cache then keeps its old size
+ */
+int page_cache_set_budget(struct page_cache *cache, size_t budget){
+    size_t slot_count = budget / cache->page_size;
+    if (slot_count < 4)
+        slot_count = 4;
+
+    uint32_t bucket_count = 16;
+    while (bucket_count < slot_count * 2)
+        bucket_count *= 2;
+    struct page_slot *slots = calloc(slot_count, sizeof(struct page_slot));
+    int32_t *buckets = malloc(bucket_count * sizeof(int32_t));
+    if (slots == NULL || buckets == NULL){
+        free(slots);
+        free(buckets);
+        return -1;
+    }
+
+    for (size_t i = 0; i < cache->slot_count; i++)
+        free(cache->slots[i].data);
+    free(cache->slots);
+    free(cache->buckets);
+
+    cache->slot_count = slot_count;
+    cache->slots = slots;
+    for (size_t i = 0; i < slot_count; i++){
+        cache->slots[i].hash_next = -1;
+        cache->slots[i].lru_prev = (int32_t)i - 1;
+        cache->slots[i].lru_next = (i + 1 < slot_count) ? (int32_t)i + 1 : -1;
+    }
+    cache->lru_head = 0;
+    cache->lru_tail = slot_count - 1;
+    cache->id = __atomic_add_fetch(&next_cache_id, 1, __ATOMIC_RELAXED);
+    cache->bucket_mask = bucket_count - 1;
+    cache->buckets = buckets;
+    memset(cache->buckets, 0xff, bucket_count * sizeof(int32_t));
+    return 0;
+}
+
+static uint32_t page_bucket(struct page_cache *cache, uint64_t page){
+    return (uint32_t)((page * 0x9E3779B97F4A7C15ULL) >> 32) & cache->bucket_mask;
+}
+
+static struct page_slot *find_slot(struct page_cache *cache, uint64_t page){
+    for (int32_t i = cache->buckets[page_bucket(cache, page)]; i != -1; i = cache->slots[i].hash_next){
+        if (cache->slots[i].page == page)
+            return &cache->slots[i];
+    }
+    return NULL;
+}
+
+static void unlink_slot(struct page_cache *cache, struct page_slot *slot){
+    int32_t index = slot - cache->slots;
+    int32_t *link = &cache->buckets[page_bucket(cache, slot->page)];
+    while (*link != index)
+        link = &cache->slots[*link].hash_next;
+    *link = slot->hash_next;
+    slot->hash_next = -1;
+}
+
+static void link_slot(struct page_cache *cache, struct page_slot *slot){
+    uint32_t bucket = page_bucket(cache, slot->page);
+    slot->hash_next = cache->buckets[bucket];
+    cache->buckets[bucket] = slot - cache->slots;
+}
+
+/**
+ * @brief Moves a slot to the most recently used end of the LRU list
+ */
+static void touch_slot(struct page_cache *cache, struct page_slot *slot){
+    int32_t index = slot - cache->slots;
+    if (cache->lru_head == index)
+        return;
+
+    cache->slots[slot->lru_prev].lru_next = slot->lru_next;
+    if (slot->lru_next != -1)
+        cache->slots[slot->lru_next].lru_prev = slot->lru_prev;
+    else
+        cache->lru_tail = slot->lru_prev;
+
+    slot->lru_prev = -1;
+    slot->lru_next = cache->lru_head;
+    cache->slots[cache->lru_head].lru_prev = index;
+    cache->lru_head = index;
+}
+
+/**
+ * @brief Returns the least recently used slot that can be refilled.  Pinned slots are skipped,
+ * there are at most as many of them as threads reading, so this stays close to O(1).
+ *
+ * @return struct page_slot* : NULL if every slot is pinned
+ */
+static struct page_slot *find_victim(struct page_cache *cache){
+    for (int32_t i = cache->lru_tail; i != -1; i = cache->slots[i].lru_prev){
+        if (!cache->slots[i].pins)
+            return &cache->slots[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Returns the slot holding page, loading it into the least recently used slot if it is
+ * not cached.  The slot is pinned and must be handed back with release_page.
+ *
+ * @param cache
+ * @param page
+ * @return struct page_slot* : NULL if the page could not be loaded
+ */
+static struct page_slot *acquire_page(struct page_cache *cache, uint64_t page){
+    pthread_mutex_lock(&cache->lock);
+    for (;;){
+        struct page_slot *slot = find_slot(cache, page);
+        if (slot != NULL){
+            if (slot->state == PAGE_LOADING){
+                // Another thread is already loading it
+                pthread_cond_wait(&cache->changed, &cache->lock);
+                continue;
+            }
+            slot->pins++;
+            touch_slot(cache, slot);
+            pthread_mutex_unlock(&cache->lock);
+            return slot;
+        }
+
+        // A loading slot is always pinned, so it is never picked
+        struct page_slot *victim = find_victim(cache);
+        if (victim == NULL){
+            // Every slot is in use by another reader
+            pthread_cond_wait(&cache->changed, &cache->lock);
+            continue;
+        }
+
+        if (victim->state != PAGE_EMPTY)
+            unlink_slot(cache, victim);
+        // Lock free readers of the slot's old page see the odd version and take the lock instead
+        __atomic_store_n(&victim->version, victim->version + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        if (victim->data == NULL)
+            victim->data = malloc(cache->page_size);
+        victim->page = page;
+        victim->state = PAGE_LOADING;
+        victim->pins = 1;
+        touch_slot(cache, victim);
+        link_slot(cache, victim);
+        pthread_mutex_unlock(&cache->lock);
+
+        int result = (victim->data == NULL) ? -1 : cache->load(cache->context, page, victim->data);
+
+        pthread_mutex_lock(&cache->lock);
+        if (result < 0){
+            unlink_slot(cache, victim);
+            victim->state = PAGE_EMPTY;
+            victim->pins = 0;
+        }
+        else{
+            victim->state = PAGE_READY;
+        }
+        __atomic_store_n(&victim->version, victim->version + 1, __ATOMIC_RELEASE);
+        if (result < 0)
+            victim = NULL;
+        pthread_cond_broadcast(&cache->changed);
+        pthread_mutex_unlock(&cache->lock);
+        return victim;
+    }
+}
+
+static void release_page(struct page_cache *cache, struct page_slot *slot){
+    pthread_mutex_lock(&cache->lock);
+    if (--slot->pins == 0)
+        pthread_cond_broadcast(&cache->changed);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * @brief Copies piece bytes of page from the slot this thread last read from, without taking the
+ * lock.  The slot is not pinned, a copy that raced with the slot being refilled is detected by its
+ * version changing and thrown away.
+ *
+ * @return bool : false if the slot no longer holds page, the caller then takes the lock
+ */
+static bool read_last_page(struct page_cache *cache, uint64_t page, size_t within, uint8_t *buffer, size_t piece){
+    if (last_page.cache != cache || last_page.id != cache->id)
+        return false;
+
+    struct page_slot *slot = last_page.slot;
+    uint32_t version = __atomic_load_n(&slot->version, __ATOMIC_ACQUIRE);
+    if ((version & 1) || __atomic_load_n(&slot->page, __ATOMIC_RELAXED) != page || __atomic_load_n(&slot->state, __ATOMIC_RELAXED) != PAGE_READY)
+        return false;
+    memcpy(buffer, slot->data + within, piece);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->version, __ATOMIC_RELAXED) == version;
+}
+
+/**
+ * @brief Copies length bytes starting at offset into buffer, loading the pages they are on as
+ * needed.  Safe to call from several threads at once.  Reads from the page the thread read from
+ * last do not take the lock.
+ *
+ * @param cache
+ * @param buffer
+ * @param length
+ * @param offset offset in bytes, page n holds [n * page_size, (n + 1) * page_size)
+ * @return int : 0 if successful, -1 if a page could not be loaded
+ */
+int page_cache_read(struct page_cache *cache, void *buffer, size_t length, uint64_t offset){
+    size_t done = 0;
+    while (done < length){
+        uint64_t position = offset + done;
+        uint64_t page = position / cache->page_size;
+        size_t within = position % cache->page_size;
+        size_t piece = cache->page_size - within;
+        if (piece > length - done)
+            piece = length - done;
+
+        if (read_last_page(cache, page, within, (uint8_t *)buffer + done, piece)){
+            done += piece;
+            continue;
+        }
+
+        struct page_slot *slot = acquire_page(cache, page);
+        if (slot == NULL)
+            return -1;
+        memcpy((uint8_t *)buffer + done, slot->data + within, piece);
+        release_page(cache, slot);
+        last_page.cache = cache;
+        last_page.id = cache->id;
+        last_page.slot = slot;
+        done += piece;
+    }
+    return 0;
+}
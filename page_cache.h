@@ -0,0 +1,24 @@
+/**
+ * @file page_cache.h
+ * @brief Thread-safe LRU cache of fixed size pages bounded by a memory budget.  Pages are filled
+ * on a miss by a caller supplied load function, e.g. by inflating a chunk of a compressed image
+ * or by reading a piece of the FAT from disk.  Each thread remembers the page it read last, so
+ * runs of small reads from one page do not take the lock.
+ */
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct page_cache page_cache;
+
+// Fills data with page_size bytes of the page, returns 0 if successful and -1 on failure
+typedef int (*page_cache_load_fn)(void *context, uint64_t page, uint8_t *data);
+
+struct page_cache *page_cache_create(size_t page_size, size_t budget, page_cache_load_fn load, void *context);
+void page_cache_destroy(struct page_cache *cache);
+int page_cache_set_budget(struct page_cache *cache, size_t budget);
+int page_cache_read(struct page_cache *cache, void *buffer, size_t length, uint64_t offset);
+
+#endif
@@ -0,0 +1,162 @@
+/**
+ * @file perf_stats.c
+ * @brief Per-phase performance statistics
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "perf_stats.h"
+
+static const char *phase_names[PERF_PHASE_COUNT] = {
+    "other",
+    "verify_disk_image",
+    "boot_sector",
+    "fat_load",
+    "tree_walk",
+    "slack_check",
+    "partition_gap",
+    "unallocated"
+};
+
+static __thread struct perf_stats *thread_stats; // volume this thread's I/O is counted in, NULL if none
+static __thread enum perf_phase thread_phase;
+static __thread uint64_t thread_wall_start;
+static __thread uint64_t thread_cpu_start;
+
+/**
+ * @brief Reads a clock in nanoseconds
+ */
+static uint64_t clock_ns(clockid_t clock){
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * @brief Clears the statistics of a volume
+ *
+ * @param stats
+ * @param enabled record anything at all
+ * @param concurrent true when other volumes are scanned at the same time (--batch, the
+ * partitions of a raw image), the wall times of a phase then add up over the threads and its CPU
+ * time is that of the threads running it rather than of the process
+ */
+void perf_stats_init(struct perf_stats *stats, bool enabled, bool concurrent){
+    memset(stats, 0, sizeof(struct perf_stats));
+    stats->enabled = enabled;
+    stats->concurrent = concurrent;
+}
+
+/**
+ * @brief Returns the name of a phase as printed by --stats
+ */
+const char *perf_phase_name(enum perf_phase phase){
+    return phase_names[phase];
+}
+
+/**
+ * @brief Starts timing a phase of a volume and counts this thread's I/O in it until
+ * perf_phase_end.  A phase can be run more than once, its times add up.
+ *
+ * @param stats
+ * @param phase
+ */
+void perf_phase_begin(struct perf_stats *stats, enum perf_phase phase){
+    if (!stats->enabled)
+        return;
+    thread_stats = stats;
+    thread_phase = phase;
+    thread_wall_start = clock_ns(CLOCK_MONOTONIC);
+    thread_cpu_start = clock_ns(stats->concurrent ? CLOCK_THREAD_CPUTIME_ID : CLOCK_PROCESS_CPUTIME_ID);
+}
+
+/**
+ * @brief Stops timing a phase.  Unless other volumes are scanned at the same time, the CPU time
+ * includes every thread that worked on it.
+ *
+ * @param stats
+ * @param phase
+ */
+void perf_phase_end(struct perf_stats *stats, enum perf_phase phase){
+    if (!stats->enabled)
+        return;
+    __atomic_fetch_add(&stats->phases[phase].wall_ns, clock_ns(CLOCK_MONOTONIC) - thread_wall_start, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->phases[phase].cpu_ns, clock_ns(stats->concurrent ? CLOCK_THREAD_CPUTIME_ID : CLOCK_PROCESS_CPUTIME_ID) - thread_cpu_start, __ATOMIC_RELAXED);
+    thread_stats = NULL;
+}
+
+/**
+ * @brief Counts this thread's I/O in a phase begun on another thread.  Called by work pool tasks,
+ * the binding lasts until the thread ends or begins a phase of its own.
+ *
+ * @param stats
+ * @param phase
+ */
+void perf_thread_attach(struct perf_stats *stats, enum perf_phase phase){
+    if (!stats->enabled)
+        return;
+    thread_stats = stats;
+    thread_phase = phase;
+}
+
+/**
+ * @brief Call right before a read syscall
+ *
+ * @return uint64_t : start time to pass to perf_read_end
+ */
+uint64_t perf_read_begin(void){
+    return thread_stats != NULL ? clock_ns(CLOCK_MONOTONIC) : 0;
+}
+
+/**
+ * @brief Call right after a read syscall, counts the syscall and its latency
+ *
+ * @param start as returned by perf_read_begin
+ */
+void perf_read_end(uint64_t start){
+    struct perf_stats *stats = thread_stats;
+    if (stats == NULL)
+        return;
+    uint64_t us = (clock_ns(CLOCK_MONOTONIC) - start) / 1000;
+    int bucket = 0;
+    while (us && bucket < PERF_LATENCY_BUCKETS - 1){
+        us >>= 1;
+        bucket++;
+    }
+    __atomic_fetch_add(&stats->latency[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->phases[thread_phase].syscalls, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Counts a syscall that is not a read, e.g. a read ahead hint
+ */
+void perf_count_syscall(void){
+    if (thread_stats != NULL)
+        __atomic_fetch_add(&thread_stats->phases[thread_phase].syscalls, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Counts bytes of the image read by the current phase, whether copied by a syscall or
+ * viewed through the mapping
+ */
+void perf_count_bytes(size_t bytes){
+    if (thread_stats != NULL)
+        __atomic_fetch_add(&thread_stats->phases[thread_phase].bytes_read, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Counts entries (FAT entries, directory entries, files) processed by the current phase
+ */
+void perf_count_entries(uint64_t entries){
+    if (thread_stats != NULL)
+        __atomic_fetch_add(&thread_stats->phases[thread_phase].entries, entries, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Counts clusters read by the current phase
+ */
+void perf_count_clusters(uint64_t clusters){
+    if (thread_stats != NULL)
+        __atomic_fetch_add(&thread_stats->phases[thread_phase].clusters, clusters, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,63 @@
+/**
+ * @file perf_stats.h
+ * @brief Per-phase performance statistics (--stats).  Each phase of a scan records its wall and
+ * CPU time, the syscalls issued and bytes read on its behalf, and the entries and clusters it
+ * processed, and the latency of every read that went to the operating system is kept in a log2
+ * histogram.  The counters live in the volume being scanned, and a thread's I/O is counted in the
+ * volume and phase the thread is working on: the one it began, or the one of the work pool task
+ * it runs (perf_thread_attach).  Nothing is recorded for a volume whose statistics are off, and
+ * the counters are safe to bump from any thread.
+ */
+#ifndef PERF_STATS_H
+#define PERF_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Phases of a scan, opening the image and FAT dumps are counted under PERF_PHASE_OTHER
+typedef enum perf_phase {
+    PERF_PHASE_OTHER,
+    PERF_PHASE_VERIFY_IMAGE, // verify_disk_image
+    PERF_PHASE_BOOT_SECTOR, // boot sector or MBR parse
+    PERF_PHASE_FAT_LOAD, // FAT copies loaded and compared, extent index built
+    PERF_PHASE_TREE_WALK,
+    PERF_PHASE_SLACK_CHECK,
+    PERF_PHASE_PARTITION_GAP, // space between partitions
+    PERF_PHASE_UNALLOCATED, // clusters the FAT marks free
+    PERF_PHASE_COUNT
+} perf_phase;
+
+// Bucket 0 counts reads under 1 us, bucket n reads of [2^(n-1), 2^n) us, the last one everything slower
+#define PERF_LATENCY_BUCKETS 25
+
+typedef struct perf_phase_stats {
+    uint64_t wall_ns;
+    uint64_t cpu_ns;
+    uint64_t syscalls;
+    uint64_t bytes_read;
+    uint64_t entries;
+    uint64_t clusters;
+} perf_phase_stats;
+
+// Statistics of one volume
+typedef struct perf_stats {
+    bool enabled;
+    bool concurrent; // other volumes are scanned at the same time
+    struct perf_phase_stats phases[PERF_PHASE_COUNT];
+    uint64_t latency[PERF_LATENCY_BUCKETS];
+} perf_stats;
+
+void perf_stats_init(struct perf_stats *stats, bool enabled, bool concurrent);
+const char *perf_phase_name(enum perf_phase phase);
+void perf_phase_begin(struct perf_stats *stats, enum perf_phase phase);
+void perf_phase_end(struct perf_stats *stats, enum perf_phase phase);
+void perf_thread_attach(struct perf_stats *stats, enum perf_phase phase);
+uint64_t perf_read_begin(void);
+void perf_read_end(uint64_t start);
+void perf_count_syscall(void);
+void perf_count_bytes(size_t bytes);
+void perf_count_entries(uint64_t entries);
+void perf_count_clusters(uint64_t clusters);
+
+#endif
@@ -0,0 +1,527 @@
+/**
+ * @file scan.c
+ * @brief Non-zero byte detection kernels with runtime CPU dispatch
+ */
+
+#include <string.h>
+
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+// A kernel is two pairs of searches, everything else is built on top of them, plus the free
+// entry maps of FAT tables
+typedef struct scan_kernel {
+    const char *name;
+    size_t (*first_nonzero)(const uint8_t *buffer, size_t length); // returns length if every byte is zero
+    size_t (*first_zero)(const uint8_t *buffer, size_t length); // returns length if no byte is zero
+    size_t (*first_mismatch)(const uint8_t *a, const uint8_t *b, size_t length); // returns length if a and b are equal
+    size_t (*first_match)(const uint8_t *a, const uint8_t *b, size_t length); // returns length if no byte of a equals b
+    void (*zero_map16)(const uint8_t *entries, size_t words, uint64_t *bitmap); // 64 16 bit entries per bitmap word
+    void (*zero_map28)(const uint8_t *entries, size_t words, uint64_t *bitmap); // 64 FAT32 entries per bitmap word
+} scan_kernel;
+
+//-------------------------------------------------------------------------
+// Scalar kernel, works a 64 bit word at a time
+//-------------------------------------------------------------------------
+static size_t first_nonzero_scalar(const uint8_t *buffer, size_t length){
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8){
+        uint64_t word;
+        memcpy(&word, buffer + i, 8);
+        if (word)
+            break;
+    }
+    for (; i < length && buffer[i] == 0; i++);
+    return i;
+}
+
+static size_t first_zero_scalar(const uint8_t *buffer, size_t length){
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8){
+        uint64_t word;
+        memcpy(&word, buffer + i, 8);
+        // Classic "has a zero byte" test
+        if ((word - 0x0101010101010101ULL) & ~word & 0x8080808080808080ULL)
+            break;
+    }
+    for (; i < length && buffer[i] != 0; i++);
+    return i;
+}
+
+static size_t first_mismatch_scalar(const uint8_t *a, const uint8_t *b, size_t length){
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8){
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        if (x != y)
+            break;
+    }
+    for (; i < length && a[i] == b[i]; i++);
+    return i;
+}
+
+static size_t first_match_scalar(const uint8_t *a, const uint8_t *b, size_t length){
+    size_t i = 0;
+    for (; i < length && a[i] != b[i]; i++);
+    return i;
+}
+
+// The maps read entries byte by byte, so they do not depend on the byte order of the host
+static void zero_map16_scalar(const uint8_t *entries, size_t words, uint64_t *bitmap){
+    for (size_t w = 0; w < words; w++, entries += 128){
+        uint64_t bits = 0;
+        for (int j = 0; j < 64; j++)
+            bits |= (uint64_t)!(entries[2 * j] | entries[2 * j + 1]) << j;
+        bitmap[w] = bits;
+    }
+}
+
+static void zero_map28_scalar(const uint8_t *entries, size_t words, uint64_t *bitmap){
+    for (size_t w = 0; w < words; w++, entries += 256){
+        uint64_t bits = 0;
+        for (int j = 0; j < 64; j++){
+            const uint8_t *e = entries + 4 * j;
+            bits |= (uint64_t)!(e[0] | e[1] | e[2] | (e[3] & 0x0F)) << j;
+        }
+        bitmap[w] = bits;
+    }
+}
+
+#ifdef SCAN_X86
+//-------------------------------------------------------------------------
+// SSE2 kernel
+//-------------------------------------------------------------------------
+__attribute__((target("sse2")))
+static size_t first_nonzero_sse2(const uint8_t *buffer, size_t length){
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    // Skip zero blocks 64 bytes at a time, then find the exact byte
+    for (; i + 64 <= length; i += 64){
+        __m128i v = _mm_or_si128(
+            _mm_or_si128(_mm_loadu_si128((const __m128i *)(buffer + i)), _mm_loadu_si128((const __m128i *)(buffer + i + 16))),
+            _mm_or_si128(_mm_loadu_si128((const __m128i *)(buffer + i + 32)), _mm_loadu_si128((const __m128i *)(buffer + i + 48))));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xffff)
+            break;
+    }
+    for (; i + 16 <= length; i += 16){
+        unsigned mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buffer + i)), zero)) & 0xffff;
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + first_nonzero_scalar(buffer + i, length - i);
+}
+
+__attribute__((target("sse2")))
+static size_t first_zero_sse2(const uint8_t *buffer, size_t length){
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16){
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buffer + i)), zero));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + first_zero_scalar(buffer + i, length - i);
+}
+
+__attribute__((target("sse2")))
+static size_t first_mismatch_sse2(const uint8_t *a, const uint8_t *b, size_t length){
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16){
+        unsigned mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i)))) & 0xffff;
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + first_mismatch_scalar(a + i, b + i, length - i);
+}
+
+__attribute__((target("sse2")))
+static size_t first_match_sse2(const uint8_t *a, const uint8_t *b, size_t length){
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16){
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i))));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + first_match_scalar(a + i, b + i, length - i);
+}
+
+__attribute__((target("sse2")))
+static void zero_map16_sse2(const uint8_t *entries, size_t words, uint64_t *bitmap){
+    const __m128i zero = _mm_setzero_si128();
+    for (size_t w = 0; w < words; w++, entries += 128){
+        uint64_t bits = 0;
+        // 16 entries per step, the two compares are packed to one byte per entry
+        for (int j = 0; j < 4; j++){
+            __m128i a = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(entries + 32 * j)), zero);
+            __m128i b = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(entries + 32 * j + 16)), zero);
+            bits |= (uint64_t)_mm_movemask_epi8(_mm_packs_epi16(a, b)) << (16 * j);
+        }
+        bitmap[w] = bits;
+    }
+}
+
+__attribute__((target("sse2")))
+static void zero_map28_sse2(const uint8_t *entries, size_t words, uint64_t *bitmap){
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = _mm_set1_epi32(0x0FFFFFFF);
+    for (size_t w = 0; w < words; w++, entries += 256){
+        uint64_t bits = 0;
+        for (int j = 0; j < 16; j++){
+            __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(entries + 16 * j)), mask);
+            bits |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, zero))) << (4 * j);
+        }
+        bitmap[w] = bits;
+    }
+}
+
+//-------------------------------------------------------------------------
+// AVX2 kernel
+//-------------------------------------------------------------------------
+__attribute__((target("avx2")))
+static size_t first_nonzero_avx2(const uint8_t *buffer, size_t length){
+    size_t i = 0;
+    for (; i + 128 <= length; i += 128){
+        __m256i v = _mm256_or_si256(
+            _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(buffer + i)), _mm256_loadu_si256((const __m256i *)(buffer + i + 32))),
+            _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(buffer + i + 64)), _mm256_loadu_si256((const __m256i *)(buffer + i + 96))));
+        if (!_mm256_testz_si256(v, v))
+            break;
+    }
+    const __m256i zero = _mm256_setzero_si256();
+    for (; i + 32 <= length; i += 32){
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buffer + i)), zero));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + first_nonzero_sse2(buffer + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t first_zero_avx2(const uint8_t *buffer, size_t length){
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32){
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buffer + i)), zero));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + first_zero_sse2(buffer + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t first_mismatch_avx2(const uint8_t *a, const uint8_t *b, size_t length){
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32){
+        unsigned mask = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a + i)), _mm256_loadu_si256((const __m256i *)(b + i))));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + first_mismatch_sse2(a + i, b + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t first_match_avx2(const uint8_t *a, const uint8_t *b, size_t length){
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32){
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a + i)), _mm256_loadu_si256((const __m256i *)(b + i))));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + first_match_sse2(a + i, b + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static void zero_map16_avx2(const uint8_t *entries, size_t words, uint64_t *bitmap){
+    const __m256i zero = _mm256_setzero_si256();
+    for (size_t w = 0; w < words; w++, entries += 128){
+        uint64_t bits = 0;
+        for (int j = 0; j < 2; j++){
+            __m256i a = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)(entries + 64 * j)), zero);
+            __m256i b = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)(entries + 64 * j + 32)), zero);
+            // packs works within 128 bit lanes, the permute puts the entries back in order
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8);
+            bits |= (uint64_t)(uint32_t)_mm256_movemask_epi8(packed) << (32 * j);
+        }
+        bitmap[w] = bits;
+    }
+}
+
+__attribute__((target("avx2")))
+static void zero_map28_avx2(const uint8_t *entries, size_t words, uint64_t *bitmap){
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i mask = _mm256_set1_epi32(0x0FFFFFFF);
+    for (size_t w = 0; w < words; w++, entries += 256){
+        uint64_t bits = 0;
+        for (int j = 0; j < 8; j++){
+            __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(entries + 32 * j)), mask);
+            bits |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, zero))) << (8 * j);
+        }
+        bitmap[w] = bits;
+    }
+}
+
+//-------------------------------------------------------------------------
+// AVX-512 kernel (needs BW for byte granular masks)
+//-------------------------------------------------------------------------
+__attribute__((target("avx512f,avx512bw")))
+static size_t first_nonzero_avx512(const uint8_t *buffer, size_t length){
+    size_t i = 0;
+    for (; i + 256 <= length; i += 256){
+        __m512i v = _mm512_or_si512(
+            _mm512_or_si512(_mm512_loadu_si512(buffer + i), _mm512_loadu_si512(buffer + i + 64)),
+            _mm512_or_si512(_mm512_loadu_si512(buffer + i + 128), _mm512_loadu_si512(buffer + i + 192)));
+        if (_mm512_test_epi8_mask(v, v))
+            break;
+    }
+    for (; i < length; i += 64){
+        // Masked load handles the tail without touching bytes past the end of the buffer
+        __mmask64 valid = (length - i >= 64) ? ~0ULL : (1ULL << (length - i)) - 1;
+        __m512i v = _mm512_maskz_loadu_epi8(valid, buffer + i);
+        __mmask64 mask = _mm512_test_epi8_mask(v, v);
+        if (mask)
+            return i + __builtin_ctzll(mask);
+    }
+    return length;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t first_zero_avx512(const uint8_t *buffer, size_t length){
+    for (size_t i = 0; i < length; i += 64){
+        __mmask64 valid = (length - i >= 64) ? ~0ULL : (1ULL << (length - i)) - 1;
+        __m512i v = _mm512_maskz_loadu_epi8(valid, buffer + i);
+        __mmask64 mask = _mm512_testn_epi8_mask(v, v) & valid;
+        if (mask)
+            return i + __builtin_ctzll(mask);
+    }
+    return length;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t first_mismatch_avx512(const uint8_t *a, const uint8_t *b, size_t length){
+    for (size_t i = 0; i < length; i += 64){
+        __mmask64 valid = (length - i >= 64) ? ~0ULL : (1ULL << (length - i)) - 1;
+        __mmask64 mask = _mm512_mask_cmpneq_epi8_mask(valid, _mm512_maskz_loadu_epi8(valid, a + i), _mm512_maskz_loadu_epi8(valid, b + i));
+        if (mask)
+            return i + __builtin_ctzll(mask);
+    }
+    return length;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t first_match_avx512(const uint8_t *a, const uint8_t *b, size_t length){
+    for (size_t i = 0; i < length; i += 64){
+        __mmask64 valid = (length - i >= 64) ? ~0ULL : (1ULL << (length - i)) - 1;
+        __mmask64 mask = _mm512_mask_cmpeq_epi8_mask(valid, _mm512_maskz_loadu_epi8(valid, a + i), _mm512_maskz_loadu_epi8(valid, b + i));
+        if (mask)
+            return i + __builtin_ctzll(mask);
+    }
+    return length;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void zero_map16_avx512(const uint8_t *entries, size_t words, uint64_t *bitmap){
+    for (size_t w = 0; w < words; w++, entries += 128){
+        __m512i a = _mm512_loadu_si512(entries);
+        __m512i b = _mm512_loadu_si512(entries + 64);
+        bitmap[w] = (uint64_t)_mm512_testn_epi16_mask(a, a) | (uint64_t)_mm512_testn_epi16_mask(b, b) << 32;
+    }
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void zero_map28_avx512(const uint8_t *entries, size_t words, uint64_t *bitmap){
+    const __m512i mask = _mm512_set1_epi32(0x0FFFFFFF);
+    for (size_t w = 0; w < words; w++, entries += 256){
+        uint64_t bits = 0;
+        for (int j = 0; j < 4; j++)
+            bits |= (uint64_t)_mm512_testn_epi32_mask(_mm512_loadu_si512(entries + 64 * j), mask) << (16 * j);
+        bitmap[w] = bits;
+    }
+}
+#endif
+
+static const struct scan_kernel scalar_kernel = {"scalar", first_nonzero_scalar, first_zero_scalar, first_mismatch_scalar, first_match_scalar,
+    zero_map16_scalar, zero_map28_scalar};
+#ifdef SCAN_X86
+static const struct scan_kernel sse2_kernel = {"sse2", first_nonzero_sse2, first_zero_sse2, first_mismatch_sse2, first_match_sse2,
+    zero_map16_sse2, zero_map28_sse2};
+static const struct scan_kernel avx2_kernel = {"avx2", first_nonzero_avx2, first_zero_avx2, first_mismatch_avx2, first_match_avx2,
+    zero_map16_avx2, zero_map28_avx2};
+static const struct scan_kernel avx512_kernel = {"avx512bw", first_nonzero_avx512, first_zero_avx512, first_mismatch_avx512, first_match_avx512,
+    zero_map16_avx512, zero_map28_avx512};
+#endif
+
+// Scalar until scan_init runs, so early callers are still correct
+static const struct scan_kernel *kernel = &scalar_kernel;
+
+/**
+ * @brief Picks the fastest kernel the CPU supports.  Must be called once at startup before any
+ * threads are started.
+ */
+void scan_init(void){
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512bw"))
+        kernel = &avx512_kernel;
+    else if (__builtin_cpu_supports("avx2"))
+        kernel = &avx2_kernel;
+    else if (__builtin_cpu_supports("sse2"))
+        kernel = &sse2_kernel;
+#endif
+}
+
+/**
+ * @brief Switches to the named kernel ("scalar", "sse2", "avx2" or "avx512bw"), so every kernel
+ * can be checked against the scalar one.  Like scan_init, not to be called while scans are running.
+ *
+ * @param name
+ * @return bool : false if there is no such kernel or the CPU does not support it
+ */
+bool scan_select_kernel(const char *name){
+    if (!strcmp(name, scalar_kernel.name)){
+        kernel = &scalar_kernel;
+        return true;
+    }
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (!strcmp(name, sse2_kernel.name) && __builtin_cpu_supports("sse2")){
+        kernel = &sse2_kernel;
+        return true;
+    }
+    if (!strcmp(name, avx2_kernel.name) && __builtin_cpu_supports("avx2")){
+        kernel = &avx2_kernel;
+        return true;
+    }
+    if (!strcmp(name, avx512_kernel.name) && __builtin_cpu_supports("avx512bw")){
+        kernel = &avx512_kernel;
+        return true;
+    }
+#endif
+    return false;
+}
+
+/**
+ * @brief Returns the name of the selected kernel
+ */
+const char *scan_kernel_name(void){
+    return kernel->name;
+}
+
+/**
+ * @brief Checks if every byte of the buffer is zero
+ *
+ * @param buffer
+ * @param length
+ * @return true if the buffer contains no non-zero bytes
+ */
+bool scan_is_zero(const uint8_t *buffer, size_t length){
+    return kernel->first_nonzero(buffer, length) == length;
+}
+
+/**
+ * @brief Finds every run of non-zero bytes in the buffer and adds them to ranges.  A run that
+ * starts exactly where the previous one ended (i.e. it continues across buffers) is joined with it.
+ *
+ * @param buffer
+ * @param length
+ * @param base offset added to the positions in buffer when recording runs
+ * @param ranges accumulator for the runs found
+ */
+void scan_nonzero_ranges(const uint8_t *buffer, size_t length, uint64_t base, struct nonzero_ranges *ranges){
+    size_t i = 0;
+    while (i < length){
+        i += kernel->first_nonzero(buffer + i, length - i);
+        if (i == length)
+            break;
+        size_t run = kernel->first_zero(buffer + i, length - i);
+        uint64_t start = base + i;
+
+        if (ranges->found && ranges->last_end == start){
+            // Continuation of the previous run
+            if (ranges->stored == ranges->found)
+                ranges->range[ranges->stored - 1].length += run;
+        }
+        else{
+            if (ranges->stored < ranges->capacity){
+                ranges->range[ranges->stored].start = start;
+                ranges->range[ranges->stored].length = run;
+                ranges->stored++;
+            }
+            ranges->found++;
+        }
+        ranges->nonzero_bytes += run;
+        ranges->last_end = start + run;
+        i += run;
+    }
+}
+
+/**
+ * @brief Adds the runs of a later part of a region, scanned on its own (e.g. by another thread),
+ * to the runs of the part before it, as if both had been scanned into one accumulator
+ *
+ * @param ranges runs of the earlier part
+ * @param next runs of the later part, every one of them after those in ranges
+ */
+void scan_join_ranges(struct nonzero_ranges *ranges, const struct nonzero_ranges *next){
+    size_t i = 0;
+
+    if (next->found == 0)
+        return;
+    if (ranges->found && next->stored && ranges->last_end == next->range[0].start){
+        // The first run of next continues the last one of ranges
+        if (ranges->stored == ranges->found)
+            ranges->range[ranges->stored - 1].length += next->range[0].length;
+        ranges->found--;
+        i = 1;
+    }
+    for (; i < next->stored && ranges->stored < ranges->capacity; i++)
+        ranges->range[ranges->stored++] = next->range[i];
+    ranges->found += next->found;
+    ranges->nonzero_bytes += next->nonzero_bytes;
+    ranges->last_end = next->last_end;
+}
+
+/**
+ * @brief Finds the first run of bytes that differ between a and b
+ *
+ * @param a
+ * @param b
+ * @param length # of bytes to compare
+ * @param run_length receives the length of the run, 0 if the buffers are equal
+ * @return size_t offset of the first differing byte, length if the buffers are equal
+ */
+size_t scan_next_difference(const uint8_t *a, const uint8_t *b, size_t length, size_t *run_length){
+    size_t start = kernel->first_mismatch(a, b, length);
+    *run_length = (start == length) ? 0 : kernel->first_match(a + start, b + start, length - start);
+    return start;
+}
+
+/**
+ * @brief Maps which entries of a FAT table are zero (free), one bit per entry, least significant
+ * bit first.  Bits of the last bitmap word past count are cleared.
+ *
+ * @param entries little endian entries, 2 bytes each for 16 bit entries (FAT16, unpacked FAT12)
+ * or 4 bytes each for FAT32, whose top 4 bits are ignored
+ * @param count # of entries
+ * @param entry_bits 16 or 28
+ * @param bitmap receives (count + 63) / 64 words
+ */
+void scan_zero_entries(const uint8_t *entries, size_t count, int entry_bits, uint64_t *bitmap){
+    size_t entry_bytes = entry_bits == 16 ? 2 : 4;
+    void (*map)(const uint8_t *, size_t, uint64_t *) = entry_bits == 16 ? kernel->zero_map16 : kernel->zero_map28;
+    size_t words = count / 64;
+    size_t tail = count % 64;
+
+    map(entries, words, bitmap);
+    if (tail){
+        // The last partial word goes through a copy padded with non-zero entries
+        uint8_t last[256];
+        memset(last, 0xFF, sizeof(last));
+        memcpy(last, entries + words * 64 * entry_bytes, tail * entry_bytes);
+        map(last, 1, bitmap + words);
+    }
+}
@@ -0,0 +1,40 @@
+/**
+ * @file scan.h
+ * @brief Non-zero byte detection kernels used by the slack, partition gap and unallocated cluster
+ * checks, byte comparison kernels used to compare FAT copies, and the free entry map of a FAT.
+ * The fastest kernel supported by the CPU (AVX-512, AVX2, SSE2 or scalar) is selected once at
+ * startup.
+ */
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// A run of non-zero bytes
+typedef struct nonzero_range {
+    uint64_t start; // offset of the first non-zero byte
+    uint64_t length; // number of bytes in the run
+} nonzero_range;
+
+// Accumulates the non-zero runs found across one or more scanned buffers
+typedef struct nonzero_ranges {
+    struct nonzero_range *range; // caller supplied storage for the first 'capacity' runs
+    size_t capacity;
+    size_t stored; // number of runs written to 'range'
+    uint64_t found; // total number of runs found, can be larger than 'stored'
+    uint64_t nonzero_bytes; // total number of bytes covered by the runs
+    uint64_t last_end; // end offset of the last run found, used to join runs across buffers
+} nonzero_ranges;
+
+void scan_init(void);
+const char *scan_kernel_name(void);
+bool scan_select_kernel(const char *name);
+bool scan_is_zero(const uint8_t *buffer, size_t length);
+void scan_nonzero_ranges(const uint8_t *buffer, size_t length, uint64_t base, struct nonzero_ranges *ranges);
+void scan_join_ranges(struct nonzero_ranges *ranges, const struct nonzero_ranges *next);
+size_t scan_next_difference(const uint8_t *a, const uint8_t *b, size_t length, size_t *run_length);
+void scan_zero_entries(const uint8_t *entries, size_t count, int entry_bits, uint64_t *bitmap);
+
+#endif
@@ -0,0 +1,220 @@
+/**
+ * @file work_pool.c
+ * @brief Work-stealing thread pool
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "work_pool.h"
+
+// Ring buffer of tasks owned by one worker
+typedef struct work_deque {
+    pthread_mutex_t lock;
+    void **tasks;
+    size_t head; // index of the oldest task, which is the one stolen first
+    size_t count;
+    size_t capacity;
+} work_deque;
+
+struct work_pool {
+    int threads;
+    work_pool_fn fn;
+    void *context;
+    struct work_deque *deques;
+    atomic_size_t pending; // tasks pushed but not yet finished
+    atomic_size_t queued; // tasks sitting in a deque
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+};
+
+// Arguments for the extra worker threads started by work_pool_run
+typedef struct worker_args {
+    struct work_pool *pool;
+    int worker;
+} worker_args;
+
+/**
+ * @brief Creates a pool of threads workers.  Nothing runs until work_pool_run is called.
+ *
+ * @param threads number of workers, the thread calling work_pool_run is worker 0
+ * @param fn function run for every task
+ * @param context passed through to fn
+ * @return struct work_pool* : NULL if out of memory
+ */
+struct work_pool *work_pool_create(int threads, work_pool_fn fn, void *context){
+    struct work_pool *pool = calloc(1, sizeof(struct work_pool));
+    if (pool == NULL)
+        return NULL;
+    if (threads < 1)
+        threads = 1;
+    pool->deques = calloc(threads, sizeof(struct work_deque));
+    if (pool->deques == NULL){
+        free(pool);
+        return NULL;
+    }
+    pool->threads = threads;
+    pool->fn = fn;
+    pool->context = context;
+    for (int i = 0; i < threads; i++)
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+    atomic_init(&pool->pending, 0);
+    atomic_init(&pool->queued, 0);
+    pthread_mutex_init(&pool->idle_lock, NULL);
+    pthread_cond_init(&pool->idle_cond, NULL);
+    return pool;
+}
+
+/**
+ * @brief Frees the pool.  Must not be called while work_pool_run is running.
+ */
+void work_pool_destroy(struct work_pool *pool){
+    if (pool == NULL)
+        return;
+    for (int i = 0; i < pool->threads; i++){
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].tasks);
+    }
+    free(pool->deques);
+    pthread_mutex_destroy(&pool->idle_lock);
+    pthread_cond_destroy(&pool->idle_cond);
+    free(pool);
+}
+
+/**
+ * @brief Adds a task to the bottom of a worker's deque.  Tasks pushed before work_pool_run
+ * should use worker 0, tasks pushed from inside a task should use the worker passed to it.
+ *
+ * @param pool
+ * @param worker deque to push to
+ * @param task
+ * @return int : 0 if successful, -1 if out of memory, the task was not queued then
+ */
+int work_pool_push(struct work_pool *pool, int worker, void *task){
+    struct work_deque *deque = &pool->deques[worker];
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count == deque->capacity){
+        size_t capacity = deque->capacity ? deque->capacity * 2 : 64;
+        void **tasks = malloc(capacity * sizeof(void *));
+        if (tasks == NULL){
+            pthread_mutex_unlock(&deque->lock);
+            return -1;
+        }
+        for (size_t i = 0; i < deque->count; i++)
+            tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->head = 0;
+        deque->capacity = capacity;
+    }
+    deque->tasks[(deque->head + deque->count) % deque->capacity] = task;
+    deque->count++;
+    atomic_fetch_add(&pool->pending, 1);
+    atomic_fetch_add(&pool->queued, 1);
+    pthread_mutex_unlock(&deque->lock);
+
+    // Wake an idle worker so it can steal the new task
+    pthread_mutex_lock(&pool->idle_lock);
+    pthread_cond_signal(&pool->idle_cond);
+    pthread_mutex_unlock(&pool->idle_lock);
+    return 0;
+}
+
+/**
+ * @brief Takes the newest task from the bottom of the worker's own deque
+ */
+static void *deque_pop(struct work_pool *pool, struct work_deque *deque){
+    void *task = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count){
+        atomic_fetch_sub(&pool->queued, 1);
+        deque->count--;
+        task = deque->tasks[(deque->head + deque->count) % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+/**
+ * @brief Takes the oldest task from the top of another worker's deque
+ */
+static void *deque_steal(struct work_pool *pool, struct work_deque *deque){
+    void *task = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count){
+        atomic_fetch_sub(&pool->queued, 1);
+        task = deque->tasks[deque->head];
+        deque->head = (deque->head + 1) % deque->capacity;
+        deque->count--;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+/**
+ * @brief Worker loop: run own tasks, steal when out of work, sleep when nothing is queued
+ * anywhere, and exit once every pushed task has finished.
+ */
+static void worker_loop(struct work_pool *pool, int worker){
+    for (;;){
+        void *task = deque_pop(pool, &pool->deques[worker]);
+        for (int i = 1; task == NULL && i < pool->threads; i++)
+            task = deque_steal(pool, &pool->deques[(worker + i) % pool->threads]);
+
+        if (task != NULL){
+            pool->fn(pool, worker, task, pool->context);
+            if (atomic_fetch_sub(&pool->pending, 1) == 1){
+                pthread_mutex_lock(&pool->idle_lock);
+                pthread_cond_broadcast(&pool->idle_cond);
+                pthread_mutex_unlock(&pool->idle_lock);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->idle_lock);
+        while (atomic_load(&pool->pending) > 0 && atomic_load(&pool->queued) == 0)
+            pthread_cond_wait(&pool->idle_cond, &pool->idle_lock);
+        if (atomic_load(&pool->pending) == 0){
+            pthread_mutex_unlock(&pool->idle_lock);
+            return;
+        }
+        pthread_mutex_unlock(&pool->idle_lock);
+    }
+}
+
+static void *worker_thread(void *arg){
+    struct worker_args *args = arg;
+    worker_loop(args->pool, args->worker);
+    return NULL;
+}
+
+/**
+ * @brief Runs every queued task, and every task they push, to completion.  The calling thread
+ * acts as worker 0, so a pool of one thread never starts any threads.  If the other workers can
+ * not be started (out of memory or threads), worker 0 steals from their deques and runs every
+ * task by itself.
+ *
+ * @param pool
+ */
+void work_pool_run(struct work_pool *pool){
+    pthread_t *threads = calloc(pool->threads, sizeof(pthread_t));
+    struct worker_args *args = calloc(pool->threads, sizeof(struct worker_args));
+    int started = 1;
+
+    for (int i = 1; threads != NULL && args != NULL && i < pool->threads; i++){
+        args[i].pool = pool;
+        args[i].worker = i;
+        if (pthread_create(&threads[i], NULL, worker_thread, &args[i]) != 0)
+            break; // the workers that did start (at least this one) still finish every task
+        started++;
+    }
+    worker_loop(pool, 0);
+    for (int i = 1; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    free(args);
+    free(threads);
+}
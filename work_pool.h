@@ -0,0 +1,20 @@
+/**
+ * @file work_pool.h
+ * @brief Work-stealing thread pool.  Each worker owns a deque of tasks: it pushes and pops its
+ * own work at the bottom (depth first) and steals from the top of other workers' deques when it
+ * runs dry.  Tasks may push more tasks, and the pool runs until every task has finished.
+ */
+#ifndef WORK_POOL_H
+#define WORK_POOL_H
+
+typedef struct work_pool work_pool;
+
+// Called once per task on the worker that popped or stole it
+typedef void (*work_pool_fn)(struct work_pool *pool, int worker, void *task, void *context);
+
+struct work_pool *work_pool_create(int threads, work_pool_fn fn, void *context);
+int work_pool_push(struct work_pool *pool, int worker, void *task);
+void work_pool_run(struct work_pool *pool);
+void work_pool_destroy(struct work_pool *pool);
+
+#endif